@@ -0,0 +1,153 @@
+//
+// BandwidthEstimator - Estimates the capacity of the link from the robot and the bitrate the robot should send at
+//
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+/**
+ * BandwidthEstimator - Receiver-side congestion control for both camera streams, after Google
+ * Congestion Control (draft-ietf-rmcat-gcc-02)
+ *
+ * Delay: packets sent within BURST_US of each other form a group. The change of the one-way delay from
+ * one group to the next (arrival spacing minus send spacing) accumulates into the queueing delay, whose
+ * trend over the last TRENDLINE_WINDOW groups tells whether the bottleneck queue grows. A trend above
+ * an adaptive threshold is overuse, below its negative underuse. Send times are the sender's wall clock
+ * from the header extension; the RTP timestamp stands in for packets without it.
+ *
+ * Rate: per camera, like StreamingConfig::bitrate, against the received bitrate split over the streams.
+ * On overuse of either stream the target drops to 0.85 of the received bitrate, at most once per round
+ * trip plus DECREASE_SPACING_US. While the delay is normal it grows by 8 % per second, or by about a
+ * packet per round trip once it is near the bitrate the last decreases happened at. Underuse holds it,
+ * the queue is draining.
+ *
+ * Loss: above 10 % lost packets the loss-based target shrinks by half the loss rate, below 2 % it grows
+ * by 5 % per LOSS_INTERVAL_US. The target is the lower of both, within the settings' bounds.
+ */
+class BandwidthEstimator {
+public:
+    struct Settings {
+        int minBitrate = 500000;
+        int maxBitrate = 20000000;
+        int startBitrate = 4000000;
+        uint64_t rttUs = 50000; // Until setRtt(), for the additive increase and the spacing of decreases
+    };
+
+    enum class Usage {
+        NORMAL, OVERUSE, UNDERUSE
+    };
+
+    enum class RateState {
+        HOLD, INCREASE, DECREASE
+    };
+
+    explicit BandwidthEstimator(const Settings &settings);
+
+    // Streaming threads, for every received packet of `stream` (0 left, 1 right) before any repair.
+    // `sendUs` is 0 when the packet carries no send time
+    void onPacket(int stream, uint64_t arrivalUs, uint64_t sendUs, uint32_t rtpTimestamp, uint16_t seqnum,
+                  size_t size);
+
+    // True with the bitrate to tell the sender when the target moved by FEEDBACK_CHANGE since the last
+    // feedback, at most every FEEDBACK_INTERVAL_US, and regardless of a change every KEEPALIVE_US
+    bool takeFeedback(uint64_t nowUs, int &bitrate);
+
+    // Main loop thread, with the current round trip to the sender
+    void setRtt(uint64_t rttUs);
+
+    // A new configured bitrate, the ceiling of the estimate
+    void setMaxBitrate(int bitrate);
+
+    [[nodiscard]] int targetBitrate() const;
+
+    // Over the last RATE_WINDOW_US, both streams together
+    [[nodiscard]] double receivedBitrate() const;
+
+    // Share of the packets lost in the last loss interval
+    [[nodiscard]] double lossRate() const;
+
+    // Worst of both streams
+    [[nodiscard]] Usage usage() const;
+
+    static constexpr int STREAMS = 2;
+    static constexpr uint64_t BURST_US = 5000;
+    static constexpr size_t TRENDLINE_WINDOW = 20;
+    static constexpr uint64_t UPDATE_INTERVAL_US = 100000;
+    static constexpr uint64_t RATE_WINDOW_US = 500000;
+    static constexpr uint64_t LOSS_INTERVAL_US = 1000000;
+    static constexpr uint64_t DECREASE_SPACING_US = 200000;
+    static constexpr uint64_t FEEDBACK_INTERVAL_US = 200000;
+    static constexpr uint64_t KEEPALIVE_US = 1000000;
+    static constexpr double FEEDBACK_CHANGE = 0.05;
+    static constexpr uint32_t CLOCK_RATE = 90000;
+
+private:
+    struct Group {
+        uint64_t firstSendUs = 0, lastSendUs = 0;
+        uint64_t lastArrivalUs = 0;
+        bool valid = false;
+    };
+
+    // Delay-gradient overuse detector of one stream
+    struct Detector {
+        Group current, previous;
+        bool sendTimes = false; // Packets carry send times, the ones without are left out
+        bool hasRtpTimestamp = false;
+        uint32_t lastRtpTimestamp = 0;
+        int64_t rtpTicks = 0; // Extended past the 32 bit wrap
+
+        // Trendline filter
+        std::deque<std::pair<double, double>> samples; // Arrival ms since the first group, smoothed delay ms
+        uint64_t firstArrivalUs = 0;
+        double accumulatedDelayMs = 0, smoothedDelayMs = 0;
+        size_t deltas = 0;
+
+        double threshold = 12.5;
+        uint64_t lastThresholdUpdateUs = 0;
+        double previousTrend = 0;
+        double overuseMs = -1; // Negative while not above the threshold
+        int overuseCount = 0;
+        Usage usage = Usage::NORMAL;
+
+        // Loss
+        bool hasSeqnum = false;
+        uint64_t highestSeqnum = 0; // Extended
+        uint64_t firstSeqnum = 0;
+        uint64_t received = 0;
+    };
+
+    void onGroupDelta(Detector &detector, double sendDeltaMs, double arrivalDeltaMs, uint64_t arrivalUs);
+
+    void detect(Detector &detector, double trend, double sendDeltaMs, uint64_t arrivalUs);
+
+    void updateRate(uint64_t nowUs);
+
+    void updateLoss(uint64_t nowUs);
+
+    [[nodiscard]] Usage combinedUsage() const;
+
+    Settings settings_;
+
+    mutable std::mutex mutex_;
+    std::array<Detector, STREAMS> detectors_;
+    std::deque<std::pair<uint64_t, size_t>> arrivals_; // Arrival and size, both streams
+    size_t windowBytes_ = 0;
+
+    RateState rateState_ = RateState::HOLD;
+    double delayBitrate_, lossBitrate_;
+    double target_;
+    double averageMaxKbit_ = -1, varianceMaxKbit_ = 0.4; // Received bitrate when decreasing, its normalized variance
+    uint64_t firstArrivalUs_ = 0, lastUpdateUs_ = 0, lastDecreaseUs_ = 0;
+
+    uint64_t lossIntervalStartUs_ = 0;
+    uint64_t expectedAtInterval_ = 0, receivedAtInterval_ = 0;
+    double lossRate_ = 0;
+
+    uint64_t lastFeedbackUs_ = 0;
+    int lastFeedbackBitrate_ = 0;
+};
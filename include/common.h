@@ -10,10 +10,13 @@
 #include <unistd.h>
 #include <sstream>
 #include <vector>
+#include <array>
 #include <unordered_map>
 #include <atomic>
 #include <deque>
 #include <mutex>
+#include "frame_mailbox.h"
+#include "frame_tracer.h"
 
 // <!-- IP CONFIGURATION SECTION --!>
 constexpr uint8_t IP_CONFIG_JETSON_ADDR[4] = {192,168,1,105};
@@ -22,6 +25,7 @@ constexpr int IP_CONFIG_REST_API_PORT = 32281;
 constexpr int IP_CONFIG_SERVO_PORT = 32115;
 constexpr int IP_CONFIG_LEFT_CAMERA_PORT = 8554;
 constexpr int IP_CONFIG_RIGHT_CAMERA_PORT = 8556;
+constexpr int IP_CONFIG_STANDBY_PORT_OFFSET = 100; // Camera ports of the pipelines built next to the running ones
 constexpr int IP_CONFIG_ROS_GATEWAY_PORT = 8502;
 
 inline std::string resolveIPv4(const std::string& hostname) {
@@ -123,6 +127,7 @@ struct UserState {
     bool xTouched;
     bool yPressed;
     bool yTouched;
+    XrFovf viewFov{}; // Both eyes' fields of view together
 };
 
 enum Codec {
@@ -188,6 +193,96 @@ inline std::string AspectRatioModeToString(AspectRatioMode mode) {
     }
 }
 
+enum StereoSyncPolicy {
+    WAIT_FOR_PAIR, LATEST_AVAILABLE, INDEPENDENT, CNT5
+};
+
+inline std::string StereoSyncPolicyToString(StereoSyncPolicy policy) {
+    switch(policy) {
+        case WAIT_FOR_PAIR:
+            return "WAIT_FOR_PAIR";
+            break;
+        case LATEST_AVAILABLE:
+            return "LATEST_AVAILABLE";
+            break;
+        case INDEPENDENT:
+            return "INDEPENDENT";
+            break;
+        default:
+            return "Unknown";
+            break;
+    }
+}
+
+// Where GStreamer's GL elements (glupload and glcolorconvert in glsinkbin) do their work
+enum GlContextMode {
+    WRAPPED_RENDER_CONTEXT, // Shared with the XR render loop through the wrapped render context
+    SHARED_CONTEXT, // A context of GStreamer's own in the render context's share group, frames handed over with EGL fences
+    CNT7
+};
+
+inline std::string GlContextModeToString(GlContextMode mode) {
+    switch(mode) {
+        case WRAPPED_RENDER_CONTEXT:
+            return "WRAPPED_RENDER_CONTEXT";
+            break;
+        case SHARED_CONTEXT:
+            return "SHARED_CONTEXT";
+            break;
+        default:
+            return "Unknown";
+            break;
+    }
+}
+
+// What applying a new StreamingConfig takes, least disruptive first
+enum ReconfigurationClass {
+    NO_CHANGE, // Nothing the sender or the pipelines need
+    ENCODER_ONLY, // Only the robot's encoders, through RestClient::UpdateStreamingConfig
+    RENEGOTIATE, // The running pipelines take it in place
+    REBUILD, // New pipelines, frame storage and image plane
+    CNT4
+};
+
+inline std::string ReconfigurationClassToString(ReconfigurationClass reconfiguration) {
+    switch(reconfiguration) {
+        case NO_CHANGE:
+            return "NO_CHANGE";
+            break;
+        case ENCODER_ONLY:
+            return "ENCODER_ONLY";
+            break;
+        case RENEGOTIATE:
+            return "RENEGOTIATE";
+            break;
+        case REBUILD:
+            return "REBUILD";
+            break;
+        default:
+            return "Unknown";
+            break;
+    }
+}
+
+// Forward error correction the sender adds to the RTP stream
+enum FecScheme {
+    NO_FEC, ULPFEC, CNT6
+};
+
+inline std::string FecSchemeToString(FecScheme scheme) {
+    switch(scheme) {
+        case NO_FEC:
+            return "NONE";
+            break;
+        case ULPFEC:
+            return "ULPFEC";
+            break;
+        default:
+            return "Unknown";
+            break;
+    }
+}
+
 inline std::string IpToString(const std::vector<uint8_t> ip) {
     std::ostringstream oss;
     oss << static_cast<int>(ip[0]) << "."
@@ -365,126 +460,132 @@ private:
     }
 };
 
-// Copyable snapshot of camera stats for passing values around
-struct CameraStatsSnapshot {
-    double prevTimestamp, currTimestamp;
-    double fps;
-    uint64_t vidConv, enc, rtpPay, udpStream, rtpDepay, dec, queue;
-    uint64_t rtpPayTimestamp, udpSrcTimestamp, rtpDepayTimestamp, decTimestamp, queueTimestamp;
-    uint64_t totalLatency;
-    uint64_t frameId;
-    uint16_t _packetsPerFrame;
-    uint64_t frameReadyTimestamp;
-    uint64_t presentation;
-};
+// View region (ROI) streaming: every frame packs the whole camera view, squeezed into the left half, next
+// to a crop of it at the camera's native resolution in the right half. RoiRect is where the crop lies in
+// the whole view, in 1/65535 of its width and height, as the sender put it into the sixth RTP header
+// extension of the frame. Empty for frames without a crop.
+struct RoiRect {
+    uint16_t x = 0, y = 0, width = 0, height = 0;
 
-struct CameraStats {
-    std::atomic<double> prevTimestamp{0.0}, currTimestamp{0.0};
-    std::atomic<double> fps{0.0};
-    std::atomic<uint64_t> vidConv{0}, enc{0}, rtpPay{0}, udpStream{0}, rtpDepay{0}, dec{0}, queue{0};
-    std::atomic<uint64_t> rtpPayTimestamp{0}, udpSrcTimestamp{0}, rtpDepayTimestamp{0}, decTimestamp{0}, queueTimestamp{0};
-    std::atomic<uint64_t> totalLatency{0};
-    std::atomic<uint64_t> frameId{0};
-    std::atomic<uint16_t> _packetsPerFrame{0};
-    std::atomic<uint64_t> frameReadyTimestamp{0};
-    std::atomic<uint64_t> presentation{0};
-
-    // Running average history
-    static constexpr size_t HISTORY_SIZE = 50;
-    mutable std::mutex historyMutex_;
-    mutable std::deque<CameraStatsSnapshot> history_;
-
-    // Create a copyable snapshot of current values
-    CameraStatsSnapshot snapshot() const {
-        return CameraStatsSnapshot{
-            prevTimestamp.load(), currTimestamp.load(),
-            fps.load(),
-            vidConv.load(), enc.load(), rtpPay.load(), udpStream.load(),
-            rtpDepay.load(), dec.load(), queue.load(),
-            rtpPayTimestamp.load(), udpSrcTimestamp.load(), rtpDepayTimestamp.load(),
-            decTimestamp.load(), queueTimestamp.load(),
-            totalLatency.load(),
-            frameId.load(),
-            _packetsPerFrame.load(),
-            frameReadyTimestamp.load(),
-            presentation.load()
-        };
+    [[nodiscard]] bool empty() const { return width == 0 || height == 0; }
+
+    // The extension's 8 bytes: x, y, width, height
+    [[nodiscard]] uint64_t pack() const {
+        return static_cast<uint64_t>(x) | static_cast<uint64_t>(y) << 16 | static_cast<uint64_t>(width) << 32 |
+               static_cast<uint64_t>(height) << 48;
     }
 
-    // Update history with current snapshot (call after each frame is processed)
-    void updateHistory() {
-        auto snap = snapshot();
-        std::lock_guard<std::mutex> lock(historyMutex_);
-        history_.push_back(snap);
-        if (history_.size() > HISTORY_SIZE) {
-            history_.pop_front();
-        }
+    static RoiRect unpack(uint64_t value) {
+        return RoiRect{static_cast<uint16_t>(value), static_cast<uint16_t>(value >> 16),
+                       static_cast<uint16_t>(value >> 32), static_cast<uint16_t>(value >> 48)};
     }
 
-    // Get averaged snapshot over the last N frames
-    CameraStatsSnapshot averagedSnapshot() const {
-        std::lock_guard<std::mutex> lock(historyMutex_);
+    static constexpr float UNIT = 65535.0f;
+};
 
-        if (history_.empty()) {
-            return snapshot(); // Return current if no history
-        }
+// Maps the presentation timestamp the jitter buffer assigns to a frame back to the frame id the sender
+// put into the RTP header extension, so decoded frames can still be identified after depayloading.
+// Carries the frame's packed RoiRect along. Written by the streaming thread, read by the appsink
+// callback, lock-free.
+struct FrameIdTracker {
+    static constexpr size_t SIZE = 32;
 
-        CameraStatsSnapshot avg{};
-        for (const auto& snap : history_) {
-            avg.prevTimestamp += snap.prevTimestamp;
-            avg.currTimestamp += snap.currTimestamp;
-            avg.fps += snap.fps;
-            avg.vidConv += snap.vidConv;
-            avg.enc += snap.enc;
-            avg.rtpPay += snap.rtpPay;
-            avg.udpStream += snap.udpStream;
-            avg.rtpDepay += snap.rtpDepay;
-            avg.dec += snap.dec;
-            avg.queue += snap.queue;
-            avg.totalLatency += snap.totalLatency;
-            avg.presentation += snap.presentation;
-            // Note: frameId and _packetsPerFrame from most recent
+    void record(uint64_t pts, uint64_t frameId, uint64_t roi = 0) {
+        if (pts == lastPts_) {
+            return; // every packet of a frame carries the id, one entry per frame is enough
         }
+        lastPts_ = pts;
+
+        auto &entry = entries_[next_++ % SIZE];
+        entry.pts.store(NONE, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        entry.frameId.store(frameId, std::memory_order_relaxed);
+        entry.roi.store(roi, std::memory_order_relaxed);
+        entry.pts.store(pts, std::memory_order_release);
+    }
 
-        size_t count = history_.size();
-        avg.prevTimestamp /= count;
-        avg.currTimestamp /= count;
-        avg.fps /= count;
-        avg.vidConv /= count;
-        avg.enc /= count;
-        avg.rtpPay /= count;
-        avg.udpStream /= count;
-        avg.rtpDepay /= count;
-        avg.dec /= count;
-        avg.queue /= count;
-        avg.totalLatency /= count;
-        avg.presentation /= count;
-
-        // Use most recent values for these
-        avg.frameId = history_.back().frameId;
-        avg._packetsPerFrame = history_.back()._packetsPerFrame;
-        avg.rtpPayTimestamp = history_.back().rtpPayTimestamp;
-        avg.udpSrcTimestamp = history_.back().udpSrcTimestamp;
-        avg.rtpDepayTimestamp = history_.back().rtpDepayTimestamp;
-        avg.decTimestamp = history_.back().decTimestamp;
-        avg.queueTimestamp = history_.back().queueTimestamp;
-        avg.frameReadyTimestamp = history_.back().frameReadyTimestamp;
-
-        return avg;
+    // Returns 0 when the frame was not tagged or its entry was already overwritten
+    uint64_t lookup(uint64_t pts, uint64_t *roi = nullptr) const {
+        for (const auto &entry: entries_) {
+            if (entry.pts.load(std::memory_order_acquire) != pts) {
+                continue;
+            }
+            uint64_t frameId = entry.frameId.load(std::memory_order_relaxed);
+            uint64_t frameRoi = entry.roi.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (entry.pts.load(std::memory_order_relaxed) == pts) {
+                if (roi) {
+                    *roi = frameRoi;
+                }
+                return frameId;
+            }
+        }
+        return 0;
     }
+
+private:
+    static constexpr uint64_t NONE = UINT64_MAX;
+
+    struct Entry {
+        std::atomic<uint64_t> pts{NONE};
+        std::atomic<uint64_t> frameId{0};
+        std::atomic<uint64_t> roi{0};
+    };
+    Entry entries_[SIZE];
+
+    // Written by the streaming thread only
+    uint64_t lastPts_ = NONE;
+    size_t next_ = 0;
+};
+
+struct CameraStats {
+    std::atomic<double> prevTimestamp{0.0}, currTimestamp{0.0};
+    std::atomic<double> fps{0.0};
+    std::atomic<uint64_t> frameId{0}; // Latest id from the RTP header extension, for packets without it
+    std::atomic<uint64_t> startUs{0}; // Pipeline start
+    std::atomic<float> firstFrameMs{0.0f}; // From the pipeline start to the first decoded frame, 0 until then
+
+    // Jitter buffer, updated by the JitterController tick
+    std::atomic<int> jitterLatencyMs{0};
+    std::atomic<float> networkJitterMs{0.0f};
+    std::atomic<uint64_t> packetsLate{0}, packetsLost{0};
+    // Lost packets the FEC decoder rebuilt or had to give up on
+    std::atomic<uint64_t> fecRecovered{0}, fecUnrecovered{0};
+    // NACK/RTX: requests sent, requests too late to be worth it, packets restored from the RTX stream
+    std::atomic<bool> rtxActive{false};
+    std::atomic<uint64_t> rtxRequested{0}, rtxSkipped{0}, rtxRepaired{0};
+    std::atomic<float> rtxAddedLatencyMs{0.0f}; // Per frame with repaired packets
+    // BandwidthEstimator of both streams: target and received bitrate per camera, loss, delay signal
+    std::atomic<int> estimatedBitrate{0};
+    std::atomic<float> receivedBitrate{0.0f};
+    std::atomic<float> bandwidthLoss{0.0f};
+    std::atomic<int> bandwidthUsage{0}; // BandwidthEstimator::Usage
+
+    FrameIdTracker frameIds;
+
+    // Stage timestamps of every frame, sealed when the frame is first presented
+    FrameTracer trace;
 };
 
+class PboUploadRing;
+class GlSampleRing;
+class ParallelJpegDecoder;
+
 struct CameraFrame {
     CameraStats *stats;
     int frameWidth = CameraResolution::fromLabel("FHD").getWidth();
     int frameHeight = CameraResolution::fromLabel("FHD").getHeight();
 
-    bool hasGlTexture = false;
-    unsigned int glTexture = 0;
-    unsigned int glTarget = 0;
+    bool hasGlTexture = false; // Frames arrive as GL textures, in glSamples
+    GlSampleRing *glSamples = nullptr; // Hardware path samples held while drawn, created on the render thread
+    bool glReadyFences = false; // Set by GstreamerPlayer: the samples come with an EGL fence, SHARED_CONTEXT
+
+    bool roiPacked = false; // Frames are view region frames (RoiRect), composited by the image plane shader
 
     unsigned long memorySize = frameWidth * frameHeight * 3; // Size of single Full HD RGB frame
-    void *dataHandle;
+    FrameMailbox *mailbox = nullptr; // CPU frames handed from the appsink callback to the renderer
+    PboUploadRing *uploadRing = nullptr; // Owns the mailbox, created on the render thread
+    ParallelJpegDecoder *jpegDecoder = nullptr; // Set when the appsink receives JPEG and decodes itself
 };
 
 using CamPair = std::pair<CameraFrame, CameraFrame>;
@@ -500,6 +601,18 @@ struct StreamingConfig {
     CameraResolution resolution{CameraResolution::fromLabel("FHD")};
     VideoMode videoMode{STEREO};
     int fps{60};
+    bool jpegPlanarYuv{false}; // JPEG: upload the decoder's native planes and convert to RGB on the GPU
+    int jpegDecodeThreads{0}; // JPEG: 0 = GStreamer's jpegdec, otherwise restart intervals decoded in parallel
+    int jitterLatencyMs{50}; // rtpjitterbuffer latency, the starting point when adaptive
+    bool adaptiveJitter{true}; // Retune the jitter buffer latency to the measured network jitter
+    float jitterTargetLoss{0.005f}; // Adaptive: share of packets allowed to miss the jitter buffer deadline
+    FecScheme fecScheme{NO_FEC}; // Redundancy the sender adds so lost packets are rebuilt without a round trip
+    int fecOverheadPercent{20}; // FEC packets per media packet, in percent of the media packets
+    bool retransmission{false}; // NACK lost packets while the RTT to the sender allows repairs in time
+    bool roi{false}; // View region streaming: the whole view at reduced detail plus a full-detail crop where the user looks
+    CameraResolution roiSource{CameraResolution::fromLabel("UHD")}; // Camera resolution the crop keeps
+    bool adaptiveBitrate{false}; // The robot's encoders follow the bandwidth estimate, `bitrate` is the start and the ceiling
+    bool warmStart{true}; // New pipelines start from cached parameter sets and ask the sender for a keyframe
 
     StreamingConfig()
     {
@@ -533,10 +646,44 @@ struct HUDState {
     std::string teleoperationState = "Disconnected";
 };
 
+// Decoder element factories per codec, best first - probed by DecoderProbe and persisted
+struct DecoderRanking {
+    std::string fingerprint; // Installed decoders the ranking is valid for
+    std::vector<std::string> decoders[Codec::Count];
+    bool probed[Codec::Count]{}; // Ranked already, also when no decoder could be timed
+};
+
+// Written by the StereoSynchronizer on the render thread
+struct StereoSyncStats {
+    uint64_t pairedFrames{0}; // Matching left and right frames presented together
+    uint64_t unpairedFrames{0}; // New frames presented without their counterpart
+    uint64_t lateFrames{0}; // Pairing gave up because one camera's frame did not arrive within the timeout
+};
+
+// Written by TelepresenceProgram on the render thread
+struct ReconfigurationStats {
+    ReconfigurationClass lastClass{NO_CHANGE};
+    std::string lastFields; // StreamingConfig fields the last Apply changed
+    float downtimeMs[CNT4]{}; // Last Apply of each class: longest wait for a new frame in the window after it
+    uint64_t applied[CNT4]{};
+};
+
 struct AppState {
-    CamPair cameraStreamingStates{};
+    // The renderer presents one pair while pipelines being built for a new config fill the other
+    std::array<CamPair, 2> cameraPairs{};
+    int presentedPair = 0;
+
+    CamPair &cameraStreamingStates() { return cameraPairs[presentedPair]; }
+
+    CamPair &standbyStreamingStates() { return cameraPairs[1 - presentedPair]; }
     StreamingConfig streamingConfig{};
     AspectRatioMode aspectRatioMode = FULLFOV;
+    StereoSyncPolicy stereoSyncPolicy = WAIT_FOR_PAIR;
+    int stereoSyncTimeoutMs = 20; // WAIT_FOR_PAIR: how long a frame waits for its counterpart
+    StereoSyncStats stereoSyncStats{};
+    ReconfigurationStats reconfigurationStats{};
+    GlContextMode glContextMode = WRAPPED_RENDER_CONTEXT; // Applied at startup
+    DecoderRanking decoderRanking{};
     float appFrameRate{0.0f};
     long long appFrameTime{0};
     SystemInfo systemInfo;
@@ -547,4 +694,5 @@ struct AppState {
     HUDState hudState{};
     bool robotControlEnabled = true;
     bool headsetMounted = false;
+    bool rtpCapturing = false; // Packets of both cameras are being recorded for offline replay
 };
\ No newline at end of file
@@ -0,0 +1,63 @@
+//
+// DecoderProbe - Finds the lowest-latency video decoder available for a codec
+//
+#pragma once
+
+#include <gst/gst.h>
+#include <string>
+#include <vector>
+#include "common.h"
+
+struct DecoderScore {
+    std::string factory;
+    bool works = false;
+    bool measured = false; // False when no encoder was available to produce the test clip
+    double latencyUs = 0; // Mean time from pushing a frame to the decoder until it comes out
+    double fps = 0; // Frames per second when the decoder is fed as fast as it accepts them
+};
+
+/**
+ * DecoderProbe - Times a short synthetic clip through every decoder of a codec
+ *
+ * Candidates are all decoder element factories whose sink caps accept the codec's encoded caps. The
+ * clip is encoded once with whatever encoder the device has, then pushed through each decoder twice:
+ * paced at the stream framerate for the per-frame latency and unpaced for the throughput.
+ *
+ * Decoders that cannot keep up with the framerate rank after those that can, otherwise the lower
+ * latency wins. Without an encoder for the codec the candidates keep their GStreamer rank order.
+ *
+ * With the application's GL context, hardware decoders output into GL memory like in the real
+ * pipeline. Runs on Linux against the software decoders just as well (tools/decoder_probe).
+ */
+class DecoderProbe {
+public:
+    DecoderProbe(int width, int height, int fps, GstContext *glContext = nullptr);
+
+    // Best first
+    std::vector<DecoderScore> run(Codec codec) const;
+
+    // Decoder factories for the codec by GStreamer rank
+    static std::vector<std::string> candidates(Codec codec);
+
+    // Changes when GStreamer or the set of installed decoders changes, invalidating stored rankings
+    static std::string fingerprint();
+
+    static std::vector<std::string> factories(const std::vector<DecoderScore> &scores);
+
+    int frames = 30;
+
+private:
+    // Access units of the test clip, empty if no encoder is available
+    std::vector<GstBuffer *> encodeClip(Codec codec, GstCaps **caps) const;
+
+    DecoderScore measure(Codec codec, const std::string &factory, const std::vector<GstBuffer *> &clip,
+                         GstCaps *caps) const;
+
+    // Pushes the clip once and stops the pipeline, returns the mean latency per frame (0 if the
+    // decoder failed)
+    double decode(GstElement *pipeline, const std::vector<GstBuffer *> &clip, bool paced,
+                  double &elapsedUs) const;
+
+    int width_, height_, fps_;
+    GstContext *glContext_;
+};
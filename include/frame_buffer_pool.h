@@ -0,0 +1,119 @@
+//
+// FrameBufferPool - Page-aligned frame buffers kept across pipeline reconfigurations
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <vector>
+
+/**
+ * FrameBufferPool - Frame memory for the CPU video path, reused by size instead of freed on every Apply
+ *
+ * Buffers are anonymous page-aligned mappings, so a slot never shares a cache line or a page with
+ * anything else, and are keyed by their size rounded up to whole pages. A frame size is a resolution
+ * (and layout), so switching back to a resolution used before finds its buffers idle in the pool.
+ * With huge pages, buffers of at least HUGE_PAGE bytes are rounded up to whole huge pages and
+ * advised as such (transparent huge pages, where the kernel has them), which takes a 4K RGB frame
+ * from over six thousand TLB entries to a dozen.
+ *
+ * Ownership: acquire() hands out a Buffer that owns its memory until it is destroyed, which returns
+ * it to the pool. A FrameMailbox owns the buffers of its slots; within the mailbox the slot states
+ * hand each frame from the decoder to the renderer and back. Idle buffers beyond the idle limit are
+ * unmapped, those of other sizes first.
+ */
+class FrameBufferPool {
+public:
+    struct Settings {
+        bool hugePages = true;
+        size_t idleLimitBytes = 192u << 20; // Idle memory kept for later reconfigurations
+    };
+
+    class Buffer {
+    public:
+        Buffer() = default;
+
+        Buffer(Buffer &&other) noexcept { *this = std::move(other); }
+
+        Buffer &operator=(Buffer &&other) noexcept;
+
+        Buffer(const Buffer &) = delete;
+        Buffer &operator=(const Buffer &) = delete;
+
+        ~Buffer() { reset(); }
+
+        // Returns the memory to the pool
+        void reset();
+
+        [[nodiscard]] uint8_t *data() const { return data_; }
+
+        // At least the size asked for, whole pages
+        [[nodiscard]] size_t capacity() const { return capacity_; }
+
+        explicit operator bool() const { return data_ != nullptr; }
+
+    private:
+        friend class FrameBufferPool;
+
+        Buffer(FrameBufferPool *pool, uint8_t *data, size_t capacity) : pool_(pool), data_(data), capacity_(capacity) {}
+
+        FrameBufferPool *pool_ = nullptr;
+        uint8_t *data_ = nullptr;
+        size_t capacity_ = 0;
+    };
+
+    FrameBufferPool();
+
+    explicit FrameBufferPool(const Settings &settings);
+
+    ~FrameBufferPool();
+
+    FrameBufferPool(const FrameBufferPool &) = delete;
+    FrameBufferPool &operator=(const FrameBufferPool &) = delete;
+
+    // Shared by all mailboxes of the process
+    static FrameBufferPool &shared();
+
+    // An idle buffer of this size if there is one, a new mapping otherwise. Throws std::bad_alloc
+    Buffer acquire(size_t size);
+
+    // Unmaps every idle buffer
+    void trim();
+
+    [[nodiscard]] uint64_t hits() const { return hits_.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] uint64_t misses() const { return misses_.load(std::memory_order_relaxed); }
+
+    // Share of acquisitions served from idle buffers, 0 before the first
+    [[nodiscard]] double hitRate() const;
+
+    // Mapped bytes, handed out and idle
+    [[nodiscard]] size_t residentBytes() const { return residentBytes_.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] size_t peakResidentBytes() const { return peakResidentBytes_.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] size_t idleBytes() const;
+
+    static constexpr size_t PAGE = 4096;
+    static constexpr size_t HUGE_PAGE = 2u << 20;
+
+private:
+    void release(uint8_t *data, size_t capacity);
+
+    // Unmaps idle buffers until at most `limit` bytes are idle, other sizes than `keep` first
+    void trimLocked(size_t limit, size_t keep);
+
+    [[nodiscard]] size_t roundUp(size_t size) const;
+
+    Settings settings_;
+
+    mutable std::mutex mutex_;
+    std::map<size_t, std::vector<uint8_t *>> idle_; // By capacity
+    size_t idleBytes_ = 0;
+
+    std::atomic<uint64_t> hits_{0}, misses_{0};
+    std::atomic<size_t> residentBytes_{0}, peakResidentBytes_{0};
+};
@@ -0,0 +1,134 @@
+//
+// FrameMailbox - Lock-free N-slot frame exchange between a GStreamer streaming thread and the render thread
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "frame_buffer_pool.h"
+
+// Pixel layout of a frame in a mailbox slot. Planar layouts are packed plane after plane without row padding
+enum class PixelLayout : uint8_t {
+    RGB, I420, Y42B, Y444
+};
+
+struct PlaneLayout {
+    int count = 1;
+    int width[3]{}, height[3]{};
+    size_t offset[3]{};
+    size_t size = 0; // Bytes of all planes together
+};
+
+PlaneLayout plane_layout(PixelLayout layout, int width, int height);
+
+/**
+ * FrameMailbox - "latest frame wins" handoff of decoded frames
+ *
+ * The producer (appsink callback) claims a free slot, fills it and publishes it with a single
+ * atomic swap of the latest index. The consumer (render thread) always picks up the newest
+ * published slot and keeps it until it moves on to a newer one, so it never reads a slot that
+ * is being written. Frames that get replaced before the consumer picks them up, or that arrive
+ * while every slot is busy, are counted as dropped.
+ *
+ * With the default of three slots this is a classic triple buffer: one slot is written, one
+ * holds the latest complete frame and one is being read by the renderer.
+ *
+ * With retained history a replaced frame stays READY until the producer needs its slot (oldest
+ * first), so the consumer can pick a specific older frame by its frame id, e.g. to pair stereo frames.
+ */
+class FrameMailbox {
+public:
+    enum SlotState : uint8_t {
+        FREE, WRITING, READY, READING
+    };
+
+    struct Slot {
+        uint8_t *data = nullptr;
+        size_t size = 0;
+        uint64_t sequence = 0;
+        uint64_t frameId = 0; // RTP frame id of the frame, 0 when the sender did not tag it
+        uint64_t roi = 0; // Packed RoiRect of a view region frame
+        PixelLayout layout = PixelLayout::RGB;
+        bool limitedRange = false; // YUV with 16-235 luma instead of the full range JFIF uses
+        std::atomic<uint8_t> state{FREE};
+    };
+
+    // Slots backed by page-aligned buffers of `pool`, returned to it with the mailbox
+    explicit FrameMailbox(size_t slotSize, size_t slotCount = DEFAULT_SLOT_COUNT,
+                          FrameBufferPool &pool = FrameBufferPool::shared());
+
+    // Slots backed by memory owned by someone else (e.g. persistently mapped pixel buffers)
+    FrameMailbox(const std::vector<uint8_t *> &buffers, size_t slotSize);
+
+    FrameMailbox(const FrameMailbox &) = delete;
+    FrameMailbox &operator=(const FrameMailbox &) = delete;
+
+    // Producer side - returns nullptr (and counts a drop) when no slot is free
+    Slot *beginWrite();
+
+    void publish(Slot *slot);
+
+    // Returns the slot to the pool without publishing it (e.g. a failed buffer map)
+    void abortWrite(Slot *slot);
+
+    // Consumer side - moves to the newest published slot if there is one and returns the slot
+    // the renderer should use (nullptr until the first frame has been published)
+    Slot *acquireLatest();
+
+    [[nodiscard]] Slot *front() const { return front_ < 0 ? nullptr : &slots_[front_]; }
+
+    // Consumer side - moves to the published frame with this frame id, nullptr if it is not (or no
+    // longer) available
+    Slot *acquire(uint64_t frameId);
+
+    // Snapshot of the frame ids the consumer could acquire right now, returns their count
+    size_t readyFrameIds(uint64_t *frameIds, size_t max) const;
+
+    void setRetainHistory(bool retain) { retainHistory_ = retain; }
+
+    // With deferred release the slot the consumer moves away from stays in READING state until
+    // release() is called, e.g. once the GPU has finished reading it
+    void setDeferredRelease(bool deferred) { deferredRelease_ = deferred; }
+
+    void release(Slot *slot);
+
+    [[nodiscard]] size_t slotSize() const { return slotSize_; }
+    [[nodiscard]] size_t slotCount() const { return slots_.size(); }
+
+    [[nodiscard]] uint64_t produced() const { return produced_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t consumed() const { return consumed_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+    // Subset of dropped frames that found every slot busy (a hint that the ring is too shallow)
+    [[nodiscard]] uint64_t starved() const { return starved_.load(std::memory_order_relaxed); }
+
+    static constexpr size_t DEFAULT_SLOT_COUNT = 3;
+
+private:
+    static constexpr int NO_SLOT = -1;
+    static constexpr size_t CACHE_LINE = 64;
+
+    size_t slotSize_;
+    std::vector<FrameBufferPool::Buffer> buffers_;
+    mutable std::vector<Slot> slots_;
+
+    void moveFront(int index);
+
+    Slot *reclaimOldest();
+
+    bool retainHistory_ = false;
+
+    // Written by the producer only
+    alignas(CACHE_LINE) std::atomic<int> latest_{NO_SLOT};
+    std::atomic<uint64_t> produced_{0};
+    std::atomic<uint64_t> dropped_{0};
+    std::atomic<uint64_t> starved_{0};
+    uint64_t nextSequence_ = 1;
+
+    // Written by the consumer only
+    alignas(CACHE_LINE) int front_ = NO_SLOT;
+    bool deferredRelease_ = false;
+    std::atomic<uint64_t> consumed_{0};
+};
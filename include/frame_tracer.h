@@ -0,0 +1,134 @@
+//
+// FrameTracer - Per-frame timestamps of every pipeline stage, keyed by the RTP frame id
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "latency_histogram.h"
+
+// Receiver-side points a frame passes, in pipeline order. Times are NTP-synced microseconds.
+enum class TraceStage {
+    FIRST_PACKET,  // udpsrc, first packet of the frame
+    LAST_PACKET,   // udpsrc, latest packet of the frame so far
+    JITTER_BUFFER, // rtpjitterbuffer released the frame's first packet
+    DEPAYLOADED,   // Whole access unit out of the depayloader
+    DECODED,
+    QUEUED,        // Through the queue behind the decoder
+    READY,         // Handed to the renderer (mailbox or GL texture)
+    PRESENTED,     // First drawn, seals the record
+    DISPLAYED,     // Predicted display time of the frame it was first drawn into, 0 where unknown
+    COUNT
+};
+
+// Copy of one frame's record
+struct FrameTrace {
+    uint64_t frameId = 0;
+    uint64_t stages[static_cast<size_t>(TraceStage::COUNT)]{}; // 0 where the frame never got
+    // Sender side from the RTP header extension: durations and the time the frame was payloaded
+    uint64_t vidConvUs = 0, encUs = 0, rtpPayUs = 0;
+    uint64_t payloadedUs = 0;
+    uint32_t packets = 0;
+
+    [[nodiscard]] uint64_t at(TraceStage stage) const { return stages[static_cast<size_t>(stage)]; }
+
+    // Time between two stages, 0 unless both were recorded in order
+    [[nodiscard]] uint64_t span(TraceStage from, TraceStage to) const {
+        return at(from) && at(to) >= at(from) ? at(to) - at(from) : 0;
+    }
+
+    // Sender payloader to the first packet received
+    [[nodiscard]] uint64_t networkUs() const {
+        return payloadedUs && at(TraceStage::FIRST_PACKET) >= payloadedUs ? at(TraceStage::FIRST_PACKET) - payloadedUs : 0;
+    }
+
+    // Sender conversion start to the display, or to presentation where the display time is unknown
+    [[nodiscard]] uint64_t totalUs() const {
+        uint64_t start = payloadedUs - rtpPayUs - encUs - vidConvUs;
+        uint64_t end = at(TraceStage::DISPLAYED) ? at(TraceStage::DISPLAYED) : at(TraceStage::PRESENTED);
+        return payloadedUs && end >= start ? end - start : 0;
+    }
+};
+
+/**
+ * FrameTracer - Lock-free ring of per-frame trace records of one camera
+ *
+ * Every stage writes its timestamp into the record of the frame it is handling, found by frame id in
+ * a preallocated ring, so the stages of one frame are never mixed with those of another. The first
+ * stage to see a new frame id claims the ring entry it maps to; stages of frames older than the
+ * entry's current one are dropped. Presentation seals the record, only sealed records are read.
+ * Sealing also adds the record's durations to per-stage latency histograms; all sealing happens on
+ * the render thread, the histograms' single writer.
+ *
+ * Writers are the streaming threads and the render thread; readers (HUD, trace export) copy a record
+ * and keep the copy only if its frame id did not change meanwhile. A writer stalled for the length of
+ * the ring (several seconds) could write into the record of a later frame, nothing else can.
+ */
+class FrameTracer {
+public:
+    static constexpr size_t SIZE = 256;
+
+    FrameTracer() = default;
+
+    FrameTracer(const FrameTracer &) = delete;
+    FrameTracer &operator=(const FrameTracer &) = delete;
+
+    // FIRST_PACKET keeps the earliest time, every other stage the latest. Frame id 0 (untagged) is ignored
+    void mark(uint64_t frameId, TraceStage stage, uint64_t timeUs);
+
+    // Counts a packet towards the frame and updates LAST_PACKET (and FIRST_PACKET for the first one)
+    void markPacket(uint64_t frameId, uint64_t timeUs);
+
+    void markSender(uint64_t frameId, uint64_t vidConvUs, uint64_t encUs, uint64_t rtpPayUs, uint64_t payloadedUs);
+
+    // Render thread. Records PRESENTED and DISPLAYED (0 if unknown) and adds the record to the latency
+    // histograms. Returns false if the frame was already presented or is no longer in the ring
+    bool seal(uint64_t frameId, uint64_t presentedUs, uint64_t displayedUs);
+
+    // Sealed records, oldest first
+    std::vector<FrameTrace> sealed() const;
+
+    struct Latencies {
+        LatencyHistogram vidConv, encode, rtpPay;
+        // stages[s]: stage s-1 to stage s; stages[FIRST_PACKET]: sender payloader to the first packet
+        LatencyHistogram stages[static_cast<size_t>(TraceStage::COUNT)];
+        LatencyHistogram total;
+    };
+
+    // Percentiles of the sealed frames, per window
+    [[nodiscard]] const Latencies &latencies() const { return latencies_; }
+
+    // Chrome / Perfetto trace event JSON (chrome://tracing, ui.perfetto.dev) of the sealed records of
+    // the named tracers, one track per tracer. Returns false if the file cannot be written
+    static bool writeChromeTrace(const std::string &path,
+                                 const std::vector<std::pair<std::string, const FrameTracer *>> &tracers);
+
+    static const char *stageName(TraceStage stage);
+
+private:
+    static constexpr uint64_t EMPTY = 0;
+    static constexpr uint64_t CLAIMING = UINT64_MAX;
+
+    struct Record {
+        std::atomic<uint64_t> frameId{EMPTY};
+        std::atomic<uint64_t> stages[static_cast<size_t>(TraceStage::COUNT)]{};
+        std::atomic<uint64_t> vidConvUs{0}, encUs{0}, rtpPayUs{0}, payloadedUs{0};
+        std::atomic<uint32_t> packets{0};
+        std::atomic<bool> sealed{false};
+    };
+
+    // Entry of the frame, claimed and cleared if it still holds an older frame, nullptr if it holds a newer one
+    Record *claim(uint64_t frameId);
+
+    // Copies a sealed record, false if it is not sealed or was reused while copying
+    static bool read(const Record &record, FrameTrace &trace);
+
+    void addLatencies(const FrameTrace &trace, uint64_t nowUs);
+
+    Record records_[SIZE];
+    Latencies latencies_;
+};
@@ -0,0 +1,95 @@
+//
+// GlSampleRing - Decoded GL frames of the hardware path, held until the GPU has finished sampling them
+//
+#pragma once
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <GLES3/gl3.h>
+#include <gst/gst.h>
+#include <memory>
+#include <vector>
+#include "frame_mailbox.h"
+
+/**
+ * GlSampleRing - GstSamples of one camera's GL memory appsink, kept referenced while they are drawn
+ *
+ * The decoder recycles a GL texture as soon as the last reference to its buffer goes, so the appsink
+ * callback hands its sample over instead of unreferencing it. The ring's FrameMailbox carries the
+ * samples from the streaming thread to the render thread ("latest frame wins", slots in place of
+ * pixel memory). After every eye pass that sampled the selected texture the renderer inserts a fence;
+ * a sample the renderer moved away from is unreferenced, and its slot handed back to the producer,
+ * only once that fence has signalled. Neither side waits: with every slot held the callback drops the
+ * new sample, which the mailbox counts.
+ *
+ * Replaced samples stay selectable until the producer needs their slot, so the StereoSynchronizer can
+ * pick a frame by its frame id with select() as on the CPU path.
+ *
+ * When GStreamer renders on a context of its own (SHARED_CONTEXT) a sample comes with an EGL fence
+ * after the GL work that produced it; the render context's GPU waits on it when the frame is selected.
+ *
+ * The depth is kept small, every held sample is a buffer the decoder's output pool cannot reuse.
+ * Render thread only, apart from push().
+ */
+class GlSampleRing {
+public:
+    explicit GlSampleRing(size_t depth = DEFAULT_DEPTH);
+
+    // Deletes the fences and releases every held sample, with the GL context current
+    ~GlSampleRing();
+
+    GlSampleRing(const GlSampleRing &) = delete;
+    GlSampleRing &operator=(const GlSampleRing &) = delete;
+
+    // Streaming thread: takes over the reference to `sample` and the `ready` fence. False when every slot
+    // is still held, the caller keeps its reference then (the fence is destroyed either way)
+    bool push(GstSample *sample, GLuint texture, GLenum target, uint64_t frameId, uint64_t roi,
+              EGLSyncKHR ready = EGL_NO_SYNC_KHR);
+
+    // Render thread, once per display frame: moves to the newest frame, ordered after its ready fence
+    void selectLatest();
+
+    // Render thread, once per display frame: moves to the frame with this RTP frame id, false if the
+    // mailbox no longer (or not yet) holds it
+    bool select(uint64_t frameId);
+
+    // Render thread, after each eye pass that drew the selected frame
+    void fence();
+
+    // Selected frame, 0 until the first frame has arrived
+    [[nodiscard]] GLuint texture() const;
+
+    [[nodiscard]] GLenum target() const;
+
+    // RTP frame id and packed RoiRect of the selected frame, 0 without
+    [[nodiscard]] uint64_t frameId() const;
+
+    [[nodiscard]] uint64_t roi() const;
+
+    [[nodiscard]] const FrameMailbox *mailbox() const { return mailbox_.get(); }
+
+    // Frames whose fence had not signalled yet when the renderer moved on
+    [[nodiscard]] size_t retiring() const { return retiring_.size(); }
+
+    static constexpr size_t DEFAULT_DEPTH = 3;
+
+private:
+    struct Held {
+        GstSample *sample = nullptr;
+        GLuint texture = 0;
+        GLenum target = GL_TEXTURE_2D;
+        GLsync fence = nullptr;
+        EGLSyncKHR ready = EGL_NO_SYNC_KHR;
+    };
+
+    static Held &held(const FrameMailbox::Slot *slot) { return *reinterpret_cast<Held *>(slot->data); }
+
+    void moveFrom(FrameMailbox::Slot *previous, FrameMailbox::Slot *selected);
+
+    void retireSignaled();
+
+    EGLDisplay display_; // Of the render context the ring was created on
+    std::vector<Held> held_;
+    std::unique_ptr<FrameMailbox> mailbox_;
+    std::vector<FrameMailbox::Slot *> retiring_;
+};
@@ -5,8 +5,16 @@
 #include "common.h"
 #include "BS_thread_pool.hpp"
 #include "ntp_timer.h"
+#include "parallel_jpeg_decoder.h"
+#include "pipeline_builder.h"
+#include "bandwidth_estimator.h"
+#include "jitter_controller.h"
+#include "media_packet_filter.h"
+#include "retransmission_controller.h"
+#include "rtp_capture.h"
 #include <gst/gl/gstglcontext.h>
 #include <gst/gl/egl/gstgldisplay_egl.h>
+#include <EGL/eglext.h>
 
 #pragma once
 
@@ -14,22 +22,67 @@
 class GstreamerPlayer {
 public:
 
-    explicit GstreamerPlayer(CamPair *camPair, NtpTimer *ntpTimer);
+    // SHARED_CONTEXT falls back to WRAPPED_RENDER_CONTEXT when GStreamer cannot create its context
+    explicit GstreamerPlayer(CamPair *camPair, NtpTimer *ntpTimer,
+                             GlContextMode glContextMode = WRAPPED_RENDER_CONTEXT);
 
     ~GstreamerPlayer();
 
-    void configurePipelines(BS::thread_pool<BS::tp::none> &threadPool, const StreamingConfig &config);
+    // Uses the first of `decoders` that is installed and builds, the platform default otherwise
+    void configurePipelines(BS::thread_pool<BS::tp::none> &threadPool, const StreamingConfig &config,
+                            const std::vector<std::string> &decoders = {});
+
+    // Stops both pipelines and joins their main loop, so the frame storage they write into can be replaced
+    void stopPipelines();
+
+    // Stops everything stopPipelines() does, after which the player can be destroyed
+    void shutdown();
+
+    // Applies a StreamingConfig that differs from the running one only in settings the pipelines take
+    // in place (RENEGOTIATE, see StreamingConfigDiff): the jitter buffers, the view region flag, warm start,
+    // the bandwidth estimator's ceiling and the frame rate of the retransmission deadlines and H.264 decoder caps. False when no pipelines are running, configurePipelines() then
+    bool updatePipelines(const StreamingConfig &config);
+
+    // Records the packets arriving at both udpsrcs into left.rtpcap and right.rtpcap in `directory`,
+    // until stopCapture() or the pipelines stop. Returns false if the files cannot be created
+    bool startCapture(const std::string &directory, const StreamingConfig &config);
+
+    void stopCapture();
+
+    [[nodiscard]] bool capturing() const { return captureProbeLeft_ != 0; }
+
+    // Fed by both pipelines, null before configurePipelines()
+    [[nodiscard]] BandwidthEstimator *bandwidthEstimator() const { return bandwidth_.get(); }
+
+    [[nodiscard]] GlContextMode glContextMode() const { return glContextMode_; }
 
 private:
 
     using GStreamerCallbackObj = std::pair<CamPair*, NtpTimer*>;
 
+    struct JitterUpdate {
+        GstreamerPlayer *player;
+        JitterController::Settings settings;
+    };
+
+    // State of one pipeline's parameter set probe
+    struct WarmStart {
+        GstreamerPlayer *player;
+        std::string stream; // ParameterSetCache key
+        Codec codec;
+        bool first = true; // Before the pipeline's first access unit
+        bool annexB = false;
+    };
+
     static GstFlowReturn newFrameCallback(GstElement *sink, GStreamerCallbackObj *callbackObj);
 
     static void onRtpHeaderMetadata(GstElement *identity, GstBuffer *buffer, gpointer data);
 
     static void onIdentityHandoff(GstElement *identity, GstBuffer *buffer, gpointer data);
 
+    // Remembers which frame id belongs to the timestamp the jitter buffer gave a frame
+    static void onJitterBufferOutput(GstElement *identity, GstBuffer *buffer, gpointer data);
+
     static void stateChangedCallback(GstBus *bus, GstMessage *msg, GstElement *pipeline);
 
     static void infoCallback(GstBus *bus, GstMessage *msg, GstElement *pipeline);
@@ -38,8 +91,53 @@ private:
 
     static void errorCallback(GstBus *bus, GstMessage *msg, GstElement *pipeline);
 
+    // Feeds every received packet to the stream's JitterController and to the BandwidthEstimator
     static GstPadProbeReturn udpPacketProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
 
+    // Parser input of H.264 / H.265: caches the stream's parameter sets in ParameterSetCache and, with warm
+    // start, prepends the cached ones to a first access unit that has none
+    static GstPadProbeReturn parameterSetProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    // Appends every received packet to the stream's RtpCaptureWriter
+    static GstPadProbeReturn captureProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    // Probe on the udpsrc src pad owning `writer`, which is closed when the probe is removed
+    static gulong addCaptureProbe(GstElement *pipeline, std::unique_ptr<RtpCaptureWriter> writer);
+
+    static void removeCaptureProbe(GstElement *pipeline, gulong &probe);
+
+    // Packets restored by rtxreceive and the jitter buffer's retransmission requests, which only go on
+    // (as NACKs) when the RetransmissionController expects the repair in time
+    static GstPadProbeReturn retransmissionProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data);
+
+    // Main loop timer, retunes both jitter buffers and collects the loss, FEC, retransmission and
+    // bandwidth estimator counters
+    static gboolean jitterTimerCallback(gpointer data);
+
+    // Quits the main loop and waits until its thread has left it
+    void stopMainLoop();
+
+    void updateJitterBuffer(GstElement *pipeline, JitterController *jitter, RetransmissionController *rtx,
+                            CameraStats *stats);
+
+    static JitterController::Settings jitterSettingsFor(const StreamingConfig &config);
+
+    // Main loop, once per updatePipelines(): new JitterController settings and the latency they start at
+    static gboolean applyJitterSettings(gpointer data);
+
+    // Copies a decoded CPU frame into a mailbox slot, planar formats without their row padding
+    static bool copyToSlot(GstBuffer *buffer, GstCaps *caps, const CameraFrame &frame, FrameMailbox::Slot *slot);
+
+    // Decodes a JPEG sample straight into a mailbox slot with the camera's ParallelJpegDecoder
+    static bool decodeToSlot(GstBuffer *buffer, const CameraFrame &frame, FrameMailbox::Slot *slot);
+
+    // Trace stages the dec_ident / queue_ident handoffs record when the pipeline decodes
+    static void recordDecoded(CameraStats *stats, uint64_t frameId, NtpTimer *ntpTimer);
+
+    // SHARED_CONTEXT: EGL fence after the GL work that produced the frame in `buffer`, created on the GL
+    // thread of its context. Blocks the streaming thread until that thread gets to it
+    static EGLSyncKHR createReadyFence(GstBuffer *buffer);
+
     static GstCaps* buildDecoderSrcCaps(Codec codec, int width, int height, int fps);
 
     // Helper functions for cleaner GStreamer element management
@@ -47,22 +145,41 @@ private:
     static GstElement* getElementOptional(GstElement* pipeline, const char* name);
     static void connectAndUnref(GstElement* element, const char* signal, GCallback callback, gpointer data);
 
+    // The GL display (SHARED_CONTEXT) and application context GStreamer's GL elements pick up
+    void setGlContexts(GstElement *element) const;
+
+    // Creates both pipelines with the first decoder that builds
+    PipelineBuilder buildPipelines(const StreamingConfig &config, const std::vector<std::string> &decoders);
+
     // Configure a single stereo pipeline (left or right)
     void configureSinglePipeline(GstElement* pipeline, const char* pipelineName, int port,
-                                 const StreamingConfig& config, const std::string& xDimString, int payload);
+                                 const StreamingConfig& config, const PipelineBuilder& builder,
+                                 const std::string& xDimString, RetransmissionController* rtx);
 
     GstElement *pipelineLeft_{}, *pipelineRight_{};
     GstContext *gContext_{};
     GMainContext *gMainContext_{};
-    GstGLContext *glContext_{};
+    GstGLContext *glContext_{}; // The render context, wrapped
+    GstContext *gDisplayContext_{}; // SHARED_CONTEXT only
+    GstGLContext *sharedGlContext_{}; // SHARED_CONTEXT only
     GMainLoop *mainLoop_{};
+    std::future<void> mainLoopDone_;
 
     CamPair *camPair_;
-    GStreamerCallbackObj *callbackObj_;
+    GStreamerCallbackObj *callbackObj_{};
 
     NtpTimer *ntpTimer_;
+    GlContextMode glContextMode_;
+    std::atomic<bool> warmStart_{true}; // StreamingConfig::warmStart of the running pipelines
+
+    std::unique_ptr<JitterController> jitterLeft_, jitterRight_;
+    std::unique_ptr<MediaPacketFilter> mediaFilterLeft_, mediaFilterRight_;
+    std::unique_ptr<RetransmissionController> rtxLeft_, rtxRight_;
+    std::unique_ptr<BandwidthEstimator> bandwidth_;
+    GSource *jitterTimer_{};
+
+    gulong captureProbeLeft_ = 0, captureProbeRight_ = 0;
 
-    const std::string jpegPipeline_ =   "udpsrc name=udpsrc ! capsfilter name=rtp_capsfilter caps=\"application/x-rtp, media=video, encoding-name=JPEG, payload=26, clock-rate=90000\" ! identity name=udpsrc_ident ! rtpjitterbuffer latency=50 do-lost=true drop-on-latency=true do-retransmission=false ! rtpjpegdepay ! identity name=rtpdepay_ident ! jpegparse ! jpegdec ! videoconvert ! video/x-raw,format=RGB ! identity name=dec_ident ! identity name=queue_ident ! appsink emit-signals=true name=appsink sync=false";
-    const std::string h264Pipeline_ =   "udpsrc name=udpsrc ! capsfilter name=rtp_capsfilter caps=\"application/x-rtp, encoding-name=H264, media=video, clock-rate=90000, payload=96\" ! identity name=udpsrc_ident ! rtpjitterbuffer latency=50 do-lost=true drop-on-latency=true do-retransmission=false ! rtph264depay ! identity name=rtpdepay_ident ! h264parse config-interval=-1 ! queue ! video/x-h264, stream-format=byte-stream, alignment=au, parsed=true ! amcviddec-omxqcomvideodecoderavc name=dec ! identity name=dec_ident ! queue ! identity name=queue_ident ! glsinkbin name=glsink";
-    const std::string h265Pipeline_ =   "udpsrc name=udpsrc ! capsfilter name=rtp_capsfilter caps=\"application/x-rtp, encoding-name=H265, media=video, clock-rate=90000, payload=96\" ! identity name=udpsrc_ident ! rtpjitterbuffer latency=50 do-lost=true drop-on-latency=true do-retransmission=false ! rtph265depay ! identity name=rtpdepay_ident ! h265parse config-interval=-1 ! queue ! video/x-h265, width=1920, height=1080, framerate=60/1, stream-format=byte-stream, alignment=au, parsed=true ! amcviddec-omxqcomvideodecoderhevc name=dec ! identity name=dec_ident ! queue ! identity name=queue_ident ! glsinkbin name=glsink";
+    std::unique_ptr<BS::thread_pool<BS::tp::none>> jpegDecodePool_;
+    std::unique_ptr<ParallelJpegDecoder> jpegDecoderLeft_, jpegDecoderRight_;
 };
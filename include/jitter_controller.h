@@ -0,0 +1,77 @@
+//
+// JitterController - Adapts the rtpjitterbuffer latency to the measured network jitter
+//
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * JitterController - Chooses the jitter buffer latency of one stream
+ *
+ * Every received packet contributes its transit time (arrival minus RTP timestamp). The spread of
+ * the transit times above the fastest recent packet is how long the jitter buffer has to wait for a
+ * packet to arrive in time, so the (1 - target loss) quantile of it over the last seconds is the
+ * latency that loses about the target share of packets to lateness.
+ *
+ * The jitter buffer's own counter of packets that arrived too late closes the loop: above the target
+ * the latency backs off quickly, below it the latency follows the quantile down in small steps.
+ * Packets that never arrive are reported but do not raise the latency, waiting longer cannot save them.
+ */
+class JitterController {
+public:
+    struct Settings {
+        int initialMs = 50;
+        int minMs = 5;
+        int maxMs = 200;
+        double targetLoss = 0.005; // Share of packets allowed to arrive after their deadline
+    };
+
+    JitterController(std::string name, const Settings &settings);
+
+    // Streaming thread, for every packet
+    void onPacket(uint64_t arrivalUs, uint32_t rtpTimestamp);
+
+    // Main loop thread, periodically with the jitter buffer's cumulative counters. Returns the latency
+    // the jitter buffer should use from now on
+    int update(uint64_t pushed, uint64_t lost, uint64_t late);
+
+    // Main loop thread: new bounds and target, the latency starts over from settings.initialMs. Returns it
+    int setSettings(const Settings &settings);
+
+    [[nodiscard]] int latencyMs() const { return latencyMs_; }
+
+    // RFC 3550 interarrival jitter
+    [[nodiscard]] double jitterMs() const;
+
+    // Late packets per packet in the last update interval
+    [[nodiscard]] double lateRate() const { return lateRate_; }
+
+    static constexpr uint64_t WINDOW_US = 5000000;
+    static constexpr uint32_t CLOCK_RATE = 90000;
+
+private:
+    struct Sample {
+        uint64_t arrivalUs;
+        int64_t transitUs;
+    };
+
+    std::string name_;
+    Settings settings_;
+    int latencyMs_;
+
+    mutable std::mutex mutex_;
+    std::deque<Sample> samples_;
+    bool hasTimestamp_ = false;
+    uint32_t lastRtpTimestamp_ = 0;
+    uint64_t rtpTimestamp_ = 0; // Extended past the 32 bit wrap
+    int64_t lastTransitUs_ = 0;
+    double jitterUs_ = 0;
+
+    uint64_t pushed_ = 0, lost_ = 0, late_ = 0;
+    double lateRate_ = 0;
+    std::vector<int64_t> spread_;
+};
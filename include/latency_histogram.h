@@ -0,0 +1,65 @@
+//
+// LatencyHistogram - Log-bucketed latency distribution over fixed time windows
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * LatencyHistogram - Percentiles of one latency, recomputed once per window
+ *
+ * Samples fall into logarithmic buckets, eight per power of two (at most 12.5 % wide, exact below
+ * 8 us), held in a fixed array. A single writer thread records samples; the first sample after the
+ * window has elapsed completes it, and the writer then publishes that window's percentiles and starts
+ * an empty one. Readers on any thread only copy the published summary, so the HUD never walks the
+ * buckets or waits on the writer. As nothing completes a window while no samples arrive, a summary
+ * published more than two windows ago (on the steady clock) is read as stale.
+ */
+class LatencyHistogram {
+public:
+    static constexpr uint64_t DEFAULT_WINDOW_US = 2000000;
+
+    explicit LatencyHistogram(uint64_t windowUs = DEFAULT_WINDOW_US) : windowUs_(windowUs) {}
+
+    LatencyHistogram(const LatencyHistogram &) = delete;
+    LatencyHistogram &operator=(const LatencyHistogram &) = delete;
+
+    // Writer thread only. `nowUs` places the sample in a window, a clock step backwards ends the window
+    void record(uint64_t valueUs, uint64_t nowUs);
+
+    // Last completed window, count 0 until the first one completes
+    struct Summary {
+        uint64_t count = 0;
+        uint64_t p50Us = 0, p95Us = 0, p99Us = 0, maxUs = 0;
+        uint64_t windowEndUs = 0;
+        bool stale = false; // No window completed since, the samples stopped (a stalled stream)
+    };
+
+    [[nodiscard]] Summary summary() const;
+
+    static constexpr int SUB_BUCKET_BITS = 3;
+    static constexpr int MAX_EXPONENT = 36; // Values from 2^36 us (19 hours) up share the last bucket
+    static constexpr size_t BUCKETS = (1 << SUB_BUCKET_BITS) * (MAX_EXPONENT - SUB_BUCKET_BITS + 1);
+
+    static size_t bucketOf(uint64_t valueUs);
+
+    // Middle of the bucket's range
+    static uint64_t bucketValue(size_t bucket);
+
+private:
+    void publish(uint64_t windowEndUs);
+
+    uint64_t windowUs_;
+
+    // Writer thread only
+    uint64_t windowStartUs_ = 0;
+    uint32_t counts_[BUCKETS]{};
+    uint64_t count_ = 0, max_ = 0;
+
+    // Published summary, odd sequence while the writer updates it
+    std::atomic<uint32_t> sequence_{0};
+    std::atomic<uint64_t> summaryCount_{0}, p50Us_{0}, p95Us_{0}, p99Us_{0}, maxUs_{0}, windowEndUs_{0};
+    std::atomic<uint64_t> publishedUs_{0}; // Steady clock
+};
@@ -1,7 +1,14 @@
 #pragma once
 
+#ifdef XR_USE_PLATFORM_ANDROID
 #define LOG_INFO(...) __android_log_print(ANDROID_LOG_INFO, "but_telepresence", __VA_ARGS__)
 #define LOG_ERROR(...) __android_log_print(ANDROID_LOG_ERROR, "but_telepresence", __VA_ARGS__)
+#else
+// Desktop tools and benchmarks
+#include <cstdio>
+#define LOG_INFO(...) do { fprintf(stdout, __VA_ARGS__); fputc('\n', stdout); } while(0)
+#define LOG_ERROR(...) do { fprintf(stderr, __VA_ARGS__); fputc('\n', stderr); } while(0)
+#endif
 
 //NOOP
 //#define LOG_INFO(...)  do {} while(0)
@@ -0,0 +1,39 @@
+//
+// MediaPacketFilter - Tells the packets of a camera's media stream from the other RTP traffic on its port
+//
+#pragma once
+
+#include <cstdint>
+
+/**
+ * MediaPacketFilter - Which packets on a camera's port belong to its media stream
+ *
+ * The sender's RTX stream is SSRC-multiplexed onto the media port: retransmissions carry their own
+ * payload type, SSRC and sequence numbers, and the RTP timestamp and send time of the packet they
+ * repair. Fed to the BandwidthEstimator they count as received media, hiding real loss, and once their
+ * sequence numbers trail the media's by half the number space they jump it ahead (phantom loss of
+ * nearly all packets). Their old RTP timestamps widen the JitterController's transit spread by the
+ * repair's round trip. Only packets of the media payload type, or RED wrapping it, pass.
+ *
+ * The media SSRC is taken from the first such packet. A packet of another SSRC only takes over once
+ * the current one has been silent for SSRC_TIMEOUT_US, when the sender was restarted. Not thread-safe,
+ * one per stream on its streaming thread.
+ */
+class MediaPacketFilter {
+public:
+    // `redPayloadType` -1 when the stream carries no FEC
+    MediaPacketFilter(int mediaPayloadType, int redPayloadType);
+
+    bool accept(uint64_t arrivalUs, int payloadType, uint32_t ssrc);
+
+    [[nodiscard]] uint64_t rejected() const { return rejected_; }
+
+    static constexpr uint64_t SSRC_TIMEOUT_US = 1000000;
+
+private:
+    int mediaPayloadType_, redPayloadType_;
+    bool hasSsrc_ = false;
+    uint32_t ssrc_ = 0;
+    uint64_t lastMediaUs_ = 0;
+    uint64_t rejected_ = 0;
+};
@@ -5,6 +5,10 @@
 #include <string>
 #include <cstdint>
 #include <tuple>
+#include <atomic>
+#include <memory>
+#include <optional>
+#include <thread>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/steady_timer.hpp>
 
@@ -22,6 +26,9 @@ public:
 
     [[nodiscard]] uint64_t GetCurrentTimeUs() const;
 
+    // Round trip to the NTP server (the Jetson) of the best sample of the last sync, 0 before the first
+    [[nodiscard]] uint64_t GetRttUs() const { return rttUs_.load(); }
+
 private:
     void SyncWithServer(boost::asio::io_context& io);
 
@@ -33,6 +40,8 @@ private:
 
     int64_t smoothedOffsetUs_ = 0;
 
+    std::atomic<uint64_t> rttUs_{0};
+
     bool hasInitialOffset_ = false;
     uint64_t lastSyncedTimestampLocal_ = 0;
 
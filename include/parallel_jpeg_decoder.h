@@ -0,0 +1,82 @@
+//
+// ParallelJpegDecoder - Restart-interval sliced JPEG decoding on a worker pool
+//
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include "BS_thread_pool.hpp"
+#include "frame_mailbox.h"
+
+/**
+ * ParallelJpegDecoder - Decodes one JPEG frame with several threads
+ *
+ * Baseline JPEGs encoded with a restart interval (DRI) can be cut at every restart marker that falls
+ * on the start of an MCU row. Each slice is turned into a stand-alone JPEG - the original headers with
+ * the image height reduced to the slice, its entropy-coded intervals with the restart markers
+ * renumbered from RST0 - and decoded by libjpeg(-turbo) straight into its rows of the destination
+ * frame. The calling thread decodes the first slice itself, the others run on the pool.
+ *
+ * Output is either RGB (libjpeg-turbo's SIMD colour conversion) or, when the chroma subsampling allows,
+ * the raw planes packed as I420 / Y42B / Y444 for the GPU colour conversion. Frames without usable
+ * restart markers are decoded whole on the calling thread.
+ *
+ * One decoder per stream, decode() is not reentrant. The pool can be shared between decoders.
+ */
+class ParallelJpegDecoder {
+public:
+    explicit ParallelJpegDecoder(BS::thread_pool<BS::tp::none> &pool);
+
+    ParallelJpegDecoder(const ParallelJpegDecoder &) = delete;
+    ParallelJpegDecoder &operator=(const ParallelJpegDecoder &) = delete;
+
+    // Decodes into a packed width x height frame (larger images are cropped), `capacity` must fit the
+    // RGB frame. Tries to produce `layout` and reports the layout actually written, which falls back to
+    // RGB for subsamplings that have no planar equivalent. Returns false on corrupt data.
+    bool decode(const uint8_t *jpeg, size_t size, uint8_t *dst, size_t capacity, int width, int height,
+                PixelLayout &layout);
+
+    // Layout the owner of the decoder asks for, decode() itself takes it as an argument
+    void setPreferredLayout(PixelLayout layout) { preferredLayout_ = layout; }
+
+    [[nodiscard]] PixelLayout preferredLayout() const { return preferredLayout_; }
+
+    // Upper bound of slices per frame, defaults to the pool size
+    void setMaxSlices(size_t slices) { maxSlices_ = std::max<size_t>(1, slices); }
+
+    [[nodiscard]] uint64_t slicedFrames() const { return slicedFrames_.load(std::memory_order_relaxed); }
+    [[nodiscard]] uint64_t wholeFrames() const { return wholeFrames_.load(std::memory_order_relaxed); }
+    [[nodiscard]] size_t lastSliceCount() const { return lastSliceCount_.load(std::memory_order_relaxed); }
+
+private:
+    // Marker positions of a baseline JPEG, offsets into the original data
+    struct ScanLayout {
+        int width = 0, height = 0;
+        int mcuWidth = 0, mcuHeight = 0;
+        int restartInterval = 0;
+        size_t sofHeightOffset = 0;
+        size_t scanStart = 0, scanEnd = 0;
+        std::vector<size_t> restarts;
+    };
+
+    struct Slice {
+        int firstRow = 0; // In pixels of the full image
+        std::vector<uint8_t> jpeg;
+    };
+
+    static bool parse(const uint8_t *jpeg, size_t size, ScanLayout &scan);
+
+    // Splits at row-aligned restart markers, returns false if the frame cannot be split
+    bool buildSlices(const uint8_t *jpeg, const ScanLayout &scan, size_t count);
+
+    BS::thread_pool<BS::tp::none> &pool_;
+    size_t maxSlices_;
+    PixelLayout preferredLayout_{PixelLayout::RGB};
+    std::vector<Slice> slices_;
+
+    std::atomic<uint64_t> slicedFrames_{0};
+    std::atomic<uint64_t> wholeFrames_{0};
+    std::atomic<size_t> lastSliceCount_{0};
+};
@@ -0,0 +1,48 @@
+//
+// ParameterSetCache - The last H.264 / H.265 parameter sets of every stream, kept across pipeline restarts
+//
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "common.h"
+
+/**
+ * ParameterSetCache - SPS/PPS (and the H.265 VPS) a fresh decoder can start from before the sender repeats them
+ *
+ * A decoder can do nothing with an IDR frame until it has the parameter sets. Senders that only send
+ * them at the start of the stream, or with every IDR and not in between, leave a receiver that joins
+ * (or restarts) mid-stream waiting for the next one. GstreamerPlayer stores every Annex B access unit
+ * that passes the parser's input, and prepends the cached sets to the first access unit of a new
+ * pipeline when that unit has none of its own.
+ *
+ * Streams are keyed by camera, codec and resolution, sets of another encoder configuration are never
+ * handed out. Only the last NAL unit of each parameter set type is kept, the robot's encoders use a
+ * single SPS and PPS. Thread-safe, shared by all pipelines and outliving them.
+ */
+class ParameterSetCache {
+public:
+    static ParameterSetCache &shared();
+
+    static std::string key(const char *camera, const StreamingConfig &config);
+
+    // Caches the parameter sets in an Annex B access unit. True when the unit carries an SPS itself
+    bool store(const std::string &stream, Codec codec, const uint8_t *data, size_t size);
+
+    // The cached sets of `stream` as Annex B, in decoding order (VPS, SPS, PPS). Empty until all the
+    // codec needs were seen
+    [[nodiscard]] std::vector<uint8_t> annexB(const std::string &stream) const;
+
+private:
+    struct Sets {
+        Codec codec = H264;
+        std::map<int, std::vector<uint8_t>> units; // NAL unit type -> the unit without its start code
+    };
+
+    mutable std::mutex mutex_;
+    std::map<std::string, Sets> streams_;
+};
@@ -0,0 +1,133 @@
+//
+// PboUploadRing - Asynchronous texture upload for the CPU (JPEG) video path
+//
+#pragma once
+
+#include <GLES3/gl3.h>
+#include <memory>
+#include <vector>
+#include "frame_mailbox.h"
+
+/**
+ * PboUploadRing - Immutable texture fed from a ring of persistently mapped pixel-unpack buffers
+ *
+ * The ring owns the FrameMailbox of one camera. Its slots live directly in a persistently mapped
+ * GL_PIXEL_UNPACK_BUFFER (GL_EXT_buffer_storage), so the appsink callback copies the decoded frame
+ * straight into memory the GPU can DMA from and the render thread only issues glTexSubImage2D with
+ * a buffer offset, which returns without waiting for the copy.
+ *
+ * Ring-depth policy: every upload is followed by a fence. A slot the renderer moved away from is
+ * handed back to the producer only once its fence has signalled, so a slow GPU makes the producer
+ * run out of slots instead of overwriting memory that is still being read. When that happens for
+ * more than 1 % of the frames the ring is created one slot deeper on the next reconfiguration
+ * (up to MAX_DEPTH).
+ *
+ * Without GL_EXT_buffer_storage the ring falls back to CPU mailbox slots, from the FrameBufferPool so
+ * a reconfiguration reuses them, and client-memory uploads into the same immutable texture.
+ *
+ * Frames in a planar YUV layout are uploaded into three single-channel textures instead and are
+ * converted to RGB by the fragment shader. Textures for a layout are created with the first frame
+ * that uses it.
+ *
+ * Which frame is shown is chosen once per display frame with selectLatest() or select(frameId) - the
+ * latter lets the StereoSynchronizer present matching frames of both cameras - and draws only upload it.
+ *
+ * The texture doubles as a single-entry cache keyed by the RTP frame id (or the mailbox sequence for
+ * untagged frames): a frame is uploaded once, and every other draw of it - the second eye in mono
+ * mode, display refreshes without a new camera frame - reuses the resident texture.
+ */
+class PboUploadRing {
+public:
+    PboUploadRing(int width, int height);
+
+    ~PboUploadRing();
+
+    PboUploadRing(const PboUploadRing &) = delete;
+    PboUploadRing &operator=(const PboUploadRing &) = delete;
+
+    [[nodiscard]] FrameMailbox *mailbox() const { return mailbox_.get(); }
+
+    // Render thread, once per display frame: moves to the newest frame
+    void selectLatest();
+
+    // Render thread, once per display frame: moves to the frame with this RTP frame id, false if the
+    // mailbox no longer (or not yet) holds it
+    bool select(uint64_t frameId);
+
+    // Render thread: uploads the selected frame unless it is already resident and returns the texture
+    // to sample (0 until the first frame has arrived)
+    GLuint update();
+
+    [[nodiscard]] GLuint texture() const { return texture_; }
+
+    // RTP frame id of the selected frame, 0 if untagged or nothing selected yet
+    [[nodiscard]] uint64_t frameId() const {
+        const FrameMailbox::Slot *slot = mailbox_->front();
+        return slot ? slot->frameId : 0;
+    }
+
+    // Packed RoiRect of the selected frame, 0 without one
+    [[nodiscard]] uint64_t roi() const {
+        const FrameMailbox::Slot *slot = mailbox_->front();
+        return slot ? slot->roi : 0;
+    }
+
+    // Layout of the resident frame - for planar layouts update() returns the luma texture
+    [[nodiscard]] bool isPlanar() const { return layout_ != PixelLayout::RGB; }
+
+    [[nodiscard]] GLuint planeTexture(int plane) const { return planeTextures_[plane]; }
+
+    [[nodiscard]] bool isLimitedRange() const { return limitedRange_; }
+
+    [[nodiscard]] bool isPersistent() const { return mapped_ != nullptr; }
+
+    [[nodiscard]] size_t depth() const { return mailbox_->slotCount(); }
+
+    // CPU time the render thread spent issuing the last upload
+    [[nodiscard]] uint64_t lastUploadUs() const { return lastUploadUs_; }
+
+    [[nodiscard]] uint64_t uploads() const { return uploads_; }
+
+    // Draws that found their frame already resident and did not upload
+    [[nodiscard]] uint64_t uploadsSkipped() const { return uploadsSkipped_; }
+
+    static constexpr size_t MIN_DEPTH = 4;
+    static constexpr size_t MAX_DEPTH = 6;
+
+private:
+    void retireSignaledSlots();
+
+    void retire(FrameMailbox::Slot *previous);
+
+    void upload(const FrameMailbox::Slot *slot);
+
+    void createTextures(PixelLayout layout);
+
+    void deleteTextures();
+
+    [[nodiscard]] bool isResident(const FrameMailbox::Slot *slot) const;
+
+    [[nodiscard]] size_t slotIndex(const FrameMailbox::Slot *slot) const;
+
+    int width_, height_;
+    size_t frameSize_, stride_{0};
+
+    GLuint texture_{0};
+    GLuint planeTextures_[3]{};
+    PixelLayout layout_{PixelLayout::RGB};
+    bool hasTextures_{false};
+    bool limitedRange_{false};
+
+    GLuint pbo_{0};
+    uint8_t *mapped_{nullptr};
+
+    std::unique_ptr<FrameMailbox> mailbox_;
+    std::vector<GLsync> fences_;
+    std::vector<FrameMailbox::Slot *> retiring_;
+    uint64_t uploadedSequence_{0};
+    uint64_t uploadedFrameId_{0};
+
+    uint64_t lastUploadUs_{0};
+    uint64_t uploads_{0};
+    uint64_t uploadsSkipped_{0};
+};
@@ -0,0 +1,119 @@
+//
+// PipelineBuilder - Assembles the RTP receive pipeline description for gst_parse_launch
+//
+#pragma once
+
+#include <string>
+#include "common.h"
+
+// Where decoded (or undecoded) frames leave the pipeline
+enum class PipelineSink {
+    GL_MEMORY,  // glsinkbin "glsink", hardware decoder output stays on the GPU
+    CPU_RGB,    // appsink "appsink", packed RGB in system memory
+    CPU_PLANAR, // appsink "appsink", the decoder's I420 / Y42B / Y444 planes
+    ENCODED,    // appsink "appsink", undecoded access units (JPEG decoded by ParallelJpegDecoder)
+    FAKE,       // fakesink "sink" with handoff signals, for benchmarks
+};
+
+/**
+ * PipelineBuilder - Receive chain of one camera, built from the streaming configuration
+ *
+ *   udpsrc ! capsfilter ! rtpjitterbuffer ! depayloader ! parser ! decoder ! sink
+ *
+ * with the named elements GstreamerPlayer configures (udpsrc, rtp_capsfilter, rtpjb, parse, dec, glsink / appsink)
+ * and the identity probes its latency statistics hang off (udpsrc_ident, rtpjb_ident, rtpdepay_ident,
+ * dec_ident, queue_ident).
+ *
+ * With ULPFEC the sender wraps media and FEC packets in RED (RFC 2198), the receiver unwraps them,
+ * keeps the last second of packets in "rtpstorage" and lets "fecdec" rebuild the packets the jitter
+ * buffer reports lost:
+ *
+ *   udpsrc ! capsfilter ! rtpreddec ! rtpstorage ! rtpjitterbuffer ! rtpulpfecdec ! depayloader ! ...
+ *
+ * The storage has to be handed to the FEC decoder (its "storage" property) before the pipeline starts.
+ *
+ * With retransmission the jitter buffer asks upstream for missing packets and "rtxreceive"
+ * (rtprtxreceive) turns the sender's RTX packets back into the original ones. Sending the NACKs is up
+ * to a pad probe on rtxreceive's src pad, there is no RTCP session in the pipeline.
+ *
+ * The decoder is any element factory, so the same pipeline can be built on Linux with software
+ * decoders, and the source can be replaced by a local encoder for benchmarks, or by the appsrc
+ * "replaysrc" an RtpReplaySource feeds a recorded capture into.
+ */
+class PipelineBuilder {
+public:
+    explicit PipelineBuilder(Codec codec);
+
+    // Takes codec, resolution, framerate and jitter buffer latency from the streaming configuration
+    static PipelineBuilder fromConfig(const StreamingConfig &config);
+
+    PipelineBuilder &resolution(int width, int height);
+
+    PipelineBuilder &framerate(int fps);
+
+    PipelineBuilder &jitterLatency(int ms);
+
+    PipelineBuilder &fec(FecScheme scheme);
+
+    PipelineBuilder &retransmission(bool enabled);
+
+    // Decoder element factory, empty selects defaultDecoder()
+    PipelineBuilder &decoder(const std::string &factory);
+
+    PipelineBuilder &sink(PipelineSink sink);
+
+    // Replaces "udpsrc name=udpsrc", must produce RTP packets of the configured codec
+    PipelineBuilder &source(const std::string &description);
+
+    // Sources the stream from the appsrc "replaysrc" instead, for RtpReplaySource
+    PipelineBuilder &replay();
+
+    [[nodiscard]] std::string describe() const;
+
+    [[nodiscard]] Codec codec() const { return codec_; }
+
+    [[nodiscard]] PipelineSink sinkType() const { return sink_; }
+
+    [[nodiscard]] FecScheme fecScheme() const { return fec_; }
+
+    [[nodiscard]] bool retransmission() const { return retransmission_; }
+
+    // Decoder factory actually used
+    [[nodiscard]] std::string decoderFactory() const;
+
+    // MediaCodec on Android, a software decoder elsewhere
+    static std::string defaultDecoder(Codec codec);
+
+    // Decoders that output GLMemory (and need the GL_MEMORY sink)
+    static bool isHardwareDecoder(const std::string &factory);
+
+    static int payloadType(Codec codec);
+
+    // Payload types of the RED wrapper and the ULPFEC packets inside it, negotiated with the sender
+    static constexpr int RED_PAYLOAD_TYPE = 122;
+    static constexpr int FEC_PAYLOAD_TYPE = 123;
+    // RTX stream of the sender, SSRC-multiplexed with the media stream
+    static constexpr int RTX_PAYLOAD_TYPE = 97;
+
+    static std::string depayloader(Codec codec);
+
+    // Empty for codecs whose depayloader already outputs whole frames
+    static std::string parser(Codec codec);
+
+    // Caps of the RTP packets the source produces
+    [[nodiscard]] std::string rtpCaps() const;
+
+    // Caps of the encoded stream between parser and decoder
+    [[nodiscard]] std::string encodedCaps() const;
+
+private:
+    Codec codec_;
+    int width_ = 1920, height_ = 1080;
+    int fps_ = 60;
+    int jitterLatencyMs_ = 50;
+    FecScheme fec_ = NO_FEC;
+    bool retransmission_ = false;
+    std::string decoder_;
+    PipelineSink sink_ = PipelineSink::GL_MEMORY;
+    std::string source_ = "udpsrc name=udpsrc";
+};
@@ -9,6 +9,7 @@
 #include "ntp_timer.h"
 #include "state_storage.h"
 #include "ros_network_gateway_client.h"
+#include "stereo_synchronizer.h"
 
 #define HANDL_IN    "/user/hand/left/input"
 #define HANDR_IN    "/user/hand/right/input"
@@ -38,8 +39,44 @@ private:
 
     void InitializeStreaming();
 
+    // Ranks the decoders of every codec not ranked yet on threadPool_, the results are stored by UpdateFrame
+    void ProbeDecoders();
+
+    // Decoders of the configured codec, best first - empty until the background probe has ranked them
+    const std::vector<std::string> &RankedDecoders();
+
     void HandleControllers();
 
+    // Applies the StreamingConfig edited in the settings GUI in the least disruptive way StreamingConfigDiff
+    // allows: the sender only, the running pipelines in place, or new pipelines
+    void ApplyStreamingConfig();
+
+    // REBUILD: creates the pipelines for appState_->streamingConfig next to the running ones, with their
+    // own frame storage (the standby camera pair). False when they cannot be built
+    bool StartStandbyPipelines();
+
+    // Render thread, every display frame: presents the standby pair once its pipelines have decoded a
+    // frame and retires the replaced pipelines in the background. Without a frame after STANDBY_TIMEOUT_US
+    // the robot is moved back to the running pipelines and the standby ones are dropped
+    void UpdateStandbyPipelines();
+
+    // Drops the standby pipelines, their config never got to the view: the edited config returns to the
+    // ports of the running pipelines. The standby frame storage goes with the player, or right away without one
+    void AbortStandbyPipelines();
+
+    // Shuts `player` down on threadPool_, its frame storage is released once retired_ is set
+    void RetirePlayer(std::unique_ptr<GstreamerPlayer> player);
+
+    // Render thread, every display frame: the longest wait for a new camera frame in the window after the
+    // last Apply, its downtime
+    void TrackReconfiguration();
+
+    // Writes both cameras' trace records as Chrome trace JSON into the app's internal storage
+    void ExportFrameTrace();
+
+    // Starts or stops recording both cameras' RTP packets into the app's internal storage
+    void ToggleRtpCapture();
+
     XrInstance openxr_instance_ = XR_NULL_HANDLE;
     XrSystemId openxr_system_id_ = XR_NULL_SYSTEM_ID;
     XrSession openxr_session_ = XR_NULL_HANDLE;
@@ -55,10 +92,17 @@ private:
     bool mono_ = false;
     bool renderGui_ = true;
 
-    BS::thread_pool<BS::tp::none> gstreamerThreadPool_{1};
+    BS::thread_pool<BS::tp::none> gstreamerThreadPool_{2}; // Main loops of the running and the standby pipelines
     BS::thread_pool<BS::tp::none> threadPool_{3};
+    std::mutex probedDecodersMutex_;
+    std::vector<std::pair<Codec, std::vector<std::string>>> probedDecoders_; // Not yet in appState_->decoderRanking
 
     std::unique_ptr<GstreamerPlayer> gstreamerPlayer_;
+    std::unique_ptr<GstreamerPlayer> standbyPlayer_; // Built for the applied config, not presented yet
+    std::unique_ptr<GstreamerPlayer> retiringPlayer_; // Replaced, shutting down in the background
+    std::atomic<bool> retired_{false};
+    uint64_t standbyStartUs_ = 0;
+    static constexpr uint64_t STANDBY_TIMEOUT_US = 5000000;
     std::unique_ptr<RestClient> restClient_;
     std::unique_ptr<NtpTimer> ntpTimer_;
     std::unique_ptr<RosNetworkGatewayClient> rosNetworkGatewayClient_;
@@ -67,7 +111,17 @@ private:
 
     std::unique_ptr<StateStorage> stateStorage_;
 
+    StereoSynchronizer stereoSynchronizer_;
+
     std::chrono::time_point<std::chrono::high_resolution_clock> prevFrameStart_, frameStart_;
 
     std::shared_ptr<AppState> appState_{};
+
+    std::string traceDirectory_; // Frame traces and RTP captures
+
+    StreamingConfig appliedStreamingConfig_; // What the pipelines and the sender run with
+    StreamingConfig replacedStreamingConfig_; // Applied before the standby pipelines, restored if they fail
+    ReconfigurationClass reconfiguring_ = NO_CHANGE; // Until the window after the last Apply is over
+    uint64_t reconfigurationStartUs_ = 0, lastNewFrameUs_ = 0, longestFrameWaitUs_ = 0;
+    static constexpr uint64_t RECONFIGURATION_WINDOW_US = 3000000;
 };
\ No newline at end of file
@@ -17,6 +17,12 @@ void generate_shader();
 
 void init_image_plane(int textureWidth, int textureHeight);
 
+// (Re)creates the per-camera upload rings of the CPU video path, pipelines must be stopped
+void init_video_upload(CamPair *camPair, int width, int height);
+
+// Deletes the upload rings and GL sample rings of a pair no pipeline writes into any more
+void release_video_upload(CamPair *camPair);
+
 void render_scene(const XrCompositionLayerProjectionView &layerView, render_target_t &rtarget,
                   const Quad &quad, const std::shared_ptr<AppState> &appState,
                   const CameraFrame *image, bool drawSettingsGui, bool drawTeleoperationGui);
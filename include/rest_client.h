@@ -19,6 +19,10 @@ public:
 
     int UpdateStreamingConfig(const StreamingConfig& config);
 
+    // Asks the sender's encoders for an IDR frame (with its parameter sets) right away, instead of at
+    // the end of the current GOP
+    int RequestKeyframe();
+
 private:
 
     StreamingConfig& config_;
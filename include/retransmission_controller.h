@@ -0,0 +1,114 @@
+//
+// RetransmissionController - Requests lost packets again when the repair can still make it in time
+//
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <netinet/in.h>
+
+/**
+ * RetransmissionController - Selective NACK/RTX for one stream
+ *
+ * The jitter buffer asks for every packet it misses (GstRTPRetransmissionRequest). A request only turns
+ * into an RTCP generic NACK (RFC 4585) to the sender if the retransmitted packet, arriving one round
+ * trip from now, still beats the playout deadline of its frame: the arrival of the frame's first
+ * packet plus the jitter buffer latency. Arrival times and "now" come from the same NTP-synced clock.
+ *
+ * Retransmission as a whole is only active while the round trip to the sender is a small share of the
+ * frame interval, e.g. on wired Ethernet; on Wi-Fi the repairs would mostly come too late and the
+ * NACKs only cost uplink airtime.
+ *
+ * Repaired packets (restored from the RTX stream by rtprtxreceive) count towards the success rate and
+ * the extra time their frames waited after the last original packet arrived.
+ */
+class RetransmissionController {
+public:
+    struct Settings {
+        int fps = 60;
+        double maxRttShare = 0.5; // Active while RTT <= this share of the frame interval
+        int marginUs = 2000; // Sender reaction and jitter buffer scheduling on top of the RTT
+    };
+
+    RetransmissionController(std::string name, const Settings &settings, const std::string &senderIp,
+                             int nackPort);
+
+    ~RetransmissionController();
+
+    RetransmissionController(const RetransmissionController &) = delete;
+    RetransmissionController &operator=(const RetransmissionController &) = delete;
+
+    // Streaming thread, for every packet after RTX restoration
+    void onPacket(uint64_t arrivalUs, uint16_t seqnum, uint32_t rtpTimestamp, uint32_t ssrc, bool marker,
+                  bool retransmitted);
+
+    // Jitter buffer timer thread, for every retransmission request. Sends the NACK and returns true if
+    // the packet can still arrive before its frame's deadline
+    bool request(uint64_t nowUs, uint16_t seqnum);
+
+    // Main loop thread, periodically with the current RTT to the sender and jitter buffer latency
+    void update(uint64_t rttUs, int latencyMs);
+
+    // Any thread, when the sender changes its frame rate while the pipelines keep running
+    void setFps(int fps);
+
+    [[nodiscard]] bool active() const;
+
+    // How long after a packet's expected arrival the jitter buffer may still ask for it
+    [[nodiscard]] int deadlineMs() const;
+
+    [[nodiscard]] uint64_t requested() const;
+    [[nodiscard]] uint64_t skipped() const;
+    [[nodiscard]] uint64_t repaired() const;
+
+    // Mean time a frame with repaired packets waited beyond its last original packet
+    [[nodiscard]] double addedLatencyUs() const;
+
+    // Generic NACK for a single sequence number
+    static std::vector<uint8_t> buildNack(uint32_t senderSsrc, uint32_t mediaSsrc, uint16_t seqnum);
+
+    static constexpr int NACK_PORT_OFFSET = 1; // NACKs go to the RTP port + 1, like RTCP
+
+private:
+    struct Packet {
+        uint16_t seqnum = 0;
+        uint32_t rtpTimestamp = 0;
+        bool marker = false;
+        bool valid = false;
+    };
+
+    struct Frame {
+        uint32_t rtpTimestamp;
+        uint64_t firstArrivalUs;
+        uint64_t lastArrivalUs; // Of the original packets
+        uint64_t addedUs;
+    };
+
+    Frame *findFrame(uint32_t rtpTimestamp);
+
+    static constexpr size_t PACKET_HISTORY = 1024;
+    static constexpr size_t FRAME_HISTORY = 64;
+    static constexpr int MAX_GAP = 256; // Packets searched back for the frame of a missing one
+
+    std::string name_;
+    Settings settings_;
+    int socket_ = -1;
+    sockaddr_in destination_{};
+    uint32_t senderSsrc_;
+
+    mutable std::mutex mutex_;
+    std::array<Packet, PACKET_HISTORY> packets_;
+    std::deque<Frame> frames_;
+    uint32_t mediaSsrc_ = 0;
+    uint64_t rttUs_ = 0;
+    int latencyMs_ = 0;
+    bool active_ = false;
+
+    uint64_t requested_ = 0, skipped_ = 0, repaired_ = 0;
+    uint64_t repairedFrames_ = 0;
+    double addedUsTotal_ = 0;
+};
@@ -24,6 +24,16 @@
  * Message Type 0x02 - Robot Control (21 bytes):
  *   [0x02] [linear_x (float)] [linear_y (float)] [angular (float)] [timestamp (uint64)]
  *
+ * Message Type 0x03 - View Region (33 bytes):
+ *   [0x03] [azimuth (float)] [elevation (float)] [fov_left (float)] [fov_right (float)] [fov_up (float)]
+ *   [fov_down (float)] [timestamp (uint64)]
+ *   Head direction plus the field of view the headset shows around it (OpenXR XrFovf angles, radians),
+ *   the sender crops the full-detail part of view region frames to it.
+ *
+ * Message Type 0x04 - Bitrate (13 bytes):
+ *   [0x04] [bitrate (uint32, bit/s per camera)] [timestamp (uint64)]
+ *   Target of the headset's bandwidth estimate, the sender retunes its encoders to it without restarting.
+ *
  * This simple protocol allows the receiving server to implement its own
  * robot-specific control logic without coupling the VR headset to specific hardware.
  */
@@ -40,6 +50,12 @@ public:
     // Send robot control commands (for mobile base control)
     void sendRobotControl(float linearX, float linearY, float angular, BS::thread_pool<BS::tp::none> &threadPool);
 
+    // Send where the user looks for view region streaming
+    void sendViewRegion(XrQuaternionf quatPose, XrFovf fov, BS::thread_pool<BS::tp::none> &threadPool);
+
+    // Send the encoder bitrate the bandwidth estimate allows
+    void sendBitrate(int bitrate, BS::thread_pool<BS::tp::none> &threadPool);
+
 private:
     struct AzimuthElevation {
         float azimuth;    // radians, -π to π
@@ -58,6 +74,8 @@ private:
 
     void sendHeadPosePacket(float azimuth, float elevation, float speed, uint64_t timestamp);
     void sendRobotControlPacket(float linearX, float linearY, float angular, uint64_t timestamp);
+    void sendViewRegionPacket(float azimuth, float elevation, const XrFovf &fov, uint64_t timestamp);
+    void sendBitratePacket(uint32_t bitrate, uint64_t timestamp);
 
     int socket_{-1};
     struct sockaddr_in destAddr_{};
@@ -67,4 +85,6 @@ private:
     // Message types
     static constexpr uint8_t MSG_HEAD_POSE = 0x01;
     static constexpr uint8_t MSG_ROBOT_CONTROL = 0x02;
+    static constexpr uint8_t MSG_VIEW_REGION = 0x03;
+    static constexpr uint8_t MSG_BITRATE = 0x04;
 };
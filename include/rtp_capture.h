@@ -0,0 +1,89 @@
+//
+// RtpCapture - Raw RTP packets of one stream with their arrival times, written to and read from a file
+//
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "common.h"
+
+// Stream a capture was taken from, enough to build its receive pipeline again
+struct RtpCaptureInfo {
+    Codec codec = Codec::H264;
+    int width = 1920, height = 1080;
+    int fps = 60;
+    FecScheme fecScheme = NO_FEC;
+    bool retransmission = false;
+
+    static RtpCaptureInfo fromConfig(const StreamingConfig &config);
+};
+
+/**
+ * RtpCaptureWriter - Appends packets as they arrive at udpsrc
+ *
+ * File layout, all integers little endian:
+ *
+ *   header  "BTRTPCAP", u16 version, u8 codec, u8 fec scheme, u8 retransmission, u8 reserved,
+ *           u16 width, u16 height, u16 fps
+ *   packet  u32 microseconds since the previous packet (the first one 0), u16 size, size bytes of RTP
+ *
+ * Writes are buffered, the file is complete once the writer is destroyed. One thread writes at a time.
+ */
+class RtpCaptureWriter {
+public:
+    // Throws std::runtime_error if the file cannot be created
+    RtpCaptureWriter(const std::string &path, const RtpCaptureInfo &info);
+
+    ~RtpCaptureWriter();
+
+    RtpCaptureWriter(const RtpCaptureWriter &) = delete;
+    RtpCaptureWriter &operator=(const RtpCaptureWriter &) = delete;
+
+    // Arrival times on any monotonic microsecond clock
+    void write(uint64_t arrivalUs, const uint8_t *data, size_t size);
+
+    [[nodiscard]] uint64_t packets() const { return packets_; }
+
+    [[nodiscard]] const std::string &path() const { return path_; }
+
+private:
+    std::string path_;
+    FILE *file_;
+    uint64_t lastArrivalUs_ = 0;
+    uint64_t packets_ = 0;
+};
+
+/**
+ * RtpCaptureReader - Reads a capture back packet by packet
+ */
+class RtpCaptureReader {
+public:
+    struct Packet {
+        uint64_t arrivalUs = 0; // Since the first packet
+        std::vector<uint8_t> data;
+    };
+
+    // Throws std::runtime_error if the file cannot be opened or is not a capture
+    explicit RtpCaptureReader(const std::string &path);
+
+    ~RtpCaptureReader();
+
+    RtpCaptureReader(const RtpCaptureReader &) = delete;
+    RtpCaptureReader &operator=(const RtpCaptureReader &) = delete;
+
+    [[nodiscard]] const RtpCaptureInfo &info() const { return info_; }
+
+    // False at the end of the capture, a packet cut off by the end of the file ends it too
+    bool next(Packet &packet);
+
+    // Back to the first packet
+    void rewind();
+
+private:
+    FILE *file_;
+    RtpCaptureInfo info_;
+    long firstPacket_ = 0;
+    uint64_t arrivalUs_ = 0;
+};
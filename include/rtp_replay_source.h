@@ -0,0 +1,61 @@
+//
+// RtpReplaySource - Feeds a recorded RTP capture into a receive pipeline in place of udpsrc
+//
+#pragma once
+
+#include <gst/gst.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include "rtp_capture.h"
+
+/**
+ * RtpReplaySource - Pushes the packets of a capture into the pipeline's "replaysrc" appsrc
+ *
+ * The pipeline comes from PipelineBuilder with replay() set, so everything after the source is the
+ * headset's receive chain. With original pacing every packet goes in at its recorded offset from the
+ * start of the replay, bursts and gaps included; unpaced, packets go in as fast as the pipeline
+ * accepts them. The appsrc timestamps packets when they are pushed, so the jitter buffer sees the same
+ * arrival pattern it would on the network.
+ *
+ * The capture is read on a thread of its own, which ends the stream after the last loop. Every loop
+ * starts the RTP sequence over, which the jitter buffer handles like a sender restart.
+ */
+class RtpReplaySource {
+public:
+    enum class Pacing {
+        ORIGINAL, // Recorded arrival times
+        FAST,     // As fast as the pipeline accepts packets
+    };
+
+    // Throws std::runtime_error if the capture cannot be read or the pipeline has no "replaysrc"
+    RtpReplaySource(GstElement *pipeline, const std::string &capturePath, Pacing pacing, int loops = 1);
+
+    // Stops pushing. Destroy after stopping the pipeline, the thread waits in a full appsrc until then
+    ~RtpReplaySource();
+
+    RtpReplaySource(const RtpReplaySource &) = delete;
+    RtpReplaySource &operator=(const RtpReplaySource &) = delete;
+
+    void start();
+
+    // Packets pushed so far
+    [[nodiscard]] uint64_t packets() const { return packets_.load(std::memory_order_relaxed); }
+
+    [[nodiscard]] bool finished() const { return finished_.load(std::memory_order_acquire); }
+
+    [[nodiscard]] const RtpCaptureInfo &info() const { return reader_.info(); }
+
+private:
+    void run();
+
+    GstElement *appsrc_;
+    RtpCaptureReader reader_;
+    Pacing pacing_;
+    int loops_;
+
+    std::thread thread_;
+    std::atomic<bool> stop_{false};
+    std::atomic<bool> finished_{false};
+    std::atomic<uint64_t> packets_{0};
+};
@@ -0,0 +1,56 @@
+//
+// StereoSynchronizer - Presents left and right camera frames as matched pairs
+//
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include "common.h"
+
+/**
+ * StereoSynchronizer - Chooses once per display frame which camera frames both eyes show
+ *
+ * Frames are matched by the frame id the sender puts into the RTP header extension. The upload rings of
+ * the CPU path and the GL sample rings of the hardware decoder path keep a few replaced frames around,
+ * so the newest frame id present in both mailboxes can be shown even when one camera is already a
+ * frame ahead.
+ *
+ * Policies, when no new pair is available:
+ *  - WAIT_FOR_PAIR keeps showing the last pair until the counterpart arrives or the timeout expires,
+ *    after which the newest frames are shown unpaired (counted as late)
+ *  - LATEST_AVAILABLE shows the newest frames right away (counted as unpaired)
+ *  - INDEPENDENT does not pair at all, each eye shows its camera's newest frame
+ *
+ * Streams without frame ids are always shown independently. The GlSampleRing only holds as many frames
+ * as the decoder can spare, so the hardware path pairs within a shallower history. Render thread only.
+ */
+class StereoSynchronizer {
+public:
+    void setPolicy(StereoSyncPolicy policy, int timeoutMs);
+
+    // Moves the upload rings or GL sample rings, whichever the frames arrive in, to the frames this
+    // display frame presents
+    void select(CamPair &cameras, bool mono, StereoSyncStats &stats);
+
+    // Sender restarts and jumps of more frame ids than this reset the pairing
+    static constexpr uint64_t RESYNC_GAP = 1000;
+
+    // Most frame ids a ring of either path can hold
+    static constexpr size_t MAX_RING_DEPTH = 6;
+
+private:
+    // PboUploadRing or GlSampleRing, both select by frame id on top of a FrameMailbox with history
+    template<typename Ring>
+    void selectPair(Ring *left, Ring *right, bool mono, StereoSyncStats &stats);
+
+    template<typename Ring>
+    void selectLatest(Ring *left, Ring *right);
+
+    StereoSyncPolicy policy_{WAIT_FOR_PAIR};
+    std::chrono::milliseconds timeout_{20};
+
+    const void *left_{nullptr}, *right_{nullptr};
+    uint64_t presentedFrameId_{0};
+    bool waiting_{false};
+    std::chrono::steady_clock::time_point waitingSince_;
+};
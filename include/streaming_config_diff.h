@@ -0,0 +1,44 @@
+//
+// StreamingConfigDiff - Classifies what applying a new StreamingConfig takes
+//
+#pragma once
+
+#include <string>
+#include <vector>
+#include "common.h"
+
+/**
+ * StreamingConfigDiff - The fields two StreamingConfigs differ in, and the least disruptive way to apply them
+ *
+ * Every field has two sides. The sender side says whether the robot's encoders need the new value,
+ * which goes through RestClient::UpdateStreamingConfig. The receiver side says what the headset's
+ * pipelines need:
+ *  - nothing: encoder settings, and settings the program reads as they change (adaptive bitrate)
+ *  - RENEGOTIATE: the running pipelines take it in place (frame rate, jitter buffer, view region flag,
+ *    warm start)
+ *  - REBUILD: the pipeline description, the frame storage or the decoder change (codec, resolution, FEC,
+ *    retransmission, addresses, the JPEG decode settings while streaming JPEG)
+ *
+ * H.265 takes its frame size and rate in a capsfilter of the pipeline description, so a frame rate
+ * change needs a rebuild there. The class of the diff is the most disruptive one of its fields, and
+ * ENCODER_ONLY when only the sender needs the new values.
+ */
+class StreamingConfigDiff {
+public:
+    StreamingConfigDiff(const StreamingConfig &running, const StreamingConfig &next);
+
+    [[nodiscard]] ReconfigurationClass reconfiguration() const { return reconfiguration_; }
+
+    // The robot's encoders need the new config
+    [[nodiscard]] bool sender() const { return sender_; }
+
+    // Names of the fields that differ, comma separated, empty without any
+    [[nodiscard]] std::string describe() const;
+
+private:
+    void compare(bool differs, const char *field, bool sender, ReconfigurationClass receiver);
+
+    std::vector<std::string> fields_;
+    bool sender_ = false;
+    ReconfigurationClass reconfiguration_ = NO_CHANGE;
+};
@@ -1,8 +1,20 @@
 #pragma once
 
+#include <EGL/eglext.h>
+
 int egl_init_with_pbuffer_surface();
 
 EGLDisplay egl_get_display();
 EGLContext egl_get_context();
 EGLConfig  egl_get_config();
-EGLSurface egl_get_surface();
\ No newline at end of file
+EGLSurface egl_get_surface();
+
+// Fence after the GL commands issued so far on the current context, for another context of the share group
+// to wait on. EGL_NO_SYNC_KHR without EGL_KHR_fence_sync
+EGLSyncKHR egl_create_fence();
+
+// Makes the GPU of the current context wait for `fence` before its next commands, without blocking the
+// calling thread (EGL_KHR_wait_sync, a CPU wait without it), then destroys the fence
+void egl_wait_fence(EGLDisplay display, EGLSyncKHR fence);
+
+void egl_destroy_fence(EGLDisplay display, EGLSyncKHR fence);
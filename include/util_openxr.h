@@ -112,6 +112,9 @@ int openxr_poll_events(XrInstance *instance, XrSession *session, bool *exit, boo
 
 int openxr_begin_frame(XrSession *session, XrTime *display_time);
 
+// Runtime clock now, CLOCK_MONOTONIC when the runtime lacks XR_KHR_convert_timespec_time
+XrTime openxr_get_current_time(XrInstance *instance);
+
 int openxr_end_frame(XrSession *session, XrTime *displayTime,
                      std::vector<XrCompositionLayerBaseHeader *> &layers);
 
@@ -6,6 +6,11 @@ struct shader_obj_t {
     GLuint program;
     GLint loc_mvp;
     GLint loc_texture;
+    GLint loc_texture_u;
+    GLint loc_texture_v;
+    GLint loc_limited_range;
+    GLint loc_roi;
+    GLint loc_roi_enabled;
     GLint loc_position;
     GLint loc_tex_coord;
 };
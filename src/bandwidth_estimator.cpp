@@ -0,0 +1,347 @@
+//
+// BandwidthEstimator - Estimates the capacity of the link from the robot and the bitrate the robot should send at
+//
+#include "pch.h"
+#include "log.h"
+#include <algorithm>
+#include <cmath>
+
+#include "bandwidth_estimator.h"
+
+// Trendline filter and overuse detector constants of the GCC reference implementation
+static constexpr double SMOOTHING = 0.9;
+static constexpr double THRESHOLD_GAIN = 4.0;
+static constexpr double MAX_DELTAS = 60;
+static constexpr double THRESHOLD_UP = 0.0087, THRESHOLD_DOWN = 0.039;
+static constexpr double MIN_THRESHOLD = 6, MAX_THRESHOLD = 600;
+static constexpr double OVERUSE_TIME_MS = 10;
+
+static constexpr double DECREASE_FACTOR = 0.85;
+static constexpr double INCREASE_PER_SECOND = 1.08;
+static constexpr double PACKET_BITS = 1200 * 8;
+
+static const char *usage_name(BandwidthEstimator::Usage usage) {
+    switch (usage) {
+        case BandwidthEstimator::Usage::OVERUSE:
+            return "overuse";
+        case BandwidthEstimator::Usage::UNDERUSE:
+            return "underuse";
+        default:
+            return "normal";
+    }
+}
+
+BandwidthEstimator::BandwidthEstimator(const Settings &settings)
+        : settings_(settings) {
+    delayBitrate_ = lossBitrate_ = target_ =
+            std::clamp(settings.startBitrate, settings.minBitrate, settings.maxBitrate);
+}
+
+void BandwidthEstimator::onPacket(int stream, uint64_t arrivalUs, uint64_t sendUs, uint32_t rtpTimestamp,
+                                  uint16_t seqnum, size_t size) {
+    if (stream < 0 || stream >= STREAMS) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    Detector &detector = detectors_[stream];
+
+    // Loss: sequence numbers seen against the range they span
+    if (!detector.hasSeqnum) {
+        detector.hasSeqnum = true;
+        detector.highestSeqnum = detector.firstSeqnum = seqnum + 65536; // Room for reordered predecessors
+    } else {
+        auto delta = static_cast<int16_t>(seqnum - static_cast<uint16_t>(detector.highestSeqnum));
+        if (delta > 0) {
+            detector.highestSeqnum += delta;
+        }
+    }
+    detector.received++;
+
+    // Received bitrate
+    if (!firstArrivalUs_) {
+        firstArrivalUs_ = lossIntervalStartUs_ = lastUpdateUs_ = arrivalUs;
+    }
+    arrivals_.emplace_back(arrivalUs, size);
+    windowBytes_ += size;
+    while (!arrivals_.empty() && arrivals_.front().first + RATE_WINDOW_US < arrivalUs) {
+        windowBytes_ -= arrivals_.front().second;
+        arrivals_.pop_front();
+    }
+
+    // Send time, from the RTP timestamp for streams without the header extension
+    if (!detector.hasRtpTimestamp) {
+        detector.hasRtpTimestamp = true;
+    } else {
+        detector.rtpTicks += static_cast<int32_t>(rtpTimestamp - detector.lastRtpTimestamp);
+    }
+    detector.lastRtpTimestamp = rtpTimestamp;
+    detector.sendTimes = detector.sendTimes || sendUs != 0;
+    if (detector.sendTimes && sendUs == 0) {
+        return; // FEC or RTX packets in between the media packets carrying the send time
+    }
+    uint64_t sentUs = sendUs ? sendUs : static_cast<uint64_t>(detector.rtpTicks * 1000000 / CLOCK_RATE + INT32_MAX);
+
+    // Delay gradient between groups of packets sent together
+    Group &current = detector.current;
+    if (!current.valid) {
+        current = {sentUs, sentUs, arrivalUs, true};
+    } else if (sentUs < current.firstSendUs) {
+        // Reordered packet of an earlier group
+    } else if (sentUs - current.firstSendUs <= BURST_US) {
+        current.lastSendUs = std::max(current.lastSendUs, sentUs);
+        current.lastArrivalUs = arrivalUs;
+    } else {
+        if (detector.previous.valid) {
+            onGroupDelta(detector, static_cast<double>(current.lastSendUs - detector.previous.lastSendUs) / 1000,
+                         (static_cast<double>(current.lastArrivalUs) -
+                          static_cast<double>(detector.previous.lastArrivalUs)) / 1000, current.lastArrivalUs);
+        }
+        detector.previous = current;
+        current = {sentUs, sentUs, arrivalUs, true};
+    }
+
+    if (arrivalUs >= lastUpdateUs_ + UPDATE_INTERVAL_US) {
+        updateRate(arrivalUs);
+    }
+}
+
+void BandwidthEstimator::onGroupDelta(Detector &detector, double sendDeltaMs, double arrivalDeltaMs,
+                                      uint64_t arrivalUs) {
+    // A stream that paused starts over, its old queueing delay says nothing about the link now
+    if (sendDeltaMs > 1000) {
+        detector.samples.clear();
+        detector.accumulatedDelayMs = detector.smoothedDelayMs = 0;
+        detector.deltas = 0;
+    }
+    if (detector.deltas == 0) {
+        detector.firstArrivalUs = arrivalUs;
+    }
+    detector.deltas++;
+
+    detector.accumulatedDelayMs += arrivalDeltaMs - sendDeltaMs;
+    detector.smoothedDelayMs = SMOOTHING * detector.smoothedDelayMs + (1 - SMOOTHING) * detector.accumulatedDelayMs;
+    detector.samples.emplace_back(static_cast<double>(arrivalUs - detector.firstArrivalUs) / 1000,
+                                  detector.smoothedDelayMs);
+    if (detector.samples.size() > TRENDLINE_WINDOW) {
+        detector.samples.pop_front();
+    }
+
+    // Least squares slope of the smoothed delay over arrival time
+    double trend = detector.previousTrend;
+    if (detector.samples.size() == TRENDLINE_WINDOW) {
+        double meanX = 0, meanY = 0;
+        for (const auto &sample: detector.samples) {
+            meanX += sample.first;
+            meanY += sample.second;
+        }
+        meanX /= static_cast<double>(TRENDLINE_WINDOW);
+        meanY /= static_cast<double>(TRENDLINE_WINDOW);
+        double numerator = 0, denominator = 0;
+        for (const auto &sample: detector.samples) {
+            numerator += (sample.first - meanX) * (sample.second - meanY);
+            denominator += (sample.first - meanX) * (sample.first - meanX);
+        }
+        if (denominator > 0) {
+            trend = numerator / denominator;
+        }
+    }
+    detect(detector, trend, sendDeltaMs, arrivalUs);
+}
+
+void BandwidthEstimator::detect(Detector &detector, double trend, double sendDeltaMs, uint64_t arrivalUs) {
+    double modified = std::min(static_cast<double>(detector.deltas), MAX_DELTAS) * trend * THRESHOLD_GAIN;
+
+    if (modified > detector.threshold) {
+        detector.overuseMs = detector.overuseMs < 0 ? sendDeltaMs / 2 : detector.overuseMs + sendDeltaMs;
+        detector.overuseCount++;
+        if (detector.overuseMs > OVERUSE_TIME_MS && detector.overuseCount > 1 && trend >= detector.previousTrend) {
+            detector.overuseMs = 0;
+            detector.overuseCount = 0;
+            detector.usage = Usage::OVERUSE;
+        }
+    } else {
+        detector.overuseMs = -1;
+        detector.overuseCount = 0;
+        detector.usage = modified < -detector.threshold ? Usage::UNDERUSE : Usage::NORMAL;
+    }
+    detector.previousTrend = trend;
+
+    // The threshold follows the trend slowly, quicker down than up, so competing traffic that keeps the
+    // queue filled does not starve the streams. Outliers leave it alone
+    if (!detector.lastThresholdUpdateUs) {
+        detector.lastThresholdUpdateUs = arrivalUs;
+    }
+    if (std::fabs(modified) <= detector.threshold + 15) {
+        double gain = std::fabs(modified) < detector.threshold ? THRESHOLD_DOWN : THRESHOLD_UP;
+        double elapsedMs = std::min(static_cast<double>(arrivalUs - detector.lastThresholdUpdateUs) / 1000, 100.0);
+        detector.threshold = std::clamp(detector.threshold + gain * (std::fabs(modified) - detector.threshold) * elapsedMs,
+                                        MIN_THRESHOLD, MAX_THRESHOLD);
+    }
+    detector.lastThresholdUpdateUs = arrivalUs;
+}
+
+void BandwidthEstimator::updateRate(uint64_t nowUs) {
+    double elapsedS = static_cast<double>(nowUs - lastUpdateUs_) / 1e6;
+    lastUpdateUs_ = nowUs;
+
+    // The target is per camera, like the configured bitrate
+    double spanUs = static_cast<double>(std::clamp(nowUs - firstArrivalUs_, UPDATE_INTERVAL_US, RATE_WINDOW_US));
+    auto streams = std::count_if(detectors_.begin(), detectors_.end(),
+                                 [](const Detector &detector) { return detector.hasSeqnum; });
+    double received = static_cast<double>(windowBytes_) * 8 * 1e6 / spanUs / static_cast<double>(std::max<long>(streams, 1));
+
+    Usage usage = combinedUsage();
+    RateState previous = rateState_;
+    switch (usage) {
+        case Usage::OVERUSE:
+            rateState_ = RateState::DECREASE;
+            break;
+        case Usage::UNDERUSE:
+            rateState_ = RateState::HOLD;
+            break;
+        default:
+            if (rateState_ != RateState::DECREASE) {
+                rateState_ = RateState::INCREASE;
+            }
+            break;
+    }
+
+    if (rateState_ == RateState::INCREASE) {
+        double receivedKbit = received / 1000;
+        double deviationKbit = std::sqrt(varianceMaxKbit_ * std::max(averageMaxKbit_, 1.0));
+        if (averageMaxKbit_ >= 0 && receivedKbit > averageMaxKbit_ + 3 * deviationKbit) {
+            averageMaxKbit_ = -1; // Beyond where the link used to saturate, the capacity changed
+        }
+        if (averageMaxKbit_ >= 0 && std::fabs(receivedKbit - averageMaxKbit_) <= 3 * deviationKbit) {
+            // Near convergence: about a packet per response time
+            double responseS = static_cast<double>(UPDATE_INTERVAL_US + settings_.rttUs) / 1e6;
+            delayBitrate_ += std::max(1000.0, PACKET_BITS / responseS) * elapsedS;
+        } else {
+            delayBitrate_ *= std::pow(INCREASE_PER_SECOND, std::min(elapsedS, 1.0));
+        }
+        // Never far ahead of what actually arrives
+        if (nowUs - firstArrivalUs_ >= RATE_WINDOW_US) {
+            delayBitrate_ = std::min(delayBitrate_, 1.5 * received + 10000);
+        }
+    } else if (rateState_ == RateState::DECREASE) {
+        if (nowUs >= lastDecreaseUs_ + settings_.rttUs + DECREASE_SPACING_US) {
+            delayBitrate_ = std::min(delayBitrate_, DECREASE_FACTOR * received);
+            lastDecreaseUs_ = nowUs;
+
+            double receivedKbit = received / 1000;
+            averageMaxKbit_ = averageMaxKbit_ < 0 ? receivedKbit : 0.95 * averageMaxKbit_ + 0.05 * receivedKbit;
+            double deviation = averageMaxKbit_ - receivedKbit;
+            varianceMaxKbit_ = std::clamp(0.95 * varianceMaxKbit_ + 0.05 * deviation * deviation /
+                                                                    std::max(averageMaxKbit_, 1.0), 0.4, 2.5);
+        }
+        rateState_ = RateState::HOLD;
+    }
+    delayBitrate_ = std::clamp(delayBitrate_, static_cast<double>(settings_.minBitrate),
+                               static_cast<double>(settings_.maxBitrate));
+
+    if (nowUs >= lossIntervalStartUs_ + LOSS_INTERVAL_US) {
+        updateLoss(nowUs);
+    }
+
+    double target = std::min(delayBitrate_, lossBitrate_);
+    if (std::fabs(target - target_) >= FEEDBACK_CHANGE * target_ || rateState_ != previous) {
+        LOG_INFO("BandwidthEstimator: %s, target %.2f Mbit/s (delay %.2f, loss %.2f), received %.2f Mbit/s per camera, lost %.1f %%",
+                 usage_name(usage), target / 1e6, delayBitrate_ / 1e6, lossBitrate_ / 1e6, received / 1e6,
+                 lossRate_ * 100);
+    }
+    target_ = target;
+}
+
+void BandwidthEstimator::updateLoss(uint64_t nowUs) {
+    uint64_t expected = 0, received = 0;
+    for (const Detector &detector: detectors_) {
+        if (detector.hasSeqnum) {
+            expected += detector.highestSeqnum - detector.firstSeqnum + 1;
+            received += detector.received;
+        }
+    }
+    uint64_t intervalExpected = expected - expectedAtInterval_;
+    uint64_t intervalReceived = received - receivedAtInterval_;
+    lossIntervalStartUs_ = nowUs;
+    expectedAtInterval_ = expected;
+    receivedAtInterval_ = received;
+    if (intervalExpected < 20) {
+        return; // Too few packets for a loss rate
+    }
+
+    // Duplicates may outnumber the losses
+    lossRate_ = intervalReceived >= intervalExpected
+                ? 0 : static_cast<double>(intervalExpected - intervalReceived) / static_cast<double>(intervalExpected);
+    if (lossRate_ > 0.1) {
+        lossBitrate_ *= 1 - 0.5 * lossRate_;
+    } else if (lossRate_ < 0.02) {
+        lossBitrate_ *= 1.05;
+    }
+    lossBitrate_ = std::clamp(lossBitrate_, static_cast<double>(settings_.minBitrate),
+                              static_cast<double>(settings_.maxBitrate));
+}
+
+bool BandwidthEstimator::takeFeedback(uint64_t nowUs, int &bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto target = static_cast<int>(std::lround(target_));
+    if (lastFeedbackUs_ && nowUs < lastFeedbackUs_ + FEEDBACK_INTERVAL_US) {
+        return false;
+    }
+    bool changed = std::abs(target - lastFeedbackBitrate_) >= FEEDBACK_CHANGE * lastFeedbackBitrate_;
+    if (lastFeedbackUs_ && !changed && nowUs < lastFeedbackUs_ + KEEPALIVE_US) {
+        return false;
+    }
+    lastFeedbackUs_ = nowUs;
+    lastFeedbackBitrate_ = target;
+    bitrate = target;
+    return true;
+}
+
+void BandwidthEstimator::setRtt(uint64_t rttUs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_.rttUs = rttUs;
+}
+
+void BandwidthEstimator::setMaxBitrate(int bitrate) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_.maxBitrate = bitrate;
+    settings_.minBitrate = std::min(settings_.minBitrate, bitrate);
+    delayBitrate_ = std::min(delayBitrate_, static_cast<double>(bitrate));
+    lossBitrate_ = std::min(lossBitrate_, static_cast<double>(bitrate));
+    target_ = std::min(target_, static_cast<double>(bitrate));
+}
+
+int BandwidthEstimator::targetBitrate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return static_cast<int>(std::lround(target_));
+}
+
+double BandwidthEstimator::receivedBitrate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (arrivals_.empty()) {
+        return 0;
+    }
+    double spanUs = static_cast<double>(std::clamp(arrivals_.back().first - firstArrivalUs_, UPDATE_INTERVAL_US,
+                                                   RATE_WINDOW_US));
+    return static_cast<double>(windowBytes_) * 8 * 1e6 / spanUs;
+}
+
+double BandwidthEstimator::lossRate() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lossRate_;
+}
+
+BandwidthEstimator::Usage BandwidthEstimator::usage() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return combinedUsage();
+}
+
+BandwidthEstimator::Usage BandwidthEstimator::combinedUsage() const {
+    Usage usage = Usage::NORMAL;
+    for (const Detector &detector: detectors_) {
+        if (detector.usage == Usage::OVERUSE || (detector.usage == Usage::UNDERUSE && usage == Usage::NORMAL)) {
+            usage = detector.usage;
+        }
+    }
+    return usage;
+}
@@ -0,0 +1,332 @@
+//
+// DecoderProbe - Finds the lowest-latency video decoder available for a codec
+//
+#include "pch.h"
+#include "log.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <fmt/format.h>
+
+#include "decoder_probe.h"
+#include "pipeline_builder.h"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+    // First one installed encodes the test clip
+    std::vector<std::string> clip_encoders(Codec codec) {
+        switch (codec) {
+            case Codec::JPEG:
+                return {"jpegenc quality=60"};
+            case Codec::VP8:
+                return {"vp8enc deadline=1 keyframe-max-dist=300"};
+            case Codec::VP9:
+                return {"vp9enc deadline=1 keyframe-max-dist=300"};
+            case Codec::H264:
+                return {"x264enc tune=zerolatency speed-preset=ultrafast key-int-max=300", "openh264enc"};
+            case Codec::H265:
+                return {"x265enc tune=zerolatency speed-preset=ultrafast key-int-max=300"};
+            default:
+                return {};
+        }
+    }
+
+    bool factory_exists(const std::string &description) {
+        GstElementFactory *factory = gst_element_factory_find(description.substr(0, description.find(' ')).c_str());
+        if (!factory) {
+            return false;
+        }
+        gst_object_unref(factory);
+        return true;
+    }
+
+    std::string parsed_stream(Codec codec, int width, int height, int fps) {
+        std::string parser = PipelineBuilder::parser(codec);
+        return (parser.empty() ? "" : parser + " ! ") +
+               PipelineBuilder(codec).resolution(width, height).framerate(fps).encodedCaps();
+    }
+
+    // Decoded frames arrive on a streaming thread
+    struct Outputs {
+        std::mutex mutex;
+        std::condition_variable arrived;
+        std::map<GstClockTime, Clock::time_point> pushed; // By PTS
+        Clock::time_point last;
+        double latencyUs = 0;
+        size_t count = 0;
+    };
+
+    void on_decoded(GstElement *, GstBuffer *buffer, Outputs *outputs) {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(outputs->mutex);
+        auto it = outputs->pushed.find(GST_BUFFER_PTS(buffer));
+        if (it != outputs->pushed.end()) {
+            outputs->latencyUs += std::chrono::duration<double, std::micro>(now - it->second).count();
+            outputs->pushed.erase(it);
+        }
+        outputs->count++;
+        outputs->last = now;
+        outputs->arrived.notify_all();
+    }
+}
+
+DecoderProbe::DecoderProbe(int width, int height, int fps, GstContext *glContext)
+        : width_(width), height_(height), fps_(fps), glContext_(glContext) {}
+
+std::vector<std::string> DecoderProbe::candidates(Codec codec) {
+    std::vector<std::string> names;
+    GList *decoders = gst_element_factory_list_get_elements(
+            GST_ELEMENT_FACTORY_TYPE_DECODER | GST_ELEMENT_FACTORY_TYPE_MEDIA_VIDEO |
+            GST_ELEMENT_FACTORY_TYPE_MEDIA_IMAGE, GST_RANK_NONE);
+    GstCaps *caps = gst_caps_from_string(PipelineBuilder(codec).encodedCaps().c_str());
+    GList *accepting = gst_element_factory_list_filter(decoders, caps, GST_PAD_SINK, FALSE);
+    accepting = g_list_sort(accepting, (GCompareFunc) gst_plugin_feature_rank_compare_func);
+
+    for (GList *it = accepting; it; it = it->next) {
+        auto *factory = GST_ELEMENT_FACTORY(it->data);
+        // Auto-plugging bins also claim to decode everything
+        const gchar *klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+        if (klass && strstr(klass, "Bin")) {
+            continue;
+        }
+        names.emplace_back(GST_OBJECT_NAME(factory));
+    }
+
+    gst_plugin_feature_list_free(accepting);
+    gst_plugin_feature_list_free(decoders);
+    gst_caps_unref(caps);
+    return names;
+}
+
+std::string DecoderProbe::fingerprint() {
+    gchar *version = gst_version_string();
+    std::string installed = version;
+    g_free(version);
+    for (int codec = 0; codec < Codec::Count; ++codec) {
+        for (const auto &name: candidates(static_cast<Codec>(codec))) {
+            installed += "," + name;
+        }
+    }
+    return fmt::format("{:016x}", std::hash<std::string>{}(installed));
+}
+
+std::vector<std::string> DecoderProbe::factories(const std::vector<DecoderScore> &scores) {
+    std::vector<std::string> names;
+    for (const auto &score: scores) {
+        if (score.works) {
+            names.push_back(score.factory);
+        }
+    }
+    return names;
+}
+
+std::vector<DecoderScore> DecoderProbe::run(Codec codec) const {
+    std::vector<DecoderScore> scores;
+    GstCaps *caps = nullptr;
+    std::vector<GstBuffer *> clip = encodeClip(codec, &caps);
+
+    for (const auto &factory: candidates(codec)) {
+        if (clip.empty()) {
+            // Nothing to measure with, trust the rank
+            DecoderScore score;
+            score.factory = factory;
+            score.works = true;
+            scores.push_back(score);
+            continue;
+        }
+        scores.push_back(measure(codec, factory, clip, caps));
+        const auto &score = scores.back();
+        LOG_INFO("DecoderProbe: %s %s - %s, %.0f us per frame, %.0f fps", CodecToString(codec).c_str(),
+                 factory.c_str(), score.works ? "works" : "failed", score.latencyUs, score.fps);
+    }
+
+    for (GstBuffer *buffer: clip) {
+        gst_buffer_unref(buffer);
+    }
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+
+    // Decoders that keep up with the stream first, then the lowest latency. Stable, so unmeasured
+    // candidates stay in rank order
+    double required = fps_;
+    std::stable_sort(scores.begin(), scores.end(), [required](const DecoderScore &a, const DecoderScore &b) {
+        if (a.works != b.works) {
+            return a.works;
+        }
+        if (!a.measured || !b.measured) {
+            return false;
+        }
+        bool aKeepsUp = a.fps >= required, bKeepsUp = b.fps >= required;
+        if (aKeepsUp != bKeepsUp) {
+            return aKeepsUp;
+        }
+        return a.latencyUs < b.latencyUs;
+    });
+    return scores;
+}
+
+std::vector<GstBuffer *> DecoderProbe::encodeClip(Codec codec, GstCaps **caps) const {
+    std::vector<GstBuffer *> clip;
+    for (const auto &encoder: clip_encoders(codec)) {
+        if (!factory_exists(encoder)) {
+            continue;
+        }
+
+        std::string description = fmt::format(
+                "videotestsrc pattern=ball num-buffers={} ! video/x-raw,format=I420,width={},height={},"
+                "framerate={}/1 ! {} ! {} ! appsink name=sink sync=false",
+                frames, width_, height_, fps_, encoder, parsed_stream(codec, width_, height_, fps_));
+        GError *error = nullptr;
+        GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+        if (error) {
+            LOG_ERROR("DecoderProbe: cannot encode the test clip with %s: %s", encoder.c_str(), error->message);
+            g_error_free(error);
+            if (pipeline) {
+                gst_object_unref(pipeline);
+            }
+            continue;
+        }
+
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        while (GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink))) {
+            if (!*caps) {
+                *caps = gst_caps_copy(gst_sample_get_caps(sample));
+            }
+            clip.push_back(gst_buffer_ref(gst_sample_get_buffer(sample)));
+            gst_sample_unref(sample);
+        }
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(sink);
+        gst_object_unref(pipeline);
+
+        if (!clip.empty()) {
+            break;
+        }
+    }
+
+    if (clip.empty()) {
+        LOG_INFO("DecoderProbe: no encoder for %s, ranking its decoders without measuring",
+                 CodecToString(codec).c_str());
+    }
+    return clip;
+}
+
+DecoderScore DecoderProbe::measure(Codec codec, const std::string &factory, const std::vector<GstBuffer *> &clip,
+                                   GstCaps *caps) const {
+    DecoderScore score;
+    score.factory = factory;
+    score.measured = true;
+
+    // Hardware decoders hand GL memory to glsinkbin like in the receive pipeline
+    bool glMemory = glContext_ && PipelineBuilder::isHardwareDecoder(factory);
+    std::string description = fmt::format(
+            "appsrc name=src format=time ! {} ! {} name=dec ! identity name=dec_ident ! {}",
+            parsed_stream(codec, width_, height_, fps_), factory,
+            glMemory ? "glsinkbin name=glsink" : "fakesink sync=false");
+
+    for (bool paced: {true, false}) {
+        GError *error = nullptr;
+        GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+        if (error) {
+            LOG_ERROR("DecoderProbe: cannot build a pipeline with %s: %s", factory.c_str(), error->message);
+            g_error_free(error);
+            if (pipeline) {
+                gst_object_unref(pipeline);
+            }
+            return score;
+        }
+
+        GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+        g_object_set(src, "caps", caps, NULL);
+        gst_object_unref(src);
+        if (glMemory) {
+            gst_element_set_context(pipeline, glContext_);
+            GstElement *glsink = gst_bin_get_by_name(GST_BIN(pipeline), "glsink");
+            GstElement *fakesink = gst_element_factory_make("fakesink", nullptr);
+            g_object_set(fakesink, "sync", FALSE, NULL);
+            g_object_set(glsink, "sink", fakesink, NULL);
+            gst_object_unref(glsink);
+        }
+
+        double elapsedUs = 0;
+        double latencyUs = decode(pipeline, clip, paced, elapsedUs);
+        gst_object_unref(pipeline);
+
+        if (latencyUs <= 0) {
+            return score;
+        }
+        if (paced) {
+            score.latencyUs = latencyUs;
+        } else {
+            score.fps = static_cast<double>(clip.size()) * 1e6 / elapsedUs;
+        }
+    }
+
+    score.works = true;
+    return score;
+}
+
+double DecoderProbe::decode(GstElement *pipeline, const std::vector<GstBuffer *> &clip, bool paced,
+                            double &elapsedUs) const {
+    Outputs outputs;
+    GstElement *decoded = gst_bin_get_by_name(GST_BIN(pipeline), "dec_ident");
+    g_signal_connect(decoded, "handoff", G_CALLBACK(on_decoded), &outputs);
+    gst_object_unref(decoded);
+
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstBus *bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    bool failed = false;
+    auto interval = std::chrono::microseconds(1000000 / std::max(1, fps_));
+    auto start = Clock::now();
+    for (size_t i = 0; i < clip.size() && !failed; ++i) {
+        GstBuffer *buffer = gst_buffer_copy(clip[i]);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(i, GST_SECOND, fps_);
+        GST_BUFFER_DTS(buffer) = GST_BUFFER_PTS(buffer);
+        {
+            std::lock_guard<std::mutex> lock(outputs.mutex);
+            outputs.pushed[GST_BUFFER_PTS(buffer)] = Clock::now();
+        }
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+
+        if (paced) {
+            std::this_thread::sleep_until(start + interval * (i + 1));
+        }
+        GstMessage *message = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+        if (message) {
+            failed = true;
+            gst_message_unref(message);
+        }
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+
+    // Decoders may hold a few frames back until the end of the stream
+    std::unique_lock<std::mutex> lock(outputs.mutex);
+    outputs.arrived.wait_for(lock, std::chrono::seconds(2), [&]() { return outputs.count >= clip.size(); });
+    size_t count = outputs.count;
+    double latencyUs = outputs.latencyUs;
+    elapsedUs = std::chrono::duration<double, std::micro>(outputs.last - start).count();
+    size_t measured = clip.size() - outputs.pushed.size();
+    lock.unlock();
+
+    // Stops the streaming threads before `outputs` goes away
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(src);
+
+    // A decoder that lost most of the clip does not work for this stream
+    if (failed || count * 2 < clip.size() || measured == 0) {
+        return 0;
+    }
+    return latencyUs / static_cast<double>(measured);
+}
@@ -0,0 +1,128 @@
+//
+// FrameBufferPool - Page-aligned frame buffers kept across pipeline reconfigurations
+//
+#include "pch.h"
+#include "log.h"
+#include <sys/mman.h>
+#include <new>
+
+#include "frame_buffer_pool.h"
+
+FrameBufferPool::Buffer &FrameBufferPool::Buffer::operator=(Buffer &&other) noexcept {
+    if (this != &other) {
+        reset();
+        pool_ = other.pool_;
+        data_ = other.data_;
+        capacity_ = other.capacity_;
+        other.pool_ = nullptr;
+        other.data_ = nullptr;
+        other.capacity_ = 0;
+    }
+    return *this;
+}
+
+void FrameBufferPool::Buffer::reset() {
+    if (pool_ && data_) {
+        pool_->release(data_, capacity_);
+    }
+    pool_ = nullptr;
+    data_ = nullptr;
+    capacity_ = 0;
+}
+
+FrameBufferPool::FrameBufferPool() : FrameBufferPool(Settings()) {}
+
+FrameBufferPool::FrameBufferPool(const Settings &settings) : settings_(settings) {}
+
+FrameBufferPool::~FrameBufferPool() {
+    trim();
+}
+
+FrameBufferPool &FrameBufferPool::shared() {
+    // Never destroyed, mailboxes may still return their buffers during static destruction
+    static auto *pool = new FrameBufferPool();
+    return *pool;
+}
+
+size_t FrameBufferPool::roundUp(size_t size) const {
+    size_t unit = settings_.hugePages && size >= HUGE_PAGE ? HUGE_PAGE : PAGE;
+    return (std::max<size_t>(size, 1) + unit - 1) / unit * unit;
+}
+
+FrameBufferPool::Buffer FrameBufferPool::acquire(size_t size) {
+    size_t capacity = roundUp(size);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = idle_.find(capacity);
+        if (it != idle_.end() && !it->second.empty()) {
+            uint8_t *data = it->second.back();
+            it->second.pop_back();
+            idleBytes_ -= capacity;
+            hits_.fetch_add(1, std::memory_order_relaxed);
+            return {this, data, capacity};
+        }
+        // Make room for the new size before mapping it
+        trimLocked(settings_.idleLimitBytes > capacity ? settings_.idleLimitBytes - capacity : 0, capacity);
+    }
+
+    void *data = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (data == MAP_FAILED) {
+        LOG_ERROR("FrameBufferPool: cannot map %zu bytes - errno: %d", capacity, errno);
+        throw std::bad_alloc();
+    }
+#ifdef MADV_HUGEPAGE
+    if (capacity % HUGE_PAGE == 0 && settings_.hugePages) {
+        madvise(data, capacity, MADV_HUGEPAGE); // A hint, the kernel may not have transparent huge pages
+    }
+#endif
+    misses_.fetch_add(1, std::memory_order_relaxed);
+    size_t resident = residentBytes_.fetch_add(capacity, std::memory_order_relaxed) + capacity;
+    size_t peak = peakResidentBytes_.load(std::memory_order_relaxed);
+    while (resident > peak && !peakResidentBytes_.compare_exchange_weak(peak, resident, std::memory_order_relaxed)) {
+    }
+    LOG_INFO("FrameBufferPool: mapped %zu KiB, %zu KiB resident", capacity / 1024, resident / 1024);
+    return {this, static_cast<uint8_t *>(data), capacity};
+}
+
+void FrameBufferPool::release(uint8_t *data, size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    idle_[capacity].push_back(data);
+    idleBytes_ += capacity;
+    trimLocked(settings_.idleLimitBytes, capacity);
+}
+
+void FrameBufferPool::trim() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    trimLocked(0, 0);
+}
+
+void FrameBufferPool::trimLocked(size_t limit, size_t keep) {
+    auto unmapFrom = [this, limit](std::vector<uint8_t *> &buffers, size_t capacity) {
+        while (idleBytes_ > limit && !buffers.empty()) {
+            munmap(buffers.back(), capacity);
+            buffers.pop_back();
+            idleBytes_ -= capacity;
+            residentBytes_.fetch_sub(capacity, std::memory_order_relaxed);
+        }
+    };
+    for (auto &[capacity, buffers]: idle_) {
+        if (capacity != keep) {
+            unmapFrom(buffers, capacity);
+        }
+    }
+    auto kept = idle_.find(keep);
+    if (kept != idle_.end()) {
+        unmapFrom(kept->second, keep);
+    }
+}
+
+double FrameBufferPool::hitRate() const {
+    uint64_t hits = hits_.load(std::memory_order_relaxed);
+    uint64_t total = hits + misses_.load(std::memory_order_relaxed);
+    return total > 0 ? static_cast<double>(hits) / static_cast<double>(total) : 0.0;
+}
+
+size_t FrameBufferPool::idleBytes() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return idleBytes_;
+}
@@ -0,0 +1,178 @@
+//
+// FrameMailbox - Lock-free N-slot frame exchange between a GStreamer streaming thread and the render thread
+//
+#include "frame_mailbox.h"
+
+PlaneLayout plane_layout(PixelLayout layout, int width, int height) {
+    PlaneLayout planes;
+    if (layout == PixelLayout::RGB) {
+        planes.width[0] = width;
+        planes.height[0] = height;
+        planes.size = static_cast<size_t>(width) * height * 3;
+        return planes;
+    }
+
+    int chromaWidth = layout == PixelLayout::Y444 ? width : (width + 1) / 2;
+    int chromaHeight = layout == PixelLayout::I420 ? (height + 1) / 2 : height;
+
+    planes.count = 3;
+    planes.width[0] = width;
+    planes.height[0] = height;
+    for (int i = 1; i < 3; ++i) {
+        planes.width[i] = chromaWidth;
+        planes.height[i] = chromaHeight;
+    }
+    for (int i = 0; i < 3; ++i) {
+        planes.offset[i] = planes.size;
+        planes.size += static_cast<size_t>(planes.width[i]) * planes.height[i];
+    }
+    return planes;
+}
+
+FrameMailbox::FrameMailbox(size_t slotSize, size_t slotCount, FrameBufferPool &pool)
+        : slotSize_(slotSize), slots_(slotCount) {
+    // Every slot on its own pages, so the producer and the consumer never share a cache line
+    for (size_t i = 0; i < slotCount; ++i) {
+        buffers_.push_back(pool.acquire(slotSize));
+        slots_[i].data = buffers_.back().data();
+        slots_[i].size = slotSize;
+    }
+}
+
+FrameMailbox::FrameMailbox(const std::vector<uint8_t *> &buffers, size_t slotSize)
+        : slotSize_(slotSize), slots_(buffers.size()) {
+    for (size_t i = 0; i < buffers.size(); ++i) {
+        slots_[i].data = buffers[i];
+        slots_[i].size = slotSize;
+    }
+}
+
+FrameMailbox::Slot *FrameMailbox::beginWrite() {
+    for (auto &slot: slots_) {
+        uint8_t expected = FREE;
+        if (slot.state.compare_exchange_strong(expected, WRITING, std::memory_order_acquire)) {
+            return &slot;
+        }
+    }
+
+    if (retainHistory_) {
+        if (Slot *slot = reclaimOldest()) {
+            return slot;
+        }
+    }
+
+    dropped_.fetch_add(1, std::memory_order_relaxed);
+    starved_.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+}
+
+FrameMailbox::Slot *FrameMailbox::reclaimOldest() {
+    // Never the latest frame, the consumer may be about to pick it up
+    int latest = latest_.load(std::memory_order_acquire);
+    for (;;) {
+        Slot *oldest = nullptr;
+        for (size_t i = 0; i < slots_.size(); ++i) {
+            if (static_cast<int>(i) == latest || slots_[i].state.load(std::memory_order_acquire) != READY) {
+                continue;
+            }
+            if (!oldest || slots_[i].sequence < oldest->sequence) {
+                oldest = &slots_[i];
+            }
+        }
+        if (!oldest) {
+            return nullptr;
+        }
+
+        uint8_t expected = READY;
+        if (oldest->state.compare_exchange_strong(expected, WRITING, std::memory_order_acquire)) {
+            // Replaced before the consumer ever picked it
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return oldest;
+        }
+        // The consumer took it in the meantime, look again
+    }
+}
+
+void FrameMailbox::publish(Slot *slot) {
+    slot->sequence = nextSequence_++;
+    slot->state.store(READY, std::memory_order_release);
+
+    int index = static_cast<int>(slot - slots_.data());
+    int previous = latest_.exchange(index, std::memory_order_acq_rel);
+    produced_.fetch_add(1, std::memory_order_relaxed);
+
+    // The previous frame was never picked up by the renderer - recycle it
+    if (!retainHistory_ && previous != NO_SLOT && previous != index) {
+        uint8_t expected = READY;
+        if (slots_[previous].state.compare_exchange_strong(expected, FREE, std::memory_order_acq_rel)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+}
+
+void FrameMailbox::abortWrite(Slot *slot) {
+    slot->state.store(FREE, std::memory_order_release);
+}
+
+FrameMailbox::Slot *FrameMailbox::acquireLatest() {
+    for (;;) {
+        int index = latest_.load(std::memory_order_acquire);
+        if (index == NO_SLOT || index == front_) {
+            break;
+        }
+
+        uint8_t expected = READY;
+        if (slots_[index].state.compare_exchange_strong(expected, READING, std::memory_order_acq_rel)) {
+            moveFront(index);
+            break;
+        }
+        // The producer replaced that frame in the meantime, retry with the newer one
+    }
+
+    return front();
+}
+
+FrameMailbox::Slot *FrameMailbox::acquire(uint64_t frameId) {
+    if (front_ != NO_SLOT && slots_[front_].frameId == frameId) {
+        return front();
+    }
+
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        auto &slot = slots_[i];
+        // frameId is written before the slot becomes READY and cannot change until it leaves READY
+        if (slot.state.load(std::memory_order_acquire) != READY || slot.frameId != frameId) {
+            continue;
+        }
+        uint8_t expected = READY;
+        if (slot.state.compare_exchange_strong(expected, READING, std::memory_order_acq_rel)) {
+            if (slot.frameId == frameId) {
+                moveFront(static_cast<int>(i));
+                return &slot;
+            }
+            slot.state.store(READY, std::memory_order_release);
+        }
+    }
+    return nullptr;
+}
+
+size_t FrameMailbox::readyFrameIds(uint64_t *frameIds, size_t max) const {
+    size_t count = 0;
+    for (const auto &slot: slots_) {
+        if (count < max && slot.state.load(std::memory_order_acquire) == READY) {
+            frameIds[count++] = slot.frameId;
+        }
+    }
+    return count;
+}
+
+void FrameMailbox::moveFront(int index) {
+    if (front_ != NO_SLOT && !deferredRelease_) {
+        slots_[front_].state.store(FREE, std::memory_order_release);
+    }
+    front_ = index;
+    consumed_.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameMailbox::release(Slot *slot) {
+    slot->state.store(FREE, std::memory_order_release);
+}
@@ -0,0 +1,213 @@
+//
+// FrameTracer - Per-frame timestamps of every pipeline stage, keyed by the RTP frame id
+//
+#include "pch.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cstdio>
+
+#include "frame_tracer.h"
+
+FrameTracer::Record *FrameTracer::claim(uint64_t frameId) {
+    Record &record = records_[frameId % SIZE];
+    uint64_t current = record.frameId.load(std::memory_order_acquire);
+    while (true) {
+        if (current == frameId) {
+            return &record;
+        }
+        if (current == CLAIMING) {
+            // Another stage is clearing the entry for a new frame, a handful of stores
+            current = record.frameId.load(std::memory_order_acquire);
+            continue;
+        }
+        if (current != EMPTY && current > frameId) {
+            return nullptr;
+        }
+        if (record.frameId.compare_exchange_weak(current, CLAIMING, std::memory_order_acq_rel)) {
+            for (auto &stage: record.stages) {
+                stage.store(0, std::memory_order_relaxed);
+            }
+            record.vidConvUs.store(0, std::memory_order_relaxed);
+            record.encUs.store(0, std::memory_order_relaxed);
+            record.rtpPayUs.store(0, std::memory_order_relaxed);
+            record.payloadedUs.store(0, std::memory_order_relaxed);
+            record.packets.store(0, std::memory_order_relaxed);
+            record.sealed.store(false, std::memory_order_relaxed);
+            record.frameId.store(frameId, std::memory_order_release);
+            return &record;
+        }
+    }
+}
+
+void FrameTracer::mark(uint64_t frameId, TraceStage stage, uint64_t timeUs) {
+    Record *record = frameId ? claim(frameId) : nullptr;
+    if (!record) {
+        return;
+    }
+    auto &slot = record->stages[static_cast<size_t>(stage)];
+    if (stage == TraceStage::FIRST_PACKET) {
+        uint64_t unset = 0;
+        slot.compare_exchange_strong(unset, timeUs, std::memory_order_relaxed);
+    } else {
+        slot.store(timeUs, std::memory_order_relaxed);
+    }
+}
+
+void FrameTracer::markPacket(uint64_t frameId, uint64_t timeUs) {
+    Record *record = frameId ? claim(frameId) : nullptr;
+    if (!record) {
+        return;
+    }
+    uint64_t unset = 0;
+    record->stages[static_cast<size_t>(TraceStage::FIRST_PACKET)].compare_exchange_strong(
+            unset, timeUs, std::memory_order_relaxed);
+    record->stages[static_cast<size_t>(TraceStage::LAST_PACKET)].store(timeUs, std::memory_order_relaxed);
+    record->packets.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameTracer::markSender(uint64_t frameId, uint64_t vidConvUs, uint64_t encUs, uint64_t rtpPayUs,
+                             uint64_t payloadedUs) {
+    Record *record = frameId ? claim(frameId) : nullptr;
+    if (!record) {
+        return;
+    }
+    record->vidConvUs.store(vidConvUs, std::memory_order_relaxed);
+    record->encUs.store(encUs, std::memory_order_relaxed);
+    record->rtpPayUs.store(rtpPayUs, std::memory_order_relaxed);
+    record->payloadedUs.store(payloadedUs, std::memory_order_relaxed);
+}
+
+bool FrameTracer::seal(uint64_t frameId, uint64_t presentedUs, uint64_t displayedUs) {
+    Record &record = records_[frameId % SIZE];
+    if (!frameId || record.frameId.load(std::memory_order_acquire) != frameId ||
+        record.sealed.load(std::memory_order_relaxed)) {
+        return false;
+    }
+    record.stages[static_cast<size_t>(TraceStage::PRESENTED)].store(presentedUs, std::memory_order_relaxed);
+    record.stages[static_cast<size_t>(TraceStage::DISPLAYED)].store(displayedUs, std::memory_order_relaxed);
+    if (record.sealed.exchange(true, std::memory_order_release)) {
+        return false;
+    }
+    FrameTrace trace;
+    if (read(record, trace)) {
+        addLatencies(trace, presentedUs);
+    }
+    return true;
+}
+
+bool FrameTracer::read(const Record &record, FrameTrace &trace) {
+    uint64_t frameId = record.frameId.load(std::memory_order_acquire);
+    if (frameId == EMPTY || frameId == CLAIMING || !record.sealed.load(std::memory_order_acquire)) {
+        return false;
+    }
+    trace.frameId = frameId;
+    for (size_t i = 0; i < static_cast<size_t>(TraceStage::COUNT); ++i) {
+        trace.stages[i] = record.stages[i].load(std::memory_order_relaxed);
+    }
+    trace.vidConvUs = record.vidConvUs.load(std::memory_order_relaxed);
+    trace.encUs = record.encUs.load(std::memory_order_relaxed);
+    trace.rtpPayUs = record.rtpPayUs.load(std::memory_order_relaxed);
+    trace.payloadedUs = record.payloadedUs.load(std::memory_order_relaxed);
+    trace.packets = record.packets.load(std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return record.frameId.load(std::memory_order_relaxed) == frameId;
+}
+
+std::vector<FrameTrace> FrameTracer::sealed() const {
+    std::vector<FrameTrace> traces;
+    traces.reserve(SIZE);
+    FrameTrace trace;
+    for (const auto &record: records_) {
+        if (read(record, trace)) {
+            traces.push_back(trace);
+        }
+    }
+    std::sort(traces.begin(), traces.end(), [](const FrameTrace &a, const FrameTrace &b) {
+        return a.frameId < b.frameId;
+    });
+    return traces;
+}
+
+void FrameTracer::addLatencies(const FrameTrace &trace, uint64_t nowUs) {
+    if (trace.payloadedUs) {
+        latencies_.vidConv.record(trace.vidConvUs, nowUs);
+        latencies_.encode.record(trace.encUs, nowUs);
+        latencies_.rtpPay.record(trace.rtpPayUs, nowUs);
+        latencies_.stages[static_cast<size_t>(TraceStage::FIRST_PACKET)].record(trace.networkUs(), nowUs);
+        latencies_.total.record(trace.totalUs(), nowUs);
+    }
+    for (size_t s = 1; s < static_cast<size_t>(TraceStage::COUNT); ++s) {
+        auto from = static_cast<TraceStage>(s - 1), to = static_cast<TraceStage>(s);
+        if (trace.at(from) && trace.at(to) >= trace.at(from)) {
+            latencies_.stages[s].record(trace.span(from, to), nowUs);
+        }
+    }
+}
+
+const char *FrameTracer::stageName(TraceStage stage) {
+    switch (stage) {
+        case TraceStage::FIRST_PACKET:
+            return "first packet";
+        case TraceStage::LAST_PACKET:
+            return "receive";
+        case TraceStage::JITTER_BUFFER:
+            return "jitter buffer";
+        case TraceStage::DEPAYLOADED:
+            return "depayload";
+        case TraceStage::DECODED:
+            return "decode";
+        case TraceStage::QUEUED:
+            return "queue";
+        case TraceStage::READY:
+            return "hand-off";
+        case TraceStage::PRESENTED:
+            return "wait for render";
+        case TraceStage::DISPLAYED:
+            return "scanout";
+        default:
+            return "unknown";
+    }
+}
+
+bool FrameTracer::writeChromeTrace(const std::string &path,
+                                   const std::vector<std::pair<std::string, const FrameTracer *>> &tracers) {
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file) {
+        return false;
+    }
+
+    // One complete ("X") event per stage, named after the work done between the previous stage and it
+    std::string events;
+    auto complete = [&events](const char *name, const char *category, int track, uint64_t startUs,
+                              uint64_t durationUs, uint64_t frameId) {
+        events += fmt::format("{}{{\"name\":\"{}\",\"cat\":\"{}\",\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{},"
+                              "\"dur\":{},\"args\":{{\"frame\":{}}}}}", events.empty() ? "" : ",\n", name,
+                              category, track, startUs, durationUs, frameId);
+    };
+
+    int track = 0;
+    for (const auto &[name, tracer]: tracers) {
+        track++;
+        events += fmt::format("{}{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},"
+                              "\"args\":{{\"name\":\"{}\"}}}}", events.empty() ? "" : ",\n", track, name);
+        for (const FrameTrace &trace: tracer->sealed()) {
+            if (trace.payloadedUs) {
+                uint64_t payStart = trace.payloadedUs - trace.rtpPayUs;
+                uint64_t encStart = payStart - trace.encUs;
+                complete("convert", "sender", track, encStart - trace.vidConvUs, trace.vidConvUs, trace.frameId);
+                complete("encode", "sender", track, encStart, trace.encUs, trace.frameId);
+                complete("payload", "sender", track, payStart, trace.rtpPayUs, trace.frameId);
+                complete("network", "network", track, trace.payloadedUs, trace.networkUs(), trace.frameId);
+            }
+            for (size_t s = 1; s < static_cast<size_t>(TraceStage::COUNT); ++s) {
+                auto from = static_cast<TraceStage>(s - 1), to = static_cast<TraceStage>(s);
+                if (trace.at(from) && trace.at(to) >= trace.at(from)) {
+                    complete(stageName(to), "receiver", track, trace.at(from), trace.span(from, to), trace.frameId);
+                }
+            }
+        }
+    }
+
+    bool written = fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n%s\n]}\n", events.c_str()) > 0;
+    return fclose(file) == 0 && written;
+}
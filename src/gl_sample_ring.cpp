@@ -0,0 +1,135 @@
+//
+// GlSampleRing - Decoded GL frames of the hardware path, held until the GPU has finished sampling them
+//
+#include "pch.h"
+#include "log.h"
+#include "util_egl.h"
+
+#include "gl_sample_ring.h"
+
+GlSampleRing::GlSampleRing(size_t depth) : display_(eglGetCurrentDisplay()), held_(depth) {
+    // The mailbox slots point at the held samples instead of pixel memory
+    std::vector<uint8_t *> slots;
+    for (Held &entry: held_) {
+        slots.push_back(reinterpret_cast<uint8_t *>(&entry));
+    }
+    mailbox_ = std::make_unique<FrameMailbox>(slots, sizeof(Held));
+    mailbox_->setDeferredRelease(true);
+    // Replaced samples stay referenced until their slot is reused either way, keeping them selectable is free
+    mailbox_->setRetainHistory(true);
+}
+
+GlSampleRing::~GlSampleRing() {
+    for (Held &entry: held_) {
+        if (entry.fence) {
+            glDeleteSync(entry.fence);
+        }
+        egl_destroy_fence(display_, entry.ready);
+        if (entry.sample) {
+            gst_sample_unref(entry.sample);
+        }
+    }
+}
+
+bool GlSampleRing::push(GstSample *sample, GLuint texture, GLenum target, uint64_t frameId, uint64_t roi,
+                        EGLSyncKHR ready) {
+    FrameMailbox::Slot *slot = mailbox_->beginWrite();
+    if (!slot) {
+        egl_destroy_fence(display_, ready);
+        return false;
+    }
+
+    // A frame the mailbox replaced before the renderer saw it, the GPU never touched it
+    Held &entry = held(slot);
+    if (entry.sample) {
+        gst_sample_unref(entry.sample);
+    }
+    egl_destroy_fence(display_, entry.ready);
+    entry.sample = sample;
+    entry.texture = texture;
+    entry.target = target;
+    entry.ready = ready;
+    slot->frameId = frameId;
+    slot->roi = roi;
+    mailbox_->publish(slot);
+    return true;
+}
+
+void GlSampleRing::selectLatest() {
+    FrameMailbox::Slot *previous = mailbox_->front();
+    moveFrom(previous, mailbox_->acquireLatest());
+}
+
+bool GlSampleRing::select(uint64_t frameId) {
+    FrameMailbox::Slot *previous = mailbox_->front();
+    bool found = mailbox_->acquire(frameId) != nullptr;
+    moveFrom(previous, mailbox_->front());
+    return found;
+}
+
+void GlSampleRing::moveFrom(FrameMailbox::Slot *previous, FrameMailbox::Slot *selected) {
+    if (selected != previous) {
+        if (previous) {
+            retiring_.push_back(previous);
+        }
+        // The draws that sample the new frame queue up behind the producer's GL work
+        Held &entry = held(selected);
+        egl_wait_fence(display_, entry.ready);
+        entry.ready = EGL_NO_SYNC_KHR;
+    }
+    retireSignaled();
+}
+
+void GlSampleRing::fence() {
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    if (!slot) {
+        return;
+    }
+    // The fence of the last eye pass covers the earlier ones
+    Held &entry = held(slot);
+    if (entry.fence) {
+        glDeleteSync(entry.fence);
+    }
+    entry.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void GlSampleRing::retireSignaled() {
+    for (auto it = retiring_.begin(); it != retiring_.end();) {
+        Held &entry = held(*it);
+        if (entry.fence) {
+            GLenum status = glClientWaitSync(entry.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                ++it;
+                continue;
+            }
+            glDeleteSync(entry.fence);
+            entry.fence = nullptr;
+        }
+        if (entry.sample) {
+            gst_sample_unref(entry.sample);
+            entry.sample = nullptr;
+        }
+        mailbox_->release(*it);
+        it = retiring_.erase(it);
+    }
+}
+
+GLuint GlSampleRing::texture() const {
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    return slot ? held(slot).texture : 0;
+}
+
+GLenum GlSampleRing::target() const {
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    return slot ? held(slot).target : GL_TEXTURE_2D;
+}
+
+uint64_t GlSampleRing::frameId() const {
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    return slot ? slot->frameId : 0;
+}
+
+uint64_t GlSampleRing::roi() const {
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    return slot ? slot->roi : 0;
+}
@@ -1,5 +1,7 @@
 #include "gstreamer_player.h"
 #include "util_egl.h"
+#include "gl_sample_ring.h"
+#include "parameter_set_cache.h"
 #include <ctime>
 #include <gst/rtp/rtp.h>
 #include <fmt/format.h>
@@ -16,8 +18,8 @@
     "framerate = (fraction) [ 0/1, max ], "           \
     "texture-target = (string) { 2D, external-oes } "
 
-GstreamerPlayer::GstreamerPlayer(CamPair *camPair, NtpTimer *ntpTimer) : camPair_(camPair),
-                                                                         ntpTimer_(ntpTimer) {
+GstreamerPlayer::GstreamerPlayer(CamPair *camPair, NtpTimer *ntpTimer, GlContextMode glContextMode)
+        : camPair_(camPair), ntpTimer_(ntpTimer), glContextMode_(glContextMode) {
     guint major, minor, micro, nano;
     gst_version(&major, &minor, &micro, &nano);
     LOG_INFO("Running GStreamer version: %d.%d.%d.%d", major, minor, micro, nano);
@@ -32,14 +34,38 @@ GstreamerPlayer::GstreamerPlayer(CamPair *camPair, NtpTimer *ntpTimer) : camPair
     GstStructure *s = gst_context_writable_structure(gContext_);
     gst_structure_set(s, "display", GST_TYPE_GL_DISPLAY, gst_display, "context",
                       GST_TYPE_GL_CONTEXT, glContext_, nullptr);
+
+    if (glContextMode_ == SHARED_CONTEXT) {
+        // One context (and GL thread) of GStreamer's own in the render context's share group, created
+        // up front. The GL elements look for a context on their display before creating one, so with
+        // the display handed to them too both pipelines run their GL work on it
+        GError *error = nullptr;
+        if (gst_gl_display_create_context(gst_display, glContext_, &sharedGlContext_, &error) &&
+            gst_gl_display_add_context(gst_display, sharedGlContext_)) {
+            gDisplayContext_ = gst_context_new(GST_GL_DISPLAY_CONTEXT_TYPE, TRUE);
+            gst_context_set_gl_display(gDisplayContext_, gst_display);
+            LOG_INFO("GStreamer GL work runs on a shared context of its own");
+        } else {
+            LOG_ERROR("Cannot create a shared GL context for GStreamer, wrapping the render context: %s",
+                      error ? error->message : "display refused the context");
+            g_clear_error(&error);
+            if (sharedGlContext_) {
+                gst_object_unref(sharedGlContext_);
+                sharedGlContext_ = nullptr;
+            }
+            glContextMode_ = WRAPPED_RENDER_CONTEXT;
+        }
+    }
     gst_object_unref(gst_display);
 
-    /* Create our own GLib Main Context and make it the default one */
+    /* Create our own GLib Main Context, the default one of the main loop thread while it runs */
     gMainContext_ = g_main_context_new();
-    g_main_context_push_thread_default(gMainContext_);
 }
 
 GstreamerPlayer::~GstreamerPlayer() {
+    // The main loop, the jitter timer and the pad probes use everything below, a no-op after shutdown()
+    stopPipelines();
+
     // Clean up callback object
     if (callbackObj_) {
         delete callbackObj_;
@@ -57,15 +83,19 @@ GstreamerPlayer::~GstreamerPlayer() {
             camPair_->second.stats = nullptr;
         }
 
-        // Clean up frame buffers
-        if (camPair_->first.dataHandle) {
-            delete[] static_cast<unsigned char *>(camPair_->first.dataHandle);
-            camPair_->first.dataHandle = nullptr;
-        }
-        if (camPair_->second.dataHandle) {
-            delete[] static_cast<unsigned char *>(camPair_->second.dataHandle);
-            camPair_->second.dataHandle = nullptr;
-        }
+    }
+
+    // GStreamer's own GL thread ends with the last reference to its context
+    if (gDisplayContext_) {
+        gst_context_unref(gDisplayContext_);
+    }
+    if (sharedGlContext_) {
+        gst_object_unref(sharedGlContext_);
+    }
+
+    // The main loop has been joined, the bus watches go with the context
+    if (gMainContext_) {
+        g_main_context_unref(gMainContext_);
     }
 }
 
@@ -95,13 +125,35 @@ void GstreamerPlayer::connectAndUnref(GstElement *element, const char *signal, G
     }
 }
 
+void GstreamerPlayer::setGlContexts(GstElement *element) const {
+    if (gDisplayContext_) {
+        gst_element_set_context(element, gDisplayContext_);
+    }
+    gst_element_set_context(element, gContext_);
+}
+
+EGLSyncKHR GstreamerPlayer::createReadyFence(GstBuffer *buffer) {
+    GstMemory *memory = gst_buffer_peek_memory(buffer, 0);
+    if (!gst_is_gl_base_memory(memory)) {
+        return EGL_NO_SYNC_KHR;
+    }
+    // Queued on the GL thread behind the upload and conversion of this frame
+    EGLSyncKHR fence = EGL_NO_SYNC_KHR;
+    gst_gl_context_thread_add(reinterpret_cast<GstGLBaseMemory *>(memory)->context,
+                              [](GstGLContext *, gpointer data) {
+                                  *static_cast<EGLSyncKHR *>(data) = egl_create_fence();
+                              }, &fence);
+    return fence;
+}
+
 // Configure a single stereo pipeline (left or right)
 void
 GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipelineName, int port,
-                                         const StreamingConfig &config,
-                                         const std::string &xDimString, int payload) {
+                                         const StreamingConfig &config, const PipelineBuilder &builder,
+                                         const std::string &xDimString, RetransmissionController *rtx) {
     // Get optional identity elements
     GstElement *udpsrc_ident = getElementOptional(pipeline, "udpsrc_ident");
+    GstElement *rtpjb_ident = getElementOptional(pipeline, "rtpjb_ident");
     GstElement *rtpdepay_ident = getElementOptional(pipeline, "rtpdepay_ident");
     GstElement *dec_ident = getElementOptional(pipeline, "dec_ident");
     GstElement *queue_ident = getElementOptional(pipeline, "queue_ident");
@@ -110,7 +162,7 @@ GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipel
     GstElement *udpsrc = getElementRequired(pipeline, "udpsrc", pipelineName);
     GstPad *pad = gst_element_get_static_pad(udpsrc, "src");
     if (pad) {
-        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, udpPacketProbeCallback, nullptr, nullptr);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, udpPacketProbeCallback, this, nullptr);
         gst_object_unref(pad);
     }
     g_object_set(udpsrc, "port", port, NULL);
@@ -120,32 +172,68 @@ GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipel
     GstCaps *new_caps = gst_caps_new_simple("application/x-rtp",
                                             "encoding-name", G_TYPE_STRING,
                                             CodecToString(config.codec).c_str(),
-                                            "payload", G_TYPE_INT, payload,
+                                            "payload", G_TYPE_INT, PipelineBuilder::payloadType(config.codec),
                                             "x-dimensions", G_TYPE_STRING, xDimString.c_str(),
                                             NULL);
     g_object_set(rtp_capsfilter, "caps", new_caps, NULL);
     gst_caps_unref(new_caps);
     gst_object_unref(rtp_capsfilter);
 
+    // The FEC decoder rebuilds lost packets from what the storage kept
+    if (builder.fecScheme() == ULPFEC) {
+        GstElement *rtpstorage = getElementRequired(pipeline, "rtpstorage", pipelineName);
+        GstElement *fecdec = getElementRequired(pipeline, "fecdec", pipelineName);
+        GObject *storage = nullptr;
+        g_object_get(rtpstorage, "internal-storage", &storage, NULL);
+        g_object_set(fecdec, "storage", storage, NULL);
+        g_object_unref(storage);
+        gst_object_unref(fecdec);
+        gst_object_unref(rtpstorage);
+    }
+
+    // Requests pass rtxreceive on their way upstream, restored packets leave it downstream
+    if (rtx) {
+        GstElement *rtxreceive = getElementRequired(pipeline, "rtxreceive", pipelineName);
+        GstPad *rtxPad = gst_element_get_static_pad(rtxreceive, "src");
+        gst_pad_add_probe(rtxPad, static_cast<GstPadProbeType>(GST_PAD_PROBE_TYPE_BUFFER |
+                                                                GST_PAD_PROBE_TYPE_EVENT_UPSTREAM),
+                          retransmissionProbeCallback, this, nullptr);
+        gst_object_unref(rtxPad);
+        gst_object_unref(rtxreceive);
+    }
+
+    // The stream's parameter sets are cached on their way into the parser, for the next pipeline to start from
+    if (config.codec == Codec::H264 || config.codec == Codec::H265) {
+        GstElement *parse = getElementRequired(pipeline, "parse", pipelineName);
+        GstPad *parsePad = gst_element_get_static_pad(parse, "sink");
+        gst_pad_add_probe(parsePad, GST_PAD_PROBE_TYPE_BUFFER, parameterSetProbeCallback,
+                          new WarmStart{this, ParameterSetCache::key(pipelineName, config), config.codec},
+                          [](gpointer data) { delete static_cast<WarmStart *>(data); });
+        gst_object_unref(parsePad);
+        gst_object_unref(parse);
+    }
+
     // Configure decoder and sink based on codec
     GstElement *dec = nullptr;
     GstElement *glsink = nullptr;
     GstElement *appsink = nullptr;
 
-    if (config.codec != Codec::JPEG) {
-        if (config.codec == Codec::H264) {
-            dec = getElementRequired(pipeline, "dec", pipelineName);
+    const bool glMemory = builder.sinkType() == PipelineSink::GL_MEMORY;
+    if (glMemory) {
+        // Only the MediaCodec decoders take their input caps as a property
+        dec = getElementRequired(pipeline, "dec", pipelineName);
+        if (config.codec == Codec::H264 && g_object_class_find_property(G_OBJECT_GET_CLASS(dec), "caps")) {
             g_autoptr(GstCaps) caps_dec = buildDecoderSrcCaps(config.codec, config.resolution.width,
                                                               config.resolution.height, config.fps);
             g_object_set(dec, "caps", caps_dec, NULL);
         }
 
         glsink = getElementRequired(pipeline, "glsink", pipelineName);
-        gst_element_set_context(glsink, gContext_);
+        setGlContexts(glsink);
 
         g_autoptr(GstCaps) caps_sink = gst_caps_from_string(SINK_CAPS);
         appsink = gst_element_factory_make("appsink", nullptr);
-        gst_element_set_context(appsink, gContext_);
+        setGlContexts(appsink);
         g_object_set(appsink, "caps", caps_sink, "max-buffers", 1, "drop", true, "emit-signals",
                      true, "sync", true, NULL);
 
@@ -153,7 +241,7 @@ GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipel
         g_object_set(glsinkbin, "sink", appsink, NULL);
     } else {
         appsink = getElementRequired(pipeline, "appsink", pipelineName);
-        gst_element_set_context(GST_ELEMENT(appsink), gContext_);
+        setGlContexts(appsink);
     }
 
     // Set up bus and callbacks
@@ -172,12 +260,13 @@ GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipel
 
     // Connect and unref optional identity elements
     connectAndUnref(udpsrc_ident, "handoff", (GCallback) onRtpHeaderMetadata, callbackObj_);
+    connectAndUnref(rtpjb_ident, "handoff", (GCallback) onJitterBufferOutput, callbackObj_);
     connectAndUnref(rtpdepay_ident, "handoff", (GCallback) onIdentityHandoff, callbackObj_);
     connectAndUnref(dec_ident, "handoff", (GCallback) onIdentityHandoff, callbackObj_);
     connectAndUnref(queue_ident, "handoff", (GCallback) onIdentityHandoff, callbackObj_);
 
     // Clean up
-    if (config.codec != Codec::JPEG) {
+    if (glMemory) {
         gst_object_unref(dec);
         gst_object_unref(glsink);
     }
@@ -190,14 +279,18 @@ GstreamerPlayer::configureSinglePipeline(GstElement *pipeline, const char *pipel
     gst_element_set_state(pipeline, GST_STATE_READY);
 }
 
-void
-GstreamerPlayer::configurePipelines(BS::thread_pool<BS::tp::none> &threadPool,
-                                    const StreamingConfig &config) {
-    GstBus *bus;
-    GSource *bus_source;
-    GError *error = nullptr;
+void GstreamerPlayer::stopPipelines() {
+    stopCapture();
 
-    LOG_INFO("(Re)configuring GStreamer pipelines");
+    // The jitter timer, the bus watches and pending updates use the pipelines and controllers on the
+    // main loop thread, the loop is joined before any of them is freed
+    stopMainLoop();
+
+    if (jitterTimer_) {
+        g_source_destroy(jitterTimer_);
+        g_source_unref(jitterTimer_);
+        jitterTimer_ = nullptr;
+    }
 
     // Stop and clean up existing pipelines if they exist
     if (pipelineLeft_) {
@@ -214,13 +307,142 @@ GstreamerPlayer::configurePipelines(BS::thread_pool<BS::tp::none> &threadPool,
         gst_object_unref(pipelineRight_);
         pipelineRight_ = nullptr;
     }
+}
+
+void GstreamerPlayer::stopMainLoop() {
+    if (!mainLoop_) {
+        return;
+    }
+    LOG_INFO("Stopping GStreamer main loop before reconfiguration");
+    // The loop may not have been entered yet when it was told to quit
+    while (mainLoopDone_.valid() &&
+           mainLoopDone_.wait_for(std::chrono::milliseconds(10)) != std::future_status::ready) {
+        g_main_loop_quit(mainLoop_);
+    }
+    mainLoopDone_ = {};
+    g_main_loop_unref(mainLoop_);
+    mainLoop_ = nullptr;
+}
+
+void GstreamerPlayer::shutdown() {
+    stopPipelines();
+}
+
+bool GstreamerPlayer::startCapture(const std::string &directory, const StreamingConfig &config) {
+    if (capturing()) {
+        return true;
+    }
+    if (!pipelineLeft_ || !pipelineRight_) {
+        return false;
+    }
+
+    RtpCaptureInfo info = RtpCaptureInfo::fromConfig(config);
+    std::unique_ptr<RtpCaptureWriter> left, right;
+    try {
+        left = std::make_unique<RtpCaptureWriter>(directory + "/left.rtpcap", info);
+        right = std::make_unique<RtpCaptureWriter>(directory + "/right.rtpcap", info);
+    } catch (const std::runtime_error &e) {
+        LOG_ERROR("GSTREAMER: %s", e.what());
+        return false;
+    }
+    captureProbeLeft_ = addCaptureProbe(pipelineLeft_, std::move(left));
+    captureProbeRight_ = addCaptureProbe(pipelineRight_, std::move(right));
+    LOG_INFO("GSTREAMER: capturing RTP packets into %s", directory.c_str());
+    return true;
+}
+
+void GstreamerPlayer::stopCapture() {
+    if (!capturing()) {
+        return;
+    }
+    removeCaptureProbe(pipelineLeft_, captureProbeLeft_);
+    removeCaptureProbe(pipelineRight_, captureProbeRight_);
+    LOG_INFO("GSTREAMER: RTP capture stopped");
+}
+
+gulong GstreamerPlayer::addCaptureProbe(GstElement *pipeline, std::unique_ptr<RtpCaptureWriter> writer) {
+    GstElement *udpsrc = getElementRequired(pipeline, "udpsrc", "capture");
+    GstPad *pad = gst_element_get_static_pad(udpsrc, "src");
+    // The pad destroys the writer, closing the file, once the probe is removed and no longer running
+    gulong probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, captureProbeCallback, writer.release(),
+                                     [](gpointer data) { delete static_cast<RtpCaptureWriter *>(data); });
+    gst_object_unref(pad);
+    gst_object_unref(udpsrc);
+    return probe;
+}
+
+void GstreamerPlayer::removeCaptureProbe(GstElement *pipeline, gulong &probe) {
+    GstElement *udpsrc = pipeline ? getElementOptional(pipeline, "udpsrc") : nullptr;
+    if (udpsrc && probe != 0) {
+        GstPad *pad = gst_element_get_static_pad(udpsrc, "src");
+        gst_pad_remove_probe(pad, probe);
+        gst_object_unref(pad);
+    }
+    if (udpsrc) {
+        gst_object_unref(udpsrc);
+    }
+    probe = 0;
+}
+
+PipelineBuilder GstreamerPlayer::buildPipelines(const StreamingConfig &config,
+                                                const std::vector<std::string> &decoders) {
+    PipelineBuilder builder = PipelineBuilder::fromConfig(config);
+
+    // Ranked decoders first, the platform default as the last resort
+    std::vector<std::string> candidates = decoders;
+    if (std::find(candidates.begin(), candidates.end(), builder.decoderFactory()) == candidates.end()) {
+        candidates.push_back(builder.decoderFactory());
+    }
+
+    for (const auto &decoder: candidates) {
+        GstElementFactory *factory = gst_element_factory_find(decoder.c_str());
+        if (!factory) {
+            LOG_INFO("GSTREAMER: decoder %s is not available", decoder.c_str());
+            continue;
+        }
+        gst_object_unref(factory);
+
+        builder.decoder(decoder);
+        if (config.codec == Codec::JPEG) {
+            builder.sink(config.jpegDecodeThreads > 0 ? PipelineSink::ENCODED :
+                         config.jpegPlanarYuv ? PipelineSink::CPU_PLANAR : PipelineSink::CPU_RGB);
+        } else {
+            builder.sink(PipelineBuilder::isHardwareDecoder(decoder) ? PipelineSink::GL_MEMORY
+                                                                     : PipelineSink::CPU_PLANAR);
+        }
+
+        GError *error = nullptr;
+        std::string description = builder.describe();
+        pipelineLeft_ = gst_parse_launch(description.c_str(), &error);
+        if (!error) {
+            pipelineRight_ = gst_parse_launch(description.c_str(), &error);
+        }
+        if (!error) {
+            LOG_INFO("GSTREAMER pipeline: %s", description.c_str());
+            return builder;
+        }
 
-    // Stop the main loop if running
-    if (mainLoop_) {
-        LOG_INFO("Stopping GStreamer main loop before reconfiguration");
-        g_main_loop_quit(mainLoop_);  // Signal the loop to stop
+        LOG_ERROR("GSTREAMER: unable to build a pipeline with %s: %s", decoder.c_str(), error->message);
+        g_error_free(error);
+        for (GstElement **pipeline: {&pipelineLeft_, &pipelineRight_}) {
+            if (*pipeline) {
+                gst_object_unref(*pipeline);
+                *pipeline = nullptr;
+            }
+        }
     }
 
+    LOG_ERROR("Unable to build pipeline!: no usable %s decoder", CodecToString(config.codec).c_str());
+    throw std::runtime_error("Unable to build pipeline!");
+}
+
+void
+GstreamerPlayer::configurePipelines(BS::thread_pool<BS::tp::none> &threadPool,
+                                    const StreamingConfig &config, const std::vector<std::string> &decoders) {
+    LOG_INFO("(Re)configuring GStreamer pipelines");
+
+    stopPipelines();
+
     // Init the CameraFrame data structure
     // Clean up old allocations if they exist (in case of reconfiguration)
     if (callbackObj_) {
@@ -235,62 +457,56 @@ GstreamerPlayer::configurePipelines(BS::thread_pool<BS::tp::none> &threadPool,
         delete camPair_->second.stats;
         camPair_->second.stats = nullptr;
     }
-    if (camPair_->first.dataHandle) {
-        delete[] static_cast<unsigned char *>(camPair_->first.dataHandle);
-        camPair_->first.dataHandle = nullptr;
-    }
-    if (camPair_->second.dataHandle) {
-        delete[] static_cast<unsigned char *>(camPair_->second.dataHandle);
-        camPair_->second.dataHandle = nullptr;
-    }
 
     // Allocate new objects
     callbackObj_ = new GStreamerCallbackObj(camPair_, ntpTimer_);
     camPair_->first.stats = new CameraStats();
     camPair_->second.stats = new CameraStats();
 
-    auto *emptyFrameLeft = new unsigned char[camPair_->first.memorySize];
-    memset(emptyFrameLeft, 0, camPair_->first.memorySize);
-    camPair_->first.dataHandle = (void *) emptyFrameLeft;
-
-    auto *emptyFrameRight = new unsigned char[camPair_->second.memorySize];
-    memset(emptyFrameRight, 0, camPair_->second.memorySize);
-    camPair_->second.dataHandle = (void *) emptyFrameRight;
-
     camPair_->first.frameWidth = config.resolution.getWidth();
     camPair_->first.frameHeight = config.resolution.getHeight();
     camPair_->second.frameWidth = config.resolution.getWidth();
     camPair_->second.frameHeight = config.resolution.getHeight();
+    camPair_->first.roiPacked = config.roi;
+    camPair_->second.roiPacked = config.roi;
+    camPair_->first.glReadyFences = glContextMode_ == SHARED_CONTEXT;
+    camPair_->second.glReadyFences = glContextMode_ == SHARED_CONTEXT;
+    warmStart_.store(config.warmStart);
     camPair_->first.memorySize = camPair_->first.frameWidth * camPair_->first.frameHeight * 3;
     camPair_->second.memorySize = camPair_->second.frameWidth * camPair_->second.frameHeight * 3;
 
     // Create new pipelines based on the provided configuration
-    switch (config.codec) {
-        case Codec::JPEG:
-            pipelineLeft_ = gst_parse_launch(jpegPipeline_.c_str(), &error);
-            pipelineRight_ = gst_parse_launch(jpegPipeline_.c_str(), &error);
-            break;
-        case Codec::VP8:
-            //TODO:
-            break;
-        case Codec::VP9:
-            //TODO:
-            break;
-        case Codec::H264:
-            pipelineLeft_ = gst_parse_launch(h264Pipeline_.c_str(), &error);
-            pipelineRight_ = gst_parse_launch(h264Pipeline_.c_str(), &error);
-            break;
-        case Codec::H265:
-            pipelineLeft_ = gst_parse_launch(h265Pipeline_.c_str(), &error);
-            pipelineRight_ = gst_parse_launch(h265Pipeline_.c_str(), &error);
-            break;
-        default:
-            break;
-    }
-
-    if (error) {
-        LOG_ERROR("Unable to build pipeline!: %s", error->message);
-        throw std::runtime_error("Unable to build pipeline!");
+    PipelineBuilder builder = buildPipelines(config, decoders);
+
+    // The CPU path writes into the mailboxes of the upload rings created by the renderer
+    if (builder.sinkType() != PipelineSink::GL_MEMORY && (!camPair_->first.mailbox || !camPair_->second.mailbox)) {
+        LOG_ERROR("No frame mailboxes for the CPU video path, call init_video_upload first");
+        throw std::runtime_error("No frame mailboxes for the CPU video path");
+    }
+    if (builder.sinkType() == PipelineSink::GL_MEMORY && (!camPair_->first.glSamples || !camPair_->second.glSamples)) {
+        LOG_ERROR("No GL sample rings for the hardware video path, call init_video_upload first");
+        throw std::runtime_error("No GL sample rings for the hardware video path");
+    }
+
+    // JPEG frames decoded in the appsink callback, the pool is shared by both cameras
+    if (config.codec == Codec::JPEG && config.jpegDecodeThreads > 0) {
+        auto threads = static_cast<size_t>(config.jpegDecodeThreads);
+        if (!jpegDecodePool_ || jpegDecodePool_->get_thread_count() != threads) {
+            jpegDecoderLeft_.reset();
+            jpegDecoderRight_.reset();
+            jpegDecodePool_ = std::make_unique<BS::thread_pool<BS::tp::none>>(threads);
+            jpegDecoderLeft_ = std::make_unique<ParallelJpegDecoder>(*jpegDecodePool_);
+            jpegDecoderRight_ = std::make_unique<ParallelJpegDecoder>(*jpegDecodePool_);
+            LOG_INFO("JPEG frames are decoded in up to %zu slices", threads);
+        }
+        PixelLayout layout = config.jpegPlanarYuv ? PixelLayout::I420 : PixelLayout::RGB;
+        jpegDecoderLeft_->setPreferredLayout(layout);
+        jpegDecoderRight_->setPreferredLayout(layout);
+        camPair_->first.jpegDecoder = jpegDecoderLeft_.get();
+        camPair_->second.jpegDecoder = jpegDecoderRight_.get();
+    } else {
+        camPair_->first.jpegDecoder = nullptr;
+        camPair_->second.jpegDecoder = nullptr;
     }
 
     // Check if pipelines were created successfully
@@ -301,28 +517,178 @@ GstreamerPlayer::configurePipelines(BS::thread_pool<BS::tp::none> &threadPool,
 
     // Stereo pipeline configuration
     std::string xDimString = fmt::format("{},{}", config.resolution.getWidth(), config.resolution.getHeight());
-    int payload = (config.codec == Codec::JPEG) ? 26 : 96;
 
-    // Configure left and right pipelines
-    configureSinglePipeline(pipelineLeft_, "left", IP_CONFIG_LEFT_CAMERA_PORT, config, xDimString, payload);
-    configureSinglePipeline(pipelineRight_, "right", IP_CONFIG_RIGHT_CAMERA_PORT, config, xDimString, payload);
+    JitterController::Settings jitterSettings = jitterSettingsFor(config);
+    jitterLeft_ = std::make_unique<JitterController>("left", jitterSettings);
+    jitterRight_ = std::make_unique<JitterController>("right", jitterSettings);
+
+    // Retransmissions arrive on the same ports, neither controller nor the estimator may see them
+    int redPayloadType = config.fecScheme == ULPFEC ? PipelineBuilder::RED_PAYLOAD_TYPE : -1;
+    mediaFilterLeft_ = std::make_unique<MediaPacketFilter>(PipelineBuilder::payloadType(config.codec), redPayloadType);
+    mediaFilterRight_ = std::make_unique<MediaPacketFilter>(PipelineBuilder::payloadType(config.codec), redPayloadType);
+
+    // Estimates also while the bitrate is fixed, the configured one is the ceiling when adaptive
+    BandwidthEstimator::Settings bandwidthSettings;
+    bandwidthSettings.maxBitrate = bandwidthSettings.startBitrate = config.bitrate;
+    bandwidthSettings.minBitrate = std::min(bandwidthSettings.minBitrate, config.bitrate);
+    bandwidth_ = std::make_unique<BandwidthEstimator>(bandwidthSettings);
+
+    // NACKs go back to the sender, which answers on the RTX payload type of the same stream
+    rtxLeft_.reset();
+    rtxRight_.reset();
+    if (builder.retransmission()) {
+        RetransmissionController::Settings rtxSettings;
+        rtxSettings.fps = config.fps;
+        rtxLeft_ = std::make_unique<RetransmissionController>(
+                "left", rtxSettings, IpToString(config.jetson_ip),
+                config.portLeft + RetransmissionController::NACK_PORT_OFFSET);
+        rtxRight_ = std::make_unique<RetransmissionController>(
+                "right", rtxSettings, IpToString(config.jetson_ip),
+                config.portRight + RetransmissionController::NACK_PORT_OFFSET);
+    }
 
-    // Start both pipelines
+    // Configure left and right pipelines
+    configureSinglePipeline(pipelineLeft_, "left", config.portLeft, config, builder, xDimString,
+                            rtxLeft_.get());
+    configureSinglePipeline(pipelineRight_, "right", config.portRight, config, builder, xDimString,
+                            rtxRight_.get());
+
+    jitterTimer_ = g_timeout_source_new(500);
+    g_source_set_callback(jitterTimer_, jitterTimerCallback, this, nullptr);
+    g_source_attach(jitterTimer_, gMainContext_);
+
+    // Start both pipelines, the time to the first frame counts from here
+    camPair_->first.stats->startUs.store(ntpTimer_->GetCurrentTimeUs());
+    camPair_->second.stats->startUs.store(ntpTimer_->GetCurrentTimeUs());
     gst_element_set_state(pipelineLeft_, GST_STATE_PLAYING);
     gst_element_set_state(pipelineRight_, GST_STATE_PLAYING);
 
-    threadPool.detach_task([&]() {
-        /* Create a GLib Main Loop and set it to run */
+    /* Create a GLib Main Loop and set it to run, it is owned and joined by stopMainLoop() */
+    mainLoop_ = g_main_loop_new(gMainContext_, FALSE);
+    mainLoopDone_ = threadPool.submit_task([this]() {
         LOG_INFO("GSTREAMER entering the main loop");
-        mainLoop_ = g_main_loop_new(gMainContext_, FALSE);
-
+        g_main_context_push_thread_default(gMainContext_);
         g_main_loop_run(mainLoop_);
+        g_main_context_pop_thread_default(gMainContext_);
         LOG_INFO("GSTREAMER exited the main loop");
-        g_main_loop_unref(mainLoop_);
-        mainLoop_ = nullptr;
     });
 }
 
+bool GstreamerPlayer::updatePipelines(const StreamingConfig &config) {
+    if (!pipelineLeft_ || !pipelineRight_ || !jitterLeft_ || !jitterRight_) {
+        return false;
+    }
+    camPair_->first.roiPacked = config.roi;
+    camPair_->second.roiPacked = config.roi;
+    warmStart_.store(config.warmStart);
+    if (bandwidth_) {
+        bandwidth_->setMaxBitrate(config.bitrate);
+    }
+
+    // A new frame rate: the retransmission deadlines and the MediaCodec decoder's input caps follow it
+    for (RetransmissionController *rtx: {rtxLeft_.get(), rtxRight_.get()}) {
+        if (rtx) {
+            rtx->setFps(config.fps);
+        }
+    }
+    if (config.codec == Codec::H264) {
+        for (GstElement *pipeline: {pipelineLeft_, pipelineRight_}) {
+            GstElement *dec = getElementOptional(pipeline, "dec");
+            if (dec && g_object_class_find_property(G_OBJECT_GET_CLASS(dec), "caps")) {
+                g_autoptr(GstCaps) caps_dec = buildDecoderSrcCaps(config.codec, config.resolution.width,
+                                                                  config.resolution.height, config.fps);
+                g_object_set(dec, "caps", caps_dec, NULL);
+            }
+            if (dec) {
+                gst_object_unref(dec);
+            }
+        }
+    }
+
+    // The controllers and the jitter buffers' latency belong to the main loop thread
+    auto *update = new JitterUpdate{this, jitterSettingsFor(config)};
+    g_main_context_invoke_full(gMainContext_, G_PRIORITY_DEFAULT, applyJitterSettings, update,
+                               [](gpointer data) { delete static_cast<JitterUpdate *>(data); });
+    LOG_INFO("Updated the running GStreamer pipelines");
+    return true;
+}
+
+GstPadProbeReturn GstreamerPlayer::parameterSetProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto *warm = static_cast<WarmStart *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer) {
+        return GST_PAD_PROBE_OK;
+    }
+    const bool first = std::exchange(warm->first, false);
+    if (first) {
+        // avc / hvc1 streams carry the sets in their caps, only Annex B ones are scanned
+        GstCaps *caps = gst_pad_get_current_caps(pad);
+        const gchar *format = caps ? gst_structure_get_string(gst_caps_get_structure(caps, 0), "stream-format")
+                                   : nullptr;
+        warm->annexB = g_strcmp0(format, "byte-stream") == 0;
+        if (caps) {
+            gst_caps_unref(caps);
+        }
+    }
+    if (!warm->annexB) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+    bool hasSps = ParameterSetCache::shared().store(warm->stream, warm->codec, map.data, map.size);
+    gst_buffer_unmap(buffer, &map);
+    if (!first || hasSps || !warm->player->warmStart_.load()) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // The first access unit of the pipeline comes without sets: the cached ones go in front of it, so
+    // the decoder is configured without waiting for the sender to repeat them
+    std::vector<uint8_t> sets = ParameterSetCache::shared().annexB(warm->stream);
+    if (sets.empty()) {
+        return GST_PAD_PROBE_OK;
+    }
+    auto *data = static_cast<guint8 *>(g_malloc(sets.size()));
+    memcpy(data, sets.data(), sets.size());
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_prepend_memory(buffer, gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, data, sets.size(), 0,
+                                                             sets.size(), data, g_free));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    LOG_INFO("GSTREAMER: %s starts with the cached parameter sets", warm->stream.c_str());
+    return GST_PAD_PROBE_OK;
+}
+
+JitterController::Settings GstreamerPlayer::jitterSettingsFor(const StreamingConfig &config) {
+    // Fixed latency unless adaptive, the controllers still measure the network
+    JitterController::Settings settings;
+    settings.initialMs = config.jitterLatencyMs;
+    settings.targetLoss = config.jitterTargetLoss;
+    if (!config.adaptiveJitter) {
+        settings.minMs = settings.maxMs = config.jitterLatencyMs;
+    }
+    return settings;
+}
+
+gboolean GstreamerPlayer::applyJitterSettings(gpointer data) {
+    auto *update = static_cast<JitterUpdate *>(data);
+    GstreamerPlayer *player = update->player;
+    for (auto [pipeline, jitter]: {std::make_pair(player->pipelineLeft_, player->jitterLeft_.get()),
+                                   std::make_pair(player->pipelineRight_, player->jitterRight_.get())}) {
+        if (!pipeline || !jitter) {
+            continue;
+        }
+        int latency = jitter->setSettings(update->settings);
+        GstElement *rtpjb = getElementOptional(pipeline, "rtpjb");
+        if (rtpjb) {
+            g_object_set(rtpjb, "latency", static_cast<guint>(latency), NULL);
+            gst_object_unref(rtpjb);
+        }
+    }
+    return G_SOURCE_REMOVE;
+}
+
 GstFlowReturn
 GstreamerPlayer::newFrameCallback(GstElement *sink, GStreamerCallbackObj *callbackObj) {
     GstSample *sample = nullptr;
@@ -348,18 +714,25 @@ GstreamerPlayer::newFrameCallback(GstElement *sink, GStreamerCallbackObj *callba
 
     CameraFrame &frame = isLeftCamera ? pair->first : pair->second;
 
-    // Update FPS stats and frame ready timestamp
+    // Update FPS stats
     double currentTime = callbackObj->second->GetCurrentTimeUs();
     double prevTime = frame.stats->currTimestamp.load();
     frame.stats->prevTimestamp.store(prevTime);
     frame.stats->currTimestamp.store(currentTime);
-    frame.stats->frameReadyTimestamp.store(static_cast<uint64_t>(currentTime));
     if (prevTime != 0) {
         double diff = currentTime - prevTime;
         frame.stats->fps.store(1e6f / diff);
+    } else {
+        float firstFrameMs = static_cast<float>(currentTime - static_cast<double>(frame.stats->startUs.load())) / 1000;
+        frame.stats->firstFrameMs.store(firstFrameMs);
+        LOG_INFO("GSTREAMER: first %s frame %.0f ms after the pipeline start", isLeftCamera ? "left" : "right",
+                 firstFrameMs);
     }
 
     GstBuffer *buffer = gst_sample_get_buffer(sample);
+    uint64_t roi = 0;
+    const uint64_t frameId =
+            GST_BUFFER_PTS_IS_VALID(buffer) ? frame.stats->frameIds.lookup(GST_BUFFER_PTS(buffer), &roi) : 0;
     GstCaps *caps = gst_sample_get_caps(sample);
 
     if (!caps) {
@@ -369,12 +742,6 @@ GstreamerPlayer::newFrameCallback(GstElement *sink, GStreamerCallbackObj *callba
     }
 
     GstStructure *st = gst_caps_get_structure(caps, 0);
-    const gchar *tex_target_str = gst_structure_get_string(st, "texture-target");
-    if (g_strcmp0(tex_target_str, "external-oes") == 0) {
-        frame.glTarget = GL_TEXTURE_EXTERNAL_OES;
-    } else {
-        frame.glTarget = GL_TEXTURE_2D;  // fallback / SW GL path
-    }
 
     // Check whether this is GLMemory (HW decode) or plain system memory (JPEG)
     GstCapsFeatures *features = gst_caps_get_features(caps, 0);
@@ -383,19 +750,35 @@ GstreamerPlayer::newFrameCallback(GstElement *sink, GStreamerCallbackObj *callba
 
     if (!isGLMemory) {
         // -----------------------------------------------------------------
-        // SOFTWARE PATH (e.g. JPEG) – CPU buffer, memcpy to dataHandle
+        // SOFTWARE PATH (e.g. JPEG) – CPU buffer, copied into a free mailbox slot
         // -----------------------------------------------------------------
-        GstMapInfo mapInfo{};
-        if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+        FrameMailbox::Slot *slot = frame.mailbox->beginWrite();
+        if (!slot) {
+            // Renderer still holds every slot, the mailbox counts this frame as dropped
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
+
+        if (gst_structure_has_name(st, "image/jpeg")) {
+            // Undecoded frame, decoded in slices straight into the slot
+            if (!frame.jpegDecoder || !decodeToSlot(buffer, frame, slot)) {
+                LOG_ERROR("GSTREAMER: Failed to decode JPEG frame");
+                frame.mailbox->abortWrite(slot);
+                gst_sample_unref(sample);
+                return GST_FLOW_OK; // A corrupt frame must not stop the stream
+            }
+            recordDecoded(frame.stats, frameId, callbackObj->second);
+        } else if (!copyToSlot(buffer, caps, frame, slot)) {
             LOG_ERROR("GSTREAMER: Failed to map CPU buffer");
+            frame.mailbox->abortWrite(slot);
             gst_sample_unref(sample);
             return GST_FLOW_ERROR;
         }
 
-        // Make sure memorySize is correct (width * height * 3 for RGB, etc.)
-        memcpy(frame.dataHandle, mapInfo.data, frame.memorySize);
-
-        gst_buffer_unmap(buffer, &mapInfo);
+        slot->frameId = frameId;
+        slot->roi = roi;
+        frame.mailbox->publish(slot);
+        frame.stats->trace.mark(frameId, TraceStage::READY, callbackObj->second->GetCurrentTimeUs());
         gst_sample_unref(sample);
 
         frame.hasGlTexture = false;  // we uploaded into CPU buffer
@@ -424,19 +807,108 @@ GstreamerPlayer::newFrameCallback(GstElement *sink, GStreamerCallbackObj *callba
         // vframe.data[0] contains a GLuint* with the texture ID
         GLuint tex_id = *(guint *) vframe.data[0];
         //LOG_INFO("GSTREAMER GL frame: texture id = %u", tex_id);
+        gst_video_frame_unmap(&vframe);
+
+        const gchar *tex_target_str = gst_structure_get_string(st, "texture-target");
+        GLenum target = g_strcmp0(tex_target_str, "external-oes") == 0 ? GL_TEXTURE_EXTERNAL_OES
+                                                                       : GL_TEXTURE_2D;  // fallback / SW GL path
 
-        frame.glTexture = tex_id;
+        // The ring keeps the sample, and so the decoder off the texture, until the GPU has drawn it
+        if (!frame.glSamples) {
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
+        EGLSyncKHR ready = frame.glReadyFences ? createReadyFence(buffer) : EGL_NO_SYNC_KHR;
+        if (!frame.glSamples->push(sample, tex_id, target, frameId, roi, ready)) {
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
         frame.hasGlTexture = true;
+        frame.stats->trace.mark(frameId, TraceStage::READY, callbackObj->second->GetCurrentTimeUs());
         frame.frameWidth = GST_VIDEO_INFO_WIDTH(&vinfo);
         frame.frameHeight = GST_VIDEO_INFO_HEIGHT(&vinfo);
 
-        gst_video_frame_unmap(&vframe);
-        gst_sample_unref(sample);
-
         return GST_FLOW_OK;
     }
 }
 
+bool GstreamerPlayer::copyToSlot(GstBuffer *buffer, GstCaps *caps, const CameraFrame &frame,
+                                 FrameMailbox::Slot *slot) {
+    GstVideoInfo vinfo;
+    PixelLayout layout = PixelLayout::RGB;
+    if (gst_video_info_from_caps(&vinfo, caps)) {
+        switch (GST_VIDEO_INFO_FORMAT(&vinfo)) {
+            case GST_VIDEO_FORMAT_I420: layout = PixelLayout::I420; break;
+            case GST_VIDEO_FORMAT_Y42B: layout = PixelLayout::Y42B; break;
+            case GST_VIDEO_FORMAT_Y444: layout = PixelLayout::Y444; break;
+            default: break;
+        }
+    }
+    slot->layout = layout;
+
+    if (layout == PixelLayout::RGB) {
+        GstMapInfo mapInfo{};
+        if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+            return false;
+        }
+        // Never copy past the slot, the sample may be bigger after a resolution change upstream
+        memcpy(slot->data, mapInfo.data, std::min<size_t>(mapInfo.size, slot->size));
+        gst_buffer_unmap(buffer, &mapInfo);
+        return true;
+    }
+
+    GstVideoFrame vframe;
+    if (!gst_video_frame_map(&vframe, &vinfo, buffer, GST_MAP_READ)) {
+        return false;
+    }
+    slot->limitedRange = GST_VIDEO_INFO_COLORIMETRY(&vinfo).range == GST_VIDEO_COLOR_RANGE_16_235;
+
+    // Planes are packed for the configured resolution, a differently sized frame is cropped
+    auto planes = plane_layout(layout, frame.frameWidth, frame.frameHeight);
+    for (int i = 0; i < planes.count; ++i) {
+        auto *src = static_cast<const uint8_t *>(GST_VIDEO_FRAME_PLANE_DATA(&vframe, i));
+        int srcStride = GST_VIDEO_FRAME_PLANE_STRIDE(&vframe, i);
+        int rows = std::min(planes.height[i], GST_VIDEO_FRAME_COMP_HEIGHT(&vframe, i));
+        size_t rowSize = std::min(planes.width[i], GST_VIDEO_FRAME_COMP_WIDTH(&vframe, i));
+        uint8_t *dst = slot->data + planes.offset[i];
+
+        if (srcStride == planes.width[i] && rowSize == static_cast<size_t>(planes.width[i])) {
+            memcpy(dst, src, rowSize * rows);
+        } else {
+            for (int row = 0; row < rows; ++row) {
+                memcpy(dst + static_cast<size_t>(row) * planes.width[i], src + static_cast<size_t>(row) * srcStride,
+                       rowSize);
+            }
+        }
+    }
+
+    gst_video_frame_unmap(&vframe);
+    return true;
+}
+
+bool GstreamerPlayer::decodeToSlot(GstBuffer *buffer, const CameraFrame &frame, FrameMailbox::Slot *slot) {
+    GstMapInfo mapInfo{};
+    if (!gst_buffer_map(buffer, &mapInfo, GST_MAP_READ)) {
+        return false;
+    }
+
+    // The decoder falls back to RGB for subsamplings without a planar layout
+    PixelLayout layout = frame.jpegDecoder->preferredLayout();
+    bool decoded = frame.jpegDecoder->decode(mapInfo.data, mapInfo.size, slot->data, slot->size, frame.frameWidth,
+                                             frame.frameHeight, layout);
+    gst_buffer_unmap(buffer, &mapInfo);
+
+    slot->layout = layout;
+    slot->limitedRange = false; // JFIF
+    return decoded;
+}
+
+void GstreamerPlayer::recordDecoded(CameraStats *stats, uint64_t frameId, NtpTimer *ntpTimer) {
+    uint64_t now = ntpTimer->GetCurrentTimeUs();
+    stats->trace.mark(frameId, TraceStage::DECODED, now);
+    stats->trace.mark(frameId, TraceStage::QUEUED, now);
+}
+
 void GstreamerPlayer::onRtpHeaderMetadata(GstElement *identity, GstBuffer *buffer, gpointer data) {
     auto *obj = reinterpret_cast<GStreamerCallbackObj *>(data);
     auto *pair = obj->first;
@@ -444,46 +916,74 @@ void GstreamerPlayer::onRtpHeaderMetadata(GstElement *identity, GstBuffer *buffe
 
     bool isLeftCamera = std::string(identity->object.parent->name) == "pipeline_left";
     auto stats = isLeftCamera ? pair->first.stats : pair->second.stats;
-    stats->totalLatency = 0;
+    uint64_t now = ntpTimer->GetCurrentTimeUs();
 
     GstRTPBuffer rtp_buf = GST_RTP_BUFFER_INIT;
-    gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp_buf);
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp_buf)) {
+        return;
+    }
+    // Extension 0 is the frame id, 1-3 the sender's conversion, encoding and payloading durations and
+    // 4 the time the packet was payloaded
+    uint64_t sender[5] = {};
+    bool present[5] = {};
+    for (guint id = 0; id < 5; ++id) {
+        gpointer myInfoBuf = nullptr;
+        guint size_64 = 8;
+        guint8 appbits = 1;
+        if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, id, &myInfoBuf,
+                                                         &size_64) != 0 && size_64 >= sizeof(uint64_t)) {
+            memcpy(&sender[id], myInfoBuf, sizeof(uint64_t));
+            present[id] = true;
+        }
+    }
+    gst_rtp_buffer_unmap(&rtp_buf);
+
+    if (present[0]) {
+        stats->frameId = sender[0];
+    }
+    uint64_t frameId = stats->frameId.load();
+    stats->trace.markPacket(frameId, now);
+    if (present[4]) {
+        stats->trace.markSender(frameId, sender[1], sender[2], sender[3], sender[4]);
+    }
+}
+
+void GstreamerPlayer::onJitterBufferOutput(GstElement *identity, GstBuffer *buffer, gpointer data) {
+    auto *obj = reinterpret_cast<GStreamerCallbackObj *>(data);
+    auto *pair = obj->first;
+
+    bool isLeftCamera = std::string(identity->object.parent->name) == "pipeline_left";
+    auto *stats = isLeftCamera ? pair->first.stats : pair->second.stats;
+
+    // All packets of a frame share the RTP timestamp and therefore the PTS the jitter buffer assigns,
+    // which the depayloader and the decoder carry over to the decoded frame
+    if (!GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return;
+    }
+
+    GstRTPBuffer rtp_buf = GST_RTP_BUFFER_INIT;
+    if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp_buf)) {
+        return;
+    }
     gpointer myInfoBuf = nullptr;
     guint size_64 = 8;
     guint8 appbits = 1;
     if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 0, &myInfoBuf,
-                                                     &size_64) != 0) {
-        stats->frameId = *(static_cast<uint64_t *>(myInfoBuf));
-        //LOG_INFO("GSTREAMER: New frameid from %s - number of packets: %s", identity->object.parent->name, std::to_string(stats->_packetsPerFrame).c_str());
-        stats->_packetsPerFrame = 0;
-    }
-    if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 1, &myInfoBuf,
-                                                     &size_64) != 0) {
-        stats->vidConv = *(static_cast<uint64_t *>(myInfoBuf));
-        //LOG_INFO("GSTREAMER: New vidconv from %s", identity->object.parent->name);
-    }
-    if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 2, &myInfoBuf,
-                                                     &size_64) != 0) {
-        stats->enc = *(static_cast<uint64_t *>(myInfoBuf));
-        //LOG_INFO("GSTREAMER: New enc from %s", identity->object.parent->name);
-    }
-    if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 3, &myInfoBuf,
-                                                     &size_64) != 0) {
-        stats->rtpPay = *(static_cast<uint64_t *>(myInfoBuf));
-        //LOG_INFO("GSTREAMER: New rtppay from %s", identity->object.parent->name);
-    }
-    if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 4, &myInfoBuf,
-                                                     &size_64) != 0) {
-        stats->rtpPayTimestamp = *(static_cast<uint64_t *>(myInfoBuf));
-        //LOG_INFO("GSTREAMER: New udpsink timestamp from %s", identity->object.parent->name);
+                                                     &size_64) != 0 && size_64 >= sizeof(uint64_t)) {
+        uint64_t frameId = 0;
+        memcpy(&frameId, myInfoBuf, sizeof(frameId)); // Extension data is not 8-byte aligned
+        // View region streams put the frame's crop into the sixth extension
+        uint64_t roi = 0;
+        gpointer roiBuf = nullptr;
+        guint roiSize = 8;
+        if (gst_rtp_buffer_get_extension_twobytes_header(&rtp_buf, &appbits, 1, 5, &roiBuf, &roiSize) &&
+            roiSize == sizeof(uint64_t)) {
+            memcpy(&roi, roiBuf, sizeof(roi));
+        }
+        stats->frameIds.record(GST_BUFFER_PTS(buffer), frameId, roi);
+        stats->trace.mark(frameId, TraceStage::JITTER_BUFFER, obj->second->GetCurrentTimeUs());
     }
     gst_rtp_buffer_unmap(&rtp_buf);
-
-    //LOG_INFO("GSTREAMER: New rtp header from %s frame: %s", identity->object.parent->name, std::to_string(stats->frameId).c_str());
-    // This is so the last packet of rtp gets saved
-    stats->udpSrcTimestamp = ntpTimer->GetCurrentTimeUs();
-    stats->udpStream = stats->udpSrcTimestamp - stats->rtpPayTimestamp;
-    stats->_packetsPerFrame += 1;
 }
 
 void GstreamerPlayer::onIdentityHandoff(GstElement *identity, GstBuffer *buffer, gpointer data) {
@@ -494,30 +994,20 @@ void GstreamerPlayer::onIdentityHandoff(GstElement *identity, GstBuffer *buffer,
     bool isLeftCamera = std::string(identity->object.parent->name) == "pipeline_left";
     auto *stats = isLeftCamera ? pair->first.stats : pair->second.stats;
 
-    if (std::string(identity->object.name) == "rtpdepay_ident") {
-        stats->rtpDepayTimestamp = ntpTimer->GetCurrentTimeUs();
-        stats->rtpDepay = stats->rtpDepayTimestamp - stats->udpSrcTimestamp;
-    } else if (std::string(identity->object.name) == "dec_ident") {
-        stats->decTimestamp = ntpTimer->GetCurrentTimeUs();
-        stats->dec = stats->decTimestamp - stats->rtpDepayTimestamp;
-    } else if (std::string(identity->object.name) == "queue_ident") {
-        stats->queueTimestamp = ntpTimer->GetCurrentTimeUs();
-        stats->queue = stats->queueTimestamp - stats->decTimestamp;
-        stats->totalLatency =
-                stats->vidConv + stats->enc + stats->rtpPay + stats->udpStream + stats->rtpDepay +
-                stats->dec + stats->queue;
-
-        // Update running average history after all stats are computed
-        stats->updateHistory();
-
-//        LOG_INFO(
-//                "GSTREAMER: %s Pipeline latencies: vidconv: %lu, enc: %lu, rtpPay: %lu, udpStream: %lu, rtpDepay: %lu, dec: %lu, queue: %lu, total: %lu",
-//                identity->object.parent->name,
-//                (unsigned long) stats->vidConv, (unsigned long) stats->enc,
-//                (unsigned long) stats->rtpPay, (unsigned long) stats->udpStream,
-//                (unsigned long) stats->rtpDepay, (unsigned long) stats->dec,
-//                (unsigned long) stats->queue,
-//                (unsigned long) stats->totalLatency);
+    // Depayloaded and decoded buffers keep the PTS the jitter buffer gave the frame's packets
+    if (!GST_BUFFER_PTS_IS_VALID(buffer)) {
+        return;
+    }
+    uint64_t frameId = stats->frameIds.lookup(GST_BUFFER_PTS(buffer));
+    uint64_t now = ntpTimer->GetCurrentTimeUs();
+
+    std::string name = identity->object.name;
+    if (name == "rtpdepay_ident") {
+        stats->trace.mark(frameId, TraceStage::DEPAYLOADED, now);
+    } else if (name == "dec_ident") {
+        stats->trace.mark(frameId, TraceStage::DECODED, now);
+    } else if (name == "queue_ident") {
+        stats->trace.mark(frameId, TraceStage::QUEUED, now);
     }
 }
 
@@ -560,19 +1050,183 @@ void GstreamerPlayer::errorCallback(GstBus *bus, GstMessage *msg, GstElement *pi
 }
 
 // Callback function to log packet arrivals
+GstPadProbeReturn
+GstreamerPlayer::captureProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto *writer = static_cast<RtpCaptureWriter *>(user_data);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!buffer) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        writer->write(static_cast<uint64_t>(now), map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
 GstPadProbeReturn
 GstreamerPlayer::udpPacketProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
-    static auto last_time = std::chrono::steady_clock::now();
+    auto *player = static_cast<GstreamerPlayer *>(user_data);
+    GstObject *element = GST_OBJECT_PARENT(pad);
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (!element || !buffer) {
+        return GST_PAD_PROBE_OK;
+    }
+    bool left = GST_OBJECT_PARENT(element) == GST_OBJECT(player->pipelineLeft_);
+    JitterController *jitter = left ? player->jitterLeft_.get() : player->jitterRight_.get();
+    MediaPacketFilter *media = left ? player->mediaFilterLeft_.get() : player->mediaFilterRight_.get();
+    if (!jitter || !media) {
+        return GST_PAD_PROBE_OK;
+    }
 
-    auto now = std::chrono::steady_clock::now();
-    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - last_time).count();
-    last_time = now;
+    auto now = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
 
-    //LOG_INFO("[UDP Packet] Arrived. Interval: %lld ms", elapsed);
+    GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+    if (gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+        if (!media->accept(static_cast<uint64_t>(now), gst_rtp_buffer_get_payload_type(&rtp),
+                           gst_rtp_buffer_get_ssrc(&rtp))) {
+            gst_rtp_buffer_unmap(&rtp);
+            return GST_PAD_PROBE_OK;
+        }
+        uint32_t timestamp = gst_rtp_buffer_get_timestamp(&rtp);
+        jitter->onPacket(static_cast<uint64_t>(now), timestamp);
+
+        // Extension 4, the time the sender payloaded the packet, spaces the packets as they were sent
+        if (player->bandwidth_) {
+            uint64_t sendUs = 0;
+            gpointer data = nullptr;
+            guint size = 8;
+            guint8 appbits = 1;
+            if (gst_rtp_buffer_get_extension_twobytes_header(&rtp, &appbits, 1, 4, &data, &size) != 0 &&
+                size >= sizeof(uint64_t)) {
+                memcpy(&sendUs, data, sizeof(uint64_t));
+            }
+            player->bandwidth_->onPacket(left ? 0 : 1, static_cast<uint64_t>(now), sendUs, timestamp,
+                                         gst_rtp_buffer_get_seq(&rtp), gst_buffer_get_size(buffer));
+        }
+        gst_rtp_buffer_unmap(&rtp);
+    }
 
     return GST_PAD_PROBE_OK;
 }
 
+GstPadProbeReturn
+GstreamerPlayer::retransmissionProbeCallback(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+    auto *player = static_cast<GstreamerPlayer *>(user_data);
+    GstObject *element = GST_OBJECT_PARENT(pad);
+    if (!element) {
+        return GST_PAD_PROBE_OK;
+    }
+    RetransmissionController *rtx = GST_OBJECT_PARENT(element) == GST_OBJECT(player->pipelineLeft_)
+                                    ? player->rtxLeft_.get() : player->rtxRight_.get();
+    if (!rtx) {
+        return GST_PAD_PROBE_OK;
+    }
+    uint64_t now = player->ntpTimer_->GetCurrentTimeUs();
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER) {
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+        if (buffer && gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+            rtx->onPacket(now, gst_rtp_buffer_get_seq(&rtp), gst_rtp_buffer_get_timestamp(&rtp),
+                          gst_rtp_buffer_get_ssrc(&rtp), gst_rtp_buffer_get_marker(&rtp),
+                          GST_BUFFER_FLAG_IS_SET(buffer, GST_RTP_BUFFER_FLAG_RETRANSMISSION));
+            gst_rtp_buffer_unmap(&rtp);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+    const GstStructure *request = gst_event_get_structure(event);
+    guint seqnum = 0;
+    if (GST_EVENT_TYPE(event) != GST_EVENT_CUSTOM_UPSTREAM || !request ||
+        !gst_structure_has_name(request, "GstRTPRetransmissionRequest") ||
+        !gst_structure_get_uint(request, "seqnum", &seqnum)) {
+        return GST_PAD_PROBE_OK;
+    }
+    // Dropped requests never reach rtxreceive, so it does not wait for their retransmission either
+    return rtx->request(now, static_cast<uint16_t>(seqnum)) ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+gboolean GstreamerPlayer::jitterTimerCallback(gpointer data) {
+    auto *player = static_cast<GstreamerPlayer *>(data);
+    player->updateJitterBuffer(player->pipelineLeft_, player->jitterLeft_.get(), player->rtxLeft_.get(),
+                               player->camPair_->first.stats);
+    player->updateJitterBuffer(player->pipelineRight_, player->jitterRight_.get(), player->rtxRight_.get(),
+                               player->camPair_->second.stats);
+
+    if (player->bandwidth_) {
+        BandwidthEstimator *bandwidth = player->bandwidth_.get();
+        bandwidth->setRtt(player->ntpTimer_->GetRttUs());
+        for (CameraStats *stats: {player->camPair_->first.stats, player->camPair_->second.stats}) {
+            stats->estimatedBitrate.store(bandwidth->targetBitrate());
+            stats->receivedBitrate.store(static_cast<float>(bandwidth->receivedBitrate() / BandwidthEstimator::STREAMS));
+            stats->bandwidthLoss.store(static_cast<float>(bandwidth->lossRate()));
+            stats->bandwidthUsage.store(static_cast<int>(bandwidth->usage()));
+        }
+    }
+    return G_SOURCE_CONTINUE;
+}
+
+void GstreamerPlayer::updateJitterBuffer(GstElement *pipeline, JitterController *jitter,
+                                         RetransmissionController *rtx, CameraStats *stats) {
+    if (!pipeline || !jitter || !stats) {
+        return;
+    }
+    GstElement *rtpjb = getElementOptional(pipeline, "rtpjb");
+    if (!rtpjb) {
+        return;
+    }
+
+    GstStructure *jbStats = nullptr;
+    g_object_get(rtpjb, "stats", &jbStats, NULL);
+    guint64 pushed = 0, lost = 0, late = 0;
+    if (jbStats) {
+        gst_structure_get_uint64(jbStats, "num-pushed", &pushed);
+        gst_structure_get_uint64(jbStats, "num-lost", &lost);
+        gst_structure_get_uint64(jbStats, "num-late", &late);
+        gst_structure_free(jbStats);
+    }
+
+    int previous = jitter->latencyMs();
+    int latency = jitter->update(pushed, lost, late);
+    if (latency != previous) {
+        g_object_set(rtpjb, "latency", static_cast<guint>(latency), NULL);
+    }
+
+    // The jitter buffer stops asking for a packet once the repair could not arrive before playout
+    if (rtx) {
+        rtx->update(ntpTimer_->GetRttUs(), latency);
+        g_object_set(rtpjb, "do-retransmission", static_cast<gboolean>(rtx->active()), "rtx-deadline", rtx->deadlineMs(), NULL);
+        stats->rtxActive.store(rtx->active());
+        stats->rtxRequested.store(rtx->requested());
+        stats->rtxSkipped.store(rtx->skipped());
+        stats->rtxRepaired.store(rtx->repaired());
+        stats->rtxAddedLatencyMs.store(static_cast<float>(rtx->addedLatencyUs() / 1000.0));
+    }
+    gst_object_unref(rtpjb);
+
+    stats->jitterLatencyMs.store(latency);
+    stats->networkJitterMs.store(static_cast<float>(jitter->jitterMs()));
+    stats->packetsLate.store(late);
+    stats->packetsLost.store(lost);
+
+    GstElement *fecdec = getElementOptional(pipeline, "fecdec");
+    if (fecdec) {
+        guint recovered = 0, unrecovered = 0;
+        g_object_get(fecdec, "recovered", &recovered, "unrecovered", &unrecovered, NULL);
+        gst_object_unref(fecdec);
+        stats->fecRecovered.store(recovered);
+        stats->fecUnrecovered.store(unrecovered);
+    }
+}
+
 GstCaps *GstreamerPlayer::buildDecoderSrcCaps(Codec codec, int width, int height, int fps) {
     const char *media_type = codec == Codec::H265 ? "video/x-h265" : "video/x-h264";
 
@@ -0,0 +1,106 @@
+//
+// JitterController - Adapts the rtpjitterbuffer latency to the measured network jitter
+//
+#include "pch.h"
+#include "log.h"
+#include <algorithm>
+#include <cmath>
+
+#include "jitter_controller.h"
+
+// Headroom on top of the measured spread, for the jitter buffer's own scheduling
+static constexpr int MARGIN_MS = 2;
+
+JitterController::JitterController(std::string name, const Settings &settings)
+        : name_(std::move(name)), settings_(settings),
+          latencyMs_(std::clamp(settings.initialMs, settings.minMs, settings.maxMs)) {}
+
+void JitterController::onPacket(uint64_t arrivalUs, uint32_t rtpTimestamp) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    if (!hasTimestamp_) {
+        hasTimestamp_ = true;
+        rtpTimestamp_ = rtpTimestamp;
+    } else {
+        // Signed difference handles the wrap and the occasional reordered packet
+        rtpTimestamp_ += static_cast<int32_t>(rtpTimestamp - lastRtpTimestamp_);
+    }
+    lastRtpTimestamp_ = rtpTimestamp;
+
+    auto transitUs = static_cast<int64_t>(arrivalUs) -
+                     static_cast<int64_t>(rtpTimestamp_ * 1000000 / CLOCK_RATE);
+    if (!samples_.empty()) {
+        jitterUs_ += (std::abs(static_cast<double>(transitUs - lastTransitUs_)) - jitterUs_) / 16.0;
+    }
+    lastTransitUs_ = transitUs;
+
+    samples_.push_back({arrivalUs, transitUs});
+    while (samples_.front().arrivalUs + WINDOW_US < arrivalUs) {
+        samples_.pop_front();
+    }
+}
+
+int JitterController::setSettings(const Settings &settings) {
+    settings_ = settings;
+    latencyMs_ = std::clamp(settings.initialMs, settings.minMs, settings.maxMs);
+    LOG_INFO("JitterController %s: latency %d ms within [%d, %d] ms", name_.c_str(), latencyMs_, settings_.minMs,
+             settings_.maxMs);
+    return latencyMs_;
+}
+
+double JitterController::jitterMs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return jitterUs_ / 1000.0;
+}
+
+int JitterController::update(uint64_t pushed, uint64_t lost, uint64_t late) {
+    // Counters restart with the pipeline
+    if (pushed < pushed_ || late < late_) {
+        pushed_ = lost_ = late_ = 0;
+    }
+    uint64_t newPushed = pushed - pushed_, newLate = late - late_;
+    pushed_ = pushed;
+    lost_ = lost;
+    late_ = late;
+    lateRate_ = newPushed + newLate > 0 ? static_cast<double>(newLate) / static_cast<double>(newPushed + newLate) : 0;
+
+    // Spread of the transit times above the fastest packet in the window
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (samples_.size() < 100) {
+            return latencyMs_; // Not enough traffic to judge
+        }
+        int64_t fastest = INT64_MAX;
+        for (const auto &sample: samples_) {
+            fastest = std::min(fastest, sample.transitUs);
+        }
+        spread_.clear();
+        for (const auto &sample: samples_) {
+            spread_.push_back(sample.transitUs - fastest);
+        }
+    }
+    auto quantile = spread_.begin() + static_cast<ptrdiff_t>(
+            static_cast<double>(spread_.size() - 1) * (1.0 - settings_.targetLoss));
+    std::nth_element(spread_.begin(), quantile, spread_.end());
+    int wanted = static_cast<int>(std::ceil(static_cast<double>(*quantile) / 1000.0)) + MARGIN_MS;
+
+    int latency = latencyMs_;
+    if (lateRate_ > settings_.targetLoss) {
+        // Frames are being lost to lateness right now, back off fast
+        latency = std::max(wanted, latencyMs_ + std::max(2, latencyMs_ / 4));
+    } else if (wanted > latencyMs_) {
+        latency = wanted;
+    } else {
+        // Give latency back slowly, a quiet second is no promise for the next one
+        latency = std::max(wanted, latencyMs_ - std::max(1, latencyMs_ / 10));
+    }
+    latency = std::clamp(latency, settings_.minMs, settings_.maxMs);
+
+    if (latency != latencyMs_) {
+        LOG_INFO("JitterController %s: latency %d -> %d ms (spread p%.1f %d ms, jitter %.2f ms, late %.2f %%, lost %lu)",
+                 name_.c_str(), latencyMs_, latency, (1.0 - settings_.targetLoss) * 100.0, wanted - MARGIN_MS,
+                 jitterMs(), lateRate_ * 100.0, (unsigned long) lost_);
+        latencyMs_ = latency;
+    }
+    return latencyMs_;
+}
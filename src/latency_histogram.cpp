@@ -0,0 +1,104 @@
+//
+// LatencyHistogram - Log-bucketed latency distribution over fixed time windows
+//
+#include "pch.h"
+#include <algorithm>
+#include <chrono>
+
+#include "latency_histogram.h"
+
+size_t LatencyHistogram::bucketOf(uint64_t valueUs) {
+    constexpr uint64_t subBuckets = 1 << SUB_BUCKET_BITS;
+    if (valueUs < subBuckets) {
+        return static_cast<size_t>(valueUs);
+    }
+    int exponent = std::min(63 - __builtin_clzll(valueUs), MAX_EXPONENT);
+    if (exponent == MAX_EXPONENT) {
+        return BUCKETS - 1;
+    }
+    uint64_t sub = (valueUs >> (exponent - SUB_BUCKET_BITS)) & (subBuckets - 1);
+    return static_cast<size_t>(subBuckets * (exponent - SUB_BUCKET_BITS + 1) + sub);
+}
+
+static uint64_t steady_now_us() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+uint64_t LatencyHistogram::bucketValue(size_t bucket) {
+    constexpr uint64_t subBuckets = 1 << SUB_BUCKET_BITS;
+    if (bucket < subBuckets) {
+        return bucket;
+    }
+    int exponent = static_cast<int>(bucket / subBuckets) + SUB_BUCKET_BITS - 1;
+    uint64_t width = uint64_t{1} << (exponent - SUB_BUCKET_BITS);
+    uint64_t low = (subBuckets + bucket % subBuckets) * width;
+    return low + width / 2;
+}
+
+void LatencyHistogram::record(uint64_t valueUs, uint64_t nowUs) {
+    if (windowStartUs_ == 0) {
+        windowStartUs_ = nowUs;
+    } else if (nowUs < windowStartUs_ || nowUs - windowStartUs_ >= windowUs_) {
+        publish(nowUs);
+        std::fill(std::begin(counts_), std::end(counts_), 0);
+        count_ = 0;
+        max_ = 0;
+        windowStartUs_ = nowUs;
+    }
+    counts_[bucketOf(valueUs)]++;
+    count_++;
+    max_ = std::max(max_, valueUs);
+}
+
+void LatencyHistogram::publish(uint64_t windowEndUs) {
+    // Nearest-rank percentiles, the bucket holding the rank-th smallest sample
+    uint64_t ranks[] = {(count_ * 50 + 99) / 100, (count_ * 95 + 99) / 100, (count_ * 99 + 99) / 100};
+    uint64_t values[] = {0, 0, 0};
+    uint64_t seen = 0;
+    size_t next = 0;
+    for (size_t bucket = 0; bucket < BUCKETS && next < 3; ++bucket) {
+        seen += counts_[bucket];
+        while (next < 3 && seen >= ranks[next]) {
+            // The top bucket can reach past the largest sample
+            values[next++] = std::min(bucketValue(bucket), max_);
+        }
+    }
+
+    uint32_t sequence = sequence_.load(std::memory_order_relaxed);
+    sequence_.store(sequence + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    summaryCount_.store(count_, std::memory_order_relaxed);
+    p50Us_.store(values[0], std::memory_order_relaxed);
+    p95Us_.store(values[1], std::memory_order_relaxed);
+    p99Us_.store(values[2], std::memory_order_relaxed);
+    maxUs_.store(max_, std::memory_order_relaxed);
+    windowEndUs_.store(windowEndUs, std::memory_order_relaxed);
+    publishedUs_.store(steady_now_us(), std::memory_order_relaxed);
+    sequence_.store(sequence + 2, std::memory_order_release);
+}
+
+LatencyHistogram::Summary LatencyHistogram::summary() const {
+    Summary summary;
+    uint64_t publishedUs;
+    while (true) {
+        uint32_t sequence = sequence_.load(std::memory_order_acquire);
+        if (sequence & 1) {
+            continue;
+        }
+        summary.count = summaryCount_.load(std::memory_order_relaxed);
+        summary.p50Us = p50Us_.load(std::memory_order_relaxed);
+        summary.p95Us = p95Us_.load(std::memory_order_relaxed);
+        summary.p99Us = p99Us_.load(std::memory_order_relaxed);
+        summary.maxUs = maxUs_.load(std::memory_order_relaxed);
+        summary.windowEndUs = windowEndUs_.load(std::memory_order_relaxed);
+        publishedUs = publishedUs_.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (sequence_.load(std::memory_order_relaxed) == sequence) {
+            break;
+        }
+    }
+    // The next window would have completed a window after this one, with one more to spare
+    summary.stale = summary.count > 0 && steady_now_us() - publishedUs > 2 * windowUs_;
+    return summary;
+}
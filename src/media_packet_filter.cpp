@@ -0,0 +1,24 @@
+//
+// MediaPacketFilter - Tells the packets of a camera's media stream from the other RTP traffic on its port
+//
+#include "pch.h"
+
+#include "media_packet_filter.h"
+
+MediaPacketFilter::MediaPacketFilter(int mediaPayloadType, int redPayloadType)
+        : mediaPayloadType_(mediaPayloadType), redPayloadType_(redPayloadType) {}
+
+bool MediaPacketFilter::accept(uint64_t arrivalUs, int payloadType, uint32_t ssrc) {
+    if (payloadType != mediaPayloadType_ && payloadType != redPayloadType_) {
+        rejected_++;
+        return false;
+    }
+    if (hasSsrc_ && ssrc != ssrc_ && arrivalUs - lastMediaUs_ < SSRC_TIMEOUT_US) {
+        rejected_++;
+        return false;
+    }
+    hasSsrc_ = true;
+    ssrc_ = ssrc;
+    lastMediaUs_ = arrivalUs;
+    return true;
+}
@@ -74,6 +74,7 @@ void NtpTimer::SyncWithServer(boost::asio::io_context &io) {
                             (1.0 - alpha) * smoothedOffsetUs_;
     }
 
+    rttUs_.store(best.rtt);
     lastSyncedTimestampLocal_ = GetCurrentTimeUsNonAdjusted();
 
     //LOG_INFO("NTPCLIENT: Selected sample Offset=%ld ms | RTT=%lu us | Diff=%ld us",
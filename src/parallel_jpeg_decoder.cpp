@@ -0,0 +1,368 @@
+//
+// ParallelJpegDecoder - Restart-interval sliced JPEG decoding on a worker pool
+//
+#include <csetjmp>
+#include <cstdio>
+#include <cstring>
+#include <future>
+#include <jpeglib.h>
+#include "log.h"
+
+#include "parallel_jpeg_decoder.h"
+
+namespace {
+
+    // libjpeg reports errors through error_exit, which must not return
+    struct DecodeError {
+        jpeg_error_mgr mgr;
+        jmp_buf jump;
+    };
+
+    void on_decode_error(j_common_ptr cinfo) {
+        auto *error = reinterpret_cast<DecodeError *>(cinfo->err);
+        longjmp(error->jump, 1);
+    }
+
+    void on_decode_warning(j_common_ptr, int) {
+        // Corrupt-data warnings would otherwise be printed for every damaged frame
+    }
+
+    // Destination of one slice: rows [firstRow, firstRow + slice height) of a packed frame
+    struct SliceTarget {
+        uint8_t *dst;
+        int width, height; // Of the whole packed frame
+        int firstRow;
+        PixelLayout layout;
+    };
+
+    PixelLayout planar_layout_for(const jpeg_decompress_struct &cinfo) {
+        if (cinfo.num_components != 3 || cinfo.jpeg_color_space != JCS_YCbCr) {
+            return PixelLayout::RGB;
+        }
+        const auto *c = cinfo.comp_info;
+        if (c[1].h_samp_factor != 1 || c[1].v_samp_factor != 1 ||
+            c[2].h_samp_factor != 1 || c[2].v_samp_factor != 1) {
+            return PixelLayout::RGB;
+        }
+        if (c[0].h_samp_factor == 2 && c[0].v_samp_factor == 2) return PixelLayout::I420;
+        if (c[0].h_samp_factor == 2 && c[0].v_samp_factor == 1) return PixelLayout::Y42B;
+        if (c[0].h_samp_factor == 1 && c[0].v_samp_factor == 1) return PixelLayout::Y444;
+        return PixelLayout::RGB;
+    }
+
+    // Returns false on corrupt data. Only plain C state lives in this frame, longjmp skips no destructors.
+    bool decode_slice(const uint8_t *jpeg, size_t size, SliceTarget &target, std::vector<uint8_t> &scratch) {
+        jpeg_decompress_struct cinfo{};
+        DecodeError error{};
+        cinfo.err = jpeg_std_error(&error.mgr);
+        error.mgr.error_exit = on_decode_error;
+        error.mgr.emit_message = on_decode_warning;
+
+        if (setjmp(error.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, jpeg, static_cast<unsigned long>(size));
+        jpeg_read_header(&cinfo, TRUE);
+
+        // Plain upsampling keeps slice seams invisible (fancy upsampling reads the neighbouring rows)
+        // and is faster; libjpeg-turbo uses its SIMD merged upsampler + colour conversion for it
+        cinfo.do_fancy_upsampling = FALSE;
+        cinfo.dct_method = JDCT_ISLOW;
+
+        if (target.layout != PixelLayout::RGB && planar_layout_for(cinfo) != target.layout) {
+            target.layout = PixelLayout::RGB;
+        }
+
+        int rows = std::min(static_cast<int>(cinfo.image_height), target.height - target.firstRow);
+        int columns = std::min(static_cast<int>(cinfo.image_width), target.width);
+
+        if (target.layout == PixelLayout::RGB) {
+            cinfo.out_color_space = JCS_RGB;
+            jpeg_start_decompress(&cinfo);
+
+            size_t stride = static_cast<size_t>(target.width) * 3;
+            scratch.resize(static_cast<size_t>(cinfo.output_width) * 3);
+            bool direct = static_cast<int>(cinfo.output_width) <= target.width;
+            while (cinfo.output_scanline < cinfo.output_height) {
+                int row = static_cast<int>(cinfo.output_scanline);
+                uint8_t *line = row < rows && direct ? target.dst + (target.firstRow + row) * stride : scratch.data();
+                jpeg_read_scanlines(&cinfo, &line, 1);
+                if (row < rows && !direct) {
+                    memcpy(target.dst + (target.firstRow + row) * stride, line, static_cast<size_t>(columns) * 3);
+                }
+            }
+        } else {
+            // Raw planes, one iMCU row (max_v_samp_factor * DCTSIZE luma rows) per call into a padded
+            // scratch buffer and then into the packed planes
+            cinfo.raw_data_out = TRUE;
+            jpeg_start_decompress(&cinfo);
+
+            auto planes = plane_layout(target.layout, target.width, target.height);
+            int maxV = cinfo.max_v_samp_factor;
+            JSAMPROW rowPointers[3][4 * DCTSIZE];
+            JSAMPARRAY componentRows[3];
+
+            size_t scratchSize = 0, offsets[3], paddedWidth[3];
+            for (int c = 0; c < 3; ++c) {
+                offsets[c] = scratchSize;
+                paddedWidth[c] = cinfo.comp_info[c].width_in_blocks * DCTSIZE;
+                scratchSize += paddedWidth[c] * cinfo.comp_info[c].v_samp_factor * DCTSIZE;
+            }
+            scratch.resize(scratchSize);
+            for (int c = 0; c < 3; ++c) {
+                for (int r = 0; r < cinfo.comp_info[c].v_samp_factor * DCTSIZE; ++r) {
+                    rowPointers[c][r] = scratch.data() + offsets[c] + r * paddedWidth[c];
+                }
+                componentRows[c] = rowPointers[c];
+            }
+
+            int imcuRows = maxV * DCTSIZE;
+            for (int lumaRow = 0; cinfo.output_scanline < cinfo.output_height; lumaRow += imcuRows) {
+                jpeg_read_raw_data(&cinfo, componentRows, imcuRows);
+
+                for (int c = 0; c < 3; ++c) {
+                    int v = cinfo.comp_info[c].v_samp_factor;
+                    // Only the last slice can end inside an iMCU row, its padding rows fall outside the plane
+                    int planeRow = (target.firstRow + lumaRow) * v / maxV;
+                    int planeRows = std::min(v * DCTSIZE, planes.height[c] - planeRow);
+                    size_t rowSize = std::min<size_t>(paddedWidth[c], planes.width[c]);
+                    for (int r = 0; r < planeRows; ++r) {
+                        memcpy(target.dst + planes.offset[c] + static_cast<size_t>(planeRow + r) * planes.width[c],
+                               rowPointers[c][r], rowSize);
+                    }
+                }
+            }
+        }
+
+        jpeg_finish_decompress(&cinfo);
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+
+    // Planar layouts need matching sampling factors, falls back to RGB like decode_slice does
+    bool probe_layout(const uint8_t *jpeg, size_t size, PixelLayout &layout) {
+        jpeg_decompress_struct cinfo{};
+        DecodeError error{};
+        cinfo.err = jpeg_std_error(&error.mgr);
+        error.mgr.error_exit = on_decode_error;
+        error.mgr.emit_message = on_decode_warning;
+
+        if (setjmp(error.jump)) {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+
+        jpeg_create_decompress(&cinfo);
+        jpeg_mem_src(&cinfo, jpeg, static_cast<unsigned long>(size));
+        jpeg_read_header(&cinfo, TRUE);
+        if (planar_layout_for(cinfo) != layout) {
+            layout = PixelLayout::RGB;
+        }
+        jpeg_destroy_decompress(&cinfo);
+        return true;
+    }
+
+    uint16_t read_be16(const uint8_t *p) {
+        return static_cast<uint16_t>(p[0] << 8 | p[1]);
+    }
+}
+
+ParallelJpegDecoder::ParallelJpegDecoder(BS::thread_pool<BS::tp::none> &pool)
+        : pool_(pool), maxSlices_(std::max<size_t>(1, pool.get_thread_count())) {}
+
+bool ParallelJpegDecoder::parse(const uint8_t *jpeg, size_t size, ScanLayout &scan) {
+    if (size < 4 || jpeg[0] != 0xFF || jpeg[1] != 0xD8) {
+        return false;
+    }
+
+    int maxH = 0, maxV = 0;
+    size_t i = 2;
+    while (i + 4 <= size) {
+        if (jpeg[i] != 0xFF) {
+            return false;
+        }
+        uint8_t marker = jpeg[i + 1];
+        if (marker == 0xFF) {
+            i++; // fill byte
+            continue;
+        }
+        size_t length = read_be16(jpeg + i + 2);
+        size_t segment = i + 4;
+        if (length < 2 || segment + length - 2 > size) {
+            return false;
+        }
+
+        switch (marker) {
+            case 0xC0: // Baseline
+            case 0xC1: // Extended sequential, Huffman
+                scan.sofHeightOffset = segment + 1;
+                scan.height = read_be16(jpeg + segment + 1);
+                scan.width = read_be16(jpeg + segment + 3);
+                for (int c = 0; c < jpeg[segment + 5]; ++c) {
+                    uint8_t sampling = jpeg[segment + 7 + c * 3];
+                    maxH = std::max(maxH, sampling >> 4);
+                    maxV = std::max(maxV, sampling & 0x0F);
+                }
+                break;
+            case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+            case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+                return false; // progressive, lossless or arithmetic coded
+            case 0xDD:
+                scan.restartInterval = read_be16(jpeg + segment);
+                break;
+            case 0xDA:
+                scan.scanStart = segment + length - 2;
+                break;
+            default:
+                break;
+        }
+        i = segment + length - 2;
+        if (scan.scanStart) {
+            break;
+        }
+    }
+    if (!scan.scanStart || scan.width == 0 || scan.height == 0 || maxH == 0 || maxV == 0) {
+        return false;
+    }
+    scan.mcuWidth = maxH * 8;
+    scan.mcuHeight = maxV * 8;
+
+    // Entropy-coded data: 0xFF is followed by 0x00 (stuffing), RSTn or the end of the scan
+    const uint8_t *p = jpeg + scan.scanStart;
+    const uint8_t *end = jpeg + size;
+    while ((p = static_cast<const uint8_t *>(memchr(p, 0xFF, end - p))) && p + 1 < end) {
+        uint8_t next = p[1];
+        if (next == 0x00 || next == 0xFF) {
+            p += next == 0x00 ? 2 : 1;
+        } else if (next >= 0xD0 && next <= 0xD7) {
+            scan.restarts.push_back(p - jpeg);
+            p += 2;
+        } else {
+            scan.scanEnd = p - jpeg;
+            break;
+        }
+    }
+    return scan.scanEnd != 0;
+}
+
+bool ParallelJpegDecoder::buildSlices(const uint8_t *jpeg, const ScanLayout &scan, size_t count) {
+    if (scan.restartInterval == 0 || scan.restarts.empty() || count < 2) {
+        return false;
+    }
+
+    int mcusPerRow = (scan.width + scan.mcuWidth - 1) / scan.mcuWidth;
+    int mcuRows = (scan.height + scan.mcuHeight - 1) / scan.mcuHeight;
+    size_t intervals = scan.restarts.size() + 1;
+    if (intervals != (static_cast<size_t>(mcusPerRow) * mcuRows + scan.restartInterval - 1) / scan.restartInterval) {
+        return false; // markers missing, the stream is damaged
+    }
+
+    // Interval k starts at MCU k * Ri, pick the ones that start an MCU row closest to an even split
+    std::vector<size_t> cuts{0};
+    for (size_t s = 1; s < count; ++s) {
+        int target = static_cast<int>(mcuRows * s / count);
+        size_t best = 0;
+        int bestDistance = mcuRows;
+        for (size_t k = cuts.back() + 1; k < intervals; ++k) {
+            long mcu = static_cast<long>(k) * scan.restartInterval;
+            if (mcu % mcusPerRow != 0) {
+                continue;
+            }
+            int distance = std::abs(static_cast<int>(mcu / mcusPerRow) - target);
+            if (distance < bestDistance) {
+                best = k;
+                bestDistance = distance;
+            }
+        }
+        if (best) {
+            cuts.push_back(best);
+        }
+    }
+    if (cuts.size() < 2) {
+        return false;
+    }
+    cuts.push_back(intervals);
+
+    slices_.resize(cuts.size() - 1);
+    for (size_t s = 0; s + 1 < cuts.size(); ++s) {
+        size_t first = cuts[s], last = cuts[s + 1];
+        int firstRow = static_cast<int>(first * scan.restartInterval / mcusPerRow) * scan.mcuHeight;
+        int lastRow = last == intervals ? scan.height
+                                        : static_cast<int>(last * scan.restartInterval / mcusPerRow) * scan.mcuHeight;
+
+        auto &slice = slices_[s];
+        slice.firstRow = firstRow;
+        slice.jpeg.clear();
+
+        // Headers, with the frame height of the slice
+        slice.jpeg.insert(slice.jpeg.end(), jpeg, jpeg + scan.scanStart);
+        slice.jpeg[scan.sofHeightOffset] = static_cast<uint8_t>((lastRow - firstRow) >> 8);
+        slice.jpeg[scan.sofHeightOffset + 1] = static_cast<uint8_t>((lastRow - firstRow) & 0xFF);
+
+        // Entropy-coded intervals, restart markers renumbered from RST0 as the decoder expects
+        for (size_t k = first; k < last; ++k) {
+            if (k != first) {
+                slice.jpeg.push_back(0xFF);
+                slice.jpeg.push_back(static_cast<uint8_t>(0xD0 + (k - first - 1) % 8));
+            }
+            size_t begin = k == 0 ? scan.scanStart : scan.restarts[k - 1] + 2;
+            size_t end = k + 1 == intervals ? scan.scanEnd : scan.restarts[k];
+            slice.jpeg.insert(slice.jpeg.end(), jpeg + begin, jpeg + end);
+        }
+        slice.jpeg.push_back(0xFF);
+        slice.jpeg.push_back(0xD9);
+    }
+    return true;
+}
+
+bool ParallelJpegDecoder::decode(const uint8_t *jpeg, size_t size, uint8_t *dst, size_t capacity, int width,
+                                 int height, PixelLayout &layout) {
+    // Any layout may fall back to RGB, the largest one
+    if (plane_layout(PixelLayout::RGB, width, height).size > capacity) {
+        return false;
+    }
+
+    ScanLayout scan;
+    bool sliced = maxSlices_ > 1 && parse(jpeg, size, scan) && buildSlices(jpeg, scan, maxSlices_);
+
+    if (!sliced) {
+        wholeFrames_.fetch_add(1, std::memory_order_relaxed);
+        lastSliceCount_.store(1, std::memory_order_relaxed);
+        thread_local std::vector<uint8_t> scratch;
+        SliceTarget target{dst, width, height, 0, layout};
+        bool ok = decode_slice(jpeg, size, target, scratch);
+        layout = target.layout;
+        return ok;
+    }
+
+    // All slices share the sampling factors, so check the planar layout once up front; otherwise
+    // a slice could fall back to RGB while the others write planes
+    if (layout != PixelLayout::RGB) {
+        if (!probe_layout(jpeg, size, layout)) {
+            return false;
+        }
+    }
+
+    slicedFrames_.fetch_add(1, std::memory_order_relaxed);
+    lastSliceCount_.store(slices_.size(), std::memory_order_relaxed);
+
+    auto run = [this, dst, width, height, layout](size_t index) {
+        thread_local std::vector<uint8_t> scratch;
+        const auto &slice = slices_[index];
+        SliceTarget target{dst, width, height, slice.firstRow, layout};
+        return decode_slice(slice.jpeg.data(), slice.jpeg.size(), target, scratch);
+    };
+
+    std::vector<std::future<bool>> pending;
+    for (size_t s = 1; s < slices_.size(); ++s) {
+        pending.push_back(pool_.submit_task([&run, s] { return run(s); }));
+    }
+    bool ok = run(0);
+    for (auto &future: pending) {
+        ok = future.get() && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,109 @@
+//
+// ParameterSetCache - The last H.264 / H.265 parameter sets of every stream, kept across pipeline restarts
+//
+#include "pch.h"
+#include <fmt/format.h>
+
+#include "parameter_set_cache.h"
+
+// Parameter set NAL unit types in decoding order: H.264 SPS, PPS; H.265 VPS, SPS, PPS
+static const std::vector<int> &parameter_set_types(Codec codec) {
+    static const std::vector<int> h264 = {7, 8}, h265 = {32, 33, 34}, none;
+    return codec == H264 ? h264 : codec == H265 ? h265 : none;
+}
+
+static int nal_unit_type(Codec codec, uint8_t header) {
+    return codec == H265 ? (header >> 1) & 0x3f : header & 0x1f;
+}
+
+// Slices: whatever follows them in the access unit is no parameter set
+static bool is_slice(Codec codec, int type) {
+    return codec == H265 ? type < 32 : type >= 1 && type <= 5;
+}
+
+// Calls `unit` with the NAL units of an Annex B buffer (without start code and trailing zero bytes)
+// until it returns false
+template<typename Unit>
+static void for_each_nal_unit(const uint8_t *data, size_t size, Unit unit) {
+    size_t begin = size;
+    auto emit = [&](size_t end) {
+        while (end > begin && data[end - 1] == 0) {
+            --end;
+        }
+        return end <= begin || unit(data + begin, end - begin);
+    };
+    for (size_t i = 0; i + 3 <= size;) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            ++i;
+            continue;
+        }
+        if (begin < size && !emit(i)) {
+            return;
+        }
+        i += 3;
+        begin = i;
+    }
+    if (begin < size) {
+        emit(size);
+    }
+}
+
+ParameterSetCache &ParameterSetCache::shared() {
+    static ParameterSetCache cache;
+    return cache;
+}
+
+std::string ParameterSetCache::key(const char *camera, const StreamingConfig &config) {
+    return fmt::format("{} {} {}x{}", camera, CodecToString(config.codec), config.resolution.getWidth(),
+                       config.resolution.getHeight());
+}
+
+bool ParameterSetCache::store(const std::string &stream, Codec codec, const uint8_t *data, size_t size) {
+    const std::vector<int> &types = parameter_set_types(codec);
+    if (types.empty()) {
+        return false;
+    }
+
+    // The sets lead the access unit, the scan stops at its first slice
+    std::vector<std::pair<int, std::vector<uint8_t>>> found;
+    for_each_nal_unit(data, size, [&](const uint8_t *unit, size_t length) {
+        int type = nal_unit_type(codec, unit[0]);
+        if (std::find(types.begin(), types.end(), type) != types.end()) {
+            found.emplace_back(type, std::vector<uint8_t>(unit, unit + length));
+        }
+        return !is_slice(codec, type);
+    });
+    if (found.empty()) {
+        return false;
+    }
+
+    bool sps = false;
+    std::lock_guard<std::mutex> lock(mutex_);
+    Sets &sets = streams_[stream];
+    sets.codec = codec;
+    for (auto &[type, unit]: found) {
+        sps |= type == (codec == H265 ? 33 : 7);
+        sets.units[type] = std::move(unit);
+    }
+    return sps;
+}
+
+std::vector<uint8_t> ParameterSetCache::annexB(const std::string &stream) const {
+    static const uint8_t START_CODE[] = {0, 0, 0, 1};
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto it = streams_.find(stream);
+    if (it == streams_.end()) {
+        return {};
+    }
+
+    std::vector<uint8_t> annexB;
+    for (int type: parameter_set_types(it->second.codec)) {
+        auto unit = it->second.units.find(type);
+        if (unit == it->second.units.end()) {
+            return {};
+        }
+        annexB.insert(annexB.end(), std::begin(START_CODE), std::end(START_CODE));
+        annexB.insert(annexB.end(), unit->second.begin(), unit->second.end());
+    }
+    return annexB;
+}
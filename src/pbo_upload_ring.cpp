@@ -0,0 +1,246 @@
+//
+// PboUploadRing - Asynchronous texture upload for the CPU (JPEG) video path
+//
+#include "pch.h"
+#include "log.h"
+#include <chrono>
+#include <GLES3/gl3.h>
+#include <GLES2/gl2ext.h>
+
+#include "pbo_upload_ring.h"
+
+// Depth the next ring is created with, raised when a ring starved its producer
+static size_t s_ringDepth = PboUploadRing::MIN_DEPTH;
+
+static PFNGLBUFFERSTORAGEEXTPROC get_buffer_storage() {
+    static PFNGLBUFFERSTORAGEEXTPROC bufferStorage = []() -> PFNGLBUFFERSTORAGEEXTPROC {
+        auto extensions = reinterpret_cast<const char *>(glGetString(GL_EXTENSIONS));
+        if (!extensions || !strstr(extensions, "GL_EXT_buffer_storage")) {
+            return nullptr;
+        }
+        return reinterpret_cast<PFNGLBUFFERSTORAGEEXTPROC>(eglGetProcAddress("glBufferStorageEXT"));
+    }();
+    return bufferStorage;
+}
+
+static GLuint create_texture(GLenum internalFormat, int width, int height) {
+    // Immutable storage, allocated once per resolution instead of on every upload
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexStorage2D(GL_TEXTURE_2D, 1, internalFormat, width, height);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    return texture;
+}
+
+// Slots are sized for RGB, which is also the largest planar layout (Y444)
+PboUploadRing::PboUploadRing(int width, int height)
+        : width_(width), height_(height), frameSize_(static_cast<size_t>(width) * height * 3) {
+
+    size_t depth = s_ringDepth;
+    fences_.assign(depth, nullptr);
+
+    auto bufferStorage = get_buffer_storage();
+    if (bufferStorage) {
+        // Keep every slot page aligned inside the buffer
+        stride_ = (frameSize_ + 4095) / 4096 * 4096;
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT_EXT | GL_MAP_COHERENT_BIT_EXT;
+
+        glGenBuffers(1, &pbo_);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+        bufferStorage(GL_PIXEL_UNPACK_BUFFER, static_cast<GLsizeiptr>(stride_ * depth), nullptr, flags);
+        mapped_ = static_cast<uint8_t *>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0,
+                                                          static_cast<GLsizeiptr>(stride_ * depth), flags));
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+
+    if (mapped_) {
+        std::vector<uint8_t *> buffers;
+        for (size_t i = 0; i < depth; ++i) {
+            buffers.push_back(mapped_ + i * stride_);
+        }
+        mailbox_ = std::make_unique<FrameMailbox>(buffers, frameSize_);
+        LOG_INFO("PboUploadRing: %dx%d, %zu persistently mapped slots", width_, height_, depth);
+    } else {
+        if (pbo_) {
+            glDeleteBuffers(1, &pbo_);
+            pbo_ = 0;
+        }
+        mailbox_ = std::make_unique<FrameMailbox>(frameSize_, depth);
+        LOG_INFO("PboUploadRing: GL_EXT_buffer_storage unavailable, %dx%d uploads from client memory",
+                 width_, height_);
+    }
+    mailbox_->setDeferredRelease(true);
+    mailbox_->setRetainHistory(true);
+}
+
+PboUploadRing::~PboUploadRing() {
+    // Ring-depth policy: grow the next ring if this one kept the producer waiting on fences
+    uint64_t produced = mailbox_->produced() + mailbox_->starved();
+    if (produced > 0 && mailbox_->starved() * 100 > produced && s_ringDepth < MAX_DEPTH) {
+        s_ringDepth += 1;
+        LOG_INFO("PboUploadRing: %lu of %lu frames found no free slot, next ring depth %zu",
+                 (unsigned long) mailbox_->starved(), (unsigned long) produced, s_ringDepth);
+    }
+
+    for (auto &fence: fences_) {
+        if (fence) {
+            glDeleteSync(fence);
+        }
+    }
+    if (pbo_) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &pbo_);
+    }
+    deleteTextures();
+}
+
+void PboUploadRing::createTextures(PixelLayout layout) {
+    deleteTextures();
+
+    if (layout == PixelLayout::RGB) {
+        texture_ = create_texture(GL_SRGB8, width_, height_);
+    } else {
+        auto planes = plane_layout(layout, width_, height_);
+        for (int i = 0; i < planes.count; ++i) {
+            planeTextures_[i] = create_texture(GL_R8, planes.width[i], planes.height[i]);
+        }
+        texture_ = planeTextures_[0];
+    }
+    layout_ = layout;
+    hasTextures_ = true;
+}
+
+void PboUploadRing::deleteTextures() {
+    if (!hasTextures_) {
+        return;
+    }
+    if (layout_ == PixelLayout::RGB) {
+        glDeleteTextures(1, &texture_);
+    } else {
+        glDeleteTextures(3, planeTextures_);
+    }
+    texture_ = 0;
+    std::fill(std::begin(planeTextures_), std::end(planeTextures_), 0);
+    hasTextures_ = false;
+}
+
+void PboUploadRing::selectLatest() {
+    FrameMailbox::Slot *previous = mailbox_->front();
+    retire(mailbox_->acquireLatest() != previous ? previous : nullptr);
+}
+
+bool PboUploadRing::select(uint64_t frameId) {
+    FrameMailbox::Slot *previous = mailbox_->front();
+    FrameMailbox::Slot *slot = mailbox_->acquire(frameId);
+    retire(slot && slot != previous ? previous : nullptr);
+    return slot != nullptr;
+}
+
+void PboUploadRing::retire(FrameMailbox::Slot *previous) {
+    if (previous) {
+        // The GPU may still be copying out of the previous slot, hand it back once its fence signals
+        retiring_.push_back(previous);
+    }
+    retireSignaledSlots();
+}
+
+GLuint PboUploadRing::update() {
+    retireSignaledSlots();
+
+    const FrameMailbox::Slot *slot = mailbox_->front();
+    if (!slot) {
+        return 0;
+    }
+
+    if (!hasTextures_ || slot->layout != layout_) {
+        createTextures(slot->layout);
+        uploadedSequence_ = 0;
+        uploadedFrameId_ = 0;
+    }
+
+    if (isResident(slot)) {
+        uploadsSkipped_++;
+    } else {
+        upload(slot);
+    }
+    return texture_;
+}
+
+bool PboUploadRing::isResident(const FrameMailbox::Slot *slot) const {
+    // Slots are reused, so compare the frame identity rather than the slot. The frame id also catches
+    // a frame the sender delivered twice
+    if (slot->frameId != 0) {
+        return slot->frameId == uploadedFrameId_;
+    }
+    return slot->sequence == uploadedSequence_;
+}
+
+void PboUploadRing::upload(const FrameMailbox::Slot *slot) {
+    auto start = std::chrono::steady_clock::now();
+    size_t index = slotIndex(slot);
+
+    // With a bound unpack buffer the pointer argument is an offset into it
+    const uint8_t *base = mapped_ ? reinterpret_cast<const uint8_t *>(index * stride_) : slot->data;
+    auto planes = plane_layout(slot->layout, width_, height_);
+    GLenum format = slot->layout == PixelLayout::RGB ? GL_RGB : GL_RED;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (mapped_) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo_);
+    }
+    for (int i = 0; i < planes.count; ++i) {
+        glBindTexture(GL_TEXTURE_2D, slot->layout == PixelLayout::RGB ? texture_ : planeTextures_[i]);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, planes.width[i], planes.height[i], format, GL_UNSIGNED_BYTE,
+                        base + planes.offset[i]);
+    }
+    if (mapped_) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    limitedRange_ = slot->limitedRange;
+
+    // Fences are only needed for slots the GPU reads from asynchronously
+    if (mapped_) {
+        if (fences_[index]) {
+            glDeleteSync(fences_[index]);
+        }
+        fences_[index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    }
+    uploadedSequence_ = slot->sequence;
+    uploadedFrameId_ = slot->frameId;
+    uploads_++;
+
+    lastUploadUs_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+}
+
+size_t PboUploadRing::slotIndex(const FrameMailbox::Slot *slot) const {
+    return mapped_ ? static_cast<size_t>(slot->data - mapped_) / stride_ : 0;
+}
+
+void PboUploadRing::retireSignaledSlots() {
+    for (auto it = retiring_.begin(); it != retiring_.end();) {
+        size_t index = slotIndex(*it);
+        GLsync fence = mapped_ ? fences_[index] : nullptr;
+
+        if (fence) {
+            GLenum status = glClientWaitSync(fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+                ++it;
+                continue;
+            }
+            glDeleteSync(fence);
+            fences_[index] = nullptr;
+        }
+
+        mailbox_->release(*it);
+        it = retiring_.erase(it);
+    }
+}
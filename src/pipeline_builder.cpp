@@ -0,0 +1,230 @@
+//
+// PipelineBuilder - Assembles the RTP receive pipeline description for gst_parse_launch
+//
+#include "pch.h"
+#include <fmt/format.h>
+
+#include "pipeline_builder.h"
+
+PipelineBuilder::PipelineBuilder(Codec codec) : codec_(codec) {
+    sink_ = codec == Codec::JPEG || !isHardwareDecoder(defaultDecoder(codec)) ? PipelineSink::CPU_PLANAR
+                                                                              : PipelineSink::GL_MEMORY;
+}
+
+PipelineBuilder PipelineBuilder::fromConfig(const StreamingConfig &config) {
+    PipelineBuilder builder(config.codec);
+    builder.resolution(config.resolution.getWidth(), config.resolution.getHeight())
+            .framerate(config.fps)
+            .jitterLatency(config.jitterLatencyMs)
+            .fec(config.fecScheme)
+            .retransmission(config.retransmission);
+    return builder;
+}
+
+PipelineBuilder &PipelineBuilder::resolution(int width, int height) {
+    width_ = width;
+    height_ = height;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::framerate(int fps) {
+    fps_ = fps;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::jitterLatency(int ms) {
+    jitterLatencyMs_ = ms;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::fec(FecScheme scheme) {
+    fec_ = scheme;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::retransmission(bool enabled) {
+    retransmission_ = enabled;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::decoder(const std::string &factory) {
+    decoder_ = factory;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::sink(PipelineSink sink) {
+    sink_ = sink;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::source(const std::string &description) {
+    source_ = description;
+    return *this;
+}
+
+PipelineBuilder &PipelineBuilder::replay() {
+    // Blocks the replay thread instead of queueing without bound when packets are pushed unpaced
+    source_ = fmt::format("appsrc name=replaysrc is-live=true format=time do-timestamp=true block=true "
+                          "max-bytes=2000000 caps=\"{}\"", rtpCaps());
+    return *this;
+}
+
+std::string PipelineBuilder::decoderFactory() const {
+    return decoder_.empty() ? defaultDecoder(codec_) : decoder_;
+}
+
+std::string PipelineBuilder::defaultDecoder(Codec codec) {
+#ifdef __ANDROID__
+    switch (codec) {
+        case Codec::JPEG:
+            return "jpegdec";
+        case Codec::VP8:
+            return "amcviddec-omxqcomvideodecodervp8";
+        case Codec::VP9:
+            return "amcviddec-omxqcomvideodecodervp9";
+        case Codec::H264:
+            return "amcviddec-omxqcomvideodecoderavc";
+        case Codec::H265:
+            return "amcviddec-omxqcomvideodecoderhevc";
+        default:
+            return "";
+    }
+#else
+    switch (codec) {
+        case Codec::JPEG:
+            return "jpegdec";
+        case Codec::VP8:
+            return "vp8dec";
+        case Codec::VP9:
+            return "vp9dec";
+        case Codec::H264:
+            return "avdec_h264";
+        case Codec::H265:
+            return "avdec_h265";
+        default:
+            return "";
+    }
+#endif
+}
+
+bool PipelineBuilder::isHardwareDecoder(const std::string &factory) {
+    return factory.rfind("amcviddec-", 0) == 0;
+}
+
+int PipelineBuilder::payloadType(Codec codec) {
+    return codec == Codec::JPEG ? 26 : 96;
+}
+
+std::string PipelineBuilder::depayloader(Codec codec) {
+    switch (codec) {
+        case Codec::JPEG:
+            return "rtpjpegdepay";
+        case Codec::VP8:
+            return "rtpvp8depay";
+        case Codec::VP9:
+            return "rtpvp9depay";
+        case Codec::H264:
+            return "rtph264depay";
+        case Codec::H265:
+            return "rtph265depay";
+        default:
+            throw std::runtime_error(fmt::format("No RTP depayloader for codec {}", CodecToString(codec)));
+    }
+}
+
+std::string PipelineBuilder::parser(Codec codec) {
+    // Parsers make sure the decoder gets whole access units with the codec headers attached
+    switch (codec) {
+        case Codec::JPEG:
+            return "jpegparse";
+        case Codec::H264:
+            return "h264parse config-interval=-1";
+        case Codec::H265:
+            return "h265parse config-interval=-1";
+        default:
+            return "";
+    }
+}
+
+std::string PipelineBuilder::rtpCaps() const {
+    return fmt::format("application/x-rtp, media=video, encoding-name={}, payload={}, clock-rate=90000",
+                       CodecToString(codec_), payloadType(codec_));
+}
+
+std::string PipelineBuilder::encodedCaps() const {
+    switch (codec_) {
+        case Codec::JPEG:
+            return "image/jpeg";
+        case Codec::VP8:
+            return "video/x-vp8";
+        case Codec::VP9:
+            return "video/x-vp9";
+        case Codec::H264:
+            return "video/x-h264, stream-format=byte-stream, alignment=au, parsed=true";
+        case Codec::H265:
+            // The HEVC MediaCodec decoder does not start without the frame size
+            return fmt::format("video/x-h265, width={}, height={}, framerate={}/1, stream-format=byte-stream, "
+                               "alignment=au, parsed=true", width_, height_, fps_);
+        default:
+            return "";
+    }
+}
+
+std::string PipelineBuilder::describe() const {
+    std::string description = fmt::format("{} ! capsfilter name=rtp_capsfilter caps=\"{}\" ! ", source_,
+                                          rtpCaps());
+    if (retransmission_) {
+        description += fmt::format("rtprtxreceive name=rtxreceive payload-type-map=\"application/x-rtp-pt-map, "
+                                   "{}=(uint){}\" ! ", payloadType(codec_), RTX_PAYLOAD_TYPE);
+    }
+
+    // The FEC decoder recovers packets when the jitter buffer gives up on them (do-lost), from the
+    // media and FEC packets kept in the storage. Storage outlasts the longest jitter buffer latency.
+    std::string jitterBuffer = fmt::format("rtpjitterbuffer name=rtpjb latency={} do-lost=true "
+                                           "drop-on-latency=true do-retransmission={}", jitterLatencyMs_,
+                                           retransmission_ ? "true" : "false");
+    if (fec_ == ULPFEC) {
+        description += fmt::format(
+                "rtpreddec pt={} ! identity name=udpsrc_ident ! rtpstorage name=rtpstorage size-time={} ! {} ! "
+                "rtpulpfecdec name=fecdec pt={} ! ", RED_PAYLOAD_TYPE, 1000000000ULL, jitterBuffer,
+                FEC_PAYLOAD_TYPE);
+    } else {
+        description += "identity name=udpsrc_ident ! " + jitterBuffer + " ! ";
+    }
+    description += fmt::format("identity name=rtpjb_ident ! {} ! identity name=rtpdepay_ident ! ",
+                               depayloader(codec_));
+
+    description += parser(codec_).empty() ? "" : parser(codec_) + " name=parse ! ";
+    description += codec_ == Codec::JPEG ? "" : "queue ! ";
+    description += encodedCaps() + " ! ";
+
+    if (sink_ == PipelineSink::ENCODED) {
+        return description + "appsink emit-signals=true name=appsink sync=false";
+    }
+
+    description += decoderFactory() + " name=dec ! ";
+    switch (sink_) {
+        case PipelineSink::CPU_RGB:
+            description += "videoconvert ! video/x-raw,format=RGB ! ";
+            break;
+        case PipelineSink::CPU_PLANAR:
+            // Converted to RGB by the fragment shader
+            description += "video/x-raw,format=(string){I420,Y42B,Y444} ! ";
+            break;
+        default:
+            break;
+    }
+
+    // Decoders with an output queue of their own are decoupled from the sink by another queue
+    description += codec_ == Codec::JPEG ? "identity name=dec_ident ! identity name=queue_ident ! "
+                                         : "identity name=dec_ident ! queue ! identity name=queue_ident ! ";
+
+    switch (sink_) {
+        case PipelineSink::GL_MEMORY:
+            return description + "glsinkbin name=glsink";
+        case PipelineSink::FAKE:
+            return description + "fakesink name=sink sync=false signal-handoffs=true";
+        default:
+            return description + "appsink emit-signals=true name=appsink sync=false";
+    }
+}
@@ -4,6 +4,8 @@
 #include "check.h"
 #include "render_scene.h"
 #include "render_imgui.h"
+#include "decoder_probe.h"
+#include "streaming_config_diff.h"
 
 #include <utility>
 #include <GLES3/gl32.h>
@@ -23,11 +25,15 @@ TelepresenceProgram::TelepresenceProgram(struct android_app *app) {
     openxr_confirm_gfx_reqs(&openxr_instance_, &openxr_system_id_);
 
     stateStorage_ = std::make_unique<StateStorage>(app);
+    traceDirectory_ = app->activity->internalDataPath ? app->activity->internalDataPath : "";
 
     appState_ = std::make_shared<AppState>(stateStorage_->LoadAppState());
     appState_->streamingConfig.headset_ip = GetLocalIPAddr();
 
     init_scene(appState_->streamingConfig.resolution.getWidth(), appState_->streamingConfig.resolution.getHeight());
+    init_video_upload(&appState_->cameraStreamingStates(), appState_->streamingConfig.resolution.getWidth(),
+                      appState_->streamingConfig.resolution.getHeight());
+    stereoSynchronizer_.setPolicy(appState_->stereoSyncPolicy, appState_->stereoSyncTimeoutMs);
 
     openxr_create_session(&openxr_instance_, &openxr_system_id_, &openxr_session_);
     openxr_log_reference_spaces(&openxr_session_);
@@ -42,7 +48,8 @@ TelepresenceProgram::TelepresenceProgram(struct android_app *app) {
 
     ntpTimer_ = std::make_unique<NtpTimer>(IpToString(appState_->streamingConfig.jetson_ip));
     ntpTimer_->StartAutoSync();
-    gstreamerPlayer_ = std::make_unique<GstreamerPlayer>(&appState_->cameraStreamingStates, ntpTimer_.get());
+    gstreamerPlayer_ = std::make_unique<GstreamerPlayer>(&appState_->cameraStreamingStates(), ntpTimer_.get(),
+                                                         appState_->glContextMode);
     rosNetworkGatewayClient_ = std::make_unique<RosNetworkGatewayClient>();
 
     appState_->systemInfo.openXrRuntime = openxr_get_runtime_name(&openxr_instance_);
@@ -52,17 +59,47 @@ TelepresenceProgram::TelepresenceProgram(struct android_app *app) {
     appState_->systemInfo.openGlRenderer = glGetString(GL_RENDERER);
 
     InitializeActions();
+    ProbeDecoders();
     InitializeStreaming();
 }
 
 TelepresenceProgram::~TelepresenceProgram() {
     restClient_->StopStream();
+
+    // The players write into the app state's camera pairs and read the NTP timer, both members declared
+    // after them: their pipelines stop, and the players go, before either does
+    for (GstreamerPlayer *player: {gstreamerPlayer_.get(), standbyPlayer_.get()}) {
+        if (player) {
+            player->shutdown();
+        }
+    }
+    while (retiringPlayer_ && !retired_.load()) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    retiringPlayer_.reset();
+    standbyPlayer_.reset();
+    gstreamerPlayer_.reset();
+
+    threadPool_.wait(); // The decoder probe may still be running
 }
 
 void TelepresenceProgram::UpdateFrame() {
     bool exit, request_restart;
     openxr_poll_events(&openxr_instance_, &openxr_session_, &exit, &request_restart, &appState_->headsetMounted);
 
+    // Persisted from here, the state storage belongs to this thread
+    {
+        std::lock_guard<std::mutex> lock(probedDecodersMutex_);
+        for (auto &[codec, decoders]: probedDecoders_) {
+            appState_->decoderRanking.decoders[codec] = std::move(decoders);
+            appState_->decoderRanking.probed[codec] = true;
+        }
+        if (!probedDecoders_.empty()) {
+            probedDecoders_.clear();
+            stateStorage_->SaveAppState(*appState_);
+        }
+    }
+
     if (!openxr_is_session_running()) {
         return;
     }
@@ -101,6 +138,11 @@ void TelepresenceProgram::RenderFrame() {
 bool TelepresenceProgram::RenderLayer(XrTime displayTime,
                                       std::vector<XrCompositionLayerProjectionView> &layerViews,
                                       XrCompositionLayerProjection &layer) {
+    // When the frames drawn now reach the display, on the NTP-synced clock of the trace records
+    XrTime runtimeNow = openxr_get_current_time(&openxr_instance_);
+    uint64_t displayedUs = runtimeNow > 0 && displayTime > runtimeNow
+                           ? ntpTimer_->GetCurrentTimeUs() + (displayTime - runtimeNow) / 1000 : 0;
+
     displayTime += appState_->headMovementPredictionMs * 1e6;
     auto viewCount = viewsurfaces_.size();
     std::vector<XrView> views(viewCount, {XR_TYPE_VIEW});
@@ -109,6 +151,16 @@ bool TelepresenceProgram::RenderLayer(XrTime displayTime,
 
     layerViews.resize(viewCount);
 
+    // What both eyes see together, the sender crops view region frames to it
+    XrFovf viewFov = views[0].fov;
+    for (uint32_t i = 1; i < viewCount; i++) {
+        viewFov.angleLeft = std::min(viewFov.angleLeft, views[i].fov.angleLeft);
+        viewFov.angleRight = std::max(viewFov.angleRight, views[i].fov.angleRight);
+        viewFov.angleUp = std::max(viewFov.angleUp, views[i].fov.angleUp);
+        viewFov.angleDown = std::min(viewFov.angleDown, views[i].fov.angleDown);
+    }
+    userState_.viewFov = viewFov;
+
     XrSpaceLocation spaceLocation{XR_TYPE_SPACE_LOCATION};
 
     // Locate "Local" space relative to "ViewFront"
@@ -134,6 +186,11 @@ bool TelepresenceProgram::RenderLayer(XrTime displayTime,
         quad.Scale = {3.56f * appState_->streamingConfig.resolution.getAspectRatio(), 3.56f, 0.0f};
     }
 
+    // Both eyes of this display frame show frames of the same capture instant
+    UpdateStandbyPipelines();
+    stereoSynchronizer_.select(appState_->cameraStreamingStates(), mono_, appState_->stereoSyncStats);
+    TrackReconfiguration();
+
     for (uint32_t i = 0; i < viewCount; i++) {
         XrSwapchainSubImage subImg;
         render_target_t rtarget;
@@ -145,22 +202,27 @@ bool TelepresenceProgram::RenderLayer(XrTime displayTime,
         layerViews[i].fov = views[i].fov;
         layerViews[i].subImage = subImg;
 
-        CameraFrame *imageHandle = i == 0 ? &appState_->cameraStreamingStates.second
-                                          : &appState_->cameraStreamingStates.first;
+        CameraFrame *imageHandle = i == 0 ? &appState_->cameraStreamingStates().second
+                                          : &appState_->cameraStreamingStates().first;
 
         HandleControllers();
 
-        if (mono_) imageHandle = &appState_->cameraStreamingStates.first;
+        if (mono_) imageHandle = &appState_->cameraStreamingStates().first;
 
-        // Calculate presentation latency (frame ready → about to render)
-        uint64_t frameReadyTime = imageHandle->stats->frameReadyTimestamp.load();
-        if (frameReadyTime > 0) {
-            uint64_t renderTime = ntpTimer_->GetCurrentTimeUs();
-            imageHandle->stats->presentation.store(renderTime - frameReadyTime);
+        // The first draw of a frame completes its trace record
+        if (imageHandle->stats) {
+            uint64_t frameId = imageHandle->hasGlTexture ? imageHandle->glSamples->frameId()
+                                                         : imageHandle->uploadRing ? imageHandle->uploadRing->frameId() : 0;
+            imageHandle->stats->trace.seal(frameId, ntpTimer_->GetCurrentTimeUs(), displayedUs);
         }
 
         render_scene(layerViews[i], rtarget, quad, appState_, imageHandle, renderGui_, false);
 
+        // The decoder gets the texture back once this eye pass has finished sampling it
+        if (imageHandle->hasGlTexture && imageHandle->glSamples) {
+            imageHandle->glSamples->fence();
+        }
+
         openxr_release_viewsurface(viewsurfaces_[i]);
         auto end = std::chrono::high_resolution_clock::now();
     }
@@ -519,6 +581,19 @@ void TelepresenceProgram::SendControllerDatagram() {
         // Always send head pose
         robotControlSender_->sendHeadPose(userState_.hmdPose.orientation, appState_->headMovementMaxSpeed, threadPool_);
 
+        // The sender places the full-detail crop of view region frames where the user looks
+        if (appState_->streamingConfig.roi) {
+            robotControlSender_->sendViewRegion(userState_.hmdPose.orientation, userState_.viewFov, threadPool_);
+        }
+
+        // The sender's encoders follow the bandwidth estimate, rate limited by the estimator
+        BandwidthEstimator *bandwidth = gstreamerPlayer_ ? gstreamerPlayer_->bandwidthEstimator() : nullptr;
+        int bitrate = 0;
+        if (appState_->streamingConfig.adaptiveBitrate && bandwidth &&
+            bandwidth->takeFeedback(ntpTimer_->GetCurrentTimeUs(), bitrate)) {
+            robotControlSender_->sendBitrate(bitrate, threadPool_);
+        }
+
         // Send robot control when enabled
         if (appState_->robotControlEnabled && !renderGui_) {
             robotControlSender_->sendRobotControl(userState_.thumbstickPose[Side::RIGHT].y,
@@ -534,12 +609,252 @@ void TelepresenceProgram::InitializeStreaming() {
     restClient_->StopStream();
     restClient_->StartStream();
 
-    gstreamerPlayer_->configurePipelines(gstreamerThreadPool_, appState_->streamingConfig);
+    gstreamerPlayer_->configurePipelines(gstreamerThreadPool_, appState_->streamingConfig, RankedDecoders());
+    appliedStreamingConfig_ = appState_->streamingConfig;
+
+    // The stream started before the pipelines listened, its first IDR is gone
+    if (appState_->streamingConfig.warmStart) {
+        restClient_->RequestKeyframe();
+    }
+}
+
+void TelepresenceProgram::ApplyStreamingConfig() {
+    if (standbyPlayer_ || retiringPlayer_) {
+        LOG_INFO("Still switching to the previous streaming config, apply again once it is shown");
+        return;
+    }
+    StreamingConfig &config = appState_->streamingConfig;
+    StreamingConfigDiff diff(appliedStreamingConfig_, config);
+
+    ReconfigurationClass reconfiguration = diff.reconfiguration();
+    if (reconfiguration == RENEGOTIATE && !gstreamerPlayer_->updatePipelines(config)) {
+        reconfiguration = REBUILD;
+    }
+    if (reconfiguration == REBUILD) {
+        // Make before break: the new pipelines listen on the other camera ports, the robot is moved over
+        // to them, and the running pipelines keep the view until the new ones have a frame
+        int offset = appliedStreamingConfig_.portLeft == IP_CONFIG_LEFT_CAMERA_PORT ? IP_CONFIG_STANDBY_PORT_OFFSET : 0;
+        config.portLeft = IP_CONFIG_LEFT_CAMERA_PORT + offset;
+        config.portRight = IP_CONFIG_RIGHT_CAMERA_PORT + offset;
+        if (!StartStandbyPipelines()) {
+            // The robot has not been told anything yet
+            AbortStandbyPipelines();
+            stateStorage_->SaveAppState(*appState_);
+            return;
+        }
+    }
+    bool sent = true;
+    if (diff.sender() || reconfiguration == REBUILD) {
+        sent = restClient_->UpdateStreamingConfig(config) == 0;
+    }
+    if (!sent) {
+        // The robot still streams the applied config, the edited settings stay for another Apply
+        if (reconfiguration == REBUILD) {
+            LOG_ERROR("The robot did not take the new streaming config, keeping the running pipelines");
+            AbortStandbyPipelines();
+        } else {
+            LOG_ERROR("The robot did not take the new streaming config, keeping the applied one");
+            if (reconfiguration == RENEGOTIATE && !gstreamerPlayer_->updatePipelines(appliedStreamingConfig_)) {
+                LOG_ERROR("Cannot return the running pipelines to the applied streaming config");
+            }
+        }
+        stateStorage_->SaveAppState(*appState_);
+        return;
+    }
+    stateStorage_->SaveAppState(*appState_);
+    if (reconfiguration == REBUILD && config.warmStart) {
+        restClient_->RequestKeyframe();
+    }
+    if (reconfiguration == REBUILD) {
+        replacedStreamingConfig_ = appliedStreamingConfig_;
+    }
+    appliedStreamingConfig_ = config;
+    LOG_INFO("Applied the streaming config as %s: %s", ReconfigurationClassToString(reconfiguration).c_str(),
+             diff.describe().empty() ? "no changes" : diff.describe().c_str());
+
+    auto &stats = appState_->reconfigurationStats;
+    stats.lastClass = reconfiguration;
+    stats.lastFields = diff.describe();
+    stats.applied[reconfiguration]++;
+    if (reconfiguration != NO_CHANGE) {
+        reconfiguring_ = reconfiguration;
+        reconfigurationStartUs_ = lastNewFrameUs_ = ntpTimer_->GetCurrentTimeUs();
+        longestFrameWaitUs_ = 0;
+    }
+}
+
+bool TelepresenceProgram::StartStandbyPipelines() {
+    const StreamingConfig &config = appState_->streamingConfig;
+    CamPair &standby = appState_->standbyStreamingStates();
+    init_video_upload(&standby, config.resolution.getWidth(), config.resolution.getHeight());
+    try {
+        // The GL context mode edited in the GUI only takes effect at the next start
+        standbyPlayer_ = std::make_unique<GstreamerPlayer>(&standby, ntpTimer_.get(), gstreamerPlayer_->glContextMode());
+        standbyPlayer_->configurePipelines(gstreamerThreadPool_, config, RankedDecoders());
+    } catch (const std::runtime_error &e) {
+        LOG_ERROR("Cannot build the pipelines for the new streaming config: %s", e.what());
+        return false;
+    }
+    standbyStartUs_ = ntpTimer_->GetCurrentTimeUs();
+    return true;
+}
+
+void TelepresenceProgram::UpdateStandbyPipelines() {
+    // The replaced (or dropped) pipelines have stopped, the frame storage they wrote into goes on the render thread
+    if (retiringPlayer_ && retired_.load()) {
+        retiringPlayer_.reset();
+        release_video_upload(&appState_->standbyStreamingStates());
+    }
+    if (!standbyPlayer_) {
+        return;
+    }
+
+    // Switch once both cameras (the left one in mono) have decoded a frame
+    const CamPair &standby = appState_->standbyStreamingStates();
+    auto delivered = [](const CameraFrame &frame) { return frame.stats && frame.stats->currTimestamp.load() > 0; };
+    bool ready = delivered(standby.first) && (mono_ || delivered(standby.second));
+    if (!ready && ntpTimer_->GetCurrentTimeUs() < standbyStartUs_ + STANDBY_TIMEOUT_US) {
+        return;
+    }
+    if (!ready) {
+        LOG_ERROR("The new pipelines have not decoded a frame in %lu ms, staying with the running ones",
+                  (unsigned long) (STANDBY_TIMEOUT_US / 1000));
+        appliedStreamingConfig_ = replacedStreamingConfig_;
+        if (restClient_->UpdateStreamingConfig(appliedStreamingConfig_) != 0) {
+            LOG_ERROR("Cannot move the robot back to the running pipelines");
+        }
+        AbortStandbyPipelines();
+        stateStorage_->SaveAppState(*appState_);
+        return;
+    }
+
+    const StreamingConfig &config = appState_->streamingConfig;
+    appState_->presentedPair = 1 - appState_->presentedPair;
+    init_scene(config.resolution.getWidth(), config.resolution.getHeight(), true);
+    appState_->rtpCapturing = false; // The capture belonged to the replaced pipelines
+
+    // Break: the replaced pipelines are torn down in the background
+    RetirePlayer(std::move(gstreamerPlayer_));
+    gstreamerPlayer_ = std::move(standbyPlayer_);
+    LOG_INFO("Switched to the new pipelines on ports %d and %d", config.portLeft, config.portRight);
+}
+
+void TelepresenceProgram::AbortStandbyPipelines() {
+    // The other edited settings stay, for another Apply
+    appState_->streamingConfig.portLeft = appliedStreamingConfig_.portLeft;
+    appState_->streamingConfig.portRight = appliedStreamingConfig_.portRight;
+    if (standbyPlayer_) {
+        RetirePlayer(std::move(standbyPlayer_));
+    } else {
+        release_video_upload(&appState_->standbyStreamingStates());
+    }
+    LOG_INFO("Dropped the new pipelines, the running ones stay on ports %d and %d", appliedStreamingConfig_.portLeft,
+             appliedStreamingConfig_.portRight);
+}
+
+void TelepresenceProgram::RetirePlayer(std::unique_ptr<GstreamerPlayer> player) {
+    retiringPlayer_ = std::move(player);
+    retired_.store(false);
+    GstreamerPlayer *retiring = retiringPlayer_.get();
+    threadPool_.detach_task([this, retiring]() {
+        retiring->shutdown();
+        retired_.store(true);
+    });
+}
+
+void TelepresenceProgram::TrackReconfiguration() {
+    if (reconfiguring_ == NO_CHANGE) {
+        return;
+    }
+    // Arrival of the left camera's newest frame, the stats restart with a rebuild
+    const CameraStats *stats = appState_->cameraStreamingStates().first.stats;
+    uint64_t nowUs = ntpTimer_->GetCurrentTimeUs();
+    auto arrivalUs = stats ? static_cast<uint64_t>(stats->currTimestamp.load()) : 0;
+    if (arrivalUs > lastNewFrameUs_) {
+        longestFrameWaitUs_ = std::max(longestFrameWaitUs_, arrivalUs - lastNewFrameUs_);
+        lastNewFrameUs_ = arrivalUs;
+    }
+    if (nowUs < reconfigurationStartUs_ + RECONFIGURATION_WINDOW_US) {
+        return;
+    }
+
+    longestFrameWaitUs_ = std::max(longestFrameWaitUs_, nowUs - lastNewFrameUs_);
+    appState_->reconfigurationStats.downtimeMs[reconfiguring_] = static_cast<float>(longestFrameWaitUs_) / 1000.0f;
+    LOG_INFO("Reconfiguration %s: %.1f ms without a new frame", ReconfigurationClassToString(reconfiguring_).c_str(),
+             static_cast<double>(longestFrameWaitUs_) / 1000.0);
+    reconfiguring_ = NO_CHANGE;
+}
+
+void TelepresenceProgram::ProbeDecoders() {
+    auto &ranking = appState_->decoderRanking;
+    auto &config = appState_->streamingConfig;
+
+    // GStreamer updates and new decoder plugins invalidate every stored ranking
+    std::string fingerprint = DecoderProbe::fingerprint();
+    if (ranking.fingerprint != fingerprint) {
+        ranking = DecoderRanking{};
+        ranking.fingerprint = fingerprint;
+    }
+
+    // The configured codec first, the stream starts with the platform default decoder meanwhile
+    std::vector<Codec> codecs;
+    for (int codec = 0; codec < Codec::Count; ++codec) {
+        if (!ranking.probed[codec]) {
+            codecs.insert(codec == config.codec ? codecs.begin() : codecs.end(), static_cast<Codec>(codec));
+        }
+    }
+    if (codecs.empty()) {
+        return;
+    }
+
+    // Without the render thread's GL context, hardware decoders output to system memory while timed
+    threadPool_.detach_task([this, codecs, width = config.resolution.getWidth(),
+                             height = config.resolution.getHeight(), fps = config.fps]() {
+        for (Codec codec: codecs) {
+            LOG_INFO("Probing %s decoders", CodecToString(codec).c_str());
+            DecoderProbe probe(width, height, fps);
+            std::vector<std::string> decoders = DecoderProbe::factories(probe.run(codec));
+            std::lock_guard<std::mutex> lock(probedDecodersMutex_);
+            probedDecoders_.emplace_back(codec, std::move(decoders));
+        }
+    });
+}
+
+const std::vector<std::string> &TelepresenceProgram::RankedDecoders() {
+    return appState_->decoderRanking.decoders[appState_->streamingConfig.codec];
+}
+
+void TelepresenceProgram::ExportFrameTrace() {
+    auto &cameras = appState_->cameraStreamingStates();
+    if (traceDirectory_.empty() || !cameras.first.stats || !cameras.second.stats) {
+        return;
+    }
+    std::string path = traceDirectory_ + "/frame_trace.json";
+    if (FrameTracer::writeChromeTrace(path, {{"left camera", &cameras.first.stats->trace},
+                                             {"right camera", &cameras.second.stats->trace}})) {
+        LOG_INFO("Frame trace written to %s", path.c_str());
+    } else {
+        LOG_ERROR("Failed to write the frame trace to %s", path.c_str());
+    }
+}
+
+void TelepresenceProgram::ToggleRtpCapture() {
+    if (!gstreamerPlayer_ || traceDirectory_.empty()) {
+        return;
+    }
+    if (gstreamerPlayer_->capturing()) {
+        gstreamerPlayer_->stopCapture();
+    } else {
+        gstreamerPlayer_->startCapture(traceDirectory_, appState_->streamingConfig);
+    }
+    appState_->rtpCapturing = gstreamerPlayer_->capturing();
 }
 
 void TelepresenceProgram::HandleControllers() {
     static bool controlLockMovement = false;
     static bool controlLockGui = false;
+    static bool controlLockTrace = false;
+    static bool controlLockCapture = false;
     if (userState_.thumbstickPressed[Side::RIGHT] && !controlLockMovement) {
         appState_->robotControlEnabled = !appState_->robotControlEnabled;
         if (!appState_->robotControlEnabled) {
@@ -566,6 +881,27 @@ void TelepresenceProgram::HandleControllers() {
         controlLockGui = false;
     }
 
+    // Dumping the last few seconds of frame traces
+    if (userState_.bPressed && !controlLockTrace) {
+        ExportFrameTrace();
+        controlLockTrace = true;
+    }
+    if (!userState_.bPressed && controlLockTrace) {
+        controlLockTrace = false;
+    }
+
+    // Recording the received packets for offline replay, while the GUI (where Y changes the selection) is hidden.
+    // A press that began with the GUI shown does not toggle once it is hidden
+    if (userState_.yPressed && !controlLockCapture) {
+        if (!renderGui_) {
+            ToggleRtpCapture();
+        }
+        controlLockCapture = true;
+    }
+    if (!userState_.yPressed && controlLockCapture) {
+        controlLockCapture = false;
+    }
+
     // GUI interaction
     if (appState_->guiControl.cooldown > 0) {
         appState_->guiControl.cooldown -= 1;
@@ -613,9 +949,6 @@ void TelepresenceProgram::HandleControllers() {
                     appState_->streamingConfig.codec = static_cast<Codec>(
                             (static_cast<int>(appState_->streamingConfig.codec) + 1 +
                              static_cast<int>(Codec::Count)) % static_cast<int>(Codec::Count));
-                    if (appState_->streamingConfig.codec == Codec::VP8 || appState_->streamingConfig.codec == Codec::VP9) {
-                        appState_->streamingConfig.codec = Codec::H264; // Skip VP8 & VP9 for now
-                    }
                     appState_->guiControl.changesEnqueued = true;
                     break;
                 case 3: // Encoding quality
@@ -654,19 +987,64 @@ void TelepresenceProgram::HandleControllers() {
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 10: // Camera head movement max speed
+                case 9: // View region streaming
+                    appState_->streamingConfig.roi = !appState_->streamingConfig.roi;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 10: // Adaptive bitrate
+                    appState_->streamingConfig.adaptiveBitrate = !appState_->streamingConfig.adaptiveBitrate;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 11: // Stereo sync policy, takes effect right away
+                    appState_->stereoSyncPolicy = static_cast<StereoSyncPolicy>(
+                            (static_cast<int>(appState_->stereoSyncPolicy) + 1 +
+                             static_cast<int>(StereoSyncPolicy::CNT5)) % static_cast<int>(StereoSyncPolicy::CNT5));
+                    stereoSynchronizer_.setPolicy(appState_->stereoSyncPolicy, appState_->stereoSyncTimeoutMs);
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 12: // FEC scheme
+                    appState_->streamingConfig.fecScheme = static_cast<FecScheme>(
+                            (static_cast<int>(appState_->streamingConfig.fecScheme) + 1 +
+                             static_cast<int>(FecScheme::CNT6)) % static_cast<int>(FecScheme::CNT6));
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 13: // FEC overhead in percent of the media packets
+                    appState_->streamingConfig.fecOverheadPercent = std::clamp(
+                            appState_->streamingConfig.fecOverheadPercent + 5, 5, 100);
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 14: // Retransmission
+                    appState_->streamingConfig.retransmission = !appState_->streamingConfig.retransmission;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 15: // GL context mode, applied at the next start
+                    appState_->glContextMode = static_cast<GlContextMode>(
+                            (static_cast<int>(appState_->glContextMode) + 1 +
+                             static_cast<int>(GlContextMode::CNT7)) % static_cast<int>(GlContextMode::CNT7));
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 16: // JPEG planar YUV upload
+                    appState_->streamingConfig.jpegPlanarYuv = !appState_->streamingConfig.jpegPlanarYuv;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 17: // JPEG restart interval decode threads, 0 = jpegdec
+                    appState_->streamingConfig.jpegDecodeThreads =
+                            (appState_->streamingConfig.jpegDecodeThreads + 1 + 9) % 9;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 19: // Camera head movement max speed
                     if (appState_->headMovementMaxSpeed < 990000) {
                         appState_->headMovementMaxSpeed += 10000;
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 11: // Camera head movement speed multiplier
+                case 20: // Camera head movement speed multiplier
                     if (appState_->headMovementSpeedMultiplier < 2.0f) {
                         appState_->headMovementSpeedMultiplier += 0.1f;
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 12: // Headset movement prediction time in ms
+                case 21: // Headset movement prediction time in ms
                     if (appState_->headMovementPredictionMs < 100) {
                         appState_->headMovementPredictionMs += 1;
                         appState_->guiControl.changesEnqueued = true;
@@ -691,9 +1069,6 @@ void TelepresenceProgram::HandleControllers() {
                     appState_->streamingConfig.codec = static_cast<Codec>(
                             (static_cast<int>(appState_->streamingConfig.codec) - 1 +
                              static_cast<int>(Codec::Count)) % static_cast<int>(Codec::Count));
-                    if (appState_->streamingConfig.codec == Codec::VP8 || appState_->streamingConfig.codec == Codec::VP9) {
-                        appState_->streamingConfig.codec = Codec::JPEG; // Skip VP8 & VP9 for now
-                    }
                     appState_->guiControl.changesEnqueued = true;
                     break;
                 case 3: // Encoding quality
@@ -733,19 +1108,64 @@ void TelepresenceProgram::HandleControllers() {
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 10: // Camera head movement max speed
+                case 9: // View region streaming
+                    appState_->streamingConfig.roi = !appState_->streamingConfig.roi;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 10: // Adaptive bitrate
+                    appState_->streamingConfig.adaptiveBitrate = !appState_->streamingConfig.adaptiveBitrate;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 11: // Stereo sync policy, takes effect right away
+                    appState_->stereoSyncPolicy = static_cast<StereoSyncPolicy>(
+                            (static_cast<int>(appState_->stereoSyncPolicy) - 1 +
+                             static_cast<int>(StereoSyncPolicy::CNT5)) % static_cast<int>(StereoSyncPolicy::CNT5));
+                    stereoSynchronizer_.setPolicy(appState_->stereoSyncPolicy, appState_->stereoSyncTimeoutMs);
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 12: // FEC scheme
+                    appState_->streamingConfig.fecScheme = static_cast<FecScheme>(
+                            (static_cast<int>(appState_->streamingConfig.fecScheme) - 1 +
+                             static_cast<int>(FecScheme::CNT6)) % static_cast<int>(FecScheme::CNT6));
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 13: // FEC overhead in percent of the media packets
+                    appState_->streamingConfig.fecOverheadPercent = std::clamp(
+                            appState_->streamingConfig.fecOverheadPercent - 5, 5, 100);
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 14: // Retransmission
+                    appState_->streamingConfig.retransmission = !appState_->streamingConfig.retransmission;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 15: // GL context mode, applied at the next start
+                    appState_->glContextMode = static_cast<GlContextMode>(
+                            (static_cast<int>(appState_->glContextMode) - 1 +
+                             static_cast<int>(GlContextMode::CNT7)) % static_cast<int>(GlContextMode::CNT7));
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 16: // JPEG planar YUV upload
+                    appState_->streamingConfig.jpegPlanarYuv = !appState_->streamingConfig.jpegPlanarYuv;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 17: // JPEG restart interval decode threads, 0 = jpegdec
+                    appState_->streamingConfig.jpegDecodeThreads =
+                            (appState_->streamingConfig.jpegDecodeThreads - 1 + 9) % 9;
+                    appState_->guiControl.changesEnqueued = true;
+                    break;
+                case 19: // Camera head movement max speed
                     if (appState_->headMovementMaxSpeed > 110000) {
                         appState_->headMovementMaxSpeed -= 10000;
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 11: // Camera head movement speed multiplier
+                case 20: // Camera head movement speed multiplier
                     if (appState_->headMovementSpeedMultiplier > 0.5f) {
                         appState_->headMovementSpeedMultiplier -= 0.1f;
                         appState_->guiControl.changesEnqueued = true;
                     }
                     break;
-                case 12: // Headset movement prediction time in ms
+                case 21: // Headset movement prediction time in ms
                     if (appState_->headMovementPredictionMs > 0) {
                         appState_->headMovementPredictionMs -= 1;
                         appState_->guiControl.changesEnqueued = true;
@@ -756,11 +1176,8 @@ void TelepresenceProgram::HandleControllers() {
 
 
             // Apply streaming config button
-        else if (userState_.triggerValue[Side::LEFT] > 0.9f && appState_->guiControl.focusedElement == 9) {
-            stateStorage_->SaveAppState(*appState_);
-            init_scene(appState_->streamingConfig.resolution.getWidth(), appState_->streamingConfig.resolution.getHeight(), true);
-            gstreamerPlayer_->configurePipelines(gstreamerThreadPool_, appState_->streamingConfig);
-            restClient_->UpdateStreamingConfig(appState_->streamingConfig);
+        else if (userState_.triggerValue[Side::LEFT] > 0.9f && appState_->guiControl.focusedElement == 18) {
+            ApplyStreamingConfig();
             appState_->guiControl.changesEnqueued = true;
         }
     }
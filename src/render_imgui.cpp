@@ -5,6 +5,9 @@
 #include "imgui.h"
 #include "imgui_impl_opengl3.h"
 #include "render_imgui.h"
+#include "frame_buffer_pool.h"
+#include "pbo_upload_ring.h"
+#include "parallel_jpeg_decoder.h"
 #include "openxr/openxr.h"
 
 #define DISPLAY_SCALE_X 1.0f
@@ -17,7 +20,7 @@ static ImVec2 s_win_pos[10];
 static int s_win_num = 0;
 static ImVec2 s_mouse_pos;
 
-static int numberOfElements = 13;
+static int numberOfElements = 22;
 static int numberOfSegments = 5;
 
 int
@@ -189,43 +192,180 @@ static void render_settings_gui(const std::shared_ptr<AppState> &appState) {
                 appState->guiControl.focusedElement == 8
         );
 
-        focusable_button("Apply", appState->guiControl.focusedElement == 9);
+        focusable_text(
+                fmt::format("View region streaming: {}", BoolToString(appState->streamingConfig.roi)),
+                appState->guiControl.focusedElement == 9
+        );
+
+        focusable_text(
+                fmt::format("Adaptive bitrate: {}", BoolToString(appState->streamingConfig.adaptiveBitrate)),
+                appState->guiControl.focusedElement == 10
+        );
+
+        focusable_text(
+                fmt::format("Stereo sync: {}", StereoSyncPolicyToString(appState->stereoSyncPolicy)),
+                appState->guiControl.focusedElement == 11
+        );
+
+        focusable_text(
+                fmt::format("FEC: {}", FecSchemeToString(appState->streamingConfig.fecScheme)),
+                appState->guiControl.focusedElement == 12
+        );
+        focusable_text(
+                fmt::format("FEC overhead: {}%", appState->streamingConfig.fecOverheadPercent),
+                appState->guiControl.focusedElement == 13
+        );
+
+        // Whether the RetransmissionController of the running pipelines currently sends NACKs
+        auto rtxStats = appState->cameraStreamingStates().first.stats;
+        focusable_text(
+                fmt::format("Retransmission: {}{}", BoolToString(appState->streamingConfig.retransmission),
+                            !rtxStats || !appState->streamingConfig.retransmission ? ""
+                            : rtxStats->rtxActive.load() ? " (active)" : " (inactive, RTT too high)"),
+                appState->guiControl.focusedElement == 14
+        );
+
+        focusable_text(
+                fmt::format("GL context (next start): {}", GlContextModeToString(appState->glContextMode)),
+                appState->guiControl.focusedElement == 15
+        );
+
+        // Only used by the JPEG pipelines, planar YUV is converted to RGB on the GPU
+        focusable_text(
+                fmt::format("JPEG planar YUV: {}", BoolToString(appState->streamingConfig.jpegPlanarYuv)),
+                appState->guiControl.focusedElement == 16
+        );
+
+        focusable_text(
+                appState->streamingConfig.jpegDecodeThreads > 0
+                ? fmt::format("JPEG decode threads: {}", appState->streamingConfig.jpegDecodeThreads)
+                : std::string("JPEG decode threads: jpegdec"),
+                appState->guiControl.focusedElement == 17
+        );
+
+        focusable_button("Apply", appState->guiControl.focusedElement == 18);
 
         ImGui::SeparatorText("Status Information");
 
         focusable_text(
                 fmt::format("Camera head movement max speed: {}", appState->headMovementMaxSpeed),
-                appState->guiControl.focusedElement == 10
+                appState->guiControl.focusedElement == 19
         );
         focusable_text(
                 fmt::format("Head movement speed multiplier: {:.2}",
                             appState->headMovementSpeedMultiplier),
-                appState->guiControl.focusedElement == 11
+                appState->guiControl.focusedElement == 20
         );
         focusable_text(
                 fmt::format("Headset movement prediction: {} ms",
                             appState->headMovementPredictionMs),
-                appState->guiControl.focusedElement == 12
+                appState->guiControl.focusedElement == 21
         );
 
         ImGui::Text("Robot control: %s", BoolToString(appState->robotControlEnabled));
+        if (appState->rtpCapturing) {
+            ImGui::Text("Recording RTP packets (Y with the GUI hidden to stop)");
+        }
         ImGui::Text("");
-        ImGui::Text("Latencies (avg last 50 frames):");
-        auto s = appState->cameraStreamingStates.first.stats;
+        auto s = appState->cameraStreamingStates().first.stats;
+        if (s) {
+            // Percentiles of the presented frames of the last completed window
+            const auto &l = s->trace.latencies();
+            ImGui::Text("Latencies in ms, p50 / p95 / p99 / max (last %.0f s):",
+                        static_cast<double>(LatencyHistogram::DEFAULT_WINDOW_US) / 1e6);
+            auto line = [](const char *name, const LatencyHistogram &histogram) {
+                auto h = histogram.summary();
+                if (h.stale) {
+                    ImGui::Text("%-10s %6s (no frames for %.0f s)", name, "-",
+                                static_cast<double>(LatencyHistogram::DEFAULT_WINDOW_US) * 2 / 1e6);
+                    return;
+                }
+                ImGui::Text("%-10s %6.1f %6.1f %6.1f %6.1f", name, static_cast<double>(h.p50Us) / 1000,
+                            static_cast<double>(h.p95Us) / 1000, static_cast<double>(h.p99Us) / 1000,
+                            static_cast<double>(h.maxUs) / 1000);
+            };
+            auto stage = [&l](TraceStage stage) -> const LatencyHistogram & {
+                return l.stages[static_cast<size_t>(stage)];
+            };
+            double cameraExposing = s->fps.load() > 0 ? 1000.0 / s->fps.load() : 0;
+            ImGui::Text("%-10s %6.1f", "camera", cameraExposing);
+            line("vidConv", l.vidConv);
+            line("enc", l.encode);
+            line("rtpPay", l.rtpPay);
+            line("network", stage(TraceStage::FIRST_PACKET));
+            line("udpStream", stage(TraceStage::LAST_PACKET));
+            line("jitterBuf", stage(TraceStage::JITTER_BUFFER));
+            line("rtpDepay", stage(TraceStage::DEPAYLOADED));
+            line("dec", stage(TraceStage::DECODED));
+            line("queue", stage(TraceStage::QUEUED));
+            line("handoff", stage(TraceStage::READY));
+            line("render", stage(TraceStage::PRESENTED));
+            line("display", stage(TraceStage::DISPLAYED));
+            line("In Total", l.total);
+        }
         if (s) {
-            // Get averaged snapshot over last 50 frames for smoother display
-            auto snapshot = s->averagedSnapshot();
-            double cameraExposing = 1000000.0f / snapshot.fps;
-            ImGui::Text(
-                    "camera: %lu, vidConv: %lu, enc: %lu, rtpPay: %lu\nudpStream: %lu\nrtpDepay: %lu, dec: %lu, display: %lu",
-                    long(cameraExposing / 1000),
-                    snapshot.vidConv / 1000, snapshot.enc / 1000, snapshot.rtpPay / 1000,
-                    snapshot.udpStream / 1000, snapshot.rtpDepay / 1000, snapshot.dec / 1000,
-                    snapshot.presentation / 1000);
-            ImGui::Text("In Total: %lu: \n",
-                        (long(cameraExposing) + snapshot.vidConv + snapshot.enc + snapshot.rtpPay +
-                         snapshot.udpStream +
-                         snapshot.rtpDepay + snapshot.dec + snapshot.presentation) / 1000);
+            auto right = appState->cameraStreamingStates().second.stats;
+            ImGui::Text("First frame: %.0f / %.0f ms after the start (warm start %s)", s->firstFrameMs.load(),
+                        right ? right->firstFrameMs.load() : 0.0f,
+                        appState->streamingConfig.warmStart ? "on" : "off");
+            ImGui::Text("Jitter buffer: %d ms (jitter %.1f ms, late: %lu, lost: %lu)", s->jitterLatencyMs.load(),
+                        s->networkJitterMs.load(), (unsigned long) s->packetsLate.load(),
+                        (unsigned long) s->packetsLost.load());
+            if (appState->streamingConfig.fecScheme != NO_FEC) {
+                ImGui::Text("FEC %s %d%%: recovered %lu, unrecoverable %lu",
+                            FecSchemeToString(appState->streamingConfig.fecScheme).c_str(),
+                            appState->streamingConfig.fecOverheadPercent, (unsigned long) s->fecRecovered.load(),
+                            (unsigned long) s->fecUnrecovered.load());
+            }
+            static const char *usages[] = {"normal", "overuse", "underuse"};
+            int usage = std::clamp(s->bandwidthUsage.load(), 0, 2);
+            ImGui::Text("Bandwidth estimate%s: %.2f Mbit/s (received %.2f Mbit/s, lost %.1f%%, delay %s)",
+                        appState->streamingConfig.adaptiveBitrate ? " (adaptive)" : "",
+                        s->estimatedBitrate.load() / 1e6, s->receivedBitrate.load() / 1e6,
+                        s->bandwidthLoss.load() * 100, usages[usage]);
+            if (appState->streamingConfig.retransmission) {
+                uint64_t requested = s->rtxRequested.load();
+                ImGui::Text("Retransmission %s: repaired %lu/%lu (%.0f%%), too late: %lu, +%.1f ms per repaired frame",
+                            s->rtxActive.load() ? "on" : "off (RTT)", (unsigned long) s->rtxRepaired.load(),
+                            (unsigned long) requested,
+                            requested > 0 ? 100.0 * static_cast<double>(s->rtxRepaired.load()) / static_cast<double>(requested) : 0.0,
+                            (unsigned long) s->rtxSkipped.load(), s->rtxAddedLatencyMs.load());
+            }
+        }
+        auto m = appState->cameraStreamingStates().first.mailbox;
+        if (m) {
+            ImGui::Text("Frames produced: %lu, consumed: %lu, dropped: %lu",
+                        (unsigned long) m->produced(), (unsigned long) m->consumed(),
+                        (unsigned long) m->dropped());
+        }
+        auto ring = appState->cameraStreamingStates().first.uploadRing;
+        if (ring) {
+            ImGui::Text("Upload: %lu us (%s, %zu slots)", (unsigned long) ring->lastUploadUs(),
+                        ring->isPersistent() ? "PBO ring" : "client memory", ring->depth());
+            ImGui::Text("Uploads: %lu, skipped: %lu", (unsigned long) ring->uploads(),
+                        (unsigned long) ring->uploadsSkipped());
+        }
+        const auto &pool = FrameBufferPool::shared();
+        if (pool.hits() + pool.misses() > 0) {
+            ImGui::Text("Frame buffers: %.1f MiB resident (peak %.1f MiB), reused %.0f%%",
+                        static_cast<double>(pool.residentBytes()) / (1 << 20),
+                        static_cast<double>(pool.peakResidentBytes()) / (1 << 20), pool.hitRate() * 100);
+        }
+        const auto &sync = appState->stereoSyncStats;
+        ImGui::Text("Stereo pairs: %lu, unpaired: %lu, late: %lu", (unsigned long) sync.pairedFrames,
+                    (unsigned long) sync.unpairedFrames, (unsigned long) sync.lateFrames);
+        const auto &reconfiguration = appState->reconfigurationStats;
+        if (reconfiguration.lastClass != NO_CHANGE) {
+            ImGui::Text("Last apply: %s (%s)", ReconfigurationClassToString(reconfiguration.lastClass).c_str(),
+                        reconfiguration.lastFields.c_str());
+            ImGui::Text("Apply downtime: encoder %.0f ms, in place %.0f ms, rebuild %.0f ms",
+                        reconfiguration.downtimeMs[ENCODER_ONLY], reconfiguration.downtimeMs[RENEGOTIATE],
+                        reconfiguration.downtimeMs[REBUILD]);
+        }
+        auto decoder = appState->cameraStreamingStates().first.jpegDecoder;
+        if (decoder) {
+            ImGui::Text("JPEG decode: %zu slices (sliced: %lu, whole: %lu)", decoder->lastSliceCount(),
+                        (unsigned long) decoder->slicedFrames(), (unsigned long) decoder->wholeFrames());
         }
 
 
@@ -11,6 +11,8 @@
 #include "render_imgui.h"
 #include "util_render_target.h"
 #include "render_texplate.h"
+#include "pbo_upload_ring.h"
+#include "gl_sample_ring.h"
 
 #include "render_scene.h"
 #include "log.h"
@@ -24,10 +26,11 @@ static int TELEOPERATION_GUI_WIDTH = 300;
 static int TELEOPERATION_GUI_HEIGHT = 128;
 
 static GLuint cubeVertexBuffer{0}, cubeIndexBuffer{0}, vertexArrayObject{0},
-        vertexAttribCoords{0}, vertexAttribTexCoords{0}, texture2D{0};
+        vertexAttribCoords{0}, vertexAttribTexCoords{0};
 
 static shader_obj_t image_shader_object_2d;
 static shader_obj_t image_shader_object_oes;
+static shader_obj_t image_shader_object_yuv;
 static shader_obj_t gui_shader_object;
 
 static render_target_t settings_gui_render_target;
@@ -48,6 +51,8 @@ static const char *ImageVertexShaderGlsl = R"_(#version 320 es
     }
     )_";
 
+// Image fragment shaders are put together from the frame sampling of the texture kind (sampleFrame),
+// the view region compositing and a main
 static const char *ImageFragmentShaderGlsl = R"_(#version 320 es
     in lowp vec2 v_TexCoord;
 
@@ -55,8 +60,8 @@ static const char *ImageFragmentShaderGlsl = R"_(#version 320 es
 
     uniform sampler2D u_Texture;
 
-    void main() {
-        color = texture(u_Texture, v_TexCoord);
+    lowp vec4 sampleFrame(mediump vec2 uv) {
+        return texture(u_Texture, uv);
     }
     )_";
 
@@ -68,8 +73,80 @@ static const char *ImageFragmentShaderOES = R"_(#version 320 es
 
     uniform samplerExternalOES u_Texture;
 
+    lowp vec4 sampleFrame(mediump vec2 uv) {
+        return texture(u_Texture, uv);
+    }
+    )_";
+
+static const char *ImageFragmentShaderYUV = R"_(#version 320 es
+    in lowp vec2 v_TexCoord;
+    out lowp vec4 color;
+
+    uniform sampler2D u_Texture;  // Y
+    uniform sampler2D u_TextureU;
+    uniform sampler2D u_TextureV;
+    uniform bool u_LimitedRange;
+
+    lowp vec4 sampleFrame(mediump vec2 uv) {
+        mediump float y = texture(u_Texture, uv).r;
+        mediump float u = texture(u_TextureU, uv).r - 0.5;
+        mediump float v = texture(u_TextureV, uv).r - 0.5;
+
+        // JPEG is full range, expand limited-range 16-235 / 16-240 sources first
+        if (u_LimitedRange) {
+            y = (y - 16.0/255.0) * (255.0/219.0);
+            u = u * (255.0/224.0);
+            v = v * (255.0/224.0);
+        }
+
+        // BT.601
+        mediump vec3 rgb = vec3(y + 1.402 * v,
+                                y - 0.344136 * u - 0.714136 * v,
+                                y + 1.772 * u);
+        rgb = clamp(rgb, 0.0, 1.0);
+
+        // Decode sRGB like sampling the GL_SRGB8 texture of the RGB path does
+        rgb = mix(rgb / 12.92, pow((rgb + 0.055) / 1.055, vec3(2.4)), step(0.04045, rgb));
+
+        return vec4(rgb, 1.0);
+    }
+    )_";
+
+// View region frames (RoiRect) carry the whole view squeezed into their left half and a full-detail crop
+// of it in their right half. The crop is drawn over the whole view where it lies, faded in at its edges.
+static const char *ImageRoiGlsl = R"_(
+    uniform bool u_RoiEnabled;
+    uniform mediump vec4 u_Roi; // Crop in the whole view: x, y, width, height
+
+    lowp vec4 sampleView(mediump vec2 uv) {
+        if (!u_RoiEnabled) {
+            return sampleFrame(uv);
+        }
+        // Stay clear of the crop when filtering at the seam of the halves
+        lowp vec4 context = sampleFrame(vec2(min(uv.x * 0.5, 0.499), uv.y));
+        if (u_Roi.z <= 0.0 || u_Roi.w <= 0.0) {
+            return context;
+        }
+        mediump vec2 inCrop = (uv - u_Roi.xy) / u_Roi.zw;
+        mediump vec2 edge = min(inCrop, 1.0 - inCrop);
+        mediump float weight = smoothstep(0.0, 0.05, min(edge.x, edge.y));
+        if (weight <= 0.0) {
+            return context;
+        }
+        lowp vec4 detail = sampleFrame(vec2(max(0.5 + 0.5 * inCrop.x, 0.501), inCrop.y));
+        return mix(context, detail, weight);
+    }
+    )_";
+
+static const char *ImageMainGlsl = R"_(
+    void main() {
+        color = sampleView(v_TexCoord);
+    }
+    )_";
+
+static const char *ImageMainOES = R"_(
     void main() {
-        lowp vec4 c = texture(u_Texture, v_TexCoord);
+        lowp vec4 c = sampleView(v_TexCoord);
 
         // Assume limited-range 35–235 and expand to full range
         lowp vec3 rgb = (c.rgb - vec3(40.0/255.0)) * (255.0/235.0);
@@ -102,6 +179,12 @@ static const char *GuiFragmentShaderGlsl = R"_(#version 320 es
     }
 )_";
 
+static void generate_image_shader(shader_obj_t *shader_obj, const char *frameSampling, const char *main) {
+    std::string source = std::string(frameSampling) + ImageRoiGlsl + main;
+    const char *fragmentShader = source.c_str();
+    generate_shader(shader_obj, ImageVertexShaderGlsl, fragmentShader);
+}
+
 void init_scene(const int textureWidth, const int textureHeight, bool reinit) {
     if (reinit) {
         init_image_plane(textureWidth, textureHeight);
@@ -109,9 +192,11 @@ void init_scene(const int textureWidth, const int textureHeight, bool reinit) {
     }
 
     // 2D shader (JPEG / SW / GL_TEXTURE_2D)
-    generate_shader(&image_shader_object_2d, ImageVertexShaderGlsl, ImageFragmentShaderGlsl);
+    generate_image_shader(&image_shader_object_2d, ImageFragmentShaderGlsl, ImageMainGlsl);
     // OES shader (HW decoder giving GL_TEXTURE_EXTERNAL_OES)
-    generate_shader(&image_shader_object_oes, ImageVertexShaderGlsl, ImageFragmentShaderOES);
+    generate_image_shader(&image_shader_object_oes, ImageFragmentShaderOES, ImageMainOES);
+    // Planar YUV shader (JPEG planes converted on the GPU)
+    generate_image_shader(&image_shader_object_yuv, ImageFragmentShaderYUV, ImageMainGlsl);
     generate_shader(&gui_shader_object, GuiVertexShaderGlsl, GuiFragmentShaderGlsl);
     init_image_plane(textureWidth, textureHeight);
     init_imgui();
@@ -144,17 +229,31 @@ void init_image_plane(const int textureWidth, const int textureHeight) {
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeIndexBuffer);
     glVertexAttribPointer(vertexAttribCoords, 3, GL_FLOAT, GL_FALSE, sizeof(Geometry::Vertex),nullptr);
     glVertexAttribPointer(vertexAttribTexCoords, 2, GL_FLOAT, GL_FALSE, sizeof(Geometry::Vertex), reinterpret_cast<const void *>(sizeof(XrVector3f)));
+}
 
-    glGenTextures(1, &texture2D);
-    glBindTexture(GL_TEXTURE_2D, texture2D);
+static void init_camera_upload(CameraFrame &frame, int width, int height) {
+    delete frame.uploadRing;
+    frame.uploadRing = new PboUploadRing(width, height);
+    frame.mailbox = frame.uploadRing->mailbox();
+    delete frame.glSamples;
+    frame.glSamples = new GlSampleRing();
+}
 
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+void init_video_upload(CamPair *camPair, int width, int height) {
+    init_camera_upload(camPair->first, width, height);
+    init_camera_upload(camPair->second, width, height);
+}
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, textureWidth, textureHeight, 0, GL_SRGB,GL_UNSIGNED_BYTE, nullptr);
-    glBindTexture(GL_TEXTURE_2D, 0);
+void release_video_upload(CamPair *camPair) {
+    for (CameraFrame *frame: {&camPair->first, &camPair->second}) {
+        delete frame->uploadRing;
+        frame->uploadRing = nullptr;
+        frame->mailbox = nullptr;
+        delete frame->glSamples;
+        frame->glSamples = nullptr;
+        frame->jpegDecoder = nullptr;
+        frame->hasGlTexture = false;
+    }
 }
 
 void render_scene(const XrCompositionLayerProjectionView &layerView,
@@ -208,21 +307,32 @@ int draw_image_plane(const XrMatrix4x4f &vp, const Quad &quad, const CameraFrame
     GLenum              target = GL_TEXTURE_2D;
 
     if (cameraFrame->hasGlTexture) {
-        target = cameraFrame->glTarget; // set by GStreamer callback
+        if (!cameraFrame->glSamples || !cameraFrame->glSamples->texture()) { return 0; }
+        target = cameraFrame->glSamples->target(); // set by GStreamer callback
 
         if (target == GL_TEXTURE_EXTERNAL_OES) {
             shader = &image_shader_object_oes;
         } else { // treat everything else as 2D
             shader = &image_shader_object_2d;
         }
-    } else if (cameraFrame->dataHandle) {
-        // SW/JPEG fallback: will upload to our own GL_TEXTURE_2D
+    } else if (cameraFrame->uploadRing) {
+        // SW/JPEG fallback: will upload to the camera's own GL_TEXTURE_2D
         shader = &image_shader_object_2d;
         target = GL_TEXTURE_2D;
     } else {
         return 0;
     }
 
+    // Newest complete frame from the appsink callback, uploaded asynchronously through the PBO ring
+    GLuint uploadedTexture = 0;
+    if (!cameraFrame->hasGlTexture) {
+        uploadedTexture = cameraFrame->uploadRing->update();
+        if (!uploadedTexture) { return 0; }
+        if (cameraFrame->uploadRing->isPlanar()) {
+            shader = &image_shader_object_yuv;
+        }
+    }
+
     glUseProgram(shader->program);
     glBindVertexArray(vertexArrayObject);
 
@@ -233,19 +343,35 @@ int draw_image_plane(const XrMatrix4x4f &vp, const Quad &quad, const CameraFrame
     XrMatrix4x4f_Multiply(&mvp, &vp, &model);
     glUniformMatrix4fv(static_cast<GLint>(shader->loc_mvp), 1, GL_FALSE,reinterpret_cast<const GLfloat *>(&mvp));
 
+    // View region frames are composited from their two halves
+    const RoiRect roi = RoiRect::unpack(cameraFrame->hasGlTexture ? cameraFrame->glSamples->roi()
+                                                                  : cameraFrame->uploadRing->roi());
+    glUniform1i(shader->loc_roi_enabled, cameraFrame->roiPacked);
+    glUniform4f(shader->loc_roi, static_cast<float>(roi.x) / RoiRect::UNIT, static_cast<float>(roi.y) / RoiRect::UNIT,
+                static_cast<float>(roi.width) / RoiRect::UNIT, static_cast<float>(roi.height) / RoiRect::UNIT);
+
     glActiveTexture(GL_TEXTURE0);
 
     if(cameraFrame->hasGlTexture) {
         // HW decode path: use GL texture from GStreamer
-        glBindTexture(target, cameraFrame->glTexture);
+        glBindTexture(target, cameraFrame->glSamples->texture());
         glUniform1i((GLint)shader->loc_texture, 0);
-        //LOG_INFO("GSTREAMER: rendering GL texture %u (target=0x%x)", cameraFrame->glTexture, target);
+        //LOG_INFO("GSTREAMER: rendering GL texture %u (target=0x%x)", cameraFrame->glSamples->texture(), target);
     } else {
-        // SW / JPEG path: upload bytes
-        glBindTexture(GL_TEXTURE_2D, texture2D);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB, cameraFrame->frameWidth, cameraFrame->frameHeight, 0,
-                     GL_SRGB, GL_UNSIGNED_BYTE, cameraFrame->dataHandle);
+        // SW / JPEG path: texture filled by the upload ring
+        glBindTexture(GL_TEXTURE_2D, uploadedTexture);
         glUniform1i((GLint)shader->loc_texture, 0);
+
+        if (cameraFrame->uploadRing->isPlanar()) {
+            glActiveTexture(GL_TEXTURE1);
+            glBindTexture(GL_TEXTURE_2D, cameraFrame->uploadRing->planeTexture(1));
+            glUniform1i((GLint)shader->loc_texture_u, 1);
+            glActiveTexture(GL_TEXTURE2);
+            glBindTexture(GL_TEXTURE_2D, cameraFrame->uploadRing->planeTexture(2));
+            glUniform1i((GLint)shader->loc_texture_v, 2);
+            glUniform1i((GLint)shader->loc_limited_range, cameraFrame->uploadRing->isLimitedRange());
+            glActiveTexture(GL_TEXTURE0);
+        }
     }
 
     glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(ArraySize(Geometry::c_quadIndices)),GL_UNSIGNED_SHORT, nullptr);
@@ -3,10 +3,37 @@
 //
 #include <nlohmann/json.hpp>
 #include "rest_client.h"
+#include "pipeline_builder.h"
+#include "retransmission_controller.h"
 #include "log.h"
 
 using json = nlohmann::json;
 
+// RED/ULPFEC as the receive pipeline expects it (PipelineBuilder), the sender sends plain RTP for "NONE"
+static json FecToJson(const StreamingConfig &config) {
+    return json{{"scheme",           FecSchemeToString(config.fecScheme)},
+                {"overhead_percent", config.fecScheme == NO_FEC ? 0 : config.fecOverheadPercent},
+                {"red_payload",      PipelineBuilder::RED_PAYLOAD_TYPE},
+                {"fec_payload",      PipelineBuilder::FEC_PAYLOAD_TYPE}};
+}
+
+// Where the sender receives NACKs and which payload type its RTX stream (RFC 4588) uses
+static json RetransmissionToJson(const StreamingConfig &config) {
+    return json{{"enabled",         config.retransmission},
+                {"rtx_payload",     PipelineBuilder::RTX_PAYLOAD_TYPE},
+                {"nack_port_left",  config.portLeft + RetransmissionController::NACK_PORT_OFFSET},
+                {"nack_port_right", config.portRight + RetransmissionController::NACK_PORT_OFFSET}};
+}
+
+// View region frames: the whole view in the left half of the resolution, a crop of the source at its native
+// resolution in the right half, placed where the headset's view region messages point
+static json RoiToJson(const StreamingConfig &config) {
+    return json{{"enabled",       config.roi},
+                {"layout",        "side_by_side"},
+                {"source_height", config.roiSource.getHeight()},
+                {"source_width",  config.roiSource.getWidth()}};
+}
+
 RestClient::RestClient(StreamingConfig &config) : config_(config) {
 
     httpClient_ = std::make_unique<httplib::Client>(IpToString(config.jetson_ip).c_str(),
@@ -38,10 +65,13 @@ int RestClient::StartStream() {
     std::string req = json{{"bitrate",          config_.bitrate},
                            {"codec",            codec},
                            {"encoding_quality", config_.encodingQuality},
+                           {"fec",              FecToJson(config_)},
                            {"fps",              config_.fps},
                            {"ip_address",       IpToString(config_.headset_ip)},
                            {"port_left",        config_.portLeft},
                            {"port_right",       config_.portRight},
+                           {"retransmission",   RetransmissionToJson(config_)},
+                           {"roi",              RoiToJson(config_)},
                            {"resolution",       {{"height", config_.resolution.getHeight()}, {"width", config_.resolution.getWidth()}}},
                            {"video_mode",       config_.videoMode == VideoMode::STEREO ? "stereo": "mono"}}.dump();
 
@@ -100,10 +130,13 @@ int RestClient::UpdateStreamingConfig(const StreamingConfig &config) {
     std::string req = json{{"bitrate",          config.bitrate},
                            {"codec",            CodecToString(config.codec)},
                            {"encoding_quality", config.encodingQuality},
+                           {"fec",              FecToJson(config)},
                            {"fps",              config.fps},
                            {"ip_address",       IpToString(config_.headset_ip)},
                            {"port_left",        config.portLeft},
                            {"port_right",       config.portRight},
+                           {"retransmission",   RetransmissionToJson(config)},
+                           {"roi",              RoiToJson(config)},
                            {"resolution",       {{"height", config.resolution.getHeight()}, {"width", config.resolution.getWidth()}}},
                            {"video_mode",       config.videoMode == VideoMode::STEREO ? "stereo"
                                                                                       : "mono"}}.dump();
@@ -119,4 +152,18 @@ int RestClient::UpdateStreamingConfig(const StreamingConfig &config) {
     LOG_INFO("RestClient: Config updated successfully");
     config_ = config;
     return 0;
-}
\ No newline at end of file
+}
+
+int RestClient::RequestKeyframe() {
+    auto res = httpClient_->Post("/api/v1/stream/keyframe");
+    if (!res) {
+        LOG_ERROR("RestClient: Failed to send keyframe request - connection error");
+        return -1;
+    }
+    if (res->status != 200) {
+        LOG_ERROR("RestClient: Keyframe request failed with status %d: %s", res->status, res->body.c_str());
+        return -1;
+    }
+    LOG_INFO("RestClient: Keyframe requested");
+    return 0;
+}
@@ -0,0 +1,185 @@
+//
+// RetransmissionController - Requests lost packets again when the repair can still make it in time
+//
+#include "pch.h"
+#include "log.h"
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <random>
+
+#include "retransmission_controller.h"
+
+RetransmissionController::RetransmissionController(std::string name, const Settings &settings,
+                                                   const std::string &senderIp, int nackPort)
+        : name_(std::move(name)), settings_(settings), socket_(socket(AF_INET, SOCK_DGRAM, 0)),
+          senderSsrc_(std::random_device{}()) {
+    if (socket_ < 0) {
+        LOG_ERROR("RetransmissionController(%s): socket creation failed - errno: %d", name_.c_str(), errno);
+    }
+    destination_.sin_family = AF_INET;
+    destination_.sin_addr.s_addr = inet_addr(senderIp.c_str());
+    destination_.sin_port = htons(static_cast<uint16_t>(nackPort));
+}
+
+RetransmissionController::~RetransmissionController() {
+    if (socket_ >= 0) {
+        close(socket_);
+    }
+}
+
+RetransmissionController::Frame *RetransmissionController::findFrame(uint32_t rtpTimestamp) {
+    for (auto it = frames_.rbegin(); it != frames_.rend(); ++it) {
+        if (it->rtpTimestamp == rtpTimestamp) {
+            return &*it;
+        }
+    }
+    return nullptr;
+}
+
+void RetransmissionController::onPacket(uint64_t arrivalUs, uint16_t seqnum, uint32_t rtpTimestamp,
+                                        uint32_t ssrc, bool marker, bool retransmitted) {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    Frame *frame = findFrame(rtpTimestamp);
+    if (retransmitted) {
+        repaired_++;
+        // The frame was complete at the latest repair, later than it would have been without the loss
+        if (frame && arrivalUs > frame->lastArrivalUs + frame->addedUs) {
+            uint64_t addedUs = arrivalUs - frame->lastArrivalUs;
+            if (frame->addedUs == 0) {
+                repairedFrames_++;
+            }
+            addedUsTotal_ += static_cast<double>(addedUs - frame->addedUs);
+            frame->addedUs = addedUs;
+        }
+        return;
+    }
+
+    mediaSsrc_ = ssrc;
+    packets_[seqnum % PACKET_HISTORY] = {seqnum, rtpTimestamp, marker, true};
+    if (frame) {
+        frame->lastArrivalUs = arrivalUs;
+    } else {
+        frames_.push_back({rtpTimestamp, arrivalUs, arrivalUs, 0});
+        if (frames_.size() > FRAME_HISTORY) {
+            frames_.pop_front();
+        }
+    }
+}
+
+bool RetransmissionController::request(uint64_t nowUs, uint16_t seqnum) {
+    std::vector<uint8_t> nack;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!active_) {
+            skipped_++;
+            return false;
+        }
+
+        // The missing packet belongs to the frame of the packet before it, or to the next frame if that
+        // one ended a frame
+        const Frame *frame = nullptr;
+        bool nextFrame = false;
+        for (int gap = 1; gap <= MAX_GAP && !frame; ++gap) {
+            auto previous = static_cast<uint16_t>(seqnum - gap);
+            const Packet &packet = packets_[previous % PACKET_HISTORY];
+            if (packet.valid && packet.seqnum == previous) {
+                frame = findFrame(packet.rtpTimestamp);
+                nextFrame = packet.marker;
+                if (!frame) {
+                    break;
+                }
+            }
+        }
+        if (!frame) {
+            skipped_++;
+            return false;
+        }
+
+        uint64_t deadlineUs = frame->firstArrivalUs + static_cast<uint64_t>(latencyMs_) * 1000 +
+                              (nextFrame ? 1000000 / settings_.fps : 0);
+        if (nowUs + rttUs_ + settings_.marginUs > deadlineUs) {
+            skipped_++;
+            return false;
+        }
+        requested_++;
+        nack = buildNack(senderSsrc_, mediaSsrc_, seqnum);
+    }
+
+    if (socket_ >= 0) {
+        sendto(socket_, nack.data(), nack.size(), 0, reinterpret_cast<const sockaddr *>(&destination_),
+               sizeof(destination_));
+    }
+    return true;
+}
+
+void RetransmissionController::update(uint64_t rttUs, int latencyMs) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    rttUs_ = rttUs;
+    latencyMs_ = latencyMs;
+
+    // An unknown RTT (no NTP reply yet) keeps retransmission off
+    auto frameIntervalUs = 1000000.0 / settings_.fps;
+    bool active = rttUs > 0 && static_cast<double>(rttUs) <= settings_.maxRttShare * frameIntervalUs &&
+                  rttUs + settings_.marginUs < static_cast<uint64_t>(latencyMs) * 1000;
+    if (active != active_) {
+        LOG_INFO("RetransmissionController(%s): retransmission %s, RTT %.1f ms, frame interval %.1f ms, latency %d ms",
+                 name_.c_str(), active ? "on" : "off", static_cast<double>(rttUs) / 1000.0, frameIntervalUs / 1000.0,
+                 latencyMs);
+    }
+    active_ = active;
+}
+
+void RetransmissionController::setFps(int fps) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    settings_.fps = std::max(1, fps);
+}
+
+bool RetransmissionController::active() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_;
+}
+
+int RetransmissionController::deadlineMs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto repairMs = static_cast<int>((rttUs_ + settings_.marginUs + 999) / 1000);
+    return std::max(0, latencyMs_ - repairMs);
+}
+
+uint64_t RetransmissionController::requested() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return requested_;
+}
+
+uint64_t RetransmissionController::skipped() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return skipped_;
+}
+
+uint64_t RetransmissionController::repaired() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return repaired_;
+}
+
+double RetransmissionController::addedLatencyUs() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return repairedFrames_ > 0 ? addedUsTotal_ / static_cast<double>(repairedFrames_) : 0;
+}
+
+std::vector<uint8_t> RetransmissionController::buildNack(uint32_t senderSsrc, uint32_t mediaSsrc, uint16_t seqnum) {
+    // V=2, FMT=1 (generic NACK), PT=205 (RTPFB), length 3 words after the first, one FCI with an empty
+    // bitmask of following lost packets
+    std::vector<uint8_t> nack = {0x81, 205, 0, 3};
+    auto put32 = [&nack](uint32_t value) {
+        nack.push_back(static_cast<uint8_t>(value >> 24));
+        nack.push_back(static_cast<uint8_t>(value >> 16));
+        nack.push_back(static_cast<uint8_t>(value >> 8));
+        nack.push_back(static_cast<uint8_t>(value));
+    };
+    put32(senderSsrc);
+    put32(mediaSsrc);
+    put32(static_cast<uint32_t>(seqnum) << 16);
+    return nack;
+}
@@ -63,6 +63,27 @@ void RobotControlSender::sendRobotControl(float linearX, float linearY, float an
     });
 }
 
+void RobotControlSender::sendViewRegion(XrQuaternionf quatPose, XrFovf fov, BS::thread_pool<BS::tp::none> &threadPool) {
+    if (!isInitialized_) {
+        return;
+    }
+
+    threadPool.detach_task([this, quatPose, fov]() {
+        auto azElev = quaternionToAzimuthElevation(quatPose);
+        sendViewRegionPacket(azElev.azimuth, azElev.elevation, fov, ntpTimer_->GetCurrentTimeUs());
+    });
+}
+
+void RobotControlSender::sendBitrate(int bitrate, BS::thread_pool<BS::tp::none> &threadPool) {
+    if (!isInitialized_ || bitrate <= 0) {
+        return;
+    }
+
+    threadPool.detach_task([this, bitrate]() {
+        sendBitratePacket(static_cast<uint32_t>(bitrate), ntpTimer_->GetCurrentTimeUs());
+    });
+}
+
 void RobotControlSender::sendHeadPosePacket(float azimuth, float elevation, float speed, uint64_t timestamp) {
     std::vector<uint8_t> packet;
     packet.reserve(21);
@@ -119,6 +140,43 @@ void RobotControlSender::sendRobotControlPacket(float linearX, float linearY, fl
     }
 }
 
+void RobotControlSender::sendViewRegionPacket(float azimuth, float elevation, const XrFovf &fov, uint64_t timestamp) {
+    std::vector<uint8_t> packet;
+    packet.reserve(33);
+
+    packet.push_back(MSG_VIEW_REGION);
+    serializeLittleEndian(packet, azimuth);
+    serializeLittleEndian(packet, elevation);
+    serializeLittleEndian(packet, fov.angleLeft);
+    serializeLittleEndian(packet, fov.angleRight);
+    serializeLittleEndian(packet, fov.angleUp);
+    serializeLittleEndian(packet, fov.angleDown);
+    serializeLittleEndian(packet, timestamp);
+
+    ssize_t sent = sendto(socket_, packet.data(), packet.size(), 0,
+                          (sockaddr*)&destAddr_, sizeof(destAddr_));
+
+    if (sent < 0) {
+        LOG_ERROR("RobotControlSender: Failed to send view region packet - errno: %d", errno);
+    }
+}
+
+void RobotControlSender::sendBitratePacket(uint32_t bitrate, uint64_t timestamp) {
+    std::vector<uint8_t> packet;
+    packet.reserve(13);
+
+    packet.push_back(MSG_BITRATE);
+    serializeLittleEndian(packet, bitrate);
+    serializeLittleEndian(packet, timestamp);
+
+    ssize_t sent = sendto(socket_, packet.data(), packet.size(), 0,
+                          (sockaddr*)&destAddr_, sizeof(destAddr_));
+
+    if (sent < 0) {
+        LOG_ERROR("RobotControlSender: Failed to send bitrate packet - errno: %d", errno);
+    }
+}
+
 RobotControlSender::AzimuthElevation RobotControlSender::quaternionToAzimuthElevation(XrQuaternionf q) {
     // Convert quaternion to Euler angles (yaw/pitch) for OpenXR coordinate system
     // OpenXR uses right-handed: +X right, +Y up, +Z backward (forward is -Z)
@@ -0,0 +1,121 @@
+//
+// RtpCapture - Raw RTP packets of one stream with their arrival times, written to and read from a file
+//
+#include "pch.h"
+#include <fmt/format.h>
+#include <algorithm>
+#include <cerrno>
+
+#include "rtp_capture.h"
+
+static constexpr char MAGIC[8] = {'B', 'T', 'R', 'T', 'P', 'C', 'A', 'P'};
+static constexpr uint16_t VERSION = 1;
+static constexpr size_t HEADER_SIZE = sizeof(MAGIC) + 12;
+static constexpr size_t PACKET_HEADER_SIZE = 6;
+
+static void put16(uint8_t *out, uint16_t value) {
+    out[0] = static_cast<uint8_t>(value);
+    out[1] = static_cast<uint8_t>(value >> 8);
+}
+
+static void put32(uint8_t *out, uint32_t value) {
+    put16(out, static_cast<uint16_t>(value));
+    put16(out + 2, static_cast<uint16_t>(value >> 16));
+}
+
+static uint16_t get16(const uint8_t *in) {
+    return static_cast<uint16_t>(in[0] | in[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *in) {
+    return get16(in) | static_cast<uint32_t>(get16(in + 2)) << 16;
+}
+
+RtpCaptureInfo RtpCaptureInfo::fromConfig(const StreamingConfig &config) {
+    RtpCaptureInfo info;
+    info.codec = config.codec;
+    info.width = config.resolution.getWidth();
+    info.height = config.resolution.getHeight();
+    info.fps = config.fps;
+    info.fecScheme = config.fecScheme;
+    info.retransmission = config.retransmission;
+    return info;
+}
+
+RtpCaptureWriter::RtpCaptureWriter(const std::string &path, const RtpCaptureInfo &info)
+        : path_(path), file_(fopen(path.c_str(), "wb")) {
+    if (!file_) {
+        throw std::runtime_error(fmt::format("Cannot create RTP capture {}: errno {}", path, errno));
+    }
+
+    uint8_t header[HEADER_SIZE] = {};
+    std::copy(std::begin(MAGIC), std::end(MAGIC), header);
+    uint8_t *fields = header + sizeof(MAGIC);
+    put16(fields, VERSION);
+    fields[2] = static_cast<uint8_t>(info.codec);
+    fields[3] = static_cast<uint8_t>(info.fecScheme);
+    fields[4] = info.retransmission ? 1 : 0;
+    put16(fields + 6, static_cast<uint16_t>(info.width));
+    put16(fields + 8, static_cast<uint16_t>(info.height));
+    put16(fields + 10, static_cast<uint16_t>(info.fps));
+    fwrite(header, 1, sizeof(header), file_);
+}
+
+RtpCaptureWriter::~RtpCaptureWriter() {
+    fclose(file_);
+}
+
+void RtpCaptureWriter::write(uint64_t arrivalUs, const uint8_t *data, size_t size) {
+    // UDP payloads never exceed 64 KiB, the gap between packets is capped at 71 minutes
+    uint64_t sincePrevious = packets_ > 0 && arrivalUs > lastArrivalUs_ ? arrivalUs - lastArrivalUs_ : 0;
+    uint8_t packetHeader[PACKET_HEADER_SIZE];
+    put32(packetHeader, static_cast<uint32_t>(std::min<uint64_t>(sincePrevious, UINT32_MAX)));
+    put16(packetHeader + 4, static_cast<uint16_t>(std::min<size_t>(size, UINT16_MAX)));
+    fwrite(packetHeader, 1, sizeof(packetHeader), file_);
+    fwrite(data, 1, std::min<size_t>(size, UINT16_MAX), file_);
+
+    lastArrivalUs_ = arrivalUs;
+    packets_++;
+}
+
+RtpCaptureReader::RtpCaptureReader(const std::string &path) : file_(fopen(path.c_str(), "rb")) {
+    if (!file_) {
+        throw std::runtime_error(fmt::format("Cannot open RTP capture {}: errno {}", path, errno));
+    }
+
+    uint8_t header[HEADER_SIZE];
+    const uint8_t *fields = header + sizeof(MAGIC);
+    if (fread(header, 1, sizeof(header), file_) != sizeof(header) ||
+        !std::equal(std::begin(MAGIC), std::end(MAGIC), header) || get16(fields) != VERSION ||
+        fields[2] >= Codec::Count || fields[3] > ULPFEC) {
+        fclose(file_);
+        throw std::runtime_error(fmt::format("{} is not an RTP capture of version {}", path, VERSION));
+    }
+    info_.codec = static_cast<Codec>(fields[2]);
+    info_.fecScheme = static_cast<FecScheme>(fields[3]);
+    info_.retransmission = fields[4] != 0;
+    info_.width = get16(fields + 6);
+    info_.height = get16(fields + 8);
+    info_.fps = get16(fields + 10);
+    firstPacket_ = ftell(file_);
+}
+
+RtpCaptureReader::~RtpCaptureReader() {
+    fclose(file_);
+}
+
+bool RtpCaptureReader::next(Packet &packet) {
+    uint8_t packetHeader[PACKET_HEADER_SIZE];
+    if (fread(packetHeader, 1, sizeof(packetHeader), file_) != sizeof(packetHeader)) {
+        return false;
+    }
+    arrivalUs_ += get32(packetHeader);
+    packet.arrivalUs = arrivalUs_;
+    packet.data.resize(get16(packetHeader + 4));
+    return fread(packet.data.data(), 1, packet.data.size(), file_) == packet.data.size();
+}
+
+void RtpCaptureReader::rewind() {
+    fseek(file_, firstPacket_, SEEK_SET);
+    arrivalUs_ = 0;
+}
@@ -0,0 +1,55 @@
+//
+// RtpReplaySource - Feeds a recorded RTP capture into a receive pipeline in place of udpsrc
+//
+#include "pch.h"
+#include <gst/app/gstappsrc.h>
+#include <fmt/format.h>
+#include <chrono>
+
+#include "rtp_replay_source.h"
+
+RtpReplaySource::RtpReplaySource(GstElement *pipeline, const std::string &capturePath, Pacing pacing, int loops)
+        : appsrc_(gst_bin_get_by_name(GST_BIN(pipeline), "replaysrc")), reader_(capturePath), pacing_(pacing),
+          loops_(std::max(1, loops)) {
+    if (!appsrc_) {
+        throw std::runtime_error(fmt::format("Replaying {} needs a pipeline with replaysrc", capturePath));
+    }
+}
+
+RtpReplaySource::~RtpReplaySource() {
+    stop_ = true;
+    if (thread_.joinable()) {
+        thread_.join();
+    }
+    gst_object_unref(appsrc_);
+}
+
+void RtpReplaySource::start() {
+    if (!thread_.joinable()) {
+        thread_ = std::thread(&RtpReplaySource::run, this);
+    }
+}
+
+void RtpReplaySource::run() {
+    RtpCaptureReader::Packet packet;
+    for (int loop = 0; loop < loops_ && !stop_; ++loop) {
+        reader_.rewind();
+        auto start = std::chrono::steady_clock::now();
+        while (!stop_ && reader_.next(packet)) {
+            if (pacing_ == Pacing::ORIGINAL) {
+                std::this_thread::sleep_until(start + std::chrono::microseconds(packet.arrivalUs));
+            }
+
+            GstBuffer *buffer = gst_buffer_new_allocate(nullptr, packet.data.size(), nullptr);
+            gst_buffer_fill(buffer, 0, packet.data.data(), packet.data.size());
+            if (gst_app_src_push_buffer(GST_APP_SRC(appsrc_), buffer) != GST_FLOW_OK) {
+                // Flushing or shut down
+                stop_ = true;
+                break;
+            }
+            packets_.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc_));
+    finished_.store(true, std::memory_order_release);
+}
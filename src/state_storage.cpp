@@ -2,6 +2,7 @@
 // Created by standa on 05.01.25.
 //
 #include "state_storage.h"
+#include <cmath>
 
 StateStorage::StateStorage(android_app *app) {
     // Check if the current thread is already attached to the JVM
@@ -44,12 +45,37 @@ void StateStorage::SaveAppState(const AppState &appState) {
         SaveKeyValuePair(editor, putString, "resolution", appState.streamingConfig.resolution.getLabel());
         SaveKeyValuePair(editor, putString, "video_mode", appState.streamingConfig.videoMode);
         SaveKeyValuePair(editor, putString, "fps", appState.streamingConfig.fps);
+        SaveKeyValuePair(editor, putString, "jpeg_planar_yuv", appState.streamingConfig.jpegPlanarYuv);
+        SaveKeyValuePair(editor, putString, "jpeg_decode_threads", appState.streamingConfig.jpegDecodeThreads);
+        SaveKeyValuePair(editor, putString, "jitter_latency_ms", appState.streamingConfig.jitterLatencyMs);
+        SaveKeyValuePair(editor, putString, "adaptive_jitter", appState.streamingConfig.adaptiveJitter);
+        SaveKeyValuePair(editor, putString, "jitter_target_loss", static_cast<int>(std::lround(appState.streamingConfig.jitterTargetLoss * 10000))); // In basis points to build around integer formatting
+        SaveKeyValuePair(editor, putString, "fec_scheme", static_cast<int>(appState.streamingConfig.fecScheme));
+        SaveKeyValuePair(editor, putString, "fec_overhead_percent", appState.streamingConfig.fecOverheadPercent);
+        SaveKeyValuePair(editor, putString, "retransmission", appState.streamingConfig.retransmission);
+        SaveKeyValuePair(editor, putString, "roi", appState.streamingConfig.roi);
+        SaveKeyValuePair(editor, putString, "adaptive_bitrate", appState.streamingConfig.adaptiveBitrate);
+        SaveKeyValuePair(editor, putString, "warm_start", appState.streamingConfig.warmStart);
 
         SaveKeyValuePair(editor, putString, "aspect_ratio_mode", static_cast<int>(appState.aspectRatioMode));
+        SaveKeyValuePair(editor, putString, "stereo_sync_policy", static_cast<int>(appState.stereoSyncPolicy));
+        SaveKeyValuePair(editor, putString, "stereo_sync_timeout_ms", appState.stereoSyncTimeoutMs);
+        SaveKeyValuePair(editor, putString, "gl_context_mode", static_cast<int>(appState.glContextMode));
         SaveKeyValuePair(editor, putString, "head_movement_max_speed", appState.headMovementMaxSpeed);
         SaveKeyValuePair(editor, putString, "head_movement_prediction_ms", appState.headMovementPredictionMs);
         SaveKeyValuePair(editor, putString, "head_movement_speed_multiplier", appState.headMovementSpeedMultiplier * 10); // To build around integer formatting
         SaveKeyValuePair(editor, putString, "robot_control_enabled", appState.robotControlEnabled);
+
+        SaveKeyValuePair(editor, putString, "decoder_fingerprint", appState.decoderRanking.fingerprint);
+        for (int codec = 0; codec < Codec::Count; ++codec) {
+            std::string decoders;
+            for (const auto &decoder: appState.decoderRanking.decoders[codec]) {
+                decoders += (decoders.empty() ? "" : ",") + decoder;
+            }
+            SaveKeyValuePair(editor, putString, "decoder_ranking_" + CodecToString(static_cast<Codec>(codec)), decoders);
+            SaveKeyValuePair(editor, putString, "decoder_probed_" + CodecToString(static_cast<Codec>(codec)),
+                             appState.decoderRanking.probed[codec]);
+        }
     }
 
 
@@ -107,13 +133,90 @@ AppState StateStorage::LoadAppState() {
         appState.streamingConfig.resolution = CameraResolution::fromLabel(LoadValue(sharedPreferences, getString, "resolution"));
         appState.streamingConfig.videoMode = VideoMode(std::stoi(LoadValue(sharedPreferences, getString, "video_mode")));
         appState.streamingConfig.fps = std::stoi(LoadValue(sharedPreferences, getString, "fps"));
+        // Not stored by older versions, keep the default instead of discarding the whole state
+        std::string jpegPlanarYuv = LoadValue(sharedPreferences, getString, "jpeg_planar_yuv");
+        if (jpegPlanarYuv != "unknown") {
+            appState.streamingConfig.jpegPlanarYuv = std::stoi(jpegPlanarYuv);
+        }
+        std::string jpegDecodeThreads = LoadValue(sharedPreferences, getString, "jpeg_decode_threads");
+        if (jpegDecodeThreads != "unknown") {
+            appState.streamingConfig.jpegDecodeThreads = std::stoi(jpegDecodeThreads);
+        }
+        std::string jitterLatencyMs = LoadValue(sharedPreferences, getString, "jitter_latency_ms");
+        if (jitterLatencyMs != "unknown") {
+            appState.streamingConfig.jitterLatencyMs = std::stoi(jitterLatencyMs);
+        }
+        std::string adaptiveJitter = LoadValue(sharedPreferences, getString, "adaptive_jitter");
+        if (adaptiveJitter != "unknown") {
+            appState.streamingConfig.adaptiveJitter = std::stoi(adaptiveJitter);
+        }
+        std::string jitterTargetLoss = LoadValue(sharedPreferences, getString, "jitter_target_loss");
+        if (jitterTargetLoss != "unknown") {
+            appState.streamingConfig.jitterTargetLoss = std::stof(jitterTargetLoss) / 10000.0f;
+        }
+        std::string fecScheme = LoadValue(sharedPreferences, getString, "fec_scheme");
+        if (fecScheme != "unknown") {
+            appState.streamingConfig.fecScheme = static_cast<FecScheme>(std::stoi(fecScheme));
+        }
+        std::string fecOverheadPercent = LoadValue(sharedPreferences, getString, "fec_overhead_percent");
+        if (fecOverheadPercent != "unknown") {
+            appState.streamingConfig.fecOverheadPercent = std::stoi(fecOverheadPercent);
+        }
+        std::string retransmission = LoadValue(sharedPreferences, getString, "retransmission");
+        if (retransmission != "unknown") {
+            appState.streamingConfig.retransmission = std::stoi(retransmission);
+        }
+        std::string roi = LoadValue(sharedPreferences, getString, "roi");
+        if (roi != "unknown") {
+            appState.streamingConfig.roi = std::stoi(roi);
+        }
+        std::string adaptiveBitrate = LoadValue(sharedPreferences, getString, "adaptive_bitrate");
+        if (adaptiveBitrate != "unknown") {
+            appState.streamingConfig.adaptiveBitrate = std::stoi(adaptiveBitrate);
+        }
+        std::string warmStart = LoadValue(sharedPreferences, getString, "warm_start");
+        if (warmStart != "unknown") {
+            appState.streamingConfig.warmStart = std::stoi(warmStart);
+        }
 
         appState.aspectRatioMode = static_cast<AspectRatioMode>(std::stoi(LoadValue(sharedPreferences, getString, "aspect_ratio_mode")));
+        std::string stereoSyncPolicy = LoadValue(sharedPreferences, getString, "stereo_sync_policy");
+        if (stereoSyncPolicy != "unknown") {
+            appState.stereoSyncPolicy = static_cast<StereoSyncPolicy>(std::stoi(stereoSyncPolicy));
+        }
+        std::string stereoSyncTimeoutMs = LoadValue(sharedPreferences, getString, "stereo_sync_timeout_ms");
+        if (stereoSyncTimeoutMs != "unknown") {
+            appState.stereoSyncTimeoutMs = std::stoi(stereoSyncTimeoutMs);
+        }
+        std::string glContextMode = LoadValue(sharedPreferences, getString, "gl_context_mode");
+        if (glContextMode != "unknown") {
+            appState.glContextMode = static_cast<GlContextMode>(std::stoi(glContextMode));
+        }
         appState.headMovementMaxSpeed = std::stoi(LoadValue(sharedPreferences, getString, "head_movement_max_speed"));
         appState.headMovementPredictionMs = std::stoi(LoadValue(sharedPreferences, getString, "head_movement_prediction_ms"));
         appState.headMovementSpeedMultiplier = std::stof(LoadValue(sharedPreferences, getString, "head_movement_speed_multiplier") ) / 10.0f; // To build around integer formatting
         appState.robotControlEnabled = std::stoi(LoadValue(sharedPreferences, getString, "robot_control_enabled"));
 
+        // Codecs without a stored ranking are probed in the background on the next start
+        std::string decoderFingerprint = LoadValue(sharedPreferences, getString, "decoder_fingerprint");
+        if (decoderFingerprint != "unknown") {
+            appState.decoderRanking.fingerprint = decoderFingerprint;
+            for (int codec = 0; codec < Codec::Count; ++codec) {
+                std::stringstream decoders(LoadValue(sharedPreferences, getString,
+                                                     "decoder_ranking_" + CodecToString(static_cast<Codec>(codec))));
+                std::string decoder;
+                while (std::getline(decoders, decoder, ',')) {
+                    if (!decoder.empty() && decoder != "unknown") {
+                        appState.decoderRanking.decoders[codec].push_back(decoder);
+                    }
+                }
+                std::string probed = LoadValue(sharedPreferences, getString,
+                                               "decoder_probed_" + CodecToString(static_cast<Codec>(codec)));
+                appState.decoderRanking.probed[codec] = !appState.decoderRanking.decoders[codec].empty() ||
+                                                        (probed != "unknown" && std::stoi(probed) != 0);
+            }
+        }
+
     } catch(const std::exception& e) {
         env_->DeleteLocalRef(sharedPreferences);
         env_->DeleteLocalRef(prefsClass);
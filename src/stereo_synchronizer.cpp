@@ -0,0 +1,155 @@
+//
+// StereoSynchronizer - Presents left and right camera frames as matched pairs
+//
+#include "pch.h"
+#include "log.h"
+#include "pbo_upload_ring.h"
+#include "gl_sample_ring.h"
+
+#include "stereo_synchronizer.h"
+
+static_assert(PboUploadRing::MAX_DEPTH <= StereoSynchronizer::MAX_RING_DEPTH &&
+              GlSampleRing::DEFAULT_DEPTH <= StereoSynchronizer::MAX_RING_DEPTH);
+
+// Newest frame id in `frameIds` that is newer than `after`, 0 if there is none
+static uint64_t newest_after(const uint64_t *frameIds, size_t count, uint64_t after) {
+    uint64_t newest = 0;
+    for (size_t i = 0; i < count; ++i) {
+        if (frameIds[i] > after && frameIds[i] > newest) {
+            newest = frameIds[i];
+        }
+    }
+    return newest;
+}
+
+void StereoSynchronizer::setPolicy(StereoSyncPolicy policy, int timeoutMs) {
+    policy_ = policy;
+    timeout_ = std::chrono::milliseconds(std::max(0, timeoutMs));
+    waiting_ = false;
+    LOG_INFO("StereoSynchronizer: %s, timeout %d ms", StereoSyncPolicyToString(policy).c_str(), timeoutMs);
+}
+
+void StereoSynchronizer::select(CamPair &cameras, bool mono, StereoSyncStats &stats) {
+    // Only the rings of the path the frames arrive on are paired, the other ones stay empty
+    bool hardware = cameras.first.hasGlTexture && (mono || cameras.second.hasGlTexture);
+    for (CameraFrame *camera: {&cameras.first, &cameras.second}) {
+        if (camera->glSamples && (camera == &cameras.first || !mono) && !hardware) {
+            camera->glSamples->selectLatest();
+        }
+    }
+
+    if (hardware) {
+        selectPair(cameras.first.glSamples, cameras.second.glSamples, mono, stats);
+    } else {
+        selectPair(cameras.first.uploadRing, cameras.second.uploadRing, mono, stats);
+    }
+}
+
+template<typename Ring>
+void StereoSynchronizer::selectPair(Ring *left, Ring *right, bool mono, StereoSyncStats &stats) {
+    if (mono || policy_ == INDEPENDENT || !left || !right) {
+        if (left) {
+            left->selectLatest();
+        }
+        if (right && !mono) {
+            right->selectLatest();
+        }
+        return;
+    }
+
+    // New rings after a reconfiguration start a new stream
+    if (left != left_ || right != right_) {
+        left_ = left;
+        right_ = right;
+        presentedFrameId_ = 0;
+        waiting_ = false;
+    }
+
+    uint64_t leftIds[MAX_RING_DEPTH], rightIds[MAX_RING_DEPTH];
+    size_t leftCount = left->mailbox()->readyFrameIds(leftIds, MAX_RING_DEPTH);
+    size_t rightCount = right->mailbox()->readyFrameIds(rightIds, MAX_RING_DEPTH);
+
+    // Untagged frames cannot be paired
+    for (size_t i = 0; i < leftCount; ++i) {
+        if (leftIds[i] == 0) {
+            selectLatest(left, right);
+            return;
+        }
+    }
+    for (size_t i = 0; i < rightCount; ++i) {
+        if (rightIds[i] == 0) {
+            selectLatest(left, right);
+            return;
+        }
+    }
+
+    uint64_t newestLeft = newest_after(leftIds, leftCount, 0);
+    uint64_t newestRight = newest_after(rightIds, rightCount, 0);
+    if ((newestLeft && newestLeft + RESYNC_GAP < presentedFrameId_) ||
+        (newestRight && newestRight + RESYNC_GAP < presentedFrameId_)) {
+        LOG_INFO("StereoSynchronizer: frame ids restarted, resetting pairing");
+        presentedFrameId_ = 0;
+    }
+
+    // Newest pair that is newer than the one on screen
+    uint64_t pair = 0;
+    for (size_t i = 0; i < leftCount; ++i) {
+        for (size_t j = 0; j < rightCount; ++j) {
+            if (leftIds[i] == rightIds[j] && leftIds[i] > presentedFrameId_ && leftIds[i] > pair) {
+                pair = leftIds[i];
+            }
+        }
+    }
+
+    if (pair != 0) {
+        bool leftSelected = left->select(pair);
+        bool rightSelected = right->select(pair);
+        if (leftSelected && rightSelected) {
+            stats.pairedFrames++;
+        } else {
+            // Replaced by the producer since the snapshot, show whatever is newest
+            selectLatest(left, right);
+            stats.unpairedFrames++;
+        }
+        presentedFrameId_ = pair;
+        waiting_ = false;
+        return;
+    }
+
+    if (!newest_after(leftIds, leftCount, presentedFrameId_) &&
+        !newest_after(rightIds, rightCount, presentedFrameId_)) {
+        // Nothing new. A camera that fell behind after a timeout catches up once its late frame arrives
+        uint64_t shownLeft = left->mailbox()->front() ? left->mailbox()->front()->frameId : 0;
+        uint64_t shownRight = right->mailbox()->front() ? right->mailbox()->front()->frameId : 0;
+        if (shownLeft != shownRight) {
+            Ring *behind = shownLeft < shownRight ? left : right;
+            if (behind->select(std::max(shownLeft, shownRight))) {
+                stats.pairedFrames++;
+            }
+        }
+        return;
+    }
+
+    if (policy_ == WAIT_FOR_PAIR) {
+        auto now = std::chrono::steady_clock::now();
+        if (!waiting_) {
+            waiting_ = true;
+            waitingSince_ = now;
+        }
+        if (now - waitingSince_ < timeout_) {
+            return;
+        }
+        stats.lateFrames++;
+    }
+
+    selectLatest(left, right);
+    stats.unpairedFrames++;
+    presentedFrameId_ = std::max(newestLeft, newestRight);
+}
+
+template<typename Ring>
+void StereoSynchronizer::selectLatest(Ring *left, Ring *right) {
+    left->selectLatest();
+    right->selectLatest();
+    waiting_ = false;
+}
@@ -0,0 +1,57 @@
+//
+// StreamingConfigDiff - Classifies what applying a new StreamingConfig takes
+//
+#include "pch.h"
+
+#include "streaming_config_diff.h"
+
+static bool same_resolution(const CameraResolution &a, const CameraResolution &b) {
+    return a.getWidth() == b.getWidth() && a.getHeight() == b.getHeight();
+}
+
+StreamingConfigDiff::StreamingConfigDiff(const StreamingConfig &running, const StreamingConfig &next) {
+    const bool h265 = next.codec == Codec::H265;
+    const bool jpeg = next.codec == Codec::JPEG;
+
+    compare(running.headset_ip != next.headset_ip, "headset_ip", true, REBUILD);
+    compare(running.jetson_ip != next.jetson_ip, "jetson_ip", true, REBUILD);
+    compare(running.portLeft != next.portLeft || running.portRight != next.portRight, "ports", true, REBUILD);
+    compare(running.codec != next.codec, "codec", true, REBUILD);
+    compare(running.encodingQuality != next.encodingQuality, "encoding_quality", true, NO_CHANGE);
+    compare(running.bitrate != next.bitrate, "bitrate", true, NO_CHANGE);
+    compare(!same_resolution(running.resolution, next.resolution), "resolution", true, REBUILD);
+    compare(running.videoMode != next.videoMode, "video_mode", true, NO_CHANGE);
+    compare(running.fps != next.fps, "fps", true, h265 ? REBUILD : RENEGOTIATE);
+    compare(jpeg && running.jpegPlanarYuv != next.jpegPlanarYuv, "jpeg_planar_yuv", false, REBUILD);
+    compare(jpeg && running.jpegDecodeThreads != next.jpegDecodeThreads, "jpeg_decode_threads", false, REBUILD);
+    compare(running.jitterLatencyMs != next.jitterLatencyMs || running.adaptiveJitter != next.adaptiveJitter ||
+            running.jitterTargetLoss != next.jitterTargetLoss, "jitter", false, RENEGOTIATE);
+    compare(running.fecScheme != next.fecScheme, "fec_scheme", true, REBUILD);
+    compare(running.fecOverheadPercent != next.fecOverheadPercent, "fec_overhead", true, NO_CHANGE);
+    compare(running.retransmission != next.retransmission, "retransmission", true, REBUILD);
+    compare(running.roi != next.roi, "roi", true, RENEGOTIATE);
+    compare(!same_resolution(running.roiSource, next.roiSource), "roi_source", true, NO_CHANGE);
+    compare(running.adaptiveBitrate != next.adaptiveBitrate, "adaptive_bitrate", false, NO_CHANGE);
+    compare(running.warmStart != next.warmStart, "warm_start", false, RENEGOTIATE);
+
+    if (reconfiguration_ == NO_CHANGE && sender_) {
+        reconfiguration_ = ENCODER_ONLY;
+    }
+}
+
+void StreamingConfigDiff::compare(bool differs, const char *field, bool sender, ReconfigurationClass receiver) {
+    if (!differs) {
+        return;
+    }
+    fields_.emplace_back(field);
+    sender_ |= sender;
+    reconfiguration_ = std::max(reconfiguration_, receiver);
+}
+
+std::string StreamingConfigDiff::describe() const {
+    std::string description;
+    for (const auto &field: fields_) {
+        description += (description.empty() ? "" : ", ") + field;
+    }
+    return description;
+}
@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "log.h"
 #include "check.h"
+#include <GLES3/gl3.h>
 #include "util_egl.h"
 
 static const char *EglErrorString(const EGLint error) {
@@ -228,4 +229,61 @@ egl_get_config ()
     }
 
     return cfg;
-}
\ No newline at end of file
+}
+
+struct EglFenceFunctions {
+    PFNEGLCREATESYNCKHRPROC createSync = nullptr;
+    PFNEGLDESTROYSYNCKHRPROC destroySync = nullptr;
+    PFNEGLCLIENTWAITSYNCKHRPROC clientWaitSync = nullptr;
+    PFNEGLWAITSYNCKHRPROC waitSync = nullptr; // EGL_KHR_wait_sync, optional
+};
+
+static const EglFenceFunctions &egl_fence_functions(EGLDisplay display) {
+    static EglFenceFunctions functions = [display]() {
+        EglFenceFunctions resolved;
+        const char *extensions = eglQueryString(display, EGL_EXTENSIONS);
+        if (!extensions || !strstr(extensions, "EGL_KHR_fence_sync")) {
+            LOG_ERROR("EGL_KHR_fence_sync is not supported, GL frames are handed over without fences");
+            return resolved;
+        }
+        resolved.createSync = reinterpret_cast<PFNEGLCREATESYNCKHRPROC>(eglGetProcAddress("eglCreateSyncKHR"));
+        resolved.destroySync = reinterpret_cast<PFNEGLDESTROYSYNCKHRPROC>(eglGetProcAddress("eglDestroySyncKHR"));
+        resolved.clientWaitSync = reinterpret_cast<PFNEGLCLIENTWAITSYNCKHRPROC>(eglGetProcAddress("eglClientWaitSyncKHR"));
+        if (strstr(extensions, "EGL_KHR_wait_sync")) {
+            resolved.waitSync = reinterpret_cast<PFNEGLWAITSYNCKHRPROC>(eglGetProcAddress("eglWaitSyncKHR"));
+        }
+        return resolved;
+    }();
+    return functions;
+}
+
+EGLSyncKHR egl_create_fence() {
+    EGLDisplay display = eglGetCurrentDisplay();
+    const EglFenceFunctions &functions = egl_fence_functions(display);
+    if (display == EGL_NO_DISPLAY || !functions.createSync) {
+        return EGL_NO_SYNC_KHR;
+    }
+    EGLSyncKHR fence = functions.createSync(display, EGL_SYNC_FENCE_KHR, nullptr);
+    // Submitted, or a wait from another context could never see it signal
+    glFlush();
+    return fence;
+}
+
+void egl_wait_fence(EGLDisplay display, EGLSyncKHR fence) {
+    if (fence == EGL_NO_SYNC_KHR) {
+        return;
+    }
+    const EglFenceFunctions &functions = egl_fence_functions(display);
+    if (functions.waitSync) {
+        functions.waitSync(display, fence, 0);
+    } else if (functions.clientWaitSync) {
+        functions.clientWaitSync(display, fence, 0, EGL_FOREVER_KHR);
+    }
+    egl_destroy_fence(display, fence);
+}
+
+void egl_destroy_fence(EGLDisplay display, EGLSyncKHR fence) {
+    if (fence != EGL_NO_SYNC_KHR && egl_fence_functions(display).destroySync) {
+        egl_fence_functions(display).destroySync(display, fence);
+    }
+}
@@ -50,15 +50,41 @@ int openxr_init_loader(android_app *app) {
     return 0;
 }
 
+// Whether xrConvertTimespecTimeToTimeKHR can be used, openxr_get_current_time() falls back otherwise
+static bool s_timespec_time_enabled = false;
+
+static bool openxr_runtime_has_extension(const char *name) {
+    uint32_t count = 0;
+    if (XR_FAILED(xrEnumerateInstanceExtensionProperties(nullptr, 0, &count, nullptr))) {
+        return false;
+    }
+    std::vector<XrExtensionProperties> extensions(count, {XR_TYPE_EXTENSION_PROPERTIES});
+    if (XR_FAILED(xrEnumerateInstanceExtensionProperties(nullptr, count, &count, extensions.data()))) {
+        return false;
+    }
+    return std::any_of(extensions.begin(), extensions.end(), [name](const XrExtensionProperties &extension) {
+        return strcmp(extension.extensionName, name) == 0;
+    });
+}
+
 void openxr_create_instance(android_app *app, XrInstance *instance) {
     openxr_log_layers_and_extensions();
 
     CHECK(*instance == XR_NULL_HANDLE)
 
     // Transform platform and graphics extension std::strings to C strings.
-    const std::vector<const char *> extensions = {XR_KHR_ANDROID_CREATE_INSTANCE_EXTENSION_NAME,
-                                                  XR_KHR_OPENGL_ES_ENABLE_EXTENSION_NAME,
-                                                  XR_EXT_USER_PRESENCE_EXTENSION_NAME};
+    std::vector<const char *> extensions = {XR_KHR_ANDROID_CREATE_INSTANCE_EXTENSION_NAME,
+                                            XR_KHR_OPENGL_ES_ENABLE_EXTENSION_NAME,
+                                            XR_EXT_USER_PRESENCE_EXTENSION_NAME};
+
+    // Only for the display latency of the frame trace, optional
+    s_timespec_time_enabled = openxr_runtime_has_extension(XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME);
+    if (s_timespec_time_enabled) {
+        extensions.push_back(XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME);
+    } else {
+        LOG_INFO("%s not supported, the runtime clock is taken to be CLOCK_MONOTONIC",
+                 XR_KHR_CONVERT_TIMESPEC_TIME_EXTENSION_NAME);
+    }
 
     XrInstanceCreateInfoAndroidKHR instance_create_info = {
             XR_TYPE_INSTANCE_CREATE_INFO_ANDROID_KHR};
@@ -745,6 +771,24 @@ int openxr_begin_frame(XrSession *session, XrTime *display_time) {
     return (int) frameState.shouldRender;
 }
 
+XrTime openxr_get_current_time(XrInstance *instance) {
+    struct timespec now{};
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    // The Android runtimes count XrTime in nanoseconds of CLOCK_MONOTONIC
+    XrTime monotonic = static_cast<XrTime>(now.tv_sec) * 1000000000 + now.tv_nsec;
+
+    static PFN_xrConvertTimespecTimeToTimeKHR convertTimespecTime = nullptr;
+    if (!s_timespec_time_enabled ||
+        (!convertTimespecTime &&
+         XR_FAILED(xrGetInstanceProcAddr(*instance, "xrConvertTimespecTimeToTimeKHR",
+                                         reinterpret_cast<PFN_xrVoidFunction *>(&convertTimespecTime))))) {
+        return monotonic;
+    }
+
+    XrTime time = 0;
+    return XR_SUCCEEDED(convertTimespecTime(*instance, &now, &time)) ? time : monotonic;
+}
+
 int openxr_end_frame(XrSession *session, XrTime *displayTime,
                      std::vector<XrCompositionLayerBaseHeader *> &layers) {
 
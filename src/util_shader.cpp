@@ -28,6 +28,11 @@ int generate_shader(shader_obj_t *shader_obj, const char* vertex_shader,
 
     shader_obj->loc_mvp = glGetUniformLocation(shader_obj->program, "u_ModelViewProjection");
     shader_obj->loc_texture = glGetUniformLocation(shader_obj->program, "u_Texture");
+    shader_obj->loc_texture_u = glGetUniformLocation(shader_obj->program, "u_TextureU");
+    shader_obj->loc_texture_v = glGetUniformLocation(shader_obj->program, "u_TextureV");
+    shader_obj->loc_limited_range = glGetUniformLocation(shader_obj->program, "u_LimitedRange");
+    shader_obj->loc_roi = glGetUniformLocation(shader_obj->program, "u_Roi");
+    shader_obj->loc_roi_enabled = glGetUniformLocation(shader_obj->program, "u_RoiEnabled");
 
     return 0;
 }
@@ -0,0 +1,379 @@
+//
+// bandwidth_simulation - The headset's BandwidthEstimator in closed loop with a sender through impairment_relay
+//
+// Usage: bandwidth_simulation [scenario.ini] [--duration=60] [--bitrate=20000000] [--start=4000000] [--fps=60]
+//                             [--relay=path] [--csv=path] [--rtx=0] [--unfiltered]
+// Starts impairment_relay (next to this binary unless --relay is given) with the scenario, by default
+// tools/scenarios/bandwidth_steps.ini, and sends two camera-like streams through it: frames of the
+// current bitrate every 1/fps, a three times larger key frame every second, each in 1200 byte RTP
+// packets sent back to back and carrying their send time like the Jetson's header extension. The
+// receiving side feeds every packet to BandwidthEstimator and sends its bitrate feedback (the 0x04
+// message of RobotControlSender) back through the relay, where the sender adopts it, as the robot does.
+// Prints the bitrate, the estimate and the received bitrate, all per camera, the one-way delay and the
+// loss every second.
+//
+// --rtx mixes retransmissions into both streams, that many percent of the media packets, as the robot's
+// RTX stream does: payload type 97, an SSRC and sequence numbers of their own, and the RTP timestamp and
+// send time of the packet RTX_AGE packets back they repeat. The receiver drops them with the client's
+// MediaPacketFilter; --unfiltered feeds them to the estimator too, which then reports no loss until the
+// RTX sequence numbers trail by half the number space, about a minute in, and then nearly all packets lost.
+//
+// The scenario's links: 127.0.0.1:18554 -> 127.0.0.1:28554 and 127.0.0.1:18556 -> 127.0.0.1:28556 for
+// the streams, 127.0.0.1:18115 -> 127.0.0.1:28115 for the feedback.
+//
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "bandwidth_estimator.h"
+#include "media_packet_filter.h"
+
+extern char **environ;
+
+using Clock = std::chrono::steady_clock;
+
+static constexpr int STREAM_PORTS[2] = {18554, 18556};
+static constexpr int FEEDBACK_PORT = 18115;
+static constexpr int RELAY_PORT_OFFSET = 10000; // Where the relay forwards to
+static constexpr size_t PACKET_SIZE = 1200;
+static constexpr size_t HEADER_SIZE = 12 + 8; // RTP header, send time
+static constexpr uint8_t MSG_BITRATE = 0x04;
+static constexpr uint8_t MEDIA_PAYLOAD_TYPE = 96, RTX_PAYLOAD_TYPE = 97;
+static constexpr size_t RTX_AGE = 64; // Packets between a media packet and its retransmission
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+static sockaddr_in loopback(int port) {
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(static_cast<uint16_t>(port));
+    return address;
+}
+
+static int bound_socket(int port) {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    int buffer = 4 * 1024 * 1024;
+    setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof(buffer));
+    sockaddr_in address = loopback(port);
+    if (bind(fd, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// What the receiving side saw in one second
+struct Interval {
+    std::mutex mutex;
+    uint64_t bytes = 0;
+    std::vector<uint64_t> delaysUs;
+};
+
+static void send_streams(std::atomic<bool> &running, std::atomic<int> &bitrate, int fps, double rtxShare) {
+    int out = socket(AF_INET, SOCK_DGRAM, 0);
+    int feedback = bound_socket(FEEDBACK_PORT + RELAY_PORT_OFFSET);
+    sockaddr_in destinations[2] = {loopback(STREAM_PORTS[0]), loopback(STREAM_PORTS[1])};
+    uint16_t seqnums[2] = {0, 0}, rtxSeqnums[2] = {0, 0};
+    std::vector<uint8_t> packet(PACKET_SIZE, 0), rtx(PACKET_SIZE + 2, 0);
+
+    // The last RTX_AGE media headers of each stream, what the retransmissions repeat
+    std::vector<std::vector<uint8_t>> history[2] = {std::vector<std::vector<uint8_t>>(RTX_AGE),
+                                                    std::vector<std::vector<uint8_t>>(RTX_AGE)};
+    double rtxCredit[2] = {0, 0};
+
+    auto frameUs = static_cast<uint64_t>(1e6 / fps);
+    uint64_t next = now_us();
+    for (uint64_t frame = 0; running; ++frame) {
+        // The robot's side of the feedback
+        uint8_t message[13];
+        while (feedback >= 0 && recv(feedback, message, sizeof(message), MSG_DONTWAIT) == sizeof(message)) {
+            if (message[0] == MSG_BITRATE) {
+                uint32_t value;
+                memcpy(&value, message + 1, sizeof(value));
+                bitrate = static_cast<int>(value);
+            }
+        }
+
+        // Key frames three times the size, the mean stays at the bitrate
+        double gop = fps;
+        double scale = (frame % static_cast<uint64_t>(fps) == 0 ? 3.0 : 1.0) * gop / (gop + 2);
+        auto frameBytes = static_cast<size_t>(bitrate.load() / 8.0 / fps * scale);
+        auto rtpTimestamp = static_cast<uint32_t>(frame * BandwidthEstimator::CLOCK_RATE / fps);
+        for (int stream = 0; stream < 2; ++stream) {
+            for (size_t sent = 0; sent < frameBytes; sent += PACKET_SIZE - HEADER_SIZE) {
+                size_t payload = std::min(PACKET_SIZE - HEADER_SIZE, frameBytes - sent);
+                packet[0] = 0x80;
+                packet[1] = MEDIA_PAYLOAD_TYPE;
+                uint16_t seqnum = htons(seqnums[stream]);
+                uint32_t timestamp = htonl(rtpTimestamp), ssrc = htonl(0x5eed0000 + stream);
+                memcpy(&packet[2], &seqnum, 2);
+                memcpy(&packet[4], &timestamp, 4);
+                memcpy(&packet[8], &ssrc, 4);
+                uint64_t sendUs = now_us();
+                memcpy(&packet[12], &sendUs, 8);
+                sendto(out, packet.data(), HEADER_SIZE + payload, 0, reinterpret_cast<sockaddr *>(&destinations[stream]),
+                       sizeof(destinations[stream]));
+
+                // RTX repeats the original header extension, send time included, and prepends the
+                // original sequence number to the payload
+                std::vector<uint8_t> &original = history[stream][seqnums[stream] % RTX_AGE];
+                std::vector<uint8_t> &repaired = history[stream][(seqnums[stream] + 1) % RTX_AGE];
+                original.assign(packet.begin(), packet.begin() + static_cast<long>(HEADER_SIZE + payload));
+                seqnums[stream]++;
+                rtxCredit[stream] += rtxShare;
+                if (rtxCredit[stream] >= 1 && !repaired.empty()) {
+                    rtxCredit[stream] -= 1;
+                    rtx.assign(repaired.begin(), repaired.begin() + static_cast<long>(HEADER_SIZE));
+                    rtx[1] = RTX_PAYLOAD_TYPE;
+                    uint16_t rtxSeqnum = htons(rtxSeqnums[stream]++);
+                    uint32_t rtxSsrc = htonl(0x5eed1000 + stream);
+                    memcpy(&rtx[2], &rtxSeqnum, 2);
+                    memcpy(&rtx[8], &rtxSsrc, 4);
+                    rtx.insert(rtx.end(), repaired.begin() + 2, repaired.begin() + 4); // Original seqnum
+                    rtx.insert(rtx.end(), repaired.begin() + static_cast<long>(HEADER_SIZE), repaired.end());
+                    sendto(out, rtx.data(), rtx.size(), 0, reinterpret_cast<sockaddr *>(&destinations[stream]),
+                           sizeof(destinations[stream]));
+                }
+            }
+        }
+
+        next += frameUs;
+        uint64_t now = now_us();
+        if (next > now) {
+            std::this_thread::sleep_for(std::chrono::microseconds(next - now));
+        }
+    }
+    close(out);
+    if (feedback >= 0) {
+        close(feedback);
+    }
+}
+
+static void receive_streams(std::atomic<bool> &running, BandwidthEstimator &estimator, Interval &interval,
+                            const int sockets[2], bool filtered, std::atomic<uint64_t> &rejected) {
+    pollfd fds[2] = {{sockets[0], POLLIN, 0}, {sockets[1], POLLIN, 0}};
+    MediaPacketFilter media[2] = {{MEDIA_PAYLOAD_TYPE, -1}, {MEDIA_PAYLOAD_TYPE, -1}};
+    uint8_t packet[2048];
+    while (running) {
+        if (poll(fds, 2, 50) <= 0) {
+            continue;
+        }
+        for (int stream = 0; stream < 2; ++stream) {
+            if (!(fds[stream].revents & POLLIN)) {
+                continue;
+            }
+            ssize_t size;
+            while ((size = recv(sockets[stream], packet, sizeof(packet), MSG_DONTWAIT)) >= static_cast<ssize_t>(HEADER_SIZE)) {
+                uint64_t arrivalUs = now_us();
+                uint16_t seqnum;
+                uint32_t timestamp, ssrc;
+                uint64_t sendUs;
+                memcpy(&seqnum, packet + 2, 2);
+                memcpy(&timestamp, packet + 4, 4);
+                memcpy(&ssrc, packet + 8, 4);
+                memcpy(&sendUs, packet + 12, 8);
+                if (!media[stream].accept(arrivalUs, packet[1] & 0x7f, ntohl(ssrc))) {
+                    rejected++;
+                    if (filtered) {
+                        continue;
+                    }
+                }
+                estimator.onPacket(stream, arrivalUs, sendUs, ntohl(timestamp), ntohs(seqnum),
+                                   static_cast<size_t>(size));
+
+                std::lock_guard<std::mutex> lock(interval.mutex);
+                interval.bytes += static_cast<uint64_t>(size);
+                interval.delaysUs.push_back(arrivalUs - sendUs);
+            }
+        }
+    }
+}
+
+static pid_t start_relay(const std::string &path, const std::string &scenario, double durationS) {
+    std::vector<std::string> args = {path, scenario, "--duration=" + std::to_string(durationS)};
+    std::vector<char *> argv;
+    for (auto &arg: args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    // The relay's own report would interleave with ours
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, "/dev/null", O_WRONLY, 0);
+    pid_t pid = 0;
+    int result = posix_spawn(&pid, path.c_str(), &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    return result == 0 ? pid : 0;
+}
+
+static std::string directory_of(const std::string &path) {
+    auto slash = path.rfind('/');
+    return slash == std::string::npos ? "." : path.substr(0, slash);
+}
+
+int main(int argc, char **argv) {
+    std::string scenario = directory_of(__FILE__) + "/scenarios/bandwidth_steps.ini";
+    std::string relay = directory_of(argv[0]) + "/impairment_relay";
+    std::string csvPath;
+    double durationS = 60;
+    int fps = 60;
+    double rtxShare = 0;
+    bool filtered = true;
+    BandwidthEstimator::Settings settings;
+    settings.maxBitrate = 20000000;
+    settings.startBitrate = 4000000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--duration=", 0) == 0) {
+            durationS = std::max(1.0, atof(arg.c_str() + 11));
+        } else if (arg.rfind("--bitrate=", 0) == 0) {
+            settings.maxBitrate = std::max(settings.minBitrate, atoi(arg.c_str() + 10));
+        } else if (arg.rfind("--start=", 0) == 0) {
+            settings.startBitrate = atoi(arg.c_str() + 8);
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--relay=", 0) == 0) {
+            relay = arg.substr(8);
+        } else if (arg.rfind("--csv=", 0) == 0) {
+            csvPath = arg.substr(6);
+        } else if (arg.rfind("--rtx=", 0) == 0) {
+            rtxShare = std::clamp(atof(arg.c_str() + 6), 0.0, 100.0) / 100;
+        } else if (arg == "--unfiltered") {
+            filtered = false;
+        } else if (arg.rfind("--", 0) != 0) {
+            scenario = arg;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    int sockets[2] = {bound_socket(STREAM_PORTS[0] + RELAY_PORT_OFFSET),
+                      bound_socket(STREAM_PORTS[1] + RELAY_PORT_OFFSET)};
+    if (sockets[0] < 0 || sockets[1] < 0) {
+        fprintf(stderr, "Cannot bind the receive ports %d and %d\n", STREAM_PORTS[0] + RELAY_PORT_OFFSET,
+                STREAM_PORTS[1] + RELAY_PORT_OFFSET);
+        return 1;
+    }
+    pid_t relayPid = start_relay(relay, scenario, durationS + 1);
+    if (!relayPid) {
+        fprintf(stderr, "Cannot start %s\n", relay.c_str());
+        return 1;
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(300)); // Relay sockets bound
+
+    std::ofstream csv;
+    if (!csvPath.empty()) {
+        csv.open(csvPath);
+        csv << "time_s,sent_bps,target_bps,received_bps,delay_p50_ms,delay_p95_ms,loss\n";
+    }
+
+    BandwidthEstimator estimator(settings);
+    Interval interval;
+    std::atomic<bool> running{true};
+    std::atomic<int> bitrate{std::clamp(settings.startBitrate, settings.minBitrate, settings.maxBitrate)};
+    std::atomic<uint64_t> rejected{0};
+    std::thread receiver(receive_streams, std::ref(running), std::ref(estimator), std::ref(interval), sockets,
+                         filtered, std::ref(rejected));
+    std::thread sender(send_streams, std::ref(running), std::ref(bitrate), fps, rtxShare);
+
+    int feedbackOut = socket(AF_INET, SOCK_DGRAM, 0);
+    sockaddr_in feedbackAddress = loopback(FEEDBACK_PORT);
+    printf("%7s %10s %10s %10s %9s %9s %7s  %s\n", "t [s]", "sent", "estimate", "received", "delay p50",
+           "p95", "loss", "delay signal");
+    printf("%7s %10s %10s %10s %9s %9s %7s\n", "", "[Mbit/s]", "[Mbit/s]", "[Mbit/s]", "[ms]", "[ms]", "[%]");
+
+    double sumReceived = 0, sumTarget = 0;
+    std::vector<uint64_t> allDelaysUs;
+    auto start = Clock::now();
+    auto nextReport = start + std::chrono::seconds(1);
+    int reports = 0;
+    while (Clock::now() - start < std::chrono::duration<double>(durationS)) {
+        int feedback = 0;
+        if (estimator.takeFeedback(now_us(), feedback)) {
+            uint8_t message[13];
+            message[0] = MSG_BITRATE;
+            auto value = static_cast<uint32_t>(feedback);
+            uint64_t timestamp = now_us();
+            memcpy(message + 1, &value, sizeof(value));
+            memcpy(message + 5, &timestamp, sizeof(timestamp));
+            sendto(feedbackOut, message, sizeof(message), 0, reinterpret_cast<sockaddr *>(&feedbackAddress),
+                   sizeof(feedbackAddress));
+        }
+
+        if (Clock::now() >= nextReport) {
+            nextReport += std::chrono::seconds(1);
+            uint64_t bytes;
+            std::vector<uint64_t> delays;
+            {
+                std::lock_guard<std::mutex> lock(interval.mutex);
+                bytes = interval.bytes;
+                delays.swap(interval.delaysUs);
+                interval.bytes = 0;
+            }
+            std::sort(delays.begin(), delays.end());
+            auto percentile = [&delays](double fraction) {
+                return delays.empty() ? 0.0 : static_cast<double>(delays[std::min(
+                        delays.size() - 1, static_cast<size_t>(fraction * static_cast<double>(delays.size())))]) / 1000;
+            };
+            auto usage = estimator.usage();
+            double t = std::chrono::duration<double>(Clock::now() - start).count();
+            double received = static_cast<double>(bytes) * 8 / 2; // Per camera, like the bitrates
+            printf("%7.1f %10.2f %10.2f %10.2f %9.1f %9.1f %7.2f  %s\n", t, bitrate.load() / 1e6,
+                   estimator.targetBitrate() / 1e6, received / 1e6, percentile(0.5), percentile(0.95),
+                   estimator.lossRate() * 100, usage == BandwidthEstimator::Usage::OVERUSE ? "overuse"
+                                               : usage == BandwidthEstimator::Usage::UNDERUSE ? "underuse" : "normal");
+            fflush(stdout);
+            if (csv) {
+                csv << t << "," << bitrate.load() << "," << estimator.targetBitrate() << "," << received << ","
+                    << percentile(0.5) << "," << percentile(0.95) << "," << estimator.lossRate() << "\n";
+            }
+            sumReceived += received;
+            sumTarget += estimator.targetBitrate();
+            allDelaysUs.insert(allDelaysUs.end(), delays.begin(), delays.end());
+            reports++;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    running = false;
+    sender.join();
+    receiver.join();
+    close(feedbackOut);
+    close(sockets[0]);
+    close(sockets[1]);
+    kill(relayPid, SIGTERM);
+    waitpid(relayPid, nullptr, 0);
+
+    if (reports > 0) {
+        std::sort(allDelaysUs.begin(), allDelaysUs.end());
+        double p95 = allDelaysUs.empty() ? 0 : static_cast<double>(
+                allDelaysUs[std::min(allDelaysUs.size() - 1, allDelaysUs.size() * 95 / 100)]) / 1000;
+        printf("Per camera: mean received %.2f Mbit/s, mean estimate %.2f Mbit/s. One-way delay p95 %.1f ms\n",
+               sumReceived / reports / 1e6, sumTarget / reports / 1e6, p95);
+        if (rtxShare > 0) {
+            printf("Retransmissions received: %lu, %s\n", (unsigned long) rejected.load(),
+                   filtered ? "kept from the estimator" : "fed to the estimator (--unfiltered)");
+        }
+    }
+    return 0;
+}
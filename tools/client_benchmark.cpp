@@ -0,0 +1,551 @@
+//
+// client_benchmark - The headset's receive path on desktop Linux, end to end against a local stream_generator
+//
+// Usage: client_benchmark [--codecs=JPEG,VP8,VP9,H264,H265] [--resolutions=HD,FHD] [--fps=60] [--duration=10]
+//                         [--warmup=3] [--display-hz=90] [--decoder=factory] [--generator=path | --external]
+//                         [--gl-context=wrapped|shared] [--late-join=seconds] [--warm-start=on|off]
+//                         [--csv=path] [--baseline=path] [--tolerance=15]
+// Runs GstreamerPlayer, the frame tracer, the PBO upload rings and the stereo synchronizer as the
+// headset does, in a headless EGL context, with the host's software decoders. For every codec and
+// resolution preset it starts stream_generator (next to this binary unless --generator is given) on
+// loopback, lets the stream settle for the warmup, then "displays" at --display-hz for the duration and
+// reports the per-stage latency percentiles of the presented frames, the presented frame rate, the
+// render thread's time per display frame and the CPU use of the client process. --external skips
+// starting the generator, e.g. to receive through impairment_relay from a generator started by hand with
+// the same settings. --gl-context=shared gives GStreamer's GL elements a context of their own
+// (SHARED_CONTEXT), which only matters with a decoder that outputs GL memory (--decoder).
+//
+// Every run reports the time from the pipeline start to the first frame of both cameras. --late-join
+// starts the generator that long before the pipelines, so they join a running stream mid-GOP, and then
+// restarts the pipelines once (a rejoin, with the parameter sets cached). With warm start (the default)
+// the pipelines start from cached parameter sets and ask the generator for a keyframe, as the headset
+// does; --warm-start=off gives the time to first frame without.
+//
+// As a regression gate: --csv writes the results, --baseline compares against such a file and exits
+// with 2 if any run's total p95 latency or CPU use grew, or its frame rate fell, by more than --tolerance
+// percent.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <httplib.h>
+#include "BS_thread_pool.hpp"
+#include "gl_sample_ring.h"
+#include "gstreamer_player.h"
+#include "headless_egl.h"
+#include "ntp_timer.h"
+#include "pbo_upload_ring.h"
+#include "stereo_synchronizer.h"
+
+extern char **environ;
+
+using Clock = std::chrono::steady_clock;
+
+// Rows of the report, in pipeline order: sender durations, then the receiver stages
+static const char *ROW_NAMES[] = {"vidConv", "enc", "rtpPay", "network", "udpStream", "jitterBuf", "rtpDepay",
+                                  "dec", "queue", "handoff", "render", "In Total"};
+static constexpr size_t ROWS = sizeof(ROW_NAMES) / sizeof(ROW_NAMES[0]);
+static constexpr size_t TOTAL_ROW = ROWS - 1;
+
+struct RunResult {
+    Codec codec = Codec::H264;
+    std::string resolution;
+    int fps = 0;
+    double presentedFps = 0;
+    double cpuPercent = 0;
+    std::vector<uint64_t> samples[ROWS]; // us, per presented frame
+    std::vector<uint64_t> frameUs; // Render thread, per display frame
+    double firstFrameMs = -1, rejoinMs = -1; // Pipeline start to the first frame of both cameras, -1 without
+};
+
+static double percentile_ms(std::vector<uint64_t> &values, double fraction) {
+    if (values.empty()) {
+        return 0;
+    }
+    std::sort(values.begin(), values.end());
+    auto index = std::min(values.size() - 1, static_cast<size_t>(fraction * static_cast<double>(values.size())));
+    return static_cast<double>(values[index]) / 1000;
+}
+
+// The spans the HUD shows, from one sealed record
+static void add_trace(RunResult &result, const FrameTrace &trace) {
+    auto add = [&result](size_t row, uint64_t valueUs) { result.samples[row].push_back(valueUs); };
+    if (trace.payloadedUs) {
+        add(0, trace.vidConvUs);
+        add(1, trace.encUs);
+        add(2, trace.rtpPayUs);
+        add(3, trace.networkUs());
+        add(TOTAL_ROW, trace.totalUs());
+    }
+    for (size_t s = 1; s <= static_cast<size_t>(TraceStage::PRESENTED); ++s) {
+        auto from = static_cast<TraceStage>(s - 1), to = static_cast<TraceStage>(s);
+        if (trace.at(from) && trace.at(to) >= trace.at(from)) {
+            add(3 + s, trace.span(from, to));
+        }
+    }
+}
+
+static double cpu_seconds() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return static_cast<double>(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) +
+           static_cast<double>(usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static pid_t start_generator(const std::string &path, Codec codec, const std::string &resolution, int fps) {
+    std::vector<std::string> args = {path, "--start", "--host=127.0.0.1", "--codec=" + CodecToString(codec),
+                                     "--resolution=" + resolution, "--fps=" + std::to_string(fps)};
+    std::vector<char *> argv;
+    for (auto &arg: args) {
+        argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+    pid_t pid = 0;
+    if (posix_spawn(&pid, path.c_str(), nullptr, nullptr, argv.data(), environ) != 0) {
+        return 0;
+    }
+    return pid;
+}
+
+static void stop_generator(pid_t pid) {
+    if (pid > 0) {
+        kill(pid, SIGINT);
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+// What RestClient::RequestKeyframe asks the robot for
+static void request_keyframe() {
+    httplib::Client client("127.0.0.1", IP_CONFIG_REST_API_PORT);
+    client.set_connection_timeout(1, 0);
+    auto response = client.Post("/api/v1/stream/keyframe");
+    if (!response || response->status != 200) {
+        fprintf(stderr, "Keyframe request not answered\n");
+    }
+}
+
+// Waits up to `timeoutS` for both cameras' first frame, -1 when one has none by then
+static double wait_first_frame_ms(CamPair &cameras, double timeoutS) {
+    auto deadline = Clock::now() + std::chrono::microseconds(static_cast<int64_t>(timeoutS * 1e6));
+    while (true) {
+        float left = cameras.first.stats->firstFrameMs.load(), right = cameras.second.stats->firstFrameMs.load();
+        if (left > 0 && right > 0) {
+            return std::max(left, right);
+        }
+        if (Clock::now() >= deadline) {
+            return -1;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    }
+}
+
+static std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+struct Options {
+    std::vector<Codec> codecs;
+    std::vector<std::string> resolutions = {"HD", "FHD"};
+    int fps = 60;
+    double durationS = 10, warmupS = 3;
+    int displayHz = 90;
+    std::string decoder, generator, csv, baseline;
+    bool external = false;
+    GlContextMode glContext = WRAPPED_RENDER_CONTEXT;
+    double lateJoinS = 0;
+    bool warmStart = true;
+    double tolerancePercent = 15;
+};
+
+// Presents at the display rate like TelepresenceProgram::RenderLayer and collects the sealed records
+static bool run(GstreamerPlayer &player, BS::thread_pool<BS::tp::none> &pool, CamPair &cameras, NtpTimer &ntp,
+                const Options &options, RunResult &result) {
+    StreamingConfig config;
+    config.headset_ip = {127, 0, 0, 1};
+    config.jetson_ip = {127, 0, 0, 1};
+    config.codec = result.codec;
+    config.resolution = CameraResolution::fromLabel(result.resolution);
+    config.fps = result.fps;
+    config.warmStart = options.warmStart;
+
+    // What init_video_upload does on the headset
+    for (CameraFrame *frame: {&cameras.first, &cameras.second}) {
+        delete frame->uploadRing;
+        frame->uploadRing = new PboUploadRing(config.resolution.getWidth(), config.resolution.getHeight());
+        frame->mailbox = frame->uploadRing->mailbox();
+        delete frame->glSamples;
+        frame->glSamples = new GlSampleRing();
+    }
+    // Late join: the stream runs before the pipelines start, as when the headset reconnects
+    const bool lateJoin = options.lateJoinS > 0;
+    pid_t generator = 0;
+    auto start_pipelines = [&]() {
+        try {
+            player.configurePipelines(pool, config, options.decoder.empty()
+                                                    ? std::vector<std::string>{}
+                                                    : std::vector<std::string>{options.decoder});
+        } catch (const std::runtime_error &e) {
+            fprintf(stderr, "%s %s: %s\n", CodecToString(result.codec).c_str(), result.resolution.c_str(),
+                    e.what());
+            return false;
+        }
+        if (options.warmStart && generator) {
+            request_keyframe();
+        }
+        return true;
+    };
+
+    if (!options.external && lateJoin) {
+        generator = start_generator(options.generator, result.codec, result.resolution, result.fps);
+        if (!generator) {
+            fprintf(stderr, "Cannot start %s\n", options.generator.c_str());
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(static_cast<int64_t>(options.lateJoinS * 1e6)));
+    }
+    if (!start_pipelines()) {
+        stop_generator(generator);
+        return false;
+    }
+    if (!options.external && !lateJoin) {
+        generator = start_generator(options.generator, result.codec, result.resolution, result.fps);
+        if (!generator) {
+            fprintf(stderr, "Cannot start %s\n", options.generator.c_str());
+            player.stopPipelines();
+            pool.wait();
+            return false;
+        }
+    }
+
+    // Rejoin: the same stream again with fresh pipelines, its parameter sets cached by the first ones
+    if (lateJoin) {
+        result.firstFrameMs = wait_first_frame_ms(cameras, 5);
+        player.stopPipelines();
+        pool.wait();
+        if (!start_pipelines()) {
+            stop_generator(generator);
+            return false;
+        }
+        result.rejoinMs = wait_first_frame_ms(cameras, 5);
+    }
+
+    StereoSynchronizer synchronizer;
+    StereoSyncStats syncStats;
+    auto displayPeriod = std::chrono::microseconds(1000000 / std::max(1, options.displayHz));
+    auto start = Clock::now();
+    auto measureFrom = start + std::chrono::microseconds(static_cast<int64_t>(options.warmupS * 1e6));
+    auto end = measureFrom + std::chrono::microseconds(static_cast<int64_t>(options.durationS * 1e6));
+    uint64_t measureFromUs = 0;
+    double cpuStart = 0;
+    uint64_t collected[2] = {0, 0}; // Newest frame id taken from each tracer
+    size_t presented = 0;
+
+    // The tracer ring holds a few seconds of frames, collecting twice a second misses none
+    auto collect = [&]() {
+        CameraFrame *frames[2] = {&cameras.first, &cameras.second};
+        for (int camera = 0; camera < 2; ++camera) {
+            for (const FrameTrace &trace: frames[camera]->stats->trace.sealed()) {
+                if (trace.frameId > collected[camera] && trace.at(TraceStage::PRESENTED) >= measureFromUs) {
+                    collected[camera] = trace.frameId;
+                    add_trace(result, trace);
+                    presented++;
+                }
+            }
+        }
+    };
+
+    auto nextCollect = measureFrom;
+    for (auto vsync = start; vsync < end; vsync += displayPeriod) {
+        std::this_thread::sleep_until(vsync);
+        auto frameStart = Clock::now();
+        if (!measureFromUs && Clock::now() >= measureFrom) {
+            measureFromUs = ntp.GetCurrentTimeUs();
+            cpuStart = cpu_seconds();
+            for (int camera = 0; camera < 2; ++camera) {
+                collected[camera] = 0;
+            }
+        }
+
+        synchronizer.select(cameras, false, syncStats);
+        for (CameraFrame *frame: {&cameras.second, &cameras.first}) {
+            if (!frame->stats) {
+                continue;
+            }
+            if (!frame->hasGlTexture) {
+                frame->uploadRing->update();
+            } else {
+                frame->glSamples->fence();
+            }
+            uint64_t frameId = frame->hasGlTexture ? frame->glSamples->frameId() : frame->uploadRing->frameId();
+            frame->stats->trace.seal(frameId, ntp.GetCurrentTimeUs(), 0);
+        }
+        glFlush();
+        if (measureFromUs) {
+            result.frameUs.push_back(std::chrono::duration_cast<std::chrono::microseconds>(
+                    Clock::now() - frameStart).count());
+        }
+
+        if (measureFromUs && Clock::now() >= nextCollect) {
+            collect();
+            nextCollect += std::chrono::milliseconds(500);
+        }
+    }
+    collect();
+    if (!lateJoin) {
+        result.firstFrameMs = wait_first_frame_ms(cameras, 0);
+    }
+    double elapsedS = std::chrono::duration<double>(Clock::now() - measureFrom).count();
+    result.cpuPercent = 100 * (cpu_seconds() - cpuStart) / elapsedS;
+    result.presentedFps = static_cast<double>(presented) / 2 / elapsedS;
+
+    stop_generator(generator);
+    player.stopPipelines();
+    pool.wait();
+    return presented > 0;
+}
+
+static void print_result(RunResult &result) {
+    printf("\n%s %s @ %d fps: %.1f fps presented per camera, client CPU %.0f %%\n",
+           CodecToString(result.codec).c_str(), result.resolution.c_str(), result.fps, result.presentedFps,
+           result.cpuPercent);
+    printf("  %-10s %7s %7s %7s %7s  (ms)\n", "", "p50", "p95", "p99", "max");
+    for (size_t row = 0; row < ROWS; ++row) {
+        auto &samples = result.samples[row];
+        if (samples.empty()) {
+            continue;
+        }
+        printf("  %-10s %7.2f %7.2f %7.2f %7.2f\n", ROW_NAMES[row], percentile_ms(samples, 0.5),
+               percentile_ms(samples, 0.95), percentile_ms(samples, 0.99), percentile_ms(samples, 1.0));
+    }
+    printf("  %-10s %7.2f %7.2f %7.2f %7.2f\n", "frame", percentile_ms(result.frameUs, 0.5),
+           percentile_ms(result.frameUs, 0.95), percentile_ms(result.frameUs, 0.99),
+           percentile_ms(result.frameUs, 1.0));
+    printf("  first frame %.0f ms", result.firstFrameMs);
+    if (result.rejoinMs != -1) {
+        printf(", after a rejoin %.0f ms", result.rejoinMs);
+    }
+    printf("\n");
+}
+
+static std::string run_key(const std::string &codec, const std::string &resolution, int fps) {
+    return codec + " " + resolution + " " + std::to_string(fps);
+}
+
+// codec,resolution,fps,presented_fps,cpu_percent, then p50,p95,p99 of every row and of the render thread's
+// frame time, then the times to the first frame (-1 without)
+static bool write_csv(const std::string &path, std::vector<RunResult> &results) {
+    std::ofstream file(path);
+    if (!file) {
+        return false;
+    }
+    file << "codec,resolution,fps,presented_fps,cpu_percent";
+    for (const char *name: ROW_NAMES) {
+        file << "," << name << "_p50," << name << "_p95," << name << "_p99";
+    }
+    file << ",frame_p50,frame_p95,frame_p99,first_frame_ms,rejoin_ms\n";
+    for (auto &result: results) {
+        file << CodecToString(result.codec) << "," << result.resolution << "," << result.fps << ","
+             << result.presentedFps << "," << result.cpuPercent;
+        for (auto &samples: result.samples) {
+            file << "," << percentile_ms(samples, 0.5) << "," << percentile_ms(samples, 0.95) << ","
+                 << percentile_ms(samples, 0.99);
+        }
+        file << "," << percentile_ms(result.frameUs, 0.5) << "," << percentile_ms(result.frameUs, 0.95) << ","
+             << percentile_ms(result.frameUs, 0.99) << "," << result.firstFrameMs << "," << result.rejoinMs
+             << "\n";
+    }
+    return true;
+}
+
+// Number of regressions against the baseline file, -1 if it cannot be read
+static int compare_baseline(const std::string &path, std::vector<RunResult> &results, double tolerancePercent) {
+    std::ifstream file(path);
+    if (!file) {
+        return -1;
+    }
+    struct Baseline {
+        double presentedFps, cpuPercent, totalP95;
+    };
+    std::map<std::string, Baseline> baseline;
+    std::string line;
+    std::getline(file, line); // Header
+    const size_t totalP95Column = 5 + 3 * TOTAL_ROW + 1;
+    while (std::getline(file, line)) {
+        std::vector<std::string> columns;
+        std::stringstream stream(line);
+        std::string column;
+        while (std::getline(stream, column, ',')) {
+            columns.push_back(column);
+        }
+        if (columns.size() > totalP95Column) {
+            baseline[run_key(columns[0], columns[1], std::stoi(columns[2]))] =
+                    {std::stod(columns[3]), std::stod(columns[4]), std::stod(columns[totalP95Column])};
+        }
+    }
+
+    int regressions = 0;
+    double tolerance = tolerancePercent / 100;
+    printf("\nAgainst %s (tolerance %.0f %%):\n", path.c_str(), tolerancePercent);
+    for (auto &result: results) {
+        std::string key = run_key(CodecToString(result.codec), result.resolution, result.fps);
+        auto it = baseline.find(key);
+        if (it == baseline.end()) {
+            printf("  %-16s not in the baseline\n", key.c_str());
+            continue;
+        }
+        double totalP95 = percentile_ms(result.samples[TOTAL_ROW], 0.95);
+        bool slower = totalP95 > it->second.totalP95 * (1 + tolerance);
+        bool busier = result.cpuPercent > it->second.cpuPercent * (1 + tolerance);
+        bool choppier = result.presentedFps < it->second.presentedFps * (1 - tolerance);
+        printf("  %-16s total p95 %6.2f ms (%6.2f)  CPU %4.0f %% (%4.0f)  %5.1f fps (%5.1f)%s\n", key.c_str(),
+               totalP95, it->second.totalP95, result.cpuPercent, it->second.cpuPercent, result.presentedFps,
+               it->second.presentedFps, slower || busier || choppier ? "  REGRESSED" : "");
+        regressions += slower || busier || choppier;
+    }
+    return regressions;
+}
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--codecs=", 0) == 0) {
+            for (const auto &name: split(arg.substr(9))) {
+                bool known = false;
+                for (int c = 0; c < Codec::Count; ++c) {
+                    if (CodecToString(static_cast<Codec>(c)) == name) {
+                        options.codecs.push_back(static_cast<Codec>(c));
+                        known = true;
+                    }
+                }
+                if (!known) {
+                    fprintf(stderr, "Unknown codec %s\n", name.c_str());
+                    return 1;
+                }
+            }
+        } else if (arg.rfind("--resolutions=", 0) == 0) {
+            options.resolutions = split(arg.substr(14));
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            options.fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--duration=", 0) == 0) {
+            options.durationS = std::max(1.0, atof(arg.c_str() + 11));
+        } else if (arg.rfind("--warmup=", 0) == 0) {
+            options.warmupS = std::max(0.0, atof(arg.c_str() + 9));
+        } else if (arg.rfind("--display-hz=", 0) == 0) {
+            options.displayHz = std::max(1, atoi(arg.c_str() + 13));
+        } else if (arg.rfind("--decoder=", 0) == 0) {
+            options.decoder = arg.substr(10);
+        } else if (arg.rfind("--generator=", 0) == 0) {
+            options.generator = arg.substr(12);
+        } else if (arg == "--external") {
+            options.external = true;
+        } else if (arg == "--gl-context=wrapped" || arg == "--gl-context=shared") {
+            options.glContext = arg == "--gl-context=shared" ? SHARED_CONTEXT : WRAPPED_RENDER_CONTEXT;
+        } else if (arg.rfind("--late-join=", 0) == 0) {
+            options.lateJoinS = std::max(0.0, atof(arg.c_str() + 12));
+        } else if (arg == "--warm-start=on" || arg == "--warm-start=off") {
+            options.warmStart = arg == "--warm-start=on";
+        } else if (arg.rfind("--csv=", 0) == 0) {
+            options.csv = arg.substr(6);
+        } else if (arg.rfind("--baseline=", 0) == 0) {
+            options.baseline = arg.substr(11);
+        } else if (arg.rfind("--tolerance=", 0) == 0) {
+            options.tolerancePercent = std::max(0.0, atof(arg.c_str() + 12));
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (options.codecs.empty()) {
+        options.codecs = {Codec::JPEG, Codec::VP8, Codec::VP9, Codec::H264, Codec::H265};
+    }
+    for (const auto &label: options.resolutions) {
+        try {
+            CameraResolution::fromLabel(label);
+        } catch (const std::invalid_argument &e) {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+    }
+    if (options.generator.empty()) {
+        char path[4096];
+        ssize_t length = readlink("/proc/self/exe", path, sizeof(path) - 1);
+        std::string self(path, std::max<ssize_t>(0, length));
+        options.generator = self.substr(0, self.rfind('/') + 1) + "stream_generator";
+    }
+
+    if (!headless_egl_init()) {
+        return 1;
+    }
+
+    std::vector<RunResult> results;
+    {
+        // Time is the local clock, the generator on the same host stamps its packets with it too
+        NtpTimer ntp("127.0.0.1");
+        CamPair cameras{};
+        BS::thread_pool<BS::tp::none> pool(1);
+        GstreamerPlayer player(&cameras, &ntp, options.glContext);
+        printf("GStreamer GL context: %s\n", GlContextModeToString(player.glContextMode()).c_str());
+
+        for (Codec codec: options.codecs) {
+            for (const auto &resolution: options.resolutions) {
+                RunResult result;
+                result.codec = codec;
+                result.resolution = resolution;
+                result.fps = options.fps;
+                if (run(player, pool, cameras, ntp, options, result)) {
+                    print_result(result);
+                    results.push_back(std::move(result));
+                } else {
+                    printf("\n%s %s @ %d fps: no frames presented\n", CodecToString(codec).c_str(),
+                           resolution.c_str(), options.fps);
+                }
+            }
+        }
+
+        delete cameras.first.uploadRing;
+        delete cameras.second.uploadRing;
+        delete cameras.first.glSamples;
+        delete cameras.second.glSamples;
+    }
+    headless_egl_terminate();
+
+    if (!options.csv.empty() && !write_csv(options.csv, results)) {
+        fprintf(stderr, "Cannot write %s\n", options.csv.c_str());
+        return 1;
+    }
+    if (!options.baseline.empty()) {
+        int regressions = compare_baseline(options.baseline, results, options.tolerancePercent);
+        if (regressions < 0) {
+            fprintf(stderr, "Cannot read %s\n", options.baseline.c_str());
+            return 1;
+        }
+        if (regressions > 0) {
+            return 2;
+        }
+    }
+    return results.size() == options.codecs.size() * options.resolutions.size() ? 0 : 1;
+}
@@ -0,0 +1,66 @@
+//
+// decoder_probe - Runs the headset's decoder probe against the host's decoders
+//
+// Usage: decoder_probe [--codec=JPEG|VP8|VP9|H264|H265] [--resolution=FHD] [--fps=60] [--frames=30]
+// Prints every candidate decoder with its measured latency and throughput in the order the headset
+// would try them. Exits non-zero if a codec has no working decoder, so it can run in CI.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "decoder_probe.h"
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    std::vector<Codec> codecs = {Codec::JPEG, Codec::VP8, Codec::VP9, Codec::H264, Codec::H265};
+    std::string resolution = "FHD";
+    int fps = 60, frames = 30;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--codec=", 0) == 0) {
+            codecs.clear();
+            for (int c = 0; c < Codec::Count; ++c) {
+                if (CodecToString(static_cast<Codec>(c)) == arg.substr(8)) {
+                    codecs.push_back(static_cast<Codec>(c));
+                }
+            }
+        } else if (arg.rfind("--resolution=", 0) == 0) {
+            resolution = arg.substr(13);
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--frames=", 0) == 0) {
+            frames = std::max(1, atoi(arg.c_str() + 9));
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    auto preset = CameraResolution::fromLabel(resolution);
+    DecoderProbe probe(preset.getWidth(), preset.getHeight(), fps);
+    probe.frames = frames;
+
+    printf("Fingerprint %s, %s %dx%d @ %d fps\n", DecoderProbe::fingerprint().c_str(), resolution.c_str(),
+           preset.getWidth(), preset.getHeight(), fps);
+    printf("%-6s %-4s %-32s %-8s %12s %10s\n", "codec", "rank", "decoder", "result", "latency (us)", "fps");
+
+    int failures = 0;
+    for (Codec codec: codecs) {
+        auto scores = probe.run(codec);
+        if (scores.empty() || !scores.front().works) {
+            printf("%-6s no working decoder\n", CodecToString(codec).c_str());
+            failures++;
+            continue;
+        }
+        for (size_t i = 0; i < scores.size(); ++i) {
+            const auto &score = scores[i];
+            printf("%-6s %-4zu %-32s %-8s %12.0f %10.0f\n", CodecToString(codec).c_str(), i + 1,
+                   score.factory.c_str(), !score.works ? "failed" : score.measured ? "ok" : "unmeasured",
+                   score.latencyUs, score.fps);
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+//
+// fec_loopback - Sends a test stream through random packet loss into the headset's receive pipeline
+//
+// Usage: fec_loopback [--codec=JPEG|VP8|VP9|H264|H265] [--loss=0.05] [--overhead=20] [--frames=N]
+//                     [--resolution=HD] [--fps=30]
+// Runs the stream twice in one process, plain RTP and RED/ULPFEC with the given overhead, the way the
+// sender would produce them, and drops packets with the given probability on the way to the receive
+// pipeline PipelineBuilder assembles for the headset. Reports the packets the jitter buffer lost, the
+// ones the FEC decoder rebuilt and the frames that came out of the decoder.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <fmt/format.h>
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "pipeline_builder.h"
+
+struct LoopbackResult {
+    bool ok = false;
+    guint64 lost = 0;
+    guint recovered = 0, unrecovered = 0;
+    uint64_t frames = 0;
+};
+
+static const char *encoder_for(Codec codec) {
+    switch (codec) {
+        case Codec::JPEG:
+            return "jpegenc quality=60 ! rtpjpegpay";
+        case Codec::VP8:
+            return "vp8enc deadline=1 keyframe-max-dist=60 ! rtpvp8pay";
+        case Codec::VP9:
+            return "vp9enc deadline=1 keyframe-max-dist=60 ! rtpvp9pay";
+        case Codec::H264:
+            return "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=60 ! rtph264pay config-interval=-1";
+        case Codec::H265:
+            return "x265enc tune=zerolatency speed-preset=ultrafast key-int-max=60 ! rtph265pay config-interval=-1";
+        default:
+            return nullptr;
+    }
+}
+
+static void on_frame(GstElement *, GstBuffer *, GstPad *, std::atomic<uint64_t> *frames) {
+    frames->fetch_add(1, std::memory_order_relaxed);
+}
+
+static LoopbackResult run(PipelineBuilder builder, int width, int height, int fps, int frames, double loss,
+                          int overhead) {
+    // The sender side: live test source, payloader, FEC and RED like on the robot, then the loss
+    std::string sender = fmt::format("videotestsrc is-live=true pattern=ball num-buffers={} ! "
+                                     "video/x-raw,format=I420,width={},height={},framerate={}/1 ! {} mtu=1200",
+                                     frames, width, height, fps, encoder_for(builder.codec()));
+    if (builder.fecScheme() == ULPFEC) {
+        sender += fmt::format(" ! rtpulpfecenc pt={} percentage={} ! rtpredenc pt={} allow-no-red-blocks=true",
+                              PipelineBuilder::FEC_PAYLOAD_TYPE, overhead, PipelineBuilder::RED_PAYLOAD_TYPE);
+    }
+    sender += fmt::format(" ! identity name=loss drop-probability={}", loss);
+    builder.source(sender).sink(PipelineSink::FAKE);
+
+    LoopbackResult result;
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(builder.describe().c_str(), &error);
+    if (error) {
+        fprintf(stderr, "Cannot build the %s loopback: %s\n", FecSchemeToString(builder.fecScheme()).c_str(),
+                error->message);
+        g_error_free(error);
+        return result;
+    }
+
+    GstElement *rtpjb = gst_bin_get_by_name(GST_BIN(pipeline), "rtpjb");
+    GstElement *fecdec = gst_bin_get_by_name(GST_BIN(pipeline), "fecdec");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    if (fecdec) {
+        GstElement *rtpstorage = gst_bin_get_by_name(GST_BIN(pipeline), "rtpstorage");
+        GObject *storage = nullptr;
+        g_object_get(rtpstorage, "internal-storage", &storage, NULL);
+        g_object_set(fecdec, "storage", storage, NULL);
+        g_object_unref(storage);
+        gst_object_unref(rtpstorage);
+    }
+
+    std::atomic<uint64_t> decoded{0};
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_frame), &decoded);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                     static_cast<GstMessageType>(GST_MESSAGE_EOS |
+                                                                                 GST_MESSAGE_ERROR));
+    result.ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    if (!result.ok) {
+        GError *messageError = nullptr;
+        gst_message_parse_error(message, &messageError, nullptr);
+        fprintf(stderr, "%s loopback failed: %s\n", FecSchemeToString(builder.fecScheme()).c_str(),
+                messageError->message);
+        g_error_free(messageError);
+    }
+    gst_message_unref(message);
+    gst_object_unref(bus);
+
+    GstStructure *stats = nullptr;
+    g_object_get(rtpjb, "stats", &stats, NULL);
+    if (stats) {
+        gst_structure_get_uint64(stats, "num-lost", &result.lost);
+        gst_structure_free(stats);
+    }
+    if (fecdec) {
+        g_object_get(fecdec, "recovered", &result.recovered, "unrecovered", &result.unrecovered, NULL);
+        gst_object_unref(fecdec);
+    }
+    result.frames = decoded.load();
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(rtpjb);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return result;
+}
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    Codec codec = Codec::H264;
+    std::string resolution = "HD";
+    int frames = 300, fps = 30, overhead = 20;
+    double loss = 0.05;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--codec=", 0) == 0) {
+            for (int c = 0; c < Codec::Count; ++c) {
+                if (CodecToString(static_cast<Codec>(c)) == arg.substr(8)) {
+                    codec = static_cast<Codec>(c);
+                }
+            }
+        } else if (arg.rfind("--loss=", 0) == 0) {
+            loss = std::clamp(atof(arg.c_str() + 7), 0.0, 1.0);
+        } else if (arg.rfind("--overhead=", 0) == 0) {
+            overhead = std::clamp(atoi(arg.c_str() + 11), 1, 100);
+        } else if (arg.rfind("--frames=", 0) == 0) {
+            frames = std::max(1, atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--resolution=", 0) == 0) {
+            resolution = arg.substr(13);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    auto preset = CameraResolution::fromLabel(resolution);
+    printf("%s %s %dx%d @ %d fps, %d frames, %.1f%% packet loss\n", CodecToString(codec).c_str(),
+           resolution.c_str(), preset.getWidth(), preset.getHeight(), fps, frames, loss * 100);
+    printf("%-12s %10s %10s %12s %10s\n", "fec", "lost", "recovered", "unrecovered", "frames");
+
+    int failures = 0;
+    for (FecScheme scheme: {NO_FEC, ULPFEC}) {
+        PipelineBuilder builder(codec);
+        builder.resolution(preset.getWidth(), preset.getHeight()).framerate(fps).fec(scheme);
+        LoopbackResult result = run(builder, preset.getWidth(), preset.getHeight(), fps, frames, loss, overhead);
+        if (!result.ok) {
+            failures++;
+            continue;
+        }
+        std::string label = scheme == NO_FEC ? "none" : fmt::format("ulpfec {}%", overhead);
+        printf("%-12s %10lu %10u %12u %10lu\n", label.c_str(), (unsigned long) result.lost, result.recovered,
+               result.unrecovered, (unsigned long) result.frames);
+    }
+    return failures == 0 ? 0 : 1;
+}
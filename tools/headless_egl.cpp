@@ -0,0 +1,75 @@
+//
+// Headless EGL context for the desktop tools and benchmarks
+//
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#include <cstring>
+#include "log.h"
+
+#include "headless_egl.h"
+
+static EGLDisplay egl_display = EGL_NO_DISPLAY;
+static EGLContext egl_context = EGL_NO_CONTEXT;
+static EGLSurface egl_surface = EGL_NO_SURFACE;
+
+bool headless_egl_init() {
+    egl_display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+    EGLint major, minor;
+    if (egl_display == EGL_NO_DISPLAY || !eglInitialize(egl_display, &major, &minor)) {
+        LOG_ERROR("EGL: no display (try EGL_PLATFORM=surfaceless)");
+        return false;
+    }
+    LOG_INFO("EGL Version: %d.%d", major, minor);
+
+    const char *extensions = eglQueryString(egl_display, EGL_EXTENSIONS);
+    bool surfaceless = extensions && strstr(extensions, "EGL_KHR_surfaceless_context");
+
+    const EGLint configAttribs[] = {
+            EGL_RENDERABLE_TYPE, EGL_OPENGL_ES3_BIT,
+            EGL_SURFACE_TYPE, surfaceless ? 0 : EGL_PBUFFER_BIT,
+            EGL_RED_SIZE, 8,
+            EGL_GREEN_SIZE, 8,
+            EGL_BLUE_SIZE, 8,
+            EGL_NONE,
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(egl_display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        LOG_ERROR("EGL: failed to find a GLES 3 config");
+        return false;
+    }
+
+    eglBindAPI(EGL_OPENGL_ES_API);
+    const EGLint contextAttribs[] = {EGL_CONTEXT_CLIENT_VERSION, 3, EGL_NONE};
+    egl_context = eglCreateContext(egl_display, config, EGL_NO_CONTEXT, contextAttribs);
+    if (egl_context == EGL_NO_CONTEXT) {
+        LOG_ERROR("EGL: eglCreateContext() failed: 0x%x", eglGetError());
+        return false;
+    }
+
+    if (!surfaceless) {
+        const EGLint surfaceAttribs[] = {EGL_WIDTH, 16, EGL_HEIGHT, 16, EGL_NONE};
+        egl_surface = eglCreatePbufferSurface(egl_display, config, surfaceAttribs);
+        if (egl_surface == EGL_NO_SURFACE) {
+            LOG_ERROR("EGL: eglCreatePbufferSurface() failed: 0x%x", eglGetError());
+            return false;
+        }
+    }
+
+    if (!eglMakeCurrent(egl_display, egl_surface, egl_surface, egl_context)) {
+        LOG_ERROR("EGL: eglMakeCurrent() failed: 0x%x", eglGetError());
+        return false;
+    }
+    return true;
+}
+
+void headless_egl_terminate() {
+    if (egl_display == EGL_NO_DISPLAY) {
+        return;
+    }
+    eglMakeCurrent(egl_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if (egl_surface != EGL_NO_SURFACE) eglDestroySurface(egl_display, egl_surface);
+    if (egl_context != EGL_NO_CONTEXT) eglDestroyContext(egl_display, egl_context);
+    eglTerminate(egl_display);
+    egl_display = EGL_NO_DISPLAY;
+}
@@ -0,0 +1,11 @@
+//
+// Headless EGL context for the desktop tools and benchmarks
+//
+#pragma once
+
+// Creates a GLES 3 context on the default display and makes it current. Uses a surfaceless
+// context when EGL_KHR_surfaceless_context is available and a small pbuffer otherwise, mirroring
+// egl_init_with_pbuffer_surface() on the headset.
+bool headless_egl_init();
+
+void headless_egl_terminate();
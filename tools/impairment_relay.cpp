@@ -0,0 +1,484 @@
+//
+// impairment_relay - Userspace UDP relay that degrades the traffic between the robot and the headset
+//
+// Usage: impairment_relay <scenario.ini> [--duration=s]
+// Every link of the scenario listens on one address:port and forwards what arrives to another,
+// after loss, rate limiting, delay, reordering, duplication and outages. Links are one-way; the
+// scenario names one per flow (camera streams, NACKs, robot control, ROS gateway), see
+// tools/scenarios/warehouse_wifi.ini. Prints per-link counters every stats_interval seconds.
+//
+// Scenario keys, in [default] (inherited by the links after it) or in a [link name] section:
+//   listen    = address:port        where the sender sends to
+//   forward   = host:port           where the packets go on to
+//   loss      = bernoulli P | gilbert P_GOOD_TO_BAD P_BAD_TO_GOOD [LOSS_GOOD LOSS_BAD]
+//   delay     = constant MS | uniform MIN MAX | normal MEAN STDDEV | pareto MIN ALPHA
+//   reorder   = P EXTRA_MS          packets that may be overtaken, delayed by EXTRA_MS more
+//   duplicate = P
+//   rate      = KBIT [BURST_BYTES [QUEUE_BYTES]]   token bucket, tail drop beyond the queue
+//   rate_steps = T_S KBIT [T_S KBIT ...]     the rate from T_S seconds after the start on, capacity changes
+//   outage    = PERIOD_S DURATION_MS [drop|hold]   e.g. roaming between access points
+// Top level: seed = N, stats_interval = S.
+//
+// Without reordering packets leave in the order they came, like a Wi-Fi link retrying frames;
+// jitter then shows as bunching rather than overtaking.
+//
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+static uint64_t now_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(Clock::now().time_since_epoch()).count();
+}
+
+struct Distribution {
+    enum Kind {
+        CONSTANT, UNIFORM, NORMAL, PARETO
+    } kind = CONSTANT;
+    double a = 0, b = 0;
+
+    // Milliseconds, never negative
+    double sample(std::mt19937_64 &rng) const {
+        switch (kind) {
+            case UNIFORM:
+                return std::uniform_real_distribution<double>(a, b)(rng);
+            case NORMAL:
+                return std::max(0.0, std::normal_distribution<double>(a, b)(rng));
+            case PARETO: {
+                // Heavy tail above the minimum a with shape b
+                double u = std::uniform_real_distribution<double>(0.0, 1.0)(rng);
+                return a / std::pow(1.0 - u, 1.0 / b);
+            }
+            default:
+                return a;
+        }
+    }
+};
+
+struct Impairment {
+    enum LossModel {
+        NO_LOSS, BERNOULLI, GILBERT_ELLIOTT
+    } loss = NO_LOSS;
+    double lossProbability = 0; // Bernoulli
+    double goodToBad = 0, badToGood = 1, lossGood = 0, lossBad = 1; // Gilbert-Elliott, per packet
+    Distribution delay;
+    double reorderProbability = 0, reorderExtraMs = 0;
+    double duplicateProbability = 0;
+    double rateKbit = 0; // 0 = unlimited
+    double burstBytes = 15000, queueBytes = 200000;
+    std::vector<std::pair<double, double>> rateSteps; // Seconds from the start, rate from then on
+
+    [[nodiscard]] double rateAt(double elapsedS) const {
+        double rate = rateKbit;
+        for (const auto &step: rateSteps) {
+            if (step.first <= elapsedS) {
+                rate = step.second;
+            }
+        }
+        return rate;
+    }
+    double outagePeriodS = 0, outageMs = 0;
+    bool outageHold = false; // Hold packets until the outage ends instead of dropping them
+};
+
+struct Link {
+    std::string name;
+    sockaddr_in listen{}, forward{};
+    Impairment impairment;
+    int socket = -1;
+
+    // Impairment state
+    bool bad = false;
+    double tokens = 0;
+    uint64_t tokensAtUs = 0;
+    uint64_t lastDepartureUs = 0, lastReleaseUs = 0;
+    std::deque<std::pair<uint64_t, size_t>> backlog; // Departure time and size of the rate-limited packets
+
+    // Counters since the last report
+    uint64_t received = 0, sent = 0, lost = 0, queueDropped = 0, outageDropped = 0, duplicated = 0, reordered = 0;
+    double addedDelayMs = 0;
+};
+
+struct Scheduled {
+    uint64_t releaseUs;
+    uint64_t order; // Ties leave in arrival order
+    size_t link;
+    std::vector<uint8_t> data;
+
+    bool operator>(const Scheduled &other) const {
+        return releaseUs != other.releaseUs ? releaseUs > other.releaseUs : order > other.order;
+    }
+};
+
+struct Scenario {
+    std::vector<Link> links;
+    uint64_t seed = 1;
+    double statsIntervalS = 1;
+};
+
+static sockaddr_in parse_address(const std::string &value, int line) {
+    auto colon = value.rfind(':');
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    if (colon == std::string::npos ||
+        inet_pton(AF_INET, value.substr(0, colon).c_str(), &address.sin_addr) != 1) {
+        throw std::runtime_error("line " + std::to_string(line) + ": expected IPv4 address:port, got " + value);
+    }
+    address.sin_port = htons(static_cast<uint16_t>(std::stoi(value.substr(colon + 1))));
+    return address;
+}
+
+static void parse_impairment(Impairment &impairment, const std::string &key, std::istringstream &values, int line) {
+    auto fail = [&key, line]() {
+        throw std::runtime_error("line " + std::to_string(line) + ": invalid " + key);
+    };
+    std::string kind;
+    if (key == "loss") {
+        values >> kind;
+        if (kind == "bernoulli") {
+            impairment.loss = Impairment::BERNOULLI;
+            if (!(values >> impairment.lossProbability)) fail();
+        } else if (kind == "gilbert") {
+            impairment.loss = Impairment::GILBERT_ELLIOTT;
+            if (!(values >> impairment.goodToBad >> impairment.badToGood)) fail();
+            values >> impairment.lossGood >> impairment.lossBad;
+        } else if (kind == "none") {
+            impairment.loss = Impairment::NO_LOSS;
+        } else {
+            fail();
+        }
+    } else if (key == "delay") {
+        values >> kind;
+        Distribution &delay = impairment.delay;
+        delay.kind = kind == "uniform" ? Distribution::UNIFORM : kind == "normal" ? Distribution::NORMAL
+                   : kind == "pareto" ? Distribution::PARETO : Distribution::CONSTANT;
+        if (kind != "constant" && delay.kind == Distribution::CONSTANT) fail();
+        if (!(values >> delay.a)) fail();
+        if (delay.kind != Distribution::CONSTANT && !(values >> delay.b)) fail();
+    } else if (key == "reorder") {
+        if (!(values >> impairment.reorderProbability >> impairment.reorderExtraMs)) fail();
+    } else if (key == "duplicate") {
+        if (!(values >> impairment.duplicateProbability)) fail();
+    } else if (key == "rate") {
+        if (!(values >> impairment.rateKbit)) fail();
+        values >> impairment.burstBytes >> impairment.queueBytes;
+    } else if (key == "rate_steps") {
+        impairment.rateSteps.clear();
+        double atS, kbit;
+        while (values >> atS) {
+            if (!(values >> kbit)) fail();
+            impairment.rateSteps.emplace_back(atS, kbit);
+        }
+        if (impairment.rateSteps.empty()) fail();
+    } else if (key == "outage") {
+        if (!(values >> impairment.outagePeriodS >> impairment.outageMs)) fail();
+        values >> kind;
+        impairment.outageHold = kind == "hold";
+    } else {
+        throw std::runtime_error("line " + std::to_string(line) + ": unknown key " + key);
+    }
+}
+
+static Scenario load_scenario(const std::string &path) {
+    std::ifstream file(path);
+    if (!file) {
+        throw std::runtime_error("cannot open " + path);
+    }
+
+    Scenario scenario;
+    Impairment defaults;
+    Link *link = nullptr;
+    bool inDefaults = false;
+    std::vector<bool> hasForward;
+    std::string text;
+    for (int line = 1; std::getline(file, text); ++line) {
+        text = text.substr(0, text.find('#'));
+        auto first = text.find_first_not_of(" \t\r");
+        if (first == std::string::npos) {
+            continue;
+        }
+        text = text.substr(first, text.find_last_not_of(" \t\r") - first + 1);
+
+        if (text.front() == '[' && text.back() == ']') {
+            std::string name = text.substr(1, text.size() - 2);
+            inDefaults = name == "default";
+            if (!inDefaults) {
+                link = &scenario.links.emplace_back();
+                hasForward.push_back(false);
+                link->name = name.rfind("link ", 0) == 0 ? name.substr(5) : name;
+                link->impairment = defaults;
+            }
+            continue;
+        }
+
+        auto equals = text.find('=');
+        if (equals == std::string::npos) {
+            throw std::runtime_error("line " + std::to_string(line) + ": expected key = value");
+        }
+        std::string key = text.substr(0, text.find_last_not_of(" \t", equals - 1) + 1);
+        std::istringstream values(text.substr(equals + 1));
+
+        if (!link && !inDefaults) {
+            if (key == "seed") {
+                values >> scenario.seed;
+            } else if (key == "stats_interval") {
+                values >> scenario.statsIntervalS;
+            } else {
+                throw std::runtime_error("line " + std::to_string(line) + ": " + key + " outside of a section");
+            }
+        } else if (inDefaults) {
+            parse_impairment(defaults, key, values, line);
+        } else if (key == "listen" || key == "forward") {
+            std::string address;
+            values >> address;
+            (key == "listen" ? link->listen : link->forward) = parse_address(address, line);
+            hasForward.back() = hasForward.back() || key == "forward";
+        } else {
+            parse_impairment(link->impairment, key, values, line);
+        }
+    }
+
+    for (size_t i = 0; i < scenario.links.size(); ++i) {
+        if (scenario.links[i].listen.sin_port == 0 || !hasForward[i]) {
+            throw std::runtime_error("link " + scenario.links[i].name + " needs listen and forward");
+        }
+    }
+    if (scenario.links.empty()) {
+        throw std::runtime_error(path + " defines no links");
+    }
+    return scenario;
+}
+
+class Relay {
+public:
+    explicit Relay(Scenario scenario) : scenario_(std::move(scenario)), rng_(scenario_.seed) {
+        for (Link &link: scenario_.links) {
+            link.socket = socket(AF_INET, SOCK_DGRAM, 0);
+            int size = 4 * 1024 * 1024;
+            setsockopt(link.socket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+            if (link.socket < 0 || bind(link.socket, reinterpret_cast<sockaddr *>(&link.listen),
+                                        sizeof(link.listen)) < 0) {
+                throw std::runtime_error("link " + link.name + ": cannot bind " + describe(link.listen) + ": " +
+                                         strerror(errno));
+            }
+            link.tokens = link.impairment.burstBytes;
+            printf("%-14s %21s -> %-21s\n", link.name.c_str(), describe(link.listen).c_str(),
+                   describe(link.forward).c_str());
+        }
+    }
+
+    ~Relay() {
+        for (Link &link: scenario_.links) {
+            if (link.socket >= 0) {
+                close(link.socket);
+            }
+        }
+    }
+
+    void run(double durationS) {
+        std::vector<pollfd> fds;
+        for (const Link &link: scenario_.links) {
+            fds.push_back({link.socket, POLLIN, 0});
+        }
+        startUs_ = now_us();
+        uint64_t nextReportUs = startUs_ + static_cast<uint64_t>(scenario_.statsIntervalS * 1e6);
+        uint64_t endUs = durationS > 0 ? startUs_ + static_cast<uint64_t>(durationS * 1e6) : UINT64_MAX;
+        std::vector<uint8_t> buffer(65536);
+
+        while (now_us() < endUs) {
+            uint64_t now = now_us();
+            uint64_t wakeUs = std::min(nextReportUs, endUs);
+            if (!scheduled_.empty()) {
+                wakeUs = std::min(wakeUs, scheduled_.top().releaseUs);
+            }
+            // poll() only has millisecond resolution, the last stretch is spun
+            int timeoutMs = wakeUs > now + 1000 ? static_cast<int>((wakeUs - now) / 1000) : 0;
+            poll(fds.data(), fds.size(), timeoutMs);
+
+            for (size_t i = 0; i < fds.size(); ++i) {
+                if (!(fds[i].revents & POLLIN)) {
+                    continue;
+                }
+                ssize_t size;
+                while ((size = recv(fds[i].fd, buffer.data(), buffer.size(), MSG_DONTWAIT)) > 0) {
+                    admit(i, std::vector<uint8_t>(buffer.begin(), buffer.begin() + size), now_us());
+                }
+            }
+
+            now = now_us();
+            while (!scheduled_.empty() && scheduled_.top().releaseUs <= now) {
+                const Scheduled &packet = scheduled_.top();
+                Link &link = scenario_.links[packet.link];
+                sendto(link.socket, packet.data.data(), packet.data.size(), 0,
+                       reinterpret_cast<const sockaddr *>(&link.forward), sizeof(link.forward));
+                link.sent++;
+                scheduled_.pop();
+            }
+
+            if (now >= nextReportUs) {
+                report(now);
+                nextReportUs += static_cast<uint64_t>(scenario_.statsIntervalS * 1e6);
+            }
+        }
+    }
+
+private:
+    static std::string describe(const sockaddr_in &address) {
+        char host[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &address.sin_addr, host, sizeof(host));
+        return std::string(host) + ":" + std::to_string(ntohs(address.sin_port));
+    }
+
+    bool chance(double probability) {
+        return probability > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(rng_) < probability;
+    }
+
+    void admit(size_t index, std::vector<uint8_t> data, uint64_t arrivalUs) {
+        Link &link = scenario_.links[index];
+        const Impairment &impairment = link.impairment;
+        link.received++;
+
+        // Outages: dropped, or held until the link comes back
+        uint64_t releaseFloorUs = arrivalUs;
+        if (impairment.outagePeriodS > 0 && impairment.outageMs > 0) {
+            auto periodUs = static_cast<uint64_t>(impairment.outagePeriodS * 1e6);
+            uint64_t intoPeriodUs = (arrivalUs - startUs_) % periodUs;
+            auto outageUs = static_cast<uint64_t>(impairment.outageMs * 1000);
+            if (arrivalUs - startUs_ >= periodUs && intoPeriodUs < outageUs) {
+                if (!impairment.outageHold) {
+                    link.outageDropped++;
+                    return;
+                }
+                releaseFloorUs = arrivalUs - intoPeriodUs + outageUs;
+            }
+        }
+
+        // Loss, Gilbert-Elliott moves between its good and bad state once per packet
+        bool lose = false;
+        if (impairment.loss == Impairment::BERNOULLI) {
+            lose = chance(impairment.lossProbability);
+        } else if (impairment.loss == Impairment::GILBERT_ELLIOTT) {
+            link.bad = link.bad ? !chance(impairment.badToGood) : chance(impairment.goodToBad);
+            lose = chance(link.bad ? impairment.lossBad : impairment.lossGood);
+        }
+        if (lose) {
+            link.lost++;
+            return;
+        }
+
+        int copies = chance(impairment.duplicateProbability) ? 2 : 1;
+        link.duplicated += copies - 1;
+        for (int copy = 0; copy < copies; ++copy) {
+            uint64_t departureUs = std::max(releaseFloorUs, link.lastDepartureUs);
+            double rateKbit = impairment.rateAt(static_cast<double>(arrivalUs - startUs_) / 1e6);
+            if (rateKbit > 0) {
+                // Token bucket refilled at the rate up to the burst size, a FIFO queue in front of it
+                while (!link.backlog.empty() && link.backlog.front().first <= arrivalUs) {
+                    link.backlog.pop_front();
+                }
+                size_t queued = 0;
+                for (const auto &entry: link.backlog) {
+                    queued += entry.second;
+                }
+                if (static_cast<double>(queued + data.size()) > impairment.queueBytes) {
+                    link.queueDropped++;
+                    continue;
+                }
+                double bytesPerUs = rateKbit * 1000 / 8 / 1e6;
+                link.tokens = std::min(impairment.burstBytes, link.tokens + bytesPerUs *
+                        static_cast<double>(departureUs - std::min(departureUs, link.tokensAtUs)));
+                auto size = static_cast<double>(data.size());
+                if (link.tokens < size) {
+                    departureUs += static_cast<uint64_t>((size - link.tokens) / bytesPerUs);
+                    link.tokens = size;
+                }
+                link.tokens -= size;
+                link.tokensAtUs = departureUs;
+                link.backlog.emplace_back(departureUs, data.size());
+            }
+            link.lastDepartureUs = departureUs;
+
+            auto delayUs = static_cast<uint64_t>(impairment.delay.sample(rng_) * 1000);
+            uint64_t releaseUs = departureUs + delayUs;
+            if (chance(impairment.reorderProbability)) {
+                releaseUs += static_cast<uint64_t>(impairment.reorderExtraMs * 1000);
+                link.reordered++;
+            } else {
+                // In order behind everything sent before
+                releaseUs = std::max(releaseUs, link.lastReleaseUs);
+                link.lastReleaseUs = releaseUs;
+            }
+            link.addedDelayMs += static_cast<double>(releaseUs - arrivalUs) / 1000;
+            scheduled_.push({releaseUs, order_++, index, copy + 1 < copies ? data : std::move(data)});
+        }
+    }
+
+    void report(uint64_t now) {
+        printf("t=%7.1f s\n", static_cast<double>(now - startUs_) / 1e6);
+        for (Link &link: scenario_.links) {
+            uint64_t delayed = link.received - link.lost - link.outageDropped + link.duplicated - link.queueDropped;
+            printf("  %-14s in %6lu out %6lu  lost %5lu (%5.1f%%)  queue drop %4lu  outage %4lu  dup %3lu  "
+                   "reordered %3lu  delay %6.1f ms\n", link.name.c_str(), (unsigned long) link.received,
+                   (unsigned long) link.sent, (unsigned long) link.lost,
+                   link.received ? 100.0 * static_cast<double>(link.lost) / static_cast<double>(link.received) : 0.0,
+                   (unsigned long) link.queueDropped, (unsigned long) link.outageDropped,
+                   (unsigned long) link.duplicated, (unsigned long) link.reordered,
+                   delayed ? link.addedDelayMs / static_cast<double>(delayed) : 0.0);
+            link.received = link.sent = link.lost = link.queueDropped = link.outageDropped = 0;
+            link.duplicated = link.reordered = 0;
+            link.addedDelayMs = 0;
+        }
+        fflush(stdout);
+    }
+
+    Scenario scenario_;
+    std::mt19937_64 rng_;
+    std::priority_queue<Scheduled, std::vector<Scheduled>, std::greater<>> scheduled_;
+    uint64_t order_ = 0;
+    uint64_t startUs_ = 0;
+};
+
+int main(int argc, char **argv) {
+    std::string path;
+    double durationS = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--duration=", 0) == 0) {
+            durationS = atof(arg.c_str() + 11);
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        fprintf(stderr, "Usage: %s <scenario.ini> [--duration=s]\n", argv[0]);
+        return 1;
+    }
+
+    try {
+        Relay relay(load_scenario(path));
+        relay.run(durationS);
+    } catch (const std::exception &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
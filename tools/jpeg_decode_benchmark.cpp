@@ -0,0 +1,145 @@
+//
+// jpeg_decode_benchmark - Per-frame JPEG decode latency of ParallelJpegDecoder against thread count
+//
+// Usage: jpeg_decode_benchmark [--threads=N] [frames.jpg ...]
+// Decodes recorded frames (e.g. dumped from the sender) or, without arguments, synthetic QHD and UHD
+// frames encoded with one restart interval per MCU row. Every frame is decoded to RGB and to its
+// planar layout with 1..N slices and the latency percentiles are printed per thread count.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+#include <jpeglib.h>
+#include "parallel_jpeg_decoder.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Frame {
+    std::string name;
+    std::vector<uint8_t> jpeg;
+    int width = 0, height = 0;
+};
+
+static std::vector<uint8_t> encode_synthetic(int width, int height) {
+    std::vector<uint8_t> rgb(static_cast<size_t>(width) * height * 3);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < width; ++x) {
+            uint8_t *p = &rgb[(static_cast<size_t>(y) * width + x) * 3];
+            // Gradients plus some texture, so the entropy-coded data is not trivially small
+            p[0] = static_cast<uint8_t>(x * 255 / width);
+            p[1] = static_cast<uint8_t>(y * 255 / height);
+            p[2] = static_cast<uint8_t>(127 + 127 * std::sin(x * 0.05) * std::cos(y * 0.07));
+        }
+    }
+
+    jpeg_compress_struct cinfo{};
+    jpeg_error_mgr error{};
+    cinfo.err = jpeg_std_error(&error);
+    jpeg_create_compress(&cinfo);
+    unsigned char *out = nullptr;
+    unsigned long outSize = 0;
+    jpeg_mem_dest(&cinfo, &out, &outSize);
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, 60, TRUE);
+    cinfo.restart_in_rows = 1;
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height) {
+        JSAMPROW row = &rgb[static_cast<size_t>(cinfo.next_scanline) * width * 3];
+        jpeg_write_scanlines(&cinfo, &row, 1);
+    }
+    jpeg_finish_compress(&cinfo);
+    jpeg_destroy_compress(&cinfo);
+
+    std::vector<uint8_t> jpeg(out, out + outSize);
+    free(out);
+    return jpeg;
+}
+
+static bool read_dimensions(Frame &frame) {
+    jpeg_decompress_struct cinfo{};
+    jpeg_error_mgr error{};
+    cinfo.err = jpeg_std_error(&error);
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, frame.jpeg.data(), frame.jpeg.size());
+    bool ok = jpeg_read_header(&cinfo, TRUE) == JPEG_HEADER_OK;
+    frame.width = static_cast<int>(cinfo.image_width);
+    frame.height = static_cast<int>(cinfo.image_height);
+    jpeg_destroy_decompress(&cinfo);
+    return ok;
+}
+
+static double percentile(std::vector<double> values, double p) {
+    std::sort(values.begin(), values.end());
+    return values[std::min(values.size() - 1, static_cast<size_t>(p * values.size()))];
+}
+
+int main(int argc, char **argv) {
+    size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<Frame> frames;
+    for (int i = 1; i < argc; ++i) {
+        if (std::string(argv[i]).rfind("--threads=", 0) == 0) {
+            maxThreads = std::max(1, atoi(argv[i] + 10));
+            continue;
+        }
+        std::ifstream file(argv[i], std::ios::binary);
+        Frame frame{argv[i], {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()}};
+        if (!read_dimensions(frame)) {
+            fprintf(stderr, "Skipping %s, not a JPEG\n", argv[i]);
+            continue;
+        }
+        frames.push_back(std::move(frame));
+    }
+    if (frames.empty()) {
+        frames.push_back({"synthetic QHD", encode_synthetic(2560, 1440), 2560, 1440});
+        frames.push_back({"synthetic UHD", encode_synthetic(3840, 2160), 3840, 2160});
+    }
+
+    const int iterations = 50;
+    BS::thread_pool<BS::tp::none> pool(maxThreads);
+
+    for (const auto &frame: frames) {
+        printf("%s: %dx%d, %zu bytes\n", frame.name.c_str(), frame.width, frame.height, frame.jpeg.size());
+        printf("  %-7s %-7s %7s %9s %9s %9s\n", "output", "threads", "slices", "mean ms", "p50 ms", "p99 ms");
+
+        std::vector<uint8_t> output(static_cast<size_t>(frame.width) * frame.height * 3);
+        for (PixelLayout requested: {PixelLayout::RGB, PixelLayout::I420}) {
+            for (size_t threads = 1; threads <= maxThreads; threads *= 2) {
+                ParallelJpegDecoder decoder(pool);
+                decoder.setMaxSlices(threads);
+
+                std::vector<double> latencies;
+                PixelLayout layout = requested;
+                for (int i = 0; i < iterations + 3; ++i) {
+                    layout = requested;
+                    auto start = Clock::now();
+                    if (!decoder.decode(frame.jpeg.data(), frame.jpeg.size(), output.data(), output.size(),
+                                        frame.width, frame.height, layout)) {
+                        fprintf(stderr, "  decode failed\n");
+                        return 1;
+                    }
+                    if (i >= 3) {
+                        latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - start).count());
+                    }
+                }
+
+                double mean = 0;
+                for (double latency: latencies) mean += latency;
+                mean /= latencies.size();
+                printf("  %-7s %-7zu %7zu %9.2f %9.2f %9.2f\n", layout == PixelLayout::RGB ? "RGB" : "planar",
+                       threads, decoder.lastSliceCount(), mean, percentile(latencies, 0.5),
+                       percentile(latencies, 0.99));
+            }
+        }
+    }
+    return 0;
+}
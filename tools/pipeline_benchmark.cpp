@@ -0,0 +1,230 @@
+//
+// pipeline_benchmark - Runs the headset's receive pipeline on the desktop with software decoders
+//
+// Usage: pipeline_benchmark [--codec=JPEG|VP8|VP9|H264|H265] [--decoder=factory] [--frames=N]
+//                           [--resolution=FHD] [--fps=60] [--print]
+// Encodes a test clip into RTP packets first, then replays them paced at the framerate into the
+// pipeline PipelineBuilder assembles for the headset (jitter buffer, depayloader, parser, decoder)
+// and reports the depayloader-to-sink latency per frame. --print only prints the descriptions.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pipeline_builder.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct EncodedClip {
+    std::vector<GstBuffer *> packets;
+    GstCaps *caps = nullptr;
+};
+
+struct Measurement {
+    std::mutex mutex;
+    std::map<GstClockTime, Clock::time_point> depayloaded; // By PTS
+    std::vector<double> latencyUs;
+};
+
+static const char *encoder_for(Codec codec) {
+    switch (codec) {
+        case Codec::JPEG:
+            return "jpegenc quality=60 ! rtpjpegpay";
+        case Codec::VP8:
+            return "vp8enc deadline=1 keyframe-max-dist=60 ! rtpvp8pay";
+        case Codec::VP9:
+            return "vp9enc deadline=1 keyframe-max-dist=60 ! rtpvp9pay";
+        case Codec::H264:
+            return "x264enc tune=zerolatency speed-preset=ultrafast key-int-max=60 ! rtph264pay config-interval=-1";
+        case Codec::H265:
+            return "x265enc tune=zerolatency speed-preset=ultrafast key-int-max=60 ! rtph265pay config-interval=-1";
+        default:
+            return nullptr;
+    }
+}
+
+static EncodedClip encode_clip(Codec codec, int width, int height, int fps, int frames) {
+    std::string description = "videotestsrc pattern=ball num-buffers=" + std::to_string(frames) +
+                              " ! video/x-raw,format=I420,width=" + std::to_string(width) + ",height=" +
+                              std::to_string(height) + ",framerate=" + std::to_string(fps) + "/1 ! " +
+                              encoder_for(codec) + " ! appsink name=sink sync=false";
+    EncodedClip clip;
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(description.c_str(), &error);
+    if (error) {
+        fprintf(stderr, "Cannot encode %s: %s\n", CodecToString(codec).c_str(), error->message);
+        g_error_free(error);
+        return clip;
+    }
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    while (GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink))) {
+        if (!clip.caps) {
+            clip.caps = gst_caps_copy(gst_sample_get_caps(sample));
+        }
+        clip.packets.push_back(gst_buffer_ref(gst_sample_get_buffer(sample)));
+        gst_sample_unref(sample);
+    }
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return clip;
+}
+
+static void on_depayloaded(GstElement *, GstBuffer *buffer, Measurement *measurement) {
+    std::lock_guard<std::mutex> lock(measurement->mutex);
+    measurement->depayloaded.emplace(GST_BUFFER_PTS(buffer), Clock::now());
+}
+
+static void on_sink(GstElement *, GstBuffer *buffer, GstPad *, Measurement *measurement) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(measurement->mutex);
+    auto it = measurement->depayloaded.find(GST_BUFFER_PTS(buffer));
+    if (it != measurement->depayloaded.end()) {
+        measurement->latencyUs.push_back(std::chrono::duration<double, std::micro>(now - it->second).count());
+        measurement->depayloaded.erase(measurement->depayloaded.begin(), std::next(it));
+    }
+}
+
+static bool run(const PipelineBuilder &base, const EncodedClip &clip, int fps, size_t frames) {
+    PipelineBuilder builder = base;
+    builder.source("appsrc name=rtpsrc is-live=true do-timestamp=true format=time").sink(PipelineSink::FAKE);
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(builder.describe().c_str(), &error);
+    if (error) {
+        fprintf(stderr, "%-6s %-28s cannot build: %s\n", CodecToString(builder.codec()).c_str(),
+                builder.decoderFactory().c_str(), error->message);
+        g_error_free(error);
+        return false;
+    }
+
+    Measurement measurement;
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "rtpsrc");
+    GstElement *depay = gst_bin_get_by_name(GST_BIN(pipeline), "rtpdepay_ident");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_object_set(src, "caps", clip.caps, NULL);
+    g_signal_connect(depay, "handoff", G_CALLBACK(on_depayloaded), &measurement);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_sink), &measurement);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    // Paced like the sender: all packets of a frame, then wait for the next frame interval
+    auto interval = std::chrono::microseconds(1000000 / fps);
+    auto next = Clock::now();
+    for (GstBuffer *packet: clip.packets) {
+        gst_app_src_push_buffer(GST_APP_SRC(src), gst_buffer_copy(packet));
+
+        GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+        if (gst_rtp_buffer_map(packet, GST_MAP_READ, &rtp)) {
+            bool marker = gst_rtp_buffer_get_marker(&rtp);
+            gst_rtp_buffer_unmap(&rtp);
+            if (marker) {
+                next += interval;
+                std::this_thread::sleep_until(next);
+            }
+        }
+    }
+    // Let the jitter buffer and decoder drain
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(src);
+    gst_object_unref(depay);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+
+    auto &latency = measurement.latencyUs;
+    if (latency.empty()) {
+        printf("%-6s %-28s no frames decoded\n", CodecToString(builder.codec()).c_str(),
+               builder.decoderFactory().c_str());
+        return false;
+    }
+    std::sort(latency.begin(), latency.end());
+    double mean = 0;
+    for (double value: latency) {
+        mean += value;
+    }
+    mean /= static_cast<double>(latency.size());
+    printf("%-6s %-28s %6zu/%-6zu %10.0f %10.0f %10.0f\n", CodecToString(builder.codec()).c_str(),
+           builder.decoderFactory().c_str(), latency.size(), frames, mean, latency[latency.size() / 2],
+           latency[std::min(latency.size() - 1, latency.size() * 99 / 100)]);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    std::vector<Codec> codecs = {Codec::JPEG, Codec::VP8, Codec::VP9, Codec::H264, Codec::H265};
+    std::string decoder;
+    std::string resolution = "FHD";
+    int frames = 300, fps = 60;
+    bool print = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--codec=", 0) == 0) {
+            codecs.clear();
+            for (int c = 0; c < Codec::Count; ++c) {
+                if (CodecToString(static_cast<Codec>(c)) == arg.substr(8)) {
+                    codecs.push_back(static_cast<Codec>(c));
+                }
+            }
+        } else if (arg.rfind("--decoder=", 0) == 0) {
+            decoder = arg.substr(10);
+        } else if (arg.rfind("--frames=", 0) == 0) {
+            frames = std::max(1, atoi(arg.c_str() + 9));
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--resolution=", 0) == 0) {
+            resolution = arg.substr(13);
+        } else if (arg == "--print") {
+            print = true;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    auto preset = CameraResolution::fromLabel(resolution);
+    if (!print) {
+        printf("%s %dx%d @ %d fps, depayloader to sink latency\n", resolution.c_str(), preset.getWidth(),
+               preset.getHeight(), fps);
+        printf("%-6s %-28s %13s %10s %10s %10s\n", "codec", "decoder", "frames", "mean (us)", "p50 (us)",
+               "p99 (us)");
+    }
+
+    int failures = 0;
+    for (Codec codec: codecs) {
+        PipelineBuilder builder(codec);
+        builder.resolution(preset.getWidth(), preset.getHeight()).framerate(fps).decoder(decoder);
+        if (print) {
+            printf("%s:\n  %s\n", CodecToString(codec).c_str(), builder.describe().c_str());
+            continue;
+        }
+
+        EncodedClip clip = encode_clip(codec, preset.getWidth(), preset.getHeight(), fps, frames);
+        if (clip.packets.empty()) {
+            failures++;
+            continue;
+        }
+        if (!run(builder, clip, fps, static_cast<size_t>(frames))) {
+            failures++;
+        }
+        for (GstBuffer *packet: clip.packets) {
+            gst_buffer_unref(packet);
+        }
+        gst_caps_unref(clip.caps);
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,184 @@
+//
+// rtp_replay - Replays an RTP capture recorded on the headset through its receive pipeline
+//
+// Usage: rtp_replay <capture.rtpcap> [--fast] [--loops=N] [--decoder=factory] [--latency=ms] [--print]
+// Captures are recorded with the Y button on the headset (left.rtpcap, right.rtpcap in the app's
+// internal storage). The pipeline is the one PipelineBuilder assembles for the stream the capture
+// describes, with the host's decoder. Packets go in at their recorded arrival times, or with --fast
+// as fast as the pipeline takes them. Reports the frames decoded, the packets the jitter buffer lost
+// and the depayloader-to-sink latency per frame. --print only prints the description.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "pipeline_builder.h"
+#include "rtp_replay_source.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct Measurement {
+    std::mutex mutex;
+    std::map<GstClockTime, Clock::time_point> depayloaded; // By PTS
+    std::vector<double> latencyUs;
+};
+
+static void on_depayloaded(GstElement *, GstBuffer *buffer, Measurement *measurement) {
+    std::lock_guard<std::mutex> lock(measurement->mutex);
+    measurement->depayloaded.emplace(GST_BUFFER_PTS(buffer), Clock::now());
+}
+
+static void on_sink(GstElement *, GstBuffer *buffer, GstPad *, Measurement *measurement) {
+    auto now = Clock::now();
+    std::lock_guard<std::mutex> lock(measurement->mutex);
+    auto it = measurement->depayloaded.find(GST_BUFFER_PTS(buffer));
+    if (it != measurement->depayloaded.end()) {
+        measurement->latencyUs.push_back(std::chrono::duration<double, std::micro>(now - it->second).count());
+        measurement->depayloaded.erase(measurement->depayloaded.begin(), std::next(it));
+    }
+}
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    std::string path, decoder;
+    auto pacing = RtpReplaySource::Pacing::ORIGINAL;
+    int loops = 1, latencyMs = 50;
+    bool print = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--fast") {
+            pacing = RtpReplaySource::Pacing::FAST;
+        } else if (arg.rfind("--loops=", 0) == 0) {
+            loops = std::max(1, atoi(arg.c_str() + 8));
+        } else if (arg.rfind("--decoder=", 0) == 0) {
+            decoder = arg.substr(10);
+        } else if (arg.rfind("--latency=", 0) == 0) {
+            latencyMs = std::max(0, atoi(arg.c_str() + 10));
+        } else if (arg == "--print") {
+            print = true;
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+    if (path.empty()) {
+        fprintf(stderr, "Usage: %s <capture.rtpcap> [--fast] [--loops=N] [--decoder=factory] [--latency=ms] "
+                        "[--print]\n", argv[0]);
+        return 1;
+    }
+
+    RtpCaptureInfo info;
+    try {
+        info = RtpCaptureReader(path).info();
+    } catch (const std::runtime_error &e) {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+
+    PipelineBuilder builder(info.codec);
+    builder.resolution(info.width, info.height).framerate(info.fps).jitterLatency(latencyMs).fec(info.fecScheme)
+            .retransmission(info.retransmission).decoder(decoder).replay().sink(PipelineSink::FAKE);
+    if (print) {
+        printf("%s\n", builder.describe().c_str());
+        return 0;
+    }
+
+    GError *error = nullptr;
+    GstElement *pipeline = gst_parse_launch(builder.describe().c_str(), &error);
+    if (error) {
+        fprintf(stderr, "Cannot build the %s pipeline with %s: %s\n", CodecToString(info.codec).c_str(),
+                builder.decoderFactory().c_str(), error->message);
+        g_error_free(error);
+        return 1;
+    }
+
+    // Same wiring as GstreamerPlayer: FEC storage, no NACKs can reach a sender here
+    GstElement *fecdec = gst_bin_get_by_name(GST_BIN(pipeline), "fecdec");
+    if (fecdec) {
+        GstElement *rtpstorage = gst_bin_get_by_name(GST_BIN(pipeline), "rtpstorage");
+        GObject *storage = nullptr;
+        g_object_get(rtpstorage, "internal-storage", &storage, NULL);
+        g_object_set(fecdec, "storage", storage, NULL);
+        g_object_unref(storage);
+        gst_object_unref(rtpstorage);
+    }
+
+    Measurement measurement;
+    GstElement *rtpjb = gst_bin_get_by_name(GST_BIN(pipeline), "rtpjb");
+    GstElement *depay = gst_bin_get_by_name(GST_BIN(pipeline), "rtpdepay_ident");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    g_signal_connect(depay, "handoff", G_CALLBACK(on_depayloaded), &measurement);
+    g_signal_connect(sink, "handoff", G_CALLBACK(on_sink), &measurement);
+
+    printf("%s %dx%d @ %d fps, FEC %s, retransmission %s, decoder %s, %s pacing\n",
+           CodecToString(info.codec).c_str(), info.width, info.height, info.fps,
+           FecSchemeToString(info.fecScheme).c_str(), BoolToString(info.retransmission),
+           builder.decoderFactory().c_str(), pacing == RtpReplaySource::Pacing::FAST ? "unpaced" : "recorded");
+
+    int result = 0;
+    {
+        RtpReplaySource replay(pipeline, path, pacing, loops);
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        auto start = Clock::now();
+        replay.start();
+
+        GstBus *bus = gst_element_get_bus(pipeline);
+        GstMessage *message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
+                                                         static_cast<GstMessageType>(GST_MESSAGE_EOS |
+                                                                                     GST_MESSAGE_ERROR));
+        double elapsedS = std::chrono::duration<double>(Clock::now() - start).count();
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError *messageError = nullptr;
+            gst_message_parse_error(message, &messageError, nullptr);
+            fprintf(stderr, "Replay failed: %s\n", messageError->message);
+            g_error_free(messageError);
+            result = 1;
+        }
+        gst_message_unref(message);
+        gst_object_unref(bus);
+
+        guint64 lost = 0;
+        GstStructure *stats = nullptr;
+        g_object_get(rtpjb, "stats", &stats, NULL);
+        if (stats) {
+            gst_structure_get_uint64(stats, "num-lost", &lost);
+            gst_structure_free(stats);
+        }
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+
+        auto &latency = measurement.latencyUs;
+        printf("%lu packets in %.2f s, %zu frames (%.1f fps), %lu lost\n", (unsigned long) replay.packets(),
+               elapsedS, latency.size(), static_cast<double>(latency.size()) / elapsedS, (unsigned long) lost);
+        if (!latency.empty()) {
+            std::sort(latency.begin(), latency.end());
+            double mean = 0;
+            for (double value: latency) {
+                mean += value;
+            }
+            mean /= static_cast<double>(latency.size());
+            printf("depayloader to sink: mean %.0f us, p50 %.0f us, p99 %.0f us, max %.0f us\n", mean,
+                   latency[latency.size() / 2], latency[std::min(latency.size() - 1, latency.size() * 99 / 100)],
+                   latency.back());
+        } else {
+            result = 1;
+        }
+    }
+
+    if (fecdec) {
+        gst_object_unref(fecdec);
+    }
+    gst_object_unref(rtpjb);
+    gst_object_unref(depay);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return result;
+}
@@ -0,0 +1,710 @@
+//
+// stream_generator - Stands in for the robot: stereo RTP streams with the Jetson's header extensions
+//
+// Usage: stream_generator [--start] [--host=127.0.0.1] [--codec=JPEG|VP8|VP9|H264|H265] [--resolution=FHD]
+//                         [--fps=60] [--bitrate=4000000] [--quality=60] [--mono] [--via=address]
+//                         [--roi[=UHD]] [--camera-fov=90]
+// Serves the robot's REST API (/api/v1/stream/start, stop, update, keyframe, state on IP_CONFIG_REST_API_PORT)
+// and streams to the address and ports the client asks for, like the Jetson does. --start streams to
+// --host right away with the options given, without waiting for the client. --via sends the streams
+// to the ports at that address instead, and takes the NACKs there, for impairment_relay to sit between.
+//
+// Both cameras are one test source, converted once and encoded per camera. Every RTP packet carries
+// the five 8-byte header extensions the client's latency breakdown reads: frame id, conversion,
+// encoding and payloading durations (us) and the wall-clock time the packet was sent (us). RED/ULPFEC
+// and NACK/RTX are added when the request asks for them, NACKs are taken on the RTP ports + 1.
+//
+// View region streaming (--roi or "roi" in the request) renders the source at the --roi resolution
+// and packs every frame from its whole view, scaled into the left half, and a crop at the source's
+// native resolution, in the right half. The crop follows the view region messages (0x03) the client
+// sends to IP_CONFIG_SERVO_PORT, mapped onto a camera with a --camera-fov degrees horizontal field of
+// view, and goes out as the sixth header extension (RoiRect).
+//
+// Bitrate messages (0x04) on the same port retune the encoders of both cameras while they run, as
+// the robot does when the client's adaptive bitrate is on. JPEG has no bitrate and ignores them.
+//
+#include "pch.h"
+#include <gst/gst.h>
+#include <gst/rtp/gstrtpbuffer.h>
+#include <gst/video/video.h>
+#include <httplib.h>
+#include <nlohmann/json.hpp>
+#include <fmt/format.h>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "pipeline_builder.h"
+#include "retransmission_controller.h"
+
+using json = nlohmann::json;
+
+struct GeneratorConfig {
+    std::string host = "127.0.0.1";
+    std::string via; // Relay address the streams go through, empty to send to host directly
+    int portLeft = IP_CONFIG_LEFT_CAMERA_PORT, portRight = IP_CONFIG_RIGHT_CAMERA_PORT;
+    Codec codec = Codec::H264;
+    int width = 1920, height = 1080;
+    int fps = 60;
+    int bitrate = 4000000;
+    int quality = 60;
+    bool stereo = true;
+    FecScheme fecScheme = NO_FEC;
+    int fecOverheadPercent = 20;
+    bool retransmission = false;
+    bool roi = false;
+    int sourceWidth = 3840, sourceHeight = 2160; // Camera resolution of view region streaming
+    double cameraFovDeg = 90; // Horizontal
+};
+
+// The client's JSON (RestClient::StartStream), missing fields keep their current value
+static GeneratorConfig config_from_json(const json &body, GeneratorConfig config) {
+    if (body.contains("codec")) {
+        for (int c = 0; c < Codec::Count; ++c) {
+            if (CodecToString(static_cast<Codec>(c)) == body["codec"].get<std::string>()) {
+                config.codec = static_cast<Codec>(c);
+            }
+        }
+    }
+    config.host = body.value("ip_address", config.host);
+    config.portLeft = body.value("port_left", config.portLeft);
+    config.portRight = body.value("port_right", config.portRight);
+    config.fps = body.value("fps", config.fps);
+    config.bitrate = body.value("bitrate", config.bitrate);
+    config.quality = body.value("encoding_quality", config.quality);
+    if (body.contains("resolution")) {
+        config.width = body["resolution"].value("width", config.width);
+        config.height = body["resolution"].value("height", config.height);
+    }
+    if (body.contains("video_mode")) {
+        config.stereo = body["video_mode"].get<std::string>() == "stereo";
+    }
+    if (body.contains("fec")) {
+        config.fecScheme = body["fec"].value("scheme", std::string("NONE")) == "ULPFEC" ? ULPFEC : NO_FEC;
+        config.fecOverheadPercent = body["fec"].value("overhead_percent", config.fecOverheadPercent);
+    }
+    if (body.contains("retransmission")) {
+        config.retransmission = body["retransmission"].value("enabled", false);
+    }
+    if (body.contains("roi")) {
+        config.roi = body["roi"].value("enabled", false);
+        config.sourceWidth = body["roi"].value("source_width", config.sourceWidth);
+        config.sourceHeight = body["roi"].value("source_height", config.sourceHeight);
+    }
+    return config;
+}
+
+static json config_to_json(const GeneratorConfig &config, bool streaming) {
+    return json{{"streaming",        streaming},
+                {"codec",            CodecToString(config.codec)},
+                {"ip_address",       config.host},
+                {"port_left",        config.portLeft},
+                {"port_right",       config.portRight},
+                {"fps",              config.fps},
+                {"bitrate",          config.bitrate},
+                {"encoding_quality", config.quality},
+                {"resolution",       {{"width", config.width}, {"height", config.height}}},
+                {"video_mode",       config.stereo ? "stereo" : "mono"},
+                {"fec",              {{"scheme", FecSchemeToString(config.fecScheme)},
+                                      {"overhead_percent", config.fecOverheadPercent}}},
+                {"retransmission",   {{"enabled", config.retransmission}}},
+                {"roi",              {{"enabled", config.roi}, {"source_width", config.sourceWidth},
+                                      {"source_height", config.sourceHeight}}}};
+}
+
+static std::string encoder_for(const GeneratorConfig &config, const std::string &name) {
+    switch (config.codec) {
+        case Codec::JPEG:
+            return fmt::format("jpegenc name={} quality={} ! rtpjpegpay", name, config.quality);
+        case Codec::VP8:
+            return fmt::format("vp8enc name={} deadline=1 target-bitrate={} keyframe-max-dist=60 ! rtpvp8pay", name,
+                               config.bitrate);
+        case Codec::VP9:
+            return fmt::format("vp9enc name={} deadline=1 target-bitrate={} keyframe-max-dist=60 ! rtpvp9pay", name,
+                               config.bitrate);
+        case Codec::H264:
+            return fmt::format("x264enc name={} tune=zerolatency speed-preset=ultrafast bitrate={} key-int-max=60 "
+                               "! rtph264pay config-interval=-1", name, config.bitrate / 1000);
+        case Codec::H265:
+            return fmt::format("x265enc name={} tune=zerolatency speed-preset=ultrafast bitrate={} key-int-max=60 "
+                               "! rtph265pay config-interval=-1", name, config.bitrate / 1000);
+        default:
+            return "";
+    }
+}
+
+static uint64_t steady_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same clock as NtpTimer::GetCurrentTimeUsNonAdjusted on the client
+static uint64_t wall_clock_us() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Stage times of the frames in flight, by PTS. The converter probes fill in the frame id and the
+ * conversion, the encoder probes of each camera the encoding, the sink probes read them back.
+ */
+class FrameTimes {
+public:
+    struct Frame {
+        GstClockTime pts = GST_CLOCK_TIME_NONE;
+        uint64_t frameId = 0;
+        uint64_t convStartUs = 0, convEndUs = 0;
+        uint64_t encStartUs[2] = {}, encEndUs[2] = {};
+        uint64_t roi = 0; // Packed RoiRect of the crop
+    };
+
+    Frame &at(GstClockTime pts) {
+        Frame &frame = frames_[(pts / 1000) % SIZE];
+        if (frame.pts != pts) {
+            frame = Frame{};
+            frame.pts = pts;
+        }
+        return frame;
+    }
+
+    std::mutex mutex;
+    uint64_t nextFrameId = 1;
+
+private:
+    static constexpr size_t SIZE = 64;
+    Frame frames_[SIZE];
+};
+
+struct Branch {
+    class Generator *generator;
+    int camera; // 0 left, 1 right
+};
+
+class Generator {
+public:
+    // The configuration the client's requests are applied on top of
+    explicit Generator(GeneratorConfig config) : config_(std::move(config)) {}
+
+    ~Generator() { stop(); }
+
+    bool start(const GeneratorConfig &config) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopLocked();
+        config_ = config;
+        appliedBitrate_ = 0;
+
+        std::string description;
+        if (config.roi) {
+            // The crop keeps the frame's right half at the source's resolution, it has to fit
+            if (config.sourceWidth < config.width / 2 || config.sourceHeight < config.height) {
+                fprintf(stderr, "A %dx%d source cannot fill the %dx%d crop of %dx%d view region frames\n",
+                        config.sourceWidth, config.sourceHeight, config.width / 2, config.height, config.width,
+                        config.height);
+                return false;
+            }
+            {
+                std::lock_guard<std::mutex> viewLock(viewMutex_);
+                cropLeft_ = (config.sourceWidth - config.width / 2) / 2 & ~1;
+                cropTop_ = (config.sourceHeight - config.height) / 2 & ~1;
+            }
+            appliedLeft_ = appliedTop_ = -1;
+            int half = config.width / 2;
+            description = fmt::format(
+                    "videotestsrc is-live=true pattern=ball ! video/x-raw,format=RGBx,width={},height={},"
+                    "framerate={}/1 ! videoconvert name=conv ! video/x-raw,format=I420 ! tee name=full "
+                    "compositor name=pack start-time-selection=first sink_0::width={} sink_0::height={} "
+                    "sink_1::xpos={} sink_1::width={} sink_1::height={} ! "
+                    "video/x-raw,format=I420,width={},height={},pixel-aspect-ratio=1/1 ! tee name=t "
+                    "full. ! queue ! videoscale ! video/x-raw,width={},height={},pixel-aspect-ratio=1/1 ! pack.sink_0 "
+                    "full. ! queue ! videocrop name=crop ! pack.sink_1",
+                    config.sourceWidth, config.sourceHeight, config.fps, half, config.height, half, half,
+                    config.height, config.width, config.height, half, config.height);
+        } else {
+            description = fmt::format(
+                    "videotestsrc is-live=true pattern=ball ! video/x-raw,format=RGBx,width={},height={},"
+                    "framerate={}/1 ! videoconvert name=conv ! video/x-raw,format=I420 ! tee name=t", config.width,
+                    config.height, config.fps);
+        }
+        description += fmt::format(" udpsrc name=control address={} port={} ! fakesink name=controlsink sync=false",
+                                   config.via.empty() ? "0.0.0.0" : config.via, IP_CONFIG_SERVO_PORT);
+        int cameras = config.stereo ? 2 : 1;
+        for (int camera = 0; camera < cameras; ++camera) {
+            std::string suffix = camera == 0 ? "left" : "right";
+            description += fmt::format(" t. ! queue ! {} mtu=1200", encoder_for(config, "enc_" + suffix));
+            if (config.fecScheme == ULPFEC) {
+                description += fmt::format(" ! rtpulpfecenc pt={} percentage={} ! rtpredenc pt={} "
+                                           "allow-no-red-blocks=true", PipelineBuilder::FEC_PAYLOAD_TYPE,
+                                           config.fecOverheadPercent, PipelineBuilder::RED_PAYLOAD_TYPE);
+            }
+            if (config.retransmission) {
+                description += fmt::format(" ! rtprtxsend name=rtx_{} max-size-time=1000 payload-type-map="
+                                           "\"application/x-rtp-pt-map, {}=(uint){}\"", suffix,
+                                           PipelineBuilder::payloadType(config.codec),
+                                           PipelineBuilder::RTX_PAYLOAD_TYPE);
+            }
+            description += fmt::format(" ! udpsink name=sink_{} host={} port={} sync=false async=false", suffix,
+                                       config.via.empty() ? config.host : config.via,
+                                       camera == 0 ? config.portLeft : config.portRight);
+            if (config.retransmission) {
+                description += fmt::format(" udpsrc name=nack_{} address={} port={} ! fakesink name=nacksink_{} "
+                                           "sync=false", suffix, config.via.empty() ? "0.0.0.0" : config.via,
+                                           (camera == 0 ? config.portLeft : config.portRight) +
+                                           RetransmissionController::NACK_PORT_OFFSET, suffix);
+            }
+        }
+
+        GError *error = nullptr;
+        pipeline_ = gst_parse_launch(description.c_str(), &error);
+        if (error) {
+            fprintf(stderr, "Cannot build the %s sender: %s\n", CodecToString(config.codec).c_str(),
+                    error->message);
+            g_error_free(error);
+            pipeline_ = nullptr;
+            return false;
+        }
+
+        addProbe("conv", "sink", onConvertIn, nullptr);
+        addProbe("conv", "src", onConvertOut, nullptr);
+        if (config.roi) {
+            addProbe("crop", "sink", onCrop, nullptr);
+        }
+        addProbe("controlsink", "sink", onControl, nullptr);
+        for (int camera = 0; camera < cameras; ++camera) {
+            std::string suffix = camera == 0 ? "left" : "right";
+            branches_[camera] = {this, camera};
+            addProbe("enc_" + suffix, "sink", onEncodeIn, &branches_[camera]);
+            addProbe("enc_" + suffix, "src", onEncodeOut, &branches_[camera]);
+            addProbe("sink_" + suffix, "sink", onSend, &branches_[camera]);
+            if (config.retransmission) {
+                addProbe("nacksink_" + suffix, "sink", onNack, &branches_[camera]);
+            }
+        }
+
+        GstBus *bus = gst_element_get_bus(pipeline_);
+        busWatch_ = gst_bus_add_watch(bus, onBusMessage, nullptr);
+        gst_object_unref(bus);
+
+        gst_element_set_state(pipeline_, GST_STATE_PLAYING);
+        printf("Streaming %s %dx%d @ %d fps (%s) to %s:%d%s, FEC %s, retransmission %s\n",
+               CodecToString(config.codec).c_str(), config.width, config.height, config.fps,
+               config.stereo ? "stereo" : "mono", config.host.c_str(), config.portLeft,
+               config.stereo ? fmt::format("/{}", config.portRight).c_str() : "",
+               FecSchemeToString(config.fecScheme).c_str(), BoolToString(config.retransmission));
+        if (config.roi) {
+            printf("View region frames from a %dx%d source, %.0f degrees wide\n", config.sourceWidth,
+                   config.sourceHeight, config.cameraFovDeg);
+        }
+        return true;
+    }
+
+    void stop() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopLocked();
+    }
+
+    // Both encoders start a new GOP with their next frame, the H.264 / H.265 payloaders send the parameter
+    // sets with it. False when not streaming
+    bool forceKeyframe() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!pipeline_) {
+            return false;
+        }
+        for (const char *name: {"enc_left", "enc_right"}) {
+            GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline_), name);
+            if (!encoder) {
+                continue;
+            }
+            gst_element_send_event(encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+            gst_object_unref(encoder);
+        }
+        printf("Keyframe requested\n");
+        return true;
+    }
+
+    json state() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return config_to_json(config_, pipeline_ != nullptr);
+    }
+
+    GeneratorConfig config() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return config_;
+    }
+
+private:
+    void stopLocked() {
+        if (!pipeline_) {
+            return;
+        }
+        gst_element_set_state(pipeline_, GST_STATE_NULL);
+        g_source_remove(busWatch_);
+        gst_object_unref(pipeline_);
+        pipeline_ = nullptr;
+        printf("Stream stopped\n");
+    }
+
+    void addProbe(const std::string &element, const char *padName, GstPadProbeCallback callback, gpointer data) {
+        GstElement *found = gst_bin_get_by_name(GST_BIN(pipeline_), element.c_str());
+        GstPad *pad = gst_element_get_static_pad(found, padName);
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, callback, data ? data : this, nullptr);
+        gst_object_unref(pad);
+        gst_object_unref(found);
+    }
+
+    static GstPadProbeReturn onConvertIn(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *generator = static_cast<Generator *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        std::lock_guard<std::mutex> lock(generator->times_.mutex);
+        FrameTimes::Frame &frame = generator->times_.at(GST_BUFFER_PTS(buffer));
+        frame.frameId = generator->times_.nextFrameId++;
+        frame.convStartUs = steady_us();
+        return GST_PAD_PROBE_OK;
+    }
+
+    static GstPadProbeReturn onConvertOut(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *generator = static_cast<Generator *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        std::lock_guard<std::mutex> lock(generator->times_.mutex);
+        generator->times_.at(GST_BUFFER_PTS(buffer)).convEndUs = steady_us();
+        return GST_PAD_PROBE_OK;
+    }
+
+    static GstPadProbeReturn onEncodeIn(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *branch = static_cast<Branch *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        std::lock_guard<std::mutex> lock(branch->generator->times_.mutex);
+        branch->generator->times_.at(GST_BUFFER_PTS(buffer)).encStartUs[branch->camera] = steady_us();
+        return GST_PAD_PROBE_OK;
+    }
+
+    static GstPadProbeReturn onEncodeOut(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *branch = static_cast<Branch *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        std::lock_guard<std::mutex> lock(branch->generator->times_.mutex);
+        branch->generator->times_.at(GST_BUFFER_PTS(buffer)).encEndUs[branch->camera] = steady_us();
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Moves the crop to where the client looks before the frame is cropped and keeps its place with
+    // the frame. Runs in the crop's streaming thread, so the four sides change together.
+    static GstPadProbeReturn onCrop(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+        auto *generator = static_cast<Generator *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        const GeneratorConfig &config = generator->config_;
+        int cropWidth = config.width / 2, cropHeight = config.height;
+
+        int left, top;
+        {
+            std::lock_guard<std::mutex> lock(generator->viewMutex_);
+            left = generator->cropLeft_;
+            top = generator->cropTop_;
+        }
+        if (left != generator->appliedLeft_ || top != generator->appliedTop_) {
+            GstElement *crop = gst_pad_get_parent_element(pad);
+            g_object_set(crop, "left", left, "right", config.sourceWidth - cropWidth - left, "top", top,
+                         "bottom", config.sourceHeight - cropHeight - top, NULL);
+            gst_object_unref(crop);
+            generator->appliedLeft_ = left;
+            generator->appliedTop_ = top;
+        }
+
+        auto unit = [](int pixels, int size) {
+            return static_cast<uint16_t>(std::lround(static_cast<double>(pixels) / size * RoiRect::UNIT));
+        };
+        RoiRect roi{unit(left, config.sourceWidth), unit(top, config.sourceHeight),
+                    unit(cropWidth, config.sourceWidth), unit(cropHeight, config.sourceHeight)};
+        std::lock_guard<std::mutex> lock(generator->times_.mutex);
+        generator->times_.at(GST_BUFFER_PTS(buffer)).roi = roi.pack();
+        return GST_PAD_PROBE_OK;
+    }
+
+    // View region (0x03) and bitrate (0x04) messages of RobotControlSender, the head pose and robot
+    // control ones are for the robot's motors
+    static GstPadProbeReturn onControl(GstPad *pad, GstPadProbeInfo *info, gpointer data) {
+        auto *generator = static_cast<Generator *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            return GST_PAD_PROBE_OK;
+        }
+        float angles[6]; // azimuth, elevation, fov left, right, up, down
+        uint32_t bitrate = 0;
+        bool viewRegion = map.size >= 1 + sizeof(angles) + sizeof(uint64_t) && map.data[0] == 0x03;
+        bool bitrateChange = map.size >= 1 + sizeof(bitrate) + sizeof(uint64_t) && map.data[0] == 0x04;
+        if (viewRegion) {
+            memcpy(angles, map.data + 1, sizeof(angles));
+        } else if (bitrateChange) {
+            memcpy(&bitrate, map.data + 1, sizeof(bitrate));
+        }
+        gst_buffer_unmap(buffer, &map);
+
+        if (viewRegion && generator->config_.roi) {
+            generator->onViewRegion(angles);
+        } else if (bitrateChange && bitrate > 0) {
+            // The pipeline outlives its streaming threads, the sink's parent is safe to use here
+            GstObject *sink = GST_OBJECT_PARENT(pad);
+            generator->setBitrate(GST_ELEMENT(GST_OBJECT_PARENT(sink)), static_cast<int>(bitrate));
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Centers the crop on the middle of the headset's view, projected onto the camera's image plane
+    void onViewRegion(const float angles[6]) {
+        const GeneratorConfig &config = config_;
+        const double limit = 89.0 * M_PI / 180.0;
+        double left = std::clamp(angles[0] - (angles[2] + angles[3]) / 2.0, -limit, limit); // Positive to the left
+        double up = std::clamp(angles[1] + (angles[4] + angles[5]) / 2.0, -limit, limit);
+        double tanH = std::tan(config.cameraFovDeg * M_PI / 360.0);
+        double tanV = tanH * config.sourceHeight / config.sourceWidth;
+        double cx = 0.5 - std::tan(left) / (2 * tanH);
+        double cy = 0.5 - std::tan(up) / (2 * tanV);
+
+        int cropWidth = config.width / 2, cropHeight = config.height;
+        int cropLeft = std::clamp(static_cast<int>(std::lround(cx * config.sourceWidth)) - cropWidth / 2, 0,
+                                  config.sourceWidth - cropWidth) & ~1; // I420 chroma is subsampled 2x2
+        int cropTop = std::clamp(static_cast<int>(std::lround(cy * config.sourceHeight)) - cropHeight / 2, 0,
+                                 config.sourceHeight - cropHeight) & ~1;
+        std::lock_guard<std::mutex> lock(viewMutex_);
+        cropLeft_ = cropLeft;
+        cropTop_ = cropTop;
+    }
+
+    // Encoders take their bitrate property while playing, x264enc and x265enc in kbit/s
+    void setBitrate(GstElement *pipeline, int bitrate) {
+        const GeneratorConfig &config = config_;
+        if (config.codec == JPEG || bitrate == appliedBitrate_.exchange(bitrate)) {
+            return;
+        }
+        for (const char *name: {"enc_left", "enc_right"}) {
+            GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), name);
+            if (!encoder) {
+                continue;
+            }
+            if (config.codec == VP8 || config.codec == VP9) {
+                g_object_set(encoder, "target-bitrate", bitrate, NULL);
+            } else {
+                g_object_set(encoder, "bitrate", static_cast<guint>(std::max(1, bitrate / 1000)), NULL);
+            }
+            gst_object_unref(encoder);
+        }
+        printf("Bitrate %d kbit/s per camera\n", bitrate / 1000);
+    }
+
+    // Writes the extensions into every packet on its way out, the receiver reads them as the first to
+    // fifth two-byte extension with id 1, view region frames add their RoiRect as the sixth
+    static GstPadProbeReturn onSend(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *branch = static_cast<Branch *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+
+        uint64_t values[6] = {};
+        size_t count = branch->generator->config_.roi ? 6 : 5;
+        {
+            std::lock_guard<std::mutex> lock(branch->generator->times_.mutex);
+            const FrameTimes::Frame &frame = branch->generator->times_.at(GST_BUFFER_PTS(buffer));
+            uint64_t encStart = frame.encStartUs[branch->camera], encEnd = frame.encEndUs[branch->camera];
+            uint64_t now = steady_us();
+            values[0] = frame.frameId;
+            values[1] = frame.convEndUs > frame.convStartUs ? frame.convEndUs - frame.convStartUs : 0;
+            values[2] = encEnd > encStart ? encEnd - encStart : 0;
+            values[3] = encEnd && now > encEnd ? now - encEnd : 0;
+            values[4] = wall_clock_us();
+            values[5] = frame.roi;
+        }
+        if (values[0] == 0) {
+            return GST_PAD_PROBE_OK;
+        }
+
+        buffer = gst_buffer_make_writable(buffer);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+        if (gst_rtp_buffer_map(buffer, GST_MAP_READWRITE, &rtp)) {
+            for (size_t i = 0; i < count; ++i) {
+                gst_rtp_buffer_add_extension_twobytes_header(&rtp, 0, 1, &values[i], sizeof(values[i]));
+            }
+            gst_rtp_buffer_unmap(&rtp);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Generic NACKs (RFC 4585) from the client's RetransmissionController, each lost packet becomes a
+    // retransmission request for rtprtxsend
+    static GstPadProbeReturn onNack(GstPad *, GstPadProbeInfo *info, gpointer data) {
+        auto *branch = static_cast<Branch *>(data);
+        GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+        GstMapInfo map;
+        if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+            return GST_PAD_PROBE_OK;
+        }
+
+        std::string rtx = branch->camera == 0 ? "rtx_left" : "rtx_right";
+        GstElement *rtxsend = gst_bin_get_by_name(GST_BIN(branch->generator->pipeline_), rtx.c_str());
+        GstPad *pad = rtxsend ? gst_element_get_static_pad(rtxsend, "src") : nullptr;
+        const uint8_t *packet = map.data;
+        size_t left = map.size;
+        while (pad && left >= 12) {
+            size_t length = (static_cast<size_t>(packet[2]) << 8 | packet[3]) * 4 + 4;
+            if (length > left) {
+                break;
+            }
+            if ((packet[0] & 0x1f) == 1 && packet[1] == 205) {
+                uint32_t ssrc = static_cast<uint32_t>(packet[8]) << 24 | packet[9] << 16 | packet[10] << 8 |
+                                packet[11];
+                for (size_t fci = 12; fci + 4 <= length; fci += 4) {
+                    auto pid = static_cast<uint16_t>(packet[fci] << 8 | packet[fci + 1]);
+                    auto blp = static_cast<uint16_t>(packet[fci + 2] << 8 | packet[fci + 3]);
+                    for (int bit = -1; bit < 16; ++bit) {
+                        if (bit >= 0 && !(blp & (1 << bit))) {
+                            continue;
+                        }
+                        auto seqnum = static_cast<uint16_t>(pid + bit + 1);
+                        gst_pad_send_event(pad, gst_event_new_custom(
+                                GST_EVENT_CUSTOM_UPSTREAM,
+                                gst_structure_new("GstRTPRetransmissionRequest", "seqnum", G_TYPE_UINT,
+                                                  static_cast<guint>(seqnum), "ssrc", G_TYPE_UINT, ssrc, nullptr)));
+                    }
+                }
+            }
+            packet += length;
+            left -= length;
+        }
+        if (pad) {
+            gst_object_unref(pad);
+        }
+        if (rtxsend) {
+            gst_object_unref(rtxsend);
+        }
+        gst_buffer_unmap(buffer, &map);
+        return GST_PAD_PROBE_OK;
+    }
+
+    static gboolean onBusMessage(GstBus *, GstMessage *message, gpointer) {
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR || GST_MESSAGE_TYPE(message) == GST_MESSAGE_WARNING) {
+            GError *error = nullptr;
+            if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+                gst_message_parse_error(message, &error, nullptr);
+            } else {
+                gst_message_parse_warning(message, &error, nullptr);
+            }
+            fprintf(stderr, "%s: %s\n", GST_OBJECT_NAME(GST_MESSAGE_SRC(message)), error->message);
+            g_error_free(error);
+        }
+        return TRUE;
+    }
+
+    std::mutex mutex_;
+    GeneratorConfig config_;
+    GstElement *pipeline_ = nullptr;
+    guint busWatch_ = 0;
+    FrameTimes times_;
+    Branch branches_[2]{};
+
+    // View region crop in source pixels, set from the view region messages, applied by onCrop
+    std::mutex viewMutex_;
+    int cropLeft_ = 0, cropTop_ = 0;
+    int appliedLeft_ = -1, appliedTop_ = -1; // Crop thread only
+
+    std::atomic<int> appliedBitrate_{0}; // Set by the bitrate messages, 0 while at config_.bitrate
+};
+
+static httplib::Server *server = nullptr;
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+
+    GeneratorConfig config;
+    bool startNow = false;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--start") {
+            startNow = true;
+        } else if (arg.rfind("--host=", 0) == 0) {
+            config.host = arg.substr(7);
+        } else if (arg.rfind("--codec=", 0) == 0) {
+            config = config_from_json(json{{"codec", arg.substr(8)}}, config);
+        } else if (arg.rfind("--resolution=", 0) == 0) {
+            auto preset = CameraResolution::fromLabel(arg.substr(13));
+            config.width = preset.getWidth();
+            config.height = preset.getHeight();
+        } else if (arg.rfind("--fps=", 0) == 0) {
+            config.fps = std::max(1, atoi(arg.c_str() + 6));
+        } else if (arg.rfind("--bitrate=", 0) == 0) {
+            config.bitrate = std::max(1000, atoi(arg.c_str() + 10));
+        } else if (arg.rfind("--quality=", 0) == 0) {
+            config.quality = std::clamp(atoi(arg.c_str() + 10), 0, 100);
+        } else if (arg == "--mono") {
+            config.stereo = false;
+        } else if (arg.rfind("--via=", 0) == 0) {
+            config.via = arg.substr(6);
+        } else if (arg == "--roi" || arg.rfind("--roi=", 0) == 0) {
+            auto preset = CameraResolution::fromLabel(arg.size() > 6 ? arg.substr(6) : "UHD");
+            config.roi = true;
+            config.sourceWidth = preset.getWidth();
+            config.sourceHeight = preset.getHeight();
+        } else if (arg.rfind("--camera-fov=", 0) == 0) {
+            config.cameraFovDeg = std::clamp(atof(arg.c_str() + 13), 10.0, 170.0);
+        } else {
+            fprintf(stderr, "Unknown argument %s\n", arg.c_str());
+            return 1;
+        }
+    }
+
+    // Bus watches of the sender pipelines
+    GMainLoop *loop = g_main_loop_new(nullptr, FALSE);
+    std::thread mainLoop([loop]() { g_main_loop_run(loop); });
+
+    Generator generator(config);
+    if (startNow && !generator.start(config)) {
+        return 1;
+    }
+
+    httplib::Server http;
+    auto startFromRequest = [&generator](const httplib::Request &request, httplib::Response &response) {
+        json body = json::parse(request.body, nullptr, false);
+        if (body.is_discarded()) {
+            response.status = 400;
+            response.set_content("Invalid JSON", "text/plain");
+            return;
+        }
+        if (!generator.start(config_from_json(body, generator.config()))) {
+            response.status = 500;
+            response.set_content("Cannot build the sender pipeline", "text/plain");
+            return;
+        }
+        response.set_content(generator.state().dump(), "application/json");
+    };
+    http.Post("/api/v1/stream/start", startFromRequest);
+    http.Put("/api/v1/stream/update", startFromRequest);
+    http.Post("/api/v1/stream/stop", [&generator](const httplib::Request &, httplib::Response &response) {
+        generator.stop();
+        response.set_content(generator.state().dump(), "application/json");
+    });
+    http.Post("/api/v1/stream/keyframe", [&generator](const httplib::Request &, httplib::Response &response) {
+        if (!generator.forceKeyframe()) {
+            response.status = 409;
+            response.set_content("Not streaming", "text/plain");
+            return;
+        }
+        response.set_content(generator.state().dump(), "application/json");
+    });
+    http.Get("/api/v1/stream/state", [&generator](const httplib::Request &, httplib::Response &response) {
+        response.set_content(generator.state().dump(), "application/json");
+    });
+
+    server = &http;
+    signal(SIGINT, [](int) { server->stop(); });
+    printf("REST API on port %d\n", IP_CONFIG_REST_API_PORT);
+    if (!http.listen("0.0.0.0", IP_CONFIG_REST_API_PORT)) {
+        fprintf(stderr, "Cannot listen on port %d\n", IP_CONFIG_REST_API_PORT);
+    }
+
+    generator.stop();
+    g_main_loop_quit(loop);
+    mainLoop.join();
+    g_main_loop_unref(loop);
+    return 0;
+}
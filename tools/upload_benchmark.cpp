@@ -0,0 +1,124 @@
+//
+// upload_benchmark - Texture upload cost of the CPU video path for every camera resolution preset
+//
+// Compares the previous per-frame glTexImage2D from client memory with PboUploadRing, where the
+// producer copies into a persistently mapped buffer and the render thread only issues the upload.
+// "issue" is the CPU time spent in the upload call(s) on the render thread, "total" additionally
+// waits for the GPU (glFinish) and is the upper bound of what a frame can cost.
+//
+#include "pch.h"
+#include "log.h"
+#include <chrono>
+#include <GLES3/gl3.h>
+
+#include "pbo_upload_ring.h"
+#include "headless_egl.h"
+
+using Clock = std::chrono::steady_clock;
+
+struct UploadTiming {
+    double issueUs = 0;
+    double totalUs = 0;
+    double copyUs = 0;
+};
+
+static double elapsed_us(Clock::time_point start) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+}
+
+static void fill_frame(std::vector<uint8_t> &frame, int index) {
+    // Different content every frame so no driver can skip the upload
+    std::fill(frame.begin(), frame.end(), static_cast<uint8_t>(index * 37));
+}
+
+static UploadTiming bench_tex_image(int width, int height, int frames) {
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 3);
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+
+    UploadTiming timing;
+    for (int i = 0; i < frames; ++i) {
+        fill_frame(frame, i);
+
+        auto start = Clock::now();
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, frame.data());
+        timing.issueUs += elapsed_us(start);
+        glFinish();
+        timing.totalUs += elapsed_us(start);
+    }
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glDeleteTextures(1, &texture);
+    timing.issueUs /= frames;
+    timing.totalUs /= frames;
+    return timing;
+}
+
+static UploadTiming bench_pbo_ring(int width, int height, int frames, bool &persistent) {
+    std::vector<uint8_t> frame(static_cast<size_t>(width) * height * 3);
+    PboUploadRing ring(width, height);
+    persistent = ring.isPersistent();
+
+    UploadTiming timing;
+    int measured = 0;
+    for (int i = 0; i < frames; ++i) {
+        fill_frame(frame, i);
+
+        // Producer side, normally the appsink callback on the streaming thread
+        auto copyStart = Clock::now();
+        FrameMailbox::Slot *slot = ring.mailbox()->beginWrite();
+        if (slot) {
+            memcpy(slot->data, frame.data(), std::min(frame.size(), slot->size));
+            ring.mailbox()->publish(slot);
+        }
+        timing.copyUs += elapsed_us(copyStart);
+
+        auto start = Clock::now();
+        ring.selectLatest();
+        ring.update();
+        timing.issueUs += elapsed_us(start);
+        glFinish();
+        timing.totalUs += elapsed_us(start);
+        measured++;
+    }
+
+    timing.issueUs /= measured;
+    timing.totalUs /= measured;
+    timing.copyUs /= measured;
+    return timing;
+}
+
+int main(int argc, char **argv) {
+    int frames = argc > 1 ? std::max(1, atoi(argv[1])) : 120;
+
+    if (!headless_egl_init()) {
+        return 1;
+    }
+    LOG_INFO("GL_RENDERER: %s", glGetString(GL_RENDERER));
+
+    printf("%-8s %11s | %22s | %33s\n", "preset", "size", "glTexImage2D (us)", "PboUploadRing (us)");
+    printf("%-8s %11s | %10s %11s | %10s %10s %11s\n", "", "", "issue", "total", "copy", "issue", "total");
+
+    for (size_t i = 0; i < CameraResolution::count(); ++i) {
+        const auto &resolution = CameraResolution::fromIndex(i);
+        int width = resolution.getWidth();
+        int height = resolution.getHeight();
+
+        // One warm-up round per path so allocation and shader compilation in the driver are excluded
+        bool persistent = false;
+        bench_tex_image(width, height, 2);
+        bench_pbo_ring(width, height, 2, persistent);
+
+        auto texImage = bench_tex_image(width, height, frames);
+        auto pboRing = bench_pbo_ring(width, height, frames, persistent);
+
+        printf("%-8s %5dx%-5d | %10.1f %11.1f | %10.1f %10.1f %11.1f%s\n", resolution.getLabel().c_str(),
+               width, height, texImage.issueUs, texImage.totalUs, pboRing.copyUs, pboRing.issueUs,
+               pboRing.totalUs, persistent ? "" : " (no GL_EXT_buffer_storage)");
+    }
+
+    headless_egl_terminate();
+    return 0;
+}
@@ -0,0 +1,125 @@
+//
+// yuv_conversion_benchmark - CPU cost of the JPEG pipeline tail with and without CPU colour conversion
+//
+// Feeds the same JPEG frame through "jpegdec ! videoconvert ! RGB" (the previous pipeline tail) and
+// through "jpegdec ! I420" (planar mode), copying every decoded frame into a packed buffer like the
+// appsink callback does. Reports process CPU time per frame, so the difference is what planar mode
+// saves per camera and frame.
+//
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include "frame_mailbox.h"
+
+struct Preset {
+    const char *label;
+    int width, height;
+};
+
+static double cpu_time_us() {
+    timespec ts{};
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+// Encodes a single test frame, so decoding cost is identical for both variants
+static GstBuffer *encode_test_frame(int width, int height) {
+    std::string description = "videotestsrc pattern=smpte num-buffers=1 ! video/x-raw,format=I420,width=" +
+                              std::to_string(width) + ",height=" + std::to_string(height) +
+                              " ! jpegenc quality=60 ! appsink name=sink";
+    GstElement *pipeline = gst_parse_launch(description.c_str(), nullptr);
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+    GstBuffer *buffer = gst_buffer_ref(gst_sample_get_buffer(sample));
+    gst_sample_unref(sample);
+
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return buffer;
+}
+
+static void copy_frame(GstSample *sample, std::vector<uint8_t> &dst, int width, int height) {
+    GstVideoInfo vinfo;
+    gst_video_info_from_caps(&vinfo, gst_sample_get_caps(sample));
+    GstVideoFrame vframe;
+    gst_video_frame_map(&vframe, &vinfo, gst_sample_get_buffer(sample), GST_MAP_READ);
+
+    if (GST_VIDEO_INFO_FORMAT(&vinfo) == GST_VIDEO_FORMAT_RGB) {
+        memcpy(dst.data(), GST_VIDEO_FRAME_PLANE_DATA(&vframe, 0), static_cast<size_t>(width) * height * 3);
+    } else {
+        auto planes = plane_layout(PixelLayout::I420, width, height);
+        for (int i = 0; i < planes.count; ++i) {
+            auto *src = static_cast<const uint8_t *>(GST_VIDEO_FRAME_PLANE_DATA(&vframe, i));
+            int stride = GST_VIDEO_FRAME_PLANE_STRIDE(&vframe, i);
+            for (int row = 0; row < planes.height[i]; ++row) {
+                memcpy(dst.data() + planes.offset[i] + static_cast<size_t>(row) * planes.width[i],
+                       src + static_cast<size_t>(row) * stride, planes.width[i]);
+            }
+        }
+    }
+    gst_video_frame_unmap(&vframe);
+}
+
+static double bench(GstBuffer *jpeg, int width, int height, bool planar, int frames) {
+    std::string description = std::string("appsrc name=src caps=image/jpeg,width=") + std::to_string(width) +
+                              ",height=" + std::to_string(height) + ",framerate=60/1 ! jpegparse ! jpegdec ! " +
+                              (planar ? "video/x-raw,format=I420" : "videoconvert ! video/x-raw,format=RGB") +
+                              " ! appsink name=sink sync=false";
+    GstElement *pipeline = gst_parse_launch(description.c_str(), nullptr);
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    std::vector<uint8_t> packed(static_cast<size_t>(width) * height * 3);
+    double total = 0;
+    // The first frames include caps negotiation and allocations, leave them out
+    const int warmup = 5;
+    for (int i = 0; i < frames + warmup; ++i) {
+        double start = cpu_time_us();
+        GstBuffer *buffer = gst_buffer_copy(jpeg);
+        GST_BUFFER_PTS(buffer) = gst_util_uint64_scale(i, GST_SECOND, 60);
+        gst_app_src_push_buffer(GST_APP_SRC(src), buffer);
+
+        GstSample *sample = gst_app_sink_pull_sample(GST_APP_SINK(sink));
+        copy_frame(sample, packed, width, height);
+        gst_sample_unref(sample);
+        if (i >= warmup) {
+            total += cpu_time_us() - start;
+        }
+    }
+
+    gst_app_src_end_of_stream(GST_APP_SRC(src));
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(src);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return total / frames;
+}
+
+int main(int argc, char **argv) {
+    gst_init(&argc, &argv);
+    int frames = argc > 1 ? std::max(1, atoi(argv[1])) : 200;
+
+    const Preset presets[] = {{"FHD", 1920, 1080},
+                              {"UHD", 3840, 2160}};
+
+    printf("%-6s %12s %12s %12s\n", "preset", "RGB (us)", "I420 (us)", "saved (us)");
+    for (const auto &preset: presets) {
+        GstBuffer *jpeg = encode_test_frame(preset.width, preset.height);
+        double rgb = bench(jpeg, preset.width, preset.height, false, frames);
+        double planar = bench(jpeg, preset.width, preset.height, true, frames);
+        gst_buffer_unref(jpeg);
+
+        printf("%-6s %12.1f %12.1f %12.1f\n", preset.label, rgb, planar, rgb - planar);
+    }
+    return 0;
+}